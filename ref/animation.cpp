@@ -0,0 +1,136 @@
+// アニメーション
+// コーネルボックスの中で箱を回転させ, 小さな球を飛び散らせる連番画像を
+// 1つのプロセスでレンダリングする
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+#include "animation.h"
+#include "renderer.h"
+#include "rng.h"
+#include "scene.h"
+
+int main() {
+  constexpr int width = 256;    // 画像の横幅[px]
+  constexpr int height = 256;   // 画像の縦幅[px]
+  constexpr int samples = 16;   // サンプル数
+  constexpr int nFrames = 48;   // フレーム数
+  constexpr float fps = 24;     // 1秒あたりのフレーム数
+  constexpr int nSpheres = 200;  // 飛び散る球の数
+
+  // カメラの設定
+  constexpr Vec3f camPos(2.78, 2.73, -9);
+  constexpr Vec3f lookAt(2.78, 2.73, 2.796);
+  const auto camera = std::make_shared<PinholeCamera>(
+      camPos, normalize(lookAt - camPos), 0.25f * PI);
+
+  // レンダラーの作成
+  Renderer renderer(width, height, camera);
+
+  // シーンの作成
+  Sky sky(Vec3f(0.0f));
+  Scene scene(sky);
+
+  const auto white = std::make_shared<Lambert>(Vec3f(0.8));
+  const auto red = std::make_shared<Lambert>(Vec3f(0.8, 0.05, 0.05));
+  const auto green = std::make_shared<Lambert>(Vec3f(0.05, 0.8, 0.05));
+  const auto yellow = std::make_shared<Lambert>(Vec3f(0.8, 0.6, 0.1));
+
+  scene.addPrimitive(Primitive(
+      std::make_shared<Plane>(Vec3f(0), Vec3f(0, 0, 5.592), Vec3f(5.56, 0, 0)),
+      white));
+  scene.addPrimitive(Primitive(
+      std::make_shared<Plane>(Vec3f(0), Vec3f(0, 5.488, 0), Vec3f(0, 0, 5.592)),
+      red));
+  scene.addPrimitive(Primitive(
+      std::make_shared<Plane>(Vec3f(5.56, 0, 0), Vec3f(0, 0, 5.592),
+                              Vec3f(0, 5.488, 0)),
+      green));
+  scene.addPrimitive(Primitive(
+      std::make_shared<Plane>(Vec3f(0, 5.488, 0), Vec3f(5.56, 0, 0),
+                              Vec3f(0, 0, 5.592)),
+      white));
+  scene.addPrimitive(Primitive(
+      std::make_shared<Plane>(Vec3f(0, 0, 5.592), Vec3f(0, 5.488, 0),
+                              Vec3f(5.56, 0, 0)),
+      white));
+  scene.addPrimitive(
+      Primitive(std::make_shared<Plane>(Vec3f(3.43, 5.486, 2.27),
+                                        Vec3f(-1.3, 0, 0), Vec3f(0, 0, 1.05)),
+                white, std::make_shared<AreaLight>(Vec3f(34, 19, 10))));
+
+  Animation animation;
+
+  // 原点を中心とする一辺1の箱(底面なし)を回転させる
+  const auto box = std::make_shared<ShapeGroup>(
+      std::vector<std::shared_ptr<Shape>>{
+          std::make_shared<Plane>(Vec3f(-0.5, 0.5, -0.5), Vec3f(0, 0, 1),
+                                  Vec3f(1, 0, 0)),
+          std::make_shared<Plane>(Vec3f(-0.5, -0.5, -0.5), Vec3f(1, 0, 0),
+                                  Vec3f(0, 1, 0)),
+          std::make_shared<Plane>(Vec3f(0.5, -0.5, -0.5), Vec3f(0, 0, 1),
+                                  Vec3f(0, 1, 0)),
+          std::make_shared<Plane>(Vec3f(0.5, -0.5, 0.5), Vec3f(-1, 0, 0),
+                                  Vec3f(0, 1, 0)),
+          std::make_shared<Plane>(Vec3f(-0.5, -0.5, 0.5), Vec3f(0, 0, -1),
+                                  Vec3f(0, 1, 0))});
+  const auto boxInstance = std::make_shared<Instance>(box, Transform());
+  scene.addPrimitive(Primitive(boxInstance, white));
+
+  AnimatedTransform boxTransform;
+  const Vec3f boxSize(1.65, 3.3, 1.65);
+  for (int k = 0; k <= 4; ++k) {
+    boxTransform.addKeyframe(
+        k * 0.5f, Vec3f(3.7, 1.65, 3.5),
+        Quaternion::axisAngle(Vec3f(0, 1, 0), k * 0.5f * PI), boxSize);
+  }
+  animation.animate(boxInstance, boxTransform);
+
+  // 1つの球を共有して中心から飛び散らせる
+  const auto sphere = std::make_shared<Sphere>(Vec3f(0), 1.0f);
+  RNG rng(1);
+  for (int i = 0; i < nSpheres; ++i) {
+    const auto instance = std::make_shared<Instance>(sphere, Transform());
+    scene.addPrimitive(Primitive(instance, i % 2 == 0 ? yellow : white));
+
+    const Vec3f start(1.5f + 0.3f * rng.getNext(), 1.0f + 0.3f * rng.getNext(),
+                      2.0f + 0.3f * rng.getNext());
+    const Vec3f end(0.3f + 4.9f * rng.getNext(), 0.3f + 4.9f * rng.getNext(),
+                    0.3f + 5.0f * rng.getNext());
+    const Vec3f radius(0.1f + 0.1f * rng.getNext());
+    AnimatedTransform transform;
+    transform.addKeyframe(0, start, Quaternion(), radius);
+    transform.addKeyframe(2, end, Quaternion(), radius);
+    animation.animate(instance, transform);
+  }
+
+  // カメラを少しずつ近づける
+  CameraPath cameraPath;
+  cameraPath.addKeyframe(0, camPos, lookAt);
+  cameraPath.addKeyframe(2, Vec3f(2.0, 3.2, -6), lookAt);
+  animation.animateCamera(camera, cameraPath);
+
+  for (int frame = 0; frame < nFrames; ++frame) {
+    // フレームの時刻の状態にしてBVHを更新する
+    // NOTE: 最初のフレームでシーンを構築し, 以降はrefitする
+    const auto start = std::chrono::steady_clock::now();
+    const bool rebuilt = animation.setTime(scene, frame / fps);
+    const auto elapsed = std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+    std::cout << "[Animation] frame " << frame << ": "
+              << (rebuilt ? "rebuild" : "refit")
+              << " (SAH cost: " << scene.sahCost() << ", " << elapsed
+              << " ms)" << std::endl;
+
+    // レンダリング
+    renderer.render(scene, samples);
+
+    // 画像の出力
+    char filename[64];
+    std::snprintf(filename, sizeof(filename), "frame%03d.ppm", frame);
+    renderer.writePPM(filename);
+  }
+
+  return 0;
+}
@@ -0,0 +1,573 @@
+// マイクロベンチマーク
+// 交差判定, サンプリング, シェーディングの各処理と画像全体のレンダリングの
+// 速度を計測し, 表とJSONで出力する
+// usage: ./bench [--filter <名前の一部>] [--json <出力ファイル>]
+//                [--min-time <秒>] [--threads <スレッド数>]
+#include <omp.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "renderer.h"
+#include "scene.h"
+#include "vec3x8.h"
+
+namespace {
+
+// 計算結果を使ったことにして, 最適化で計算が消されないようにする
+template <typename T>
+inline void doNotOptimize(const T& value) {
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedSeconds(const Clock::time_point& start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// ベンチマークの設定
+struct BenchSettings {
+  std::string filter;      // 名前にこの文字列を含むものだけ実行する
+  std::string jsonPath;    // 空でなければ結果をJSONで書き出す
+  double minTime = 0.5;    // 1つのベンチマークの計測時間の目安[s]
+  int repetitions = 5;     // 計測の繰り返し回数(中央値を使う)
+  int nThreads = omp_get_max_threads();  // 画像全体のベンチマークのスレッド数
+};
+
+// ベンチマークの結果
+struct BenchResult {
+  std::string name;
+  uint64_t iterations;  // 1回の計測での関数の実行回数
+  double nsPerOp;       // 1操作あたりの時間[ns](中央値)
+  double minNsPerOp;    // 1操作あたりの時間[ns](最小値)
+  double maxNsPerOp;    // 1操作あたりの時間[ns](最大値)
+  std::string unit;     // 処理速度の単位
+  double throughput;    // 中央値から求めた処理速度
+};
+
+class BenchRunner {
+ private:
+  BenchSettings settings;
+  std::vector<BenchResult> results;
+
+  bool isSelected(const std::string& name) const {
+    return name.find(settings.filter) != std::string::npos;
+  }
+
+  void report(const BenchResult& result) {
+    std::printf("%-32s %12.2f ns/op %12.3f %s\n", result.name.c_str(),
+                result.nsPerOp, result.throughput, result.unit.c_str());
+    std::fflush(stdout);
+    results.push_back(result);
+  }
+
+  // times[k]にk回目の計測の1操作あたりの時間を入れて結果をまとめる
+  static BenchResult summarize(const std::string& name, uint64_t iterations,
+                               std::vector<double> times,
+                               const std::string& unit, double unitScale) {
+    std::sort(times.begin(), times.end());
+    BenchResult result;
+    result.name = name;
+    result.iterations = iterations;
+    result.nsPerOp = times[times.size() / 2];
+    result.minNsPerOp = times.front();
+    result.maxNsPerOp = times.back();
+    result.unit = unit;
+    result.throughput = unitScale / result.nsPerOp;
+    return result;
+  }
+
+ public:
+  BenchRunner(const BenchSettings& settings) : settings(settings) {}
+
+  const BenchSettings& getSettings() const { return settings; }
+
+  // 1回でopsPerCall操作を行うfを繰り返し呼んで計測する
+  // 処理速度は unitScale / (1操作あたりの時間[ns]) で表す
+  void run(const std::string& name, uint64_t opsPerCall,
+           const std::function<void()>& f, const std::string& unit = "Mops/s",
+           double unitScale = 1e3) {
+    if (!isSelected(name)) return;
+
+    // ウォームアップしながら, 1回の計測がminTime / repetitionsになる
+    // 実行回数を求める
+    uint64_t iterations = 1;
+    const double target = settings.minTime / settings.repetitions;
+    while (true) {
+      const auto start = Clock::now();
+      for (uint64_t k = 0; k < iterations; ++k) f();
+      const double t = elapsedSeconds(start);
+      if (t >= 0.5 * target) {
+        iterations = std::max<uint64_t>(iterations * target / t, 1);
+        break;
+      }
+      iterations *= 2;
+    }
+
+    std::vector<double> times;
+    for (int r = 0; r < settings.repetitions; ++r) {
+      const auto start = Clock::now();
+      for (uint64_t k = 0; k < iterations; ++k) f();
+      times.push_back(elapsedSeconds(start) * 1e9 / (iterations * opsPerCall));
+    }
+    report(summarize(name, iterations, times, unit, unitScale));
+  }
+
+  // 時間のかかる処理を1回ずつ計測する(画像全体のベンチマーク用)
+  // NOTE: 最初の1回はウォームアップとして計測しない
+  void runOnce(const std::string& name, uint64_t ops,
+               const std::function<void()>& f, const std::string& unit,
+               double unitScale) {
+    if (!isSelected(name)) return;
+
+    f();
+    std::vector<double> times;
+    for (int r = 0; r < std::min(settings.repetitions, 3); ++r) {
+      const auto start = Clock::now();
+      f();
+      times.push_back(elapsedSeconds(start) * 1e9 / ops);
+    }
+    report(summarize(name, 1, times, unit, unitScale));
+  }
+
+  bool writeJSON() const {
+    if (settings.jsonPath.empty()) return true;
+
+    std::ofstream file(settings.jsonPath);
+    if (!file) {
+      std::cerr << "failed to open " << settings.jsonPath << std::endl;
+      return false;
+    }
+
+    char date[32];
+    const std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S",
+                  std::localtime(&now));
+
+    file << "{\n";
+    file << "  \"context\": {\n";
+    file << "    \"date\": \"" << date << "\",\n";
+    file << "    \"compiler\": \"" << __VERSION__ << "\",\n";
+    file << "    \"bvh_width\": " << BVH_WIDTH << ",\n";
+    file << "    \"threads\": " << settings.nThreads << ",\n";
+    file << "    \"repetitions\": " << settings.repetitions << "\n";
+    file << "  },\n";
+    file << "  \"benchmarks\": [\n";
+    for (int i = 0; i < results.size(); ++i) {
+      const BenchResult& r = results[i];
+      file << "    {\"name\": \"" << r.name << "\", "
+           << "\"iterations\": " << r.iterations << ", "
+           << "\"ns_per_op\": " << r.nsPerOp << ", "
+           << "\"min_ns_per_op\": " << r.minNsPerOp << ", "
+           << "\"max_ns_per_op\": " << r.maxNsPerOp << ", "
+           << "\"throughput\": " << r.throughput << ", "
+           << "\"unit\": \"" << r.unit << "\"}"
+           << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n";
+    file << "}\n";
+    if (!file) {
+      std::cerr << "failed to write " << settings.jsonPath << std::endl;
+      return false;
+    }
+    return true;
+  }
+};
+
+// 計測に使う入力の個数
+// NOTE: L1キャッシュに収まり, 分岐予測が学習しきれない程度の数にする
+constexpr int nInputs = 1024;
+
+std::vector<Vec3f> randomVectors(RNG& rng, int n, float scale) {
+  std::vector<Vec3f> v(n);
+  for (auto& x : v) {
+    x = scale * Vec3f(2 * rng.getNext() - 1, 2 * rng.getNext() - 1,
+                      2 * rng.getNext() - 1);
+  }
+  return v;
+}
+
+// 立方体[-scale, scale]^3内から原点付近へ向かうレイ
+std::vector<Ray> randomRays(RNG& rng, int n, float scale) {
+  std::vector<Ray> rays;
+  const auto origins = randomVectors(rng, n, scale);
+  const auto targets = randomVectors(rng, n, 0.5f * scale);
+  for (int i = 0; i < n; ++i) {
+    rays.emplace_back(origins[i], normalize(targets[i] - origins[i]));
+  }
+  return rays;
+}
+
+// 接空間の上側の半球の方向
+std::vector<Vec3f> randomDirections(RNG& rng, int n) {
+  std::vector<Vec3f> dirs(n);
+  for (auto& d : dirs) {
+    float pdf;
+    d = sampleHemisphere(rng.getNext(), rng.getNext(), pdf);
+  }
+  return dirs;
+}
+
+void benchVec3(BenchRunner& runner) {
+  RNG rng(1);
+  const auto a = randomVectors(rng, nInputs, 1.0f);
+  const auto b = randomVectors(rng, nInputs, 1.0f);
+
+  runner.run("vec3/dot", nInputs, [&]() {
+    float sum = 0;
+    for (int i = 0; i < nInputs; ++i) sum += dot(a[i], b[i]);
+    doNotOptimize(sum);
+  });
+  runner.run("vec3/cross", nInputs, [&]() {
+    Vec3f sum(0);
+    for (int i = 0; i < nInputs; ++i) sum += cross(a[i], b[i]);
+    doNotOptimize(sum);
+  });
+  runner.run("vec3/normalize", nInputs, [&]() {
+    Vec3f sum(0);
+    for (int i = 0; i < nInputs; ++i) sum += normalize(a[i]);
+    doNotOptimize(sum);
+  });
+
+#ifdef __AVX__
+  // 8要素ずつのSoA(1操作は1要素あたり)
+  std::vector<Vec3x8> a8, b8;
+  for (int i = 0; i < nInputs; i += 8) {
+    a8.push_back(Vec3x8::gather(&a[i]));
+    b8.push_back(Vec3x8::gather(&b[i]));
+  }
+  runner.run("vec3x8/dot", nInputs, [&]() {
+    Float8 sum(0.0f);
+    for (int i = 0; i < a8.size(); ++i) sum = sum + dot(a8[i], b8[i]);
+    doNotOptimize(sum);
+  });
+  runner.run("vec3x8/cross", nInputs, [&]() {
+    Vec3x8 sum(Vec3f(0));
+    for (int i = 0; i < a8.size(); ++i) sum += cross(a8[i], b8[i]);
+    doNotOptimize(sum);
+  });
+  runner.run("vec3x8/normalize", nInputs, [&]() {
+    Vec3x8 sum(Vec3f(0));
+    for (int i = 0; i < a8.size(); ++i) sum += normalize(a8[i]);
+    doNotOptimize(sum);
+  });
+#endif
+}
+
+void benchShapes(BenchRunner& runner) {
+  RNG rng(2);
+  const auto rays = randomRays(rng, nInputs, 4.0f);
+
+  const Sphere sphere(Vec3f(0), 1.0f);
+  runner.run("shape/sphere-intersect", nInputs, [&]() {
+    IntersectInfo info;
+    int hits = 0;
+    for (const Ray& ray : rays) hits += sphere.intersect(ray, info);
+    doNotOptimize(hits);
+  }, "Mrays/s");
+
+  const Plane plane(Vec3f(-1, -1, 0), Vec3f(2, 0, 0), Vec3f(0, 2, 0));
+  runner.run("shape/plane-intersect", nInputs, [&]() {
+    IntersectInfo info;
+    int hits = 0;
+    for (const Ray& ray : rays) hits += plane.intersect(ray, info);
+    doNotOptimize(hits);
+  }, "Mrays/s");
+}
+
+void benchScene(BenchRunner& runner) {
+  const auto white = std::make_shared<Lambert>(Vec3f(0.8));
+  for (const int n : {16, 256, 4096, 65536}) {
+    // 立方体[-1, 1]^3内にランダムに配置した球(全体の体積の約1/4を占める)
+    RNG rng(3);
+    const float radius = std::cbrt(0.25f * 8.0f / (4.0f / 3.0f * PI * n));
+    Scene scene(Sky(Vec3f(0)));
+    for (const Vec3f& center : randomVectors(rng, n, 1.0f)) {
+      scene.addPrimitive(
+          Primitive(std::make_shared<Sphere>(center, radius), white));
+    }
+    scene.commit();
+
+    const auto rays = randomRays(rng, nInputs, 2.0f);
+    const std::string suffix = "/" + std::to_string(n);
+    runner.run("scene/intersect" + suffix, nInputs, [&]() {
+      IntersectInfo info;
+      int hits = 0;
+      for (const Ray& ray : rays) hits += scene.intersect(ray, info);
+      doNotOptimize(hits);
+    }, "Mrays/s");
+    runner.run("scene/occluded" + suffix, nInputs, [&]() {
+      int hits = 0;
+      for (const Ray& ray : rays) hits += scene.occluded(ray, 4.0f);
+      doNotOptimize(hits);
+    }, "Mrays/s");
+  }
+}
+
+void benchSampling(BenchRunner& runner) {
+  RNG rng(4);
+  std::vector<float> u(2 * nInputs);
+  for (float& x : u) x = rng.getNext();
+
+  runner.run("sampling/cosine-hemisphere", nInputs, [&]() {
+    Vec3f sum(0);
+    for (int i = 0; i < nInputs; ++i) {
+      float pdf;
+      sum += sampleCosineHemisphere(u[2 * i], u[2 * i + 1], pdf);
+    }
+    doNotOptimize(sum);
+  });
+
+  // 512x256の環境マップ(暗い空と明るい太陽)
+  constexpr int envWidth = 512;
+  constexpr int envHeight = 256;
+  std::vector<float> envRGB(3 * envWidth * envHeight);
+  for (float& x : envRGB) x = rng.getNext();
+  for (int j = 60; j < 64; ++j) {
+    for (int i = 100; i < 104; ++i) {
+      for (int c = 0; c < 3; ++c) envRGB[3 * (envWidth * j + i) + c] = 1e4f;
+    }
+  }
+  const EnvironmentMap envMap(envWidth, envHeight, std::move(envRGB));
+  runner.run("sampling/environment-map", nInputs, [&]() {
+    Vec3f sum(0);
+    for (int i = 0; i < nInputs; ++i) {
+      Vec3f wi;
+      float pdf;
+      sum += envMap.sample(u[2 * i], u[2 * i + 1], wi, pdf) / pdf;
+    }
+    doNotOptimize(sum);
+  });
+
+  // 立方体内にランダムに置いた光源から選ぶ
+  constexpr int nLights = 4096;
+  std::vector<LightBounds> lights(nLights);
+  for (LightBounds& lb : lights) {
+    const Vec3f c(rng.getNext(), rng.getNext(), rng.getNext());
+    lb = LightBounds(AABB(c - Vec3f(0.01f), c + Vec3f(0.01f)),
+                     Vec3f(0, 1, 0), rng.getNext(), 1);
+  }
+  LightBVH lightBVH;
+  lightBVH.build(lights);
+  runner.run("sampling/light-bvh", nInputs, [&]() {
+    int sum = 0;
+    for (int i = 0; i < nInputs; ++i) {
+      const Vec3f pos(u[2 * i], 0.5f, u[2 * i + 1]);
+      float pmf;
+      sum += lightBVH.sample(pos, Vec3f(0, 1, 0), u[i], pmf);
+    }
+    doNotOptimize(sum);
+  });
+
+  // 1パスで使う程度の次元数ずつ値を取り出す
+  constexpr int nDimensions = 32;
+  const auto benchSampler = [&](const std::string& name, Sampler& sampler) {
+    runner.run("sampler/" + name, nInputs * nDimensions, [&]() {
+      float sum = 0;
+      for (int i = 0; i < nInputs; ++i) {
+        sampler.startPixelSample(i % 64, i / 64, i);
+        for (int d = 0; d < nDimensions; ++d) sum += sampler.getNext();
+      }
+      doNotOptimize(sum);
+    });
+  };
+  IndependentSampler independent;
+  SobolSampler sobol;
+  HaltonSampler halton;
+  BlueNoiseSampler blueNoise;
+  benchSampler("independent", independent);
+  benchSampler("sobol", sobol);
+  benchSampler("halton", halton);
+  benchSampler("blue-noise", blueNoise);
+}
+
+void benchBSDFs(BenchRunner& runner) {
+  RNG rng(5);
+  const auto wo = randomDirections(rng, nInputs);
+  IndependentSampler sampler;
+  sampler.startPixelSample(0, 0, 0);
+
+  const Lambert lambert(Vec3f(0.8));
+  const Mirror mirror(Vec3f(0.9));
+  const Glass glass(Vec3f(1.0), 1.5f);
+  const std::pair<std::string, const BSDF*> bsdfs[] = {
+      {"lambert", &lambert}, {"mirror", &mirror}, {"glass", &glass}};
+  for (const auto& [name, bsdf] : bsdfs) {
+    const BSDFRef ref(bsdf);
+    runner.run("bsdf/" + name + "-sample", nInputs, [&]() {
+      Vec3f sum(0);
+      for (int i = 0; i < nInputs; ++i) {
+        Vec3f wi;
+        float pdf;
+        sum += ref.sample(TexCoord(), sampler, wo[i], wi, pdf) * wi;
+      }
+      doNotOptimize(sum);
+    });
+  }
+}
+
+void benchImage(BenchRunner& runner) {
+  constexpr int width = 512;
+  constexpr int height = 512;
+  Image image(width, height);
+  RNG rng(6);
+  for (int j = 0; j < height; ++j) {
+    for (int i = 0; i < width; ++i) {
+      image.setPixel(i, j, Vec3f(rng.getNext(), rng.getNext(), rng.getNext()));
+    }
+  }
+
+  const std::string filename = "bench-output.ppm";
+  runner.run("image/write-ppm", width * height, [&]() {
+    doNotOptimize(image.writePPM(filename));
+  }, "Mpixels/s");
+  std::remove(filename.c_str());
+}
+
+// Cornell Box(cornell-box.cppと同じシーン)
+void createCornellBox(Scene& scene) {
+  const auto white = std::make_shared<Lambert>(Vec3f(0.8));
+  const auto red = std::make_shared<Lambert>(Vec3f(0.8, 0.05, 0.05));
+  const auto green = std::make_shared<Lambert>(Vec3f(0.05, 0.8, 0.05));
+
+  // 左下の点, 2辺のベクトル
+  const float planes[][9] = {
+      {0, 0, 0, 0, 0, 5.592, 5.56, 0, 0},
+      {0, 0, 0, 0, 5.488, 0, 0, 0, 5.592},
+      {5.56, 0, 0, 0, 0, 5.592, 0, 5.488, 0},
+      {0, 5.488, 0, 5.56, 0, 0, 0, 0, 5.592},
+      {0, 0, 5.592, 0, 5.488, 0, 5.56, 0, 0},
+      {1.3, 1.65, 0.65, -0.48, 0, 1.6, 1.6, 0, 0.49},
+      {2.9, 0, 1.14, 0, 1.65, 0, -0.5, 0, 1.58},
+      {1.3, 0, 0.65, 0, 1.65, 0, 1.6, 0, 0.49},
+      {0.82, 0, 2.25, 0, 1.65, 0, 0.48, 0, -1.6},
+      {2.4, 0, 2.72, 0, 1.65, 0, -1.58, 0, -0.47},
+      {4.23, 3.30, 2.47, -1.58, 0, 0.49, 0.49, 0, 1.59},
+      {4.23, 0, 2.47, 0, 3.3, 0, 0.49, 0, 1.59},
+      {4.72, 0, 4.06, 0, 3.3, 0, -1.58, 0, 0.5},
+      {3.14, 0, 4.56, 0, 3.3, 0, -0.49, 0, -1.6},
+      {2.65, 0, 2.96, 0, 3.3, 0, 1.58, 0, -0.49}};
+  for (int i = 0; i < 15; ++i) {
+    const float* p = planes[i];
+    const auto& bsdf = i == 1 ? red : i == 2 ? green : white;
+    scene.addPrimitive(Primitive(
+        std::make_shared<Plane>(Vec3f(p[0], p[1], p[2]),
+                                Vec3f(p[3], p[4], p[5]),
+                                Vec3f(p[6], p[7], p[8])),
+        bsdf));
+  }
+
+  const auto lightShape = std::make_shared<Plane>(
+      Vec3f(3.43, 5.486, 2.27), Vec3f(-1.3, 0, 0), Vec3f(0, 0, 1.05));
+  const auto light = std::make_shared<AreaLight>(Vec3f(34, 19, 10));
+  scene.addPrimitive(Primitive(lightShape, white, light));
+  scene.commit();
+}
+
+void benchFrame(BenchRunner& runner) {
+  constexpr int width = 256;
+  constexpr int height = 256;
+  const int nThreads = runner.getSettings().nThreads;
+
+  Scene scene(Sky(Vec3f(0)));
+  createCornellBox(scene);
+  constexpr Vec3f camPos(2.78, 2.73, -9);
+  constexpr Vec3f lookAt(2.78, 2.73, 2.796);
+  const auto camera = std::make_shared<PinholeCamera>(
+      camPos, normalize(lookAt - camPos), 0.25f * PI);
+
+  // カメラからのレイの交差判定だけを行う
+  constexpr int primarySamples = 16;
+  const TileScheduler scheduler(width, height, 16, nThreads, true);
+  runner.runOnce(
+      "frame/primary-rays", uint64_t(width) * height * primarySamples,
+      [&]() {
+        scheduler.run([&](const Tile& tile, int threadIdx) {
+          int hits = 0;
+          for (int j = tile.y0; j < tile.y1; ++j) {
+            for (int i = tile.x0; i < tile.x1; ++i) {
+              for (int k = 0; k < primarySamples; ++k) {
+                const float u = (2.0f * (i + (k + 0.5f) / primarySamples) -
+                                 width) / height;
+                const float v = (2.0f * (j + 0.5f) - height) / height;
+                IntersectInfo info;
+                hits += scene.intersect(camera->sampleRay(u, v), info);
+              }
+            }
+          }
+          doNotOptimize(hits);
+        });
+      },
+      "Mrays/s", 1e3);
+
+  // パストレーシング(NEE + MIS)で画像全体をレンダリングする
+  constexpr int samples = 16;
+  Renderer renderer(width, height, camera);
+  renderer.setThreads(nThreads);
+  renderer.setPinThreads(true);
+  runner.runOnce(
+      "frame/path-tracing", uint64_t(width) * height * samples,
+      [&]() { renderer.render(scene, samples); }, "Msamples/s", 1e3);
+
+  // フォトンマッピング(SPPM)で画像全体をレンダリングする
+  // NOTE: 反復ごとにフォトンの追跡とハッシュ表の構築, 収集を含む
+  PhotonMappingSettings sppm;
+  sppm.iterations = 4;
+  sppm.photonsPerIteration = 100000;
+  runner.runOnce(
+      "frame/photon-mapping", uint64_t(width) * height * sppm.iterations,
+      [&]() { renderer.renderPhotonMapping(scene, sppm); }, "Msamples/s",
+      1e3);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  BenchSettings settings;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (i + 1 < argc && arg == "--filter") {
+      settings.filter = argv[++i];
+    } else if (i + 1 < argc && arg == "--json") {
+      settings.jsonPath = argv[++i];
+    } else if (i + 1 < argc && arg == "--min-time") {
+      settings.minTime = std::atof(argv[++i]);
+    } else if (i + 1 < argc && arg == "--threads") {
+      settings.nThreads = std::max(std::atoi(argv[++i]), 1);
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--filter <name>] [--json <file>] [--min-time <sec>]"
+                << " [--threads <n>]" << std::endl;
+      return 1;
+    }
+  }
+
+  // NOTE: 単一スレッドのベンチマークは論理コア0に固定して計測する
+  {
+    const ThreadAffinityGuard guard;
+    pinCurrentThread(0);
+
+    BenchRunner runner(settings);
+    benchVec3(runner);
+    benchShapes(runner);
+    benchScene(runner);
+    benchSampling(runner);
+    benchBSDFs(runner);
+    benchImage(runner);
+    benchFrame(runner);
+    if (!runner.writeJSON()) return 1;
+  }
+
+  return 0;
+}
@@ -4,9 +4,9 @@
 #include "scene.h"
 
 int main() {
-  constexpr int width = 512;     // 画像の横幅[px]
-  constexpr int height = 512;    // 画像の縦幅[px]
-  constexpr int samples = 1000;  // サンプル数
+  constexpr int width = 512;    // 画像の横幅[px]
+  constexpr int height = 512;   // 画像の縦幅[px]
+  constexpr int samples = 64;   // サンプル数
 
   // カメラの設定
   constexpr Vec3f camPos(2.78, 2.73, -9);
@@ -80,10 +80,18 @@ int main() {
   scene.addPrimitive(Primitive(tallBox5, white));
   scene.addPrimitive(Primitive(light_s, white, light));
 
+  // シーンの構築(BVHの構築と形状の前計算)
+  scene.commit();
+  scene.printMemoryReport();
+
   // レンダリング
+  // NOTE: 少ないサンプル数のノイズはAOVをガイドにしたデノイザーで除く
+  renderer.setAOV(true);
   renderer.render(scene, samples);
 
   // 画像の出力
+  renderer.writePPM("noisy.ppm");
+  renderer.denoise();
   renderer.writePPM("output.ppm");
 
   return 0;
@@ -1,12 +1,17 @@
 #include <cmath>
+#include <iostream>
+#include <string>
 
 #include "renderer.h"
 #include "scene.h"
 
-int main() {
+// usage: ./cornell-box2 [--resume | --sppm]
+// 途中経過をcornell-box2.ckptに保存し, --resumeで中断したところから再開する
+// --sppmではパストレーシングの代わりにフォトンマッピングを使う
+int main(int argc, char** argv) {
   constexpr int width = 512;     // 画像の横幅[px]
   constexpr int height = 512;    // 画像の縦幅[px]
-  constexpr int samples = 1000;  // サンプル数
+  constexpr int samples = 1000;  // 最大サンプル数
 
   // カメラの設定
   constexpr Vec3f camPos(2.78, 2.73, -9);
@@ -81,11 +86,37 @@ int main() {
   scene.addPrimitive(Primitive(tallBox5, glass));
   scene.addPrimitive(Primitive(light_s, white, light));
 
+  // シーンの構築(BVHの構築と形状の前計算)
+  scene.commit();
+
+  const std::string mode = argc > 1 ? argv[1] : "";
+
+  // フォトンマッピングによるレンダリング
+  // NOTE: ガラスを通った集光模様はフォトンで直接集めるので速く収束する
+  if (mode == "--sppm") {
+    const int iterations =
+        renderer.renderPhotonMapping(scene, PhotonMappingSettings());
+    std::cout << "[SPPM] iterations: " << iterations << std::endl;
+    renderer.writePPM("output.ppm");
+    renderer.writeStats("stats.json");
+    return 0;
+  }
+
   // レンダリング
-  renderer.render(scene, samples);
+  // NOTE: ガラスの集光模様は収束が遅いので,
+  // 誤差の大きい画素にサンプルを多く割り振る
+  ProgressiveSettings settings;
+  settings.maxSamples = samples;
+  settings.checkpointFile = "cornell-box2.ckpt";
+  settings.resume = mode == "--resume";
+  // NOTE: ガラスの箱のように時間のかかる画素をヒートマップで確認できる
+  renderer.setCostAOV(CostMetric::Time);
+  renderer.renderProgressive(scene, settings);
 
   // 画像の出力
   renderer.writePPM("output.ppm");
+  renderer.writeCostMap("cost.png");
+  renderer.writeStats("stats.json");
 
   return 0;
 }
\ No newline at end of file
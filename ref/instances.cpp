@@ -0,0 +1,120 @@
+// インスタンシング
+// 1つの箱(とメッシュ)のジオメトリを共有して倉庫のように多数並べる
+// usage: ./instances [mesh.obj|mesh.ply]
+#include <cmath>
+
+#include "instance.h"
+#include "mesh-loader.h"
+#include "renderer.h"
+#include "rng.h"
+#include "scene.h"
+
+int main(int argc, char** argv) {
+  constexpr int width = 512;   // 画像の横幅[px]
+  constexpr int height = 512;  // 画像の縦幅[px]
+  constexpr int samples = 64;  // サンプル数
+  constexpr int gridSize = 60;  // 一辺に並べる数
+  constexpr float spacing = 3;  // 間隔
+
+  // カメラの設定
+  constexpr Vec3f camPos(-12, 18, -12);
+  constexpr Vec3f lookAt(40, 0, 40);
+  const auto camera = std::make_shared<PinholeCamera>(
+      camPos, normalize(lookAt - camPos), 0.25f * PI);
+
+  // レンダラーの作成
+  Renderer renderer(width, height, camera);
+
+  // シーンの作成
+  Sky sky(Vec3f(1.0f));
+  Scene scene(sky);
+
+  // 共有するジオメトリ: 原点を中心とする一辺1の箱(底面なし)
+  const auto box = std::make_shared<ShapeGroup>(
+      std::vector<std::shared_ptr<Shape>>{
+          std::make_shared<Plane>(Vec3f(-0.5, 0.5, -0.5), Vec3f(0, 0, 1),
+                                  Vec3f(1, 0, 0)),
+          std::make_shared<Plane>(Vec3f(-0.5, -0.5, -0.5), Vec3f(1, 0, 0),
+                                  Vec3f(0, 1, 0)),
+          std::make_shared<Plane>(Vec3f(0.5, -0.5, -0.5), Vec3f(0, 0, 1),
+                                  Vec3f(0, 1, 0)),
+          std::make_shared<Plane>(Vec3f(0.5, -0.5, 0.5), Vec3f(-1, 0, 0),
+                                  Vec3f(0, 1, 0)),
+          std::make_shared<Plane>(Vec3f(-0.5, -0.5, 0.5), Vec3f(0, 0, -1),
+                                  Vec3f(0, 1, 0))});
+
+  // メッシュを指定した場合は一辺1の箱に収まるように変換して使う
+  std::shared_ptr<TriangleMesh> mesh;
+  Transform meshToUnit;
+  if (argc > 1) {
+    mesh = loadMesh(argv[1]);
+    if (!mesh) return 1;
+    const AABB bounds = mesh->getBounds();
+    const Vec3f d = bounds.diagonal();
+    const float size = std::max(d[0], std::max(d[1], d[2]));
+    meshToUnit = Transform::scale(Vec3f(1.0f / size)) *
+                 Transform::translate(-bounds.center());
+    std::cout << "[Mesh] triangles: " << mesh->nTriangles() << std::endl;
+  }
+
+  const auto floor = std::make_shared<Plane>(
+      Vec3f(-10, 0, -10), Vec3f(0, 0, gridSize * spacing + 20),
+      Vec3f(gridSize * spacing + 20, 0, 0));
+  const auto white = std::make_shared<Lambert>(Vec3f(0.8));
+  scene.addPrimitive(Primitive(floor, white));
+
+  const std::shared_ptr<BSDF> materials[] = {
+      std::make_shared<Lambert>(Vec3f(0.8, 0.6, 0.4)),
+      std::make_shared<Lambert>(Vec3f(0.6, 0.5, 0.3)),
+      std::make_shared<Lambert>(Vec3f(0.3, 0.4, 0.6))};
+
+  // 向きと大きさを変えて格子状に並べる
+  RNG rng(1);
+  int nMeshInstances = 0;
+  for (int j = 0; j < gridSize; ++j) {
+    for (int i = 0; i < gridSize; ++i) {
+      const Vec3f size(1 + rng.getNext(), 0.5f + 2.5f * rng.getNext(),
+                       1 + rng.getNext());
+      const Transform placement =
+          Transform::translate(
+              Vec3f(i * spacing, 0.5f * size[1], j * spacing)) *
+          Transform::rotate(Vec3f(0, 1, 0), 2 * PI * rng.getNext());
+
+      const auto& bsdf = materials[(i + j) % 3];
+      if (mesh && (i + j) % 2 == 0) {
+        const Transform t = placement *
+                            Transform::scale(Vec3f(size[1])) * meshToUnit;
+        scene.addPrimitive(
+            Primitive(std::make_shared<Instance>(mesh, t), bsdf));
+        ++nMeshInstances;
+      } else {
+        const Transform t = placement * Transform::scale(size);
+        scene.addPrimitive(
+            Primitive(std::make_shared<Instance>(box, t), bsdf));
+      }
+    }
+  }
+
+  // シーンの構築(インスタンスのBVHの構築)
+  // NOTE: ジオメトリ内部のBVHは作成時に1回だけ構築される
+  scene.commit();
+  const size_t perInstance =
+      sizeof(Instance) + sizeof(Primitive) + sizeof(BakedShape);
+  std::cout << "[Scene] instances: " << gridSize * gridSize << " ("
+            << perInstance << " bytes/instance)" << std::endl;
+  if (mesh) {
+    // 各インスタンスを別のメッシュにした場合の三角形数との比較
+    std::cout << "[Instance] unique triangles: " << mesh->nTriangles()
+              << ", flattened: "
+              << int64_t(mesh->nTriangles()) * nMeshInstances
+              << std::endl;
+  }
+
+  // レンダリング
+  renderer.render(scene, samples);
+
+  // 画像の出力
+  renderer.writePPM("output.ppm");
+
+  return 0;
+}
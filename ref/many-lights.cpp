@@ -0,0 +1,100 @@
+// 多数の光源
+// 小さな光源を格子状に多数並べた夜景のシーン. 光源の選び方は
+// Light BVH(デフォルト)か一様な選択(--uniform)から選ぶ
+// usage: ./many-lights [--lights <光源の数>] [--uniform]
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "renderer.h"
+#include "rng.h"
+#include "scene.h"
+
+int main(int argc, char** argv) {
+  constexpr int width = 512;    // 画像の横幅[px]
+  constexpr int height = 512;   // 画像の縦幅[px]
+  constexpr int samples = 16;   // サンプル数
+  constexpr float extent = 40;  // 光源を並べる範囲の一辺
+
+  int nLights = 4096;  // 光源の数
+  LightSampling lightSampling = LightSampling::BVH;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (i + 1 < argc && arg == "--lights") {
+      nLights = std::max(std::atoi(argv[++i]), 1);
+    } else if (arg == "--uniform") {
+      lightSampling = LightSampling::Uniform;
+    }
+  }
+
+  // カメラの設定
+  constexpr Vec3f camPos(0, 16, -28);
+  constexpr Vec3f lookAt(0, 0, 5);
+  const auto camera = std::make_shared<PinholeCamera>(
+      camPos, normalize(lookAt - camPos), 0.3f * PI);
+
+  // レンダラーの作成
+  Renderer renderer(width, height, camera);
+
+  // シーンの作成
+  Sky sky(Vec3f(0.0f));
+  Scene scene(sky);
+  scene.setLightSampling(lightSampling);
+
+  const auto white = std::make_shared<Lambert>(Vec3f(0.8));
+  const auto floor = std::make_shared<Plane>(
+      Vec3f(-extent, 0, -extent), Vec3f(0, 0, 2 * extent),
+      Vec3f(2 * extent, 0, 0));
+  scene.addPrimitive(Primitive(floor, white));
+
+  // 光源の間に球を置く
+  RNG rng(1);
+  for (int i = 0; i < 40; ++i) {
+    const float r = 0.5f + rng.getNext();
+    const Vec3f center(extent * (rng.getNext() - 0.5f), r,
+                       extent * (rng.getNext() - 0.5f));
+    scene.addPrimitive(
+        Primitive(std::make_shared<Sphere>(center, r), white));
+  }
+
+  // 光源を格子状に並べる. 高さと色はランダムで, 半分は下向きのパネル,
+  // 残りは球. 大きさは間隔に比例させ, 合計の放射束は光源の数によらず
+  // 一定にする
+  const int gridSize = std::ceil(std::sqrt(float(nLights)));
+  const float spacing = extent / gridSize;
+  const float lightSize = 0.3f * spacing;
+  for (int k = 0; k < nLights; ++k) {
+    const float x = spacing * (k % gridSize + 0.5f) - 0.5f * extent;
+    const float z = spacing * (k / gridSize + 0.5f) - 0.5f * extent;
+    const float y = 0.5f + 4 * rng.getNext();
+    const float hue = rng.getNext();
+    const Vec3f le = 4.0f * Vec3f(1 + 2 * hue, 1.5f, 3 - 2 * hue);
+
+    std::shared_ptr<Shape> shape;
+    if (k % 2) {
+      shape = std::make_shared<Plane>(
+          Vec3f(x - 0.5f * lightSize, y, z - 0.5f * lightSize),
+          Vec3f(0, 0, lightSize), Vec3f(lightSize, 0, 0));
+    } else {
+      shape = std::make_shared<Sphere>(Vec3f(x, y, z), 0.3f * lightSize);
+    }
+    scene.addPrimitive(
+        Primitive(shape, white, std::make_shared<AreaLight>(le)));
+  }
+
+  // シーンの構築(BVHとLight BVHの構築)
+  scene.commit();
+  std::cout << "[Scene] lights: " << scene.nLights() << " ("
+            << (lightSampling == LightSampling::BVH ? "light BVH" : "uniform")
+            << ")" << std::endl;
+
+  // レンダリング
+  renderer.render(scene, samples);
+
+  // 画像の出力
+  renderer.writePPM("output.ppm");
+
+  return 0;
+}
@@ -0,0 +1,58 @@
+#include <cmath>
+
+#include "mesh-loader.h"
+#include "renderer.h"
+#include "scene.h"
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " <mesh.obj|mesh.ply>" << std::endl;
+    return 1;
+  }
+
+  constexpr int width = 512;    // 画像の横幅[px]
+  constexpr int height = 512;   // 画像の縦幅[px]
+  constexpr int samples = 100;  // サンプル数
+
+  // メッシュの読み込み
+  const auto mesh = loadMesh(argv[1]);
+  if (!mesh) return 1;
+  std::cout << "[Mesh] triangles: " << mesh->nTriangles() << std::endl;
+
+  // メッシュ全体が映るようにカメラを設定
+  const AABB bounds = mesh->getBounds();
+  const Vec3f lookAt = bounds.center();
+  const float size = length(bounds.diagonal());
+  const Vec3f camPos =
+      lookAt + 2.5f * size * normalize(Vec3f(0.5, 0.4, 1.0));
+  const auto camera = std::make_shared<PinholeCamera>(
+      camPos, normalize(lookAt - camPos), 0.25f * PI);
+
+  // レンダラーの作成
+  Renderer renderer(width, height, camera);
+
+  // シーンの作成
+  Sky sky(Vec3f(1.0f));
+  Scene scene(sky);
+
+  const auto floor = std::make_shared<Plane>(
+      Vec3f(lookAt[0] - 5 * size, bounds[0][1], lookAt[2] - 5 * size),
+      Vec3f(10 * size, 0, 0), Vec3f(0, 0, 10 * size));
+
+  const auto white = std::make_shared<Lambert>(Vec3f(0.8));
+  const auto red = std::make_shared<Lambert>(Vec3f(0.8, 0.2, 0.2));
+
+  scene.addPrimitive(Primitive(floor, white));
+  scene.addPrimitive(Primitive(mesh, red));
+
+  // シーンの構築(BVHの構築と形状の前計算)
+  scene.commit();
+
+  // レンダリング
+  renderer.render(scene, samples);
+
+  // 画像の出力
+  renderer.writePPM("output.ppm");
+
+  return 0;
+}
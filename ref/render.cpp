@@ -0,0 +1,284 @@
+// シーン記述ファイルを読み込んでレンダリングする
+// usage: ./render <シーン記述ファイル> [--samples <サンプル数>]
+//                 [--output <出力ファイル>] [--threads <スレッド数>]
+//                 [--no-cache] [--texture-cache <容量[MB]>]
+//
+// 分散レンダリング
+//   --workers <n> [--split tiles|samples]
+//       n個のワーカープロセスを起動して分担し, 部分結果をmergeする
+//   --worker <k>/<n> --partial <ファイル> [--split tiles|samples]
+//       n個に分けたk番目の範囲だけをレンダリングして部分結果を書き出す
+//       (別のマシンで実行する場合に使う)
+//   --merge <部分結果>...
+//       ワーカーの部分結果をmergeして画像を出力する
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "distributed.h"
+#include "renderer.h"
+#include "scene-file.h"
+
+extern char** environ;
+
+namespace {
+
+bool endsWith(const std::string& str, const std::string& suffix) {
+  return str.size() >= suffix.size() &&
+         str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// 拡張子に応じた形式で書き出す
+bool writeImage(const Renderer& renderer, const std::string& filename) {
+  if (endsWith(filename, ".png")) return renderer.writePNG(filename);
+  if (endsWith(filename, ".pfm")) return renderer.writePFM(filename);
+  if (endsWith(filename, ".exr")) return renderer.writeEXR(filename);
+  return renderer.writePPM(filename);
+}
+
+// コマンドライン引数
+struct Options {
+  std::string sceneFile;
+  int samples = 0;     // 0ならシーン記述ファイルの値を使う
+  std::string output;  // 空ならシーン記述ファイルの値を使う
+  int nThreads = 0;    // 0なら全てのスレッドを使う
+  bool useCache = true;
+  int textureCacheMB = 256;  // テクスチャキャッシュの容量[MB]
+
+  SplitMode split = SplitMode::Tiles;
+  int nWorkers = 0;     // コーディネーターとして起動するワーカー数
+  int workerIdx = -1;   // ワーカーの場合は担当する範囲の番号
+  std::string partial;  // ワーカーの部分結果の出力先
+  std::vector<std::string> partials;  // mergeする部分結果
+};
+
+bool parseOptions(int argc, char** argv, Options& options) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (i + 1 < argc && arg == "--samples") {
+      options.samples = std::max(std::atoi(argv[++i]), 1);
+    } else if (i + 1 < argc && arg == "--output") {
+      options.output = argv[++i];
+    } else if (i + 1 < argc && arg == "--threads") {
+      options.nThreads = std::max(std::atoi(argv[++i]), 1);
+    } else if (arg == "--no-cache") {
+      options.useCache = false;
+    } else if (i + 1 < argc && arg == "--texture-cache") {
+      options.textureCacheMB = std::max(std::atoi(argv[++i]), 1);
+    } else if (i + 1 < argc && arg == "--split") {
+      const std::string mode = argv[++i];
+      if (mode != "tiles" && mode != "samples") return false;
+      options.split = mode == "tiles" ? SplitMode::Tiles : SplitMode::Samples;
+    } else if (i + 1 < argc && arg == "--workers") {
+      options.nWorkers = std::max(std::atoi(argv[++i]), 1);
+    } else if (i + 1 < argc && arg == "--worker") {
+      if (std::sscanf(argv[++i], "%d/%d", &options.workerIdx,
+                      &options.nWorkers) != 2 ||
+          options.nWorkers < 1 || options.workerIdx < 0 ||
+          options.workerIdx >= options.nWorkers) {
+        return false;
+      }
+    } else if (i + 1 < argc && arg == "--partial") {
+      options.partial = argv[++i];
+    } else if (arg == "--merge") {
+      for (++i; i < argc && argv[i][0] != '-'; ++i) {
+        options.partials.push_back(argv[i]);
+      }
+      --i;
+      if (options.partials.empty()) return false;
+    } else if (options.sceneFile.empty() && arg[0] != '-') {
+      options.sceneFile = arg;
+    } else {
+      return false;
+    }
+  }
+  if (options.workerIdx >= 0 && options.partial.empty()) return false;
+  return !options.sceneFile.empty();
+}
+
+// 部分結果をmergeした画像をrendererに設定する
+// NOTE: 部分結果の範囲が全ての画素とsamples個のサンプル番号をちょうど1回
+// ずつ覆わない場合(部分結果の不足, 分け方やサンプル数の混在)は失敗する.
+// 範囲が全体の中にあって重ならず, 組の数の和が全体と等しいかで判定する
+bool mergePartials(const std::vector<std::string>& partials,
+                   Renderer& renderer, int width, int height, int samples) {
+  AccumulationBuffer total(width, height);
+  std::vector<RenderRange> ranges;
+  int64_t volume = 0;
+  for (const auto& partial : partials) {
+    RenderRange range;
+    AccumulationBuffer accumulation(0, 0);
+    if (!readPartial(partial, range, accumulation)) return false;
+    if (!rangeInside(range, width, height, samples)) {
+      std::cerr << "failed to merge " << partial
+                << ": range is outside of the image or samples" << std::endl;
+      return false;
+    }
+    for (int k = 0; k < ranges.size(); ++k) {
+      if (rangesOverlap(range, ranges[k])) {
+        std::cerr << "failed to merge " << partial << ": range overlaps "
+                  << partials[k] << std::endl;
+        return false;
+      }
+    }
+    ranges.push_back(range);
+    volume += rangeVolume(range);
+
+    if (!total.merge(accumulation)) {
+      std::cerr << "failed to merge " << partial << ": size mismatch"
+                << std::endl;
+      return false;
+    }
+  }
+
+  if (volume != int64_t(width) * height * samples) {
+    std::cerr << "failed to merge: partials cover " << volume << " of "
+              << int64_t(width) * height * samples
+              << " samples (missing partials?)" << std::endl;
+    return false;
+  }
+  return renderer.setAccumulation(total);
+}
+
+// 同じ実行ファイルをワーカーとして起動し, 全ての終了を待つ
+bool runWorkers(const Options& options, int samples,
+                std::vector<std::string>& partials) {
+  const int nThreads =
+      options.nThreads > 0
+          ? options.nThreads
+          : std::max<int>(std::thread::hardware_concurrency() /
+                              options.nWorkers,
+                          1);
+
+  std::vector<pid_t> pids;
+  bool succeeded = true;
+  for (int k = 0; k < options.nWorkers; ++k) {
+    const std::string partial =
+        options.output + ".part" + std::to_string(k);
+    partials.push_back(partial);
+
+    std::vector<std::string> args = {
+        "/proc/self/exe",
+        options.sceneFile,
+        "--worker",
+        std::to_string(k) + "/" + std::to_string(options.nWorkers),
+        "--split",
+        options.split == SplitMode::Tiles ? "tiles" : "samples",
+        "--samples",
+        std::to_string(samples),
+        "--threads",
+        std::to_string(nThreads),
+        "--partial",
+        partial,
+        "--texture-cache",
+        std::to_string(options.textureCacheMB)};
+    if (!options.useCache) args.push_back("--no-cache");
+
+    std::vector<char*> argv;
+    for (auto& arg : args) {
+      argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid;
+    if (posix_spawn(&pid, argv[0], nullptr, nullptr, argv.data(), environ) !=
+        0) {
+      std::cerr << "failed to spawn worker " << k << std::endl;
+      succeeded = false;
+      break;
+    }
+    pids.push_back(pid);
+  }
+
+  for (const pid_t pid : pids) {
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      std::cerr << "failed to run worker (pid " << pid << ")" << std::endl;
+      succeeded = false;
+    }
+  }
+  return succeeded;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    std::cerr << "usage: " << argv[0]
+              << " <scene> [--samples <n>] [--output <file>] [--threads <n>]"
+              << " [--no-cache] [--texture-cache <MB>]"
+              << " [--split tiles|samples]"
+              << " [--workers <n> | --worker <k>/<n> --partial <file> |"
+              << " --merge <partial>...]" << std::endl;
+    return 1;
+  }
+
+  // シーンの読み込み
+  // NOTE: コーディネーターが先にキャッシュを作るので, ワーカーは
+  // キャッシュを読むだけになる
+  SceneFile scene;
+  scene.textureCacheSize = size_t(options.textureCacheMB) << 20;
+  if (!scene.load(options.sceneFile, options.useCache)) return 1;
+  if (options.samples > 0) scene.samples = options.samples;
+  if (!options.output.empty()) scene.output = options.output;
+  options.output = scene.output;
+
+  Renderer renderer(scene.width, scene.height, scene.createCamera());
+  if (options.nThreads > 0) renderer.setThreads(options.nThreads);
+
+  // ワーカー: 担当する範囲だけをレンダリングして部分結果を書き出す
+  if (options.workerIdx >= 0) {
+    const RenderRange range =
+        splitRenderRange(options.split, options.workerIdx, options.nWorkers,
+                         scene.width, scene.height, scene.samples);
+    renderer.renderRange(scene.getScene(), range);
+    return writePartial(options.partial, range, renderer.getAccumulation())
+               ? 0
+               : 1;
+  }
+
+  // NOTE: 分散レンダリングではAOVを記録しないのでデノイズしない
+  const bool isDistributed = options.nWorkers > 0 || !options.partials.empty();
+  if (isDistributed && scene.denoise) {
+    std::cerr << "denoise is not supported in distributed rendering"
+              << std::endl;
+  }
+
+  if (options.nWorkers > 0) {
+    // コーディネーター: ワーカーを起動して部分結果をmergeする
+    std::vector<std::string> partials;
+    const bool succeeded = runWorkers(options, scene.samples, partials) &&
+                           mergePartials(partials, renderer, scene.width,
+                                         scene.height, scene.samples);
+    for (const auto& partial : partials) {
+      std::remove(partial.c_str());
+    }
+    if (!succeeded) return 1;
+  } else if (!options.partials.empty()) {
+    if (!mergePartials(options.partials, renderer, scene.width,
+                       scene.height, scene.samples)) {
+      return 1;
+    }
+  } else {
+    // レンダリング
+    renderer.setAOV(scene.denoise);
+    renderer.render(scene.getScene(), scene.samples);
+    if (scene.getTextureCache()) scene.getTextureCache()->printStats();
+    if (scene.denoise && !renderer.denoise()) return 1;
+  }
+
+  // 画像の出力
+  if (!writeImage(renderer, scene.output)) return 1;
+
+  return 0;
+}
@@ -1,9 +1,13 @@
+// 球で構成されるシーン
+// 環境マップ(緯度経度形式のPFM, HDR画像)を指定した場合はそれで照らす
+// usage: ./spheres [env.pfm|env.hdr]
 #include <cmath>
 
+#include "environment-map.h"
 #include "renderer.h"
 #include "scene.h"
 
-int main() {
+int main(int argc, char** argv) {
   constexpr int width = 512;    // 画像の横幅[px]
   constexpr int height = 512;   // 画像の縦幅[px]
   constexpr int samples = 100;  // サンプル数
@@ -19,6 +23,11 @@ int main() {
 
   // シーンの作成
   Sky sky(Vec3f(1.0f));
+  if (argc > 1) {
+    const auto envMap = EnvironmentMap::load(argv[1]);
+    if (!envMap) return 1;
+    sky = Sky(envMap);
+  }
   Scene scene(sky);
 
   const auto floor = std::make_shared<Plane>(Vec3f(-5, -1, -5), Vec3f(10, 0, 0),
@@ -41,6 +50,9 @@ int main() {
   scene.addPrimitive(Primitive(sphere3, mat4));
   scene.addPrimitive(Primitive(sphere4, mat5));
 
+  // シーンの構築(BVHの構築と形状の前計算)
+  scene.commit();
+
   // レンダリング
   renderer.render(scene, samples);
 
@@ -0,0 +1,92 @@
+#ifndef _AABB_H
+#define _AABB_H
+#include <algorithm>
+#include <limits>
+
+#include "ray.h"
+#include "vec3.h"
+
+// 軸平行境界ボックス(Axis Aligned Bounding Box)
+struct AABB {
+  Vec3f bounds[2];  // 最小点, 最大点
+
+  // NOTE: 空のAABBはmin > maxとなるように初期化する
+  AABB() {
+    bounds[0] = Vec3f(std::numeric_limits<float>::max());
+    bounds[1] = Vec3f(-std::numeric_limits<float>::max());
+  }
+  AABB(const Vec3f& pMin, const Vec3f& pMax) {
+    bounds[0] = pMin;
+    bounds[1] = pMax;
+  }
+
+  const Vec3f& operator[](unsigned int i) const { return bounds[i]; }
+
+  // 中心位置
+  Vec3f center() const { return 0.5f * (bounds[0] + bounds[1]); }
+
+  // 対角線ベクトル
+  Vec3f diagonal() const { return bounds[1] - bounds[0]; }
+
+  // 表面積
+  float surfaceArea() const {
+    const Vec3f d = diagonal();
+    return 2.0f * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+  }
+
+  // 最も長い軸の番号
+  int longestAxis() const {
+    const Vec3f d = diagonal();
+    if (d[0] > d[1] && d[0] > d[2]) return 0;
+    return d[1] > d[2] ? 1 : 2;
+  }
+
+  // 点pがAABB内のどこにあるかを[0, 1]^3で返す
+  Vec3f offset(const Vec3f& p) const {
+    Vec3f o = p - bounds[0];
+    for (int i = 0; i < 3; ++i) {
+      if (bounds[1][i] > bounds[0][i]) o[i] /= bounds[1][i] - bounds[0][i];
+    }
+    return o;
+  }
+
+  // スラブ法による交差判定
+  // invDirはレイの方向の逆数, dirIsNegは各成分の方向が負かどうか
+  // 交差区間が(ray.tmin, tmax)と重なるかを判定する
+  bool intersect(const Ray& ray, const Vec3f& invDir, const int dirIsNeg[3],
+                 float tmax) const {
+    float t0 = (bounds[dirIsNeg[0]][0] - ray.origin[0]) * invDir[0];
+    float t1 = (bounds[1 - dirIsNeg[0]][0] - ray.origin[0]) * invDir[0];
+    const float ty0 = (bounds[dirIsNeg[1]][1] - ray.origin[1]) * invDir[1];
+    const float ty1 = (bounds[1 - dirIsNeg[1]][1] - ray.origin[1]) * invDir[1];
+    const float tz0 = (bounds[dirIsNeg[2]][2] - ray.origin[2]) * invDir[2];
+    const float tz1 = (bounds[1 - dirIsNeg[2]][2] - ray.origin[2]) * invDir[2];
+
+    // NOTE: NaNが生じた場合でも判定が壊れないように比較の順序に注意する
+    t0 = std::max(t0, std::max(ty0, tz0));
+    t1 = std::min(t1, std::min(ty1, tz1));
+    return std::max(t0, ray.tmin) <= std::min(t1, tmax);
+  }
+};
+
+// 2つのAABBを含むAABB
+inline AABB mergeAABB(const AABB& b1, const AABB& b2) {
+  Vec3f pMin, pMax;
+  for (int i = 0; i < 3; ++i) {
+    pMin[i] = std::min(b1[0][i], b2[0][i]);
+    pMax[i] = std::max(b1[1][i], b2[1][i]);
+  }
+  return AABB(pMin, pMax);
+}
+
+// AABBと点を含むAABB
+inline AABB mergeAABB(const AABB& b, const Vec3f& p) {
+  Vec3f pMin, pMax;
+  for (int i = 0; i < 3; ++i) {
+    pMin[i] = std::min(b[0][i], p[i]);
+    pMax[i] = std::max(b[1][i], p[i]);
+  }
+  return AABB(pMin, pMax);
+}
+
+#endif
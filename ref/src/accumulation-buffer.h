@@ -0,0 +1,166 @@
+#ifndef _ACCUMULATION_BUFFER_H
+#define _ACCUMULATION_BUFFER_H
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "binary-io.h"
+#include "vec3.h"
+
+// 輝度(Rec. 709)
+inline float luminance(const Vec3f& c) {
+  return 0.2126f * c[0] + 0.7152f * c[1] + 0.0722f * c[2];
+}
+
+// 画素ごとのサンプルの和と輝度の二乗和を蓄積するバッファ
+// 平均と分散から画素ごとの推定誤差を求められる
+// NOTE: 和は固定小数点の整数で持つ. 整数の加算は結合的なので, 画素や
+// サンプルを分けて蓄積したバッファをmergeしても, 分け方や順番によらず
+// 1つのバッファに蓄積した場合と全く同じ結果になる
+class AccumulationBuffer {
+ private:
+  // 固定小数点の1に対応する値
+  static constexpr double fixedScale = double(1 << 24);
+  // 1サンプルの値の上限(和が桁あふれしないように抑える)
+  static constexpr float maxSampleValue = float(1 << 20);
+
+  unsigned int width;
+  unsigned int height;
+  std::vector<int64_t> sum[3];     // サンプルの和のRGB
+  std::vector<int64_t> lumSum;     // 輝度の和
+  std::vector<__int128> lumSqSum;  // 輝度の二乗和(固定小数点の2乗)
+  std::vector<uint32_t> count;     // サンプル数
+
+  // NOTE: NaNは0に, 大きすぎる値は上限に丸める
+  static int64_t toFixed(float v) {
+    if (std::isnan(v)) return 0;
+    v = std::clamp(v, -maxSampleValue, maxSampleValue);
+    return static_cast<int64_t>(std::nearbyint(v * fixedScale));
+  }
+
+  // 平均輝度の分散の分子(二乗和 - 和^2 / n)をfixedScale^2倍したもの
+  double lumSquaredDeviation(int idx) const {
+    const double s = double(lumSum[idx]);
+    return std::max(double(lumSqSum[idx]) - s * s / count[idx], 0.0);
+  }
+
+ public:
+  AccumulationBuffer(unsigned int width, unsigned int height)
+      : width(width), height(height) {
+    clear();
+  }
+
+  unsigned int getWidth() const { return width; }
+  unsigned int getHeight() const { return height; }
+
+  void clear() {
+    const size_t n = width * height;
+    for (int c = 0; c < 3; ++c) {
+      sum[c].assign(n, 0);
+    }
+    lumSum.assign(n, 0);
+    lumSqSum.assign(n, 0);
+    count.assign(n, 0);
+  }
+
+  // 画素(i, j)にサンプルを加える
+  void addSample(unsigned int i, unsigned int j, const Vec3f& color) {
+    const int idx = i + width * j;
+    for (int c = 0; c < 3; ++c) {
+      sum[c][idx] += toFixed(color[c]);
+    }
+    const int64_t lum = toFixed(luminance(color));
+    lumSum[idx] += lum;
+    lumSqSum[idx] += __int128(lum) * lum;
+    count[idx]++;
+  }
+
+  // otherの全ての画素のサンプルを加える
+  // NOTE: 大きさが異なる場合はfalseを返す
+  bool merge(const AccumulationBuffer& other) {
+    if (other.width != width || other.height != height) return false;
+    const size_t n = width * height;
+    for (int c = 0; c < 3; ++c) {
+      for (size_t idx = 0; idx < n; ++idx) {
+        sum[c][idx] += other.sum[c][idx];
+      }
+    }
+    for (size_t idx = 0; idx < n; ++idx) {
+      lumSum[idx] += other.lumSum[idx];
+      lumSqSum[idx] += other.lumSqSum[idx];
+      count[idx] += other.count[idx];
+    }
+    return true;
+  }
+
+  uint32_t getCount(unsigned int i, unsigned int j) const {
+    return count[i + width * j];
+  }
+
+  // 画素(i, j)のサンプルの平均
+  Vec3f getMean(unsigned int i, unsigned int j) const {
+    const int idx = i + width * j;
+    if (count[idx] == 0) return Vec3f(0);
+    const double scale = 1.0 / (fixedScale * count[idx]);
+    return Vec3f(float(sum[0][idx] * scale), float(sum[1][idx] * scale),
+                 float(sum[2][idx] * scale));
+  }
+
+  // 画素(i, j)の平均輝度の分散
+  float getVariance(unsigned int i, unsigned int j) const {
+    const int idx = i + width * j;
+    const uint32_t n = count[idx];
+    if (n < 2) return 0;
+
+    return lumSquaredDeviation(idx) / (fixedScale * fixedScale) / (n - 1) /
+           n;
+  }
+
+  // 画素(i, j)の平均輝度の相対的な標準誤差
+  // NOTE: 暗い画素で発散しないように分母に小さな値を足す
+  float getRelativeError(unsigned int i, unsigned int j) const {
+    const int idx = i + width * j;
+    const uint32_t n = count[idx];
+    if (n < 2) return std::numeric_limits<float>::infinity();
+
+    const double mean = lumSum[idx] / fixedScale / n;
+    const double var =
+        lumSquaredDeviation(idx) / (fixedScale * fixedScale) / (n - 1);
+    return std::sqrt(var / n) / (mean + 1e-2);
+  }
+
+  // 蓄積した値を書き出す(分散レンダリングの部分結果用)
+  void write(binary_io::Writer& writer) const {
+    writer.write<uint32_t>(width);
+    writer.write<uint32_t>(height);
+    for (int c = 0; c < 3; ++c) {
+      writer.writeArray(sum[c]);
+    }
+    writer.writeArray(lumSum);
+    writer.writeArray(lumSqSum);
+    writer.writeArray(count);
+  }
+
+  // writeで書き出した値を読み込む
+  bool read(binary_io::Reader& reader) {
+    uint32_t w, h;
+    if (!reader.read(w) || !reader.read(h)) return false;
+    width = w;
+    height = h;
+    for (int c = 0; c < 3; ++c) {
+      if (!reader.readArray(sum[c])) return false;
+    }
+    if (!reader.readArray(lumSum) || !reader.readArray(lumSqSum) ||
+        !reader.readArray(count)) {
+      return false;
+    }
+
+    const size_t n = width * height;
+    return sum[0].size() == n && sum[1].size() == n && sum[2].size() == n &&
+           lumSum.size() == n && lumSqSum.size() == n && count.size() == n;
+  }
+};
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef _ANIMATION_H
+#define _ANIMATION_H
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "camera.h"
+#include "instance.h"
+#include "scene.h"
+#include "transform.h"
+#include "vec3.h"
+
+// 回転を表す単位四元数 w + (x, y, z)
+struct Quaternion {
+  float w;
+  Vec3f v;
+
+  // 回転なし
+  Quaternion() : w(1), v(0) {}
+  Quaternion(float w, const Vec3f& v) : w(w), v(v) {}
+
+  // 軸axis周りにangle[rad]の回転
+  static Quaternion axisAngle(const Vec3f& axis, float angle) {
+    return Quaternion(std::cos(0.5f * angle),
+                      std::sin(0.5f * angle) * normalize(axis));
+  }
+
+  Transform toTransform() const {
+    const float s = length(v);
+    if (s == 0) return Transform();
+    return Transform::rotate(v / s, 2 * std::atan2(s, w));
+  }
+};
+
+// 球面線形補間
+inline Quaternion slerp(const Quaternion& a, const Quaternion& b, float t) {
+  // 短い方の弧で補間する
+  float c = a.w * b.w + dot(a.v, b.v);
+  const float sign = c < 0 ? -1.0f : 1.0f;
+  c *= sign;
+
+  float ka = 1 - t, kb = t;
+  // NOTE: ほぼ同じ回転の場合は0除算を避けて線形補間する
+  if (c < 0.9995f) {
+    const float theta = std::acos(c);
+    const float invSin = 1.0f / std::sin(theta);
+    ka = std::sin((1 - t) * theta) * invSin;
+    kb = std::sin(t * theta) * invSin;
+  }
+  kb *= sign;
+
+  const float w = ka * a.w + kb * b.w;
+  const Vec3f v = ka * a.v + kb * b.v;
+  const float invLen = 1.0f / std::sqrt(w * w + length2(v));
+  return Quaternion(w * invLen, v * invLen);
+}
+
+// 時刻の昇順に並んだキーフレームkeysから時刻timeを挟む2つを探す
+// keys[i]とkeys[i + 1]の間の補間の重みuを返す
+// NOTE: 範囲外の時刻は最初, 最後のキーフレームの値にする
+template <typename Key>
+int findKeyframe(const std::vector<Key>& keys, float time, float& u) {
+  const auto it = std::upper_bound(
+      keys.begin(), keys.end(), time,
+      [](float t, const Key& key) { return t < key.time; });
+  if (it == keys.begin()) {
+    u = 0;
+    return 0;
+  }
+  if (it == keys.end()) {
+    u = 1;
+    return std::max(int(keys.size()) - 2, 0);
+  }
+  const int i = it - keys.begin() - 1;
+  u = (time - keys[i].time) / (keys[i + 1].time - keys[i].time);
+  return i;
+}
+
+// キーフレームで与えるアフィン変換
+// 平行移動, 回転, 拡大縮小をそれぞれ補間し, 拡大縮小, 回転, 平行移動の
+// 順に適用する
+class AnimatedTransform {
+ public:
+  struct Keyframe {
+    float time;
+    Vec3f translation;
+    Quaternion rotation;
+    Vec3f scale;
+  };
+
+  // NOTE: 時刻の順に並べて保持するので, 追加する順は任意
+  void addKeyframe(float time, const Vec3f& translation,
+                   const Quaternion& rotation = Quaternion(),
+                   const Vec3f& scale = Vec3f(1)) {
+    const Keyframe key = {time, translation, rotation, scale};
+    keys.insert(std::upper_bound(keys.begin(), keys.end(), key,
+                                 [](const Keyframe& a, const Keyframe& b) {
+                                   return a.time < b.time;
+                                 }),
+                key);
+  }
+
+  // 時刻timeの変換
+  Transform evaluate(float time) const {
+    if (keys.empty()) return Transform();
+    if (keys.size() == 1) return toTransform(keys[0]);
+
+    float u;
+    const int i = findKeyframe(keys, time, u);
+    const Keyframe& k0 = keys[i];
+    const Keyframe& k1 = keys[i + 1];
+    return toTransform({time, (1 - u) * k0.translation + u * k1.translation,
+                        slerp(k0.rotation, k1.rotation, u),
+                        (1 - u) * k0.scale + u * k1.scale});
+  }
+
+ private:
+  std::vector<Keyframe> keys;
+
+  static Transform toTransform(const Keyframe& key) {
+    return Transform::translate(key.translation) *
+           key.rotation.toTransform() * Transform::scale(key.scale);
+  }
+};
+
+// キーフレームで与えるカメラの位置と注視点
+class CameraPath {
+ public:
+  struct Keyframe {
+    float time;
+    Vec3f position;
+    Vec3f lookAt;
+  };
+
+  void addKeyframe(float time, const Vec3f& position, const Vec3f& lookAt) {
+    const Keyframe key = {time, position, lookAt};
+    keys.insert(std::upper_bound(keys.begin(), keys.end(), key,
+                                 [](const Keyframe& a, const Keyframe& b) {
+                                   return a.time < b.time;
+                                 }),
+                key);
+  }
+
+  bool empty() const { return keys.empty(); }
+
+  // 時刻timeのカメラの位置と注視点
+  void evaluate(float time, Vec3f& position, Vec3f& lookAt) const {
+    float u = 0;
+    const int i = keys.size() > 1 ? findKeyframe(keys, time, u) : 0;
+    const Keyframe& k0 = keys[i];
+    const Keyframe& k1 = keys[std::min<int>(i + 1, keys.size() - 1)];
+    position = (1 - u) * k0.position + u * k1.position;
+    lookAt = (1 - u) * k0.lookAt + u * k1.lookAt;
+  }
+
+ private:
+  std::vector<Keyframe> keys;
+};
+
+// 1つのプロセスで連番のフレームをレンダリングするためのアニメーション
+// setTimeでインスタンスの変換とカメラを時刻の状態にし, シーンのBVHを
+// 更新する. 形状やメッシュ, そのBVHなどはフレーム間で使い回す
+// NOTE: 動かす形状はInstanceにしておく
+class Animation {
+ public:
+  // instanceの変換をtransform * baseでアニメーションさせる
+  // baseはジオメトリを配置する前の変換(メッシュの正規化など)
+  void animate(const std::shared_ptr<Instance>& instance,
+               const AnimatedTransform& transform,
+               const Transform& base = Transform()) {
+    tracks.push_back({instance, transform, base});
+  }
+
+  void animateCamera(const std::shared_ptr<Camera>& camera,
+                     const CameraPath& path) {
+    this->camera = camera;
+    cameraPath = path;
+  }
+
+  // BVHを構築し直すSAHコストの増加率(Scene::updateを参照)
+  void setRebuildThreshold(float threshold) { rebuildThreshold = threshold; }
+
+  // 時刻timeの状態にする
+  // BVHを構築し直した場合はtrueを返す
+  // NOTE: commit前のシーンはcommitする. レンダリング中に呼んではいけない
+  bool setTime(Scene& scene, float time) const {
+    for (const auto& track : tracks) {
+      track.instance->setTransform(track.transform.evaluate(time) *
+                                   track.base);
+    }
+    if (camera && !cameraPath.empty()) {
+      Vec3f position, lookAt;
+      cameraPath.evaluate(time, position, lookAt);
+      camera->setPose(position, normalize(lookAt - position));
+    }
+    return scene.update(rebuildThreshold);
+  }
+
+ private:
+  struct Track {
+    std::shared_ptr<Instance> instance;
+    AnimatedTransform transform;
+    Transform base;
+  };
+
+  std::vector<Track> tracks;
+  std::shared_ptr<Camera> camera;
+  CameraPath cameraPath;
+  float rebuildThreshold = 1.5f;
+};
+
+#endif
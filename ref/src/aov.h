@@ -0,0 +1,167 @@
+#ifndef _AOV_H
+#define _AOV_H
+#include <algorithm>
+#include <vector>
+
+#include "binary-io.h"
+#include "image.h"
+#include "vec3.h"
+
+// 最初の交差点の情報(1サンプル分)
+// NOTE: 空に飛んでいった場合は全て0
+struct AOVSample {
+  Vec3f albedo = Vec3f(0);  // BSDFの反射率
+  Vec3f normal = Vec3f(0);  // 法線
+  float depth = 0;          // カメラからの距離
+};
+
+// 画素ごとの最初の交差点の反射率, 法線, 距離を蓄積するバッファ
+// デノイザーのガイドに使う. 画素の平均輝度の分散(ノイズの大きさ)も持つ
+// NOTE: デノイザーで画素をまとめて処理しやすいように成分ごとの配列で持つ
+class AOVBuffer {
+ private:
+  unsigned int width;
+  unsigned int height;
+  std::vector<float> albedo[3];  // 反射率のRGB
+  std::vector<float> normal[3];  // 法線のXYZ
+  std::vector<float> depth;      // 距離
+  std::vector<float> variance;   // 平均輝度の分散
+
+ public:
+  AOVBuffer(unsigned int width, unsigned int height)
+      : width(width), height(height) {
+    clear();
+  }
+
+  unsigned int getWidth() const { return width; }
+  unsigned int getHeight() const { return height; }
+
+  void clear() {
+    const size_t n = width * height;
+    for (int c = 0; c < 3; ++c) {
+      albedo[c].assign(n, 0);
+      normal[c].assign(n, 0);
+    }
+    depth.assign(n, 0);
+    variance.assign(n, 0);
+  }
+
+  // 画素(i, j)にサンプルを加える
+  void addSample(unsigned int i, unsigned int j, const AOVSample& s) {
+    const int idx = i + width * j;
+    for (int c = 0; c < 3; ++c) {
+      albedo[c][idx] += s.albedo[c];
+      normal[c][idx] += s.normal[c];
+    }
+    depth[idx] += s.depth;
+  }
+
+  // 画素(i, j)をn個のサンプルの平均にする
+  // NOTE: 平均した法線は長さが1より短くなるので正規化する
+  void normalize(unsigned int i, unsigned int j, unsigned int n) {
+    const int idx = i + width * j;
+    const float invN = 1.0f / std::max(n, 1u);
+    for (int c = 0; c < 3; ++c) {
+      albedo[c][idx] *= invN;
+    }
+    depth[idx] *= invN;
+
+    const Vec3f nrm(normal[0][idx], normal[1][idx], normal[2][idx]);
+    const float len = length(nrm);
+    for (int c = 0; c < 3; ++c) {
+      normal[c][idx] = len > 0 ? nrm[c] / len : 0;
+    }
+  }
+
+  void setVariance(unsigned int i, unsigned int j, float v) {
+    variance[i + width * j] = v;
+  }
+
+  // 成分ごとの配列
+  const std::vector<float>& getAlbedo(int c) const { return albedo[c]; }
+  const std::vector<float>& getNormal(int c) const { return normal[c]; }
+  const std::vector<float>& getDepth() const { return depth; }
+  const std::vector<float>& getVariance() const { return variance; }
+
+  Vec3f getAlbedo(unsigned int i, unsigned int j) const {
+    const int idx = i + width * j;
+    return Vec3f(albedo[0][idx], albedo[1][idx], albedo[2][idx]);
+  }
+  Vec3f getNormal(unsigned int i, unsigned int j) const {
+    const int idx = i + width * j;
+    return Vec3f(normal[0][idx], normal[1][idx], normal[2][idx]);
+  }
+  float getDepth(unsigned int i, unsigned int j) const {
+    return depth[i + width * j];
+  }
+
+  // 蓄積した値を書き出す(レンダリングの途中経過の保存用)
+  void write(binary_io::Writer& writer) const {
+    writer.write<uint32_t>(width);
+    writer.write<uint32_t>(height);
+    for (int c = 0; c < 3; ++c) {
+      writer.writeArray(albedo[c]);
+      writer.writeArray(normal[c]);
+    }
+    writer.writeArray(depth);
+    writer.writeArray(variance);
+  }
+
+  // writeで書き出した値を読み込む
+  bool read(binary_io::Reader& reader) {
+    uint32_t w, h;
+    if (!reader.read(w) || !reader.read(h)) return false;
+    width = w;
+    height = h;
+    for (int c = 0; c < 3; ++c) {
+      if (!reader.readArray(albedo[c]) || !reader.readArray(normal[c])) {
+        return false;
+      }
+    }
+    if (!reader.readArray(depth) || !reader.readArray(variance)) return false;
+
+    const size_t n = width * height;
+    for (int c = 0; c < 3; ++c) {
+      if (albedo[c].size() != n || normal[c].size() != n) return false;
+    }
+    return depth.size() == n && variance.size() == n;
+  }
+
+  // 確認用の画像
+  // 反射率はそのまま, 法線は[-1, 1]を[0, 1]に, 距離は最大値を1にして返す
+  Image getAlbedoImage() const {
+    Image image(width, height);
+    for (int j = 0; j < height; ++j) {
+      for (int i = 0; i < width; ++i) {
+        image.setPixel(i, j, getAlbedo(i, j));
+      }
+    }
+    return image;
+  }
+
+  Image getNormalImage() const {
+    Image image(width, height);
+    for (int j = 0; j < height; ++j) {
+      for (int i = 0; i < width; ++i) {
+        image.setPixel(i, j, 0.5f * getNormal(i, j) + Vec3f(0.5f));
+      }
+    }
+    return image;
+  }
+
+  Image getDepthImage() const {
+    const float maxDepth =
+        depth.empty() ? 0 : *std::max_element(depth.begin(), depth.end());
+    const float scale = maxDepth > 0 ? 1.0f / maxDepth : 0;
+
+    Image image(width, height);
+    for (int j = 0; j < height; ++j) {
+      for (int i = 0; i < width; ++i) {
+        image.setPixel(i, j, Vec3f(scale * getDepth(i, j)));
+      }
+    }
+    return image;
+  }
+};
+
+#endif
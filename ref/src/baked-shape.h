@@ -0,0 +1,142 @@
+#ifndef _BAKED_SHAPE_H
+#define _BAKED_SHAPE_H
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
+#include "constant.h"
+#include "intersect-info.h"
+#include "ray.h"
+#include "shape.h"
+#include "vec3.h"
+
+// 交差判定に必要な値を前計算した形状のレコード
+// Scene::commitで全てのPrimitiveについて作り, 1つの配列にまとめて持つ
+// NOTE: 1レコードがキャッシュラインに収まるように64byteに揃えている.
+// VEC3_SIMDの場合はVec3fが16byteになるので128byteになる
+struct alignas(64) BakedShape {
+  enum class Type : uint32_t {
+    Sphere,
+    Plane,
+    Other,  // 前計算しない形状(元の形状で交差判定する)
+  };
+
+  struct SphereData {
+    Vec3f center;     // 中心位置
+    float radius2;    // 半径の2乗
+    float invRadius;  // 半径の逆数
+  };
+
+  // NOTE: 辺ベクトルを長さの2乗で割っておき, 面上の座標を[0, 1]で判定する
+  struct PlaneData {
+    Vec3f origin;     // leftCornerPoint
+    Vec3f normal;     // 正規化した法線
+    Vec3f axisU;      // right / |right|^2
+    Vec3f axisV;      // up / |up|^2
+    float uvDensity;  // 1 / sqrt(|right| |up|)
+  };
+
+  Type type;
+  union {
+    SphereData sphere;
+    PlaneData plane;
+  };
+
+  BakedShape() : type(Type::Other), plane() {}
+
+  // 形状から交差判定用のレコードを作る
+  static BakedShape bake(const ShapeRef& shape) {
+    BakedShape baked;
+    shape.visit([&](const auto& s) {
+      using T = std::decay_t<decltype(s)>;
+      if constexpr (std::is_same_v<T, Sphere>) {
+        baked.type = Type::Sphere;
+        baked.sphere.center = s.center;
+        baked.sphere.radius2 = s.radius * s.radius;
+        baked.sphere.invRadius = 1.0f / s.radius;
+      } else if constexpr (std::is_same_v<T, Plane>) {
+        baked.type = Type::Plane;
+        baked.plane.origin = s.leftCornerPoint;
+        baked.plane.normal = normalize(cross(s.right, s.up));
+        baked.plane.axisU = s.right / length2(s.right);
+        baked.plane.axisV = s.up / length2(s.up);
+        baked.plane.uvDensity =
+            1.0f / std::sqrt(length(s.right) * length(s.up));
+      }
+    });
+    return baked;
+  }
+
+  // 交差判定を行う. 前計算していない形状はshapeで判定する
+  bool intersect(const Ray& ray, IntersectInfo& info,
+                 const ShapeRef& shape) const {
+    float t;
+    switch (type) {
+      case Type::Sphere:
+        if (!hitSphere(ray, ray.tmax, t)) return false;
+        info.t = t;
+        info.hitPos = ray(t);
+        info.hitNormal = (info.hitPos - sphere.center) * sphere.invRadius;
+        sphereTexCoord(info.hitNormal, info.u, info.v);
+        info.uvDensity = PI_INV * sphere.invRadius;
+        return true;
+      case Type::Plane:
+        if (!hitPlane(ray, ray.tmax, t, info.u, info.v)) return false;
+        info.t = t;
+        info.hitPos = ray(t);
+        info.hitNormal = plane.normal;
+        info.uvDensity = plane.uvDensity;
+        return true;
+      default:
+        return shape.intersect(ray, info);
+    }
+  }
+
+  // (ray.tmin, tmax)内に交差点があるかを判定する
+  bool occluded(const Ray& ray, float tmax, const ShapeRef& shape) const {
+    float t;
+    switch (type) {
+      case Type::Sphere:
+        return hitSphere(ray, tmax, t);
+      case Type::Plane: {
+        float u, v;
+        return hitPlane(ray, tmax, t, u, v);
+      }
+      default:
+        return shape.occluded(ray, tmax);
+    }
+  }
+
+ private:
+  // (ray.tmin, tmax)内で最も近い交差距離tを求める
+  bool hitSphere(const Ray& ray, float tmax, float& t) const {
+    const Vec3f oc = ray.origin - sphere.center;
+    const float b = dot(ray.direction, oc);
+    const float c = length2(oc) - sphere.radius2;
+    const float D = b * b - c;
+    if (D < 0) return false;
+
+    const float sqrtD = std::sqrt(D);
+    t = -b - sqrtD;
+    if (t < ray.tmin || t > tmax) {
+      t = -b + sqrtD;
+      if (t < ray.tmin || t > tmax) return false;
+    }
+    return true;
+  }
+
+  // 面上の座標(u, v)も返す
+  bool hitPlane(const Ray& ray, float tmax, float& t, float& u,
+                float& v) const {
+    t = -dot(ray.origin - plane.origin, plane.normal) /
+        dot(ray.direction, plane.normal);
+    if (t < ray.tmin || t > tmax) return false;
+
+    const Vec3f p = ray(t) - plane.origin;
+    u = dot(p, plane.axisU);
+    v = dot(p, plane.axisV);
+    return u >= 0.0f && u <= 1.0f && v >= 0.0f && v <= 1.0f;
+  }
+};
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef _BINARY_IO_H
+#define _BINARY_IO_H
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// シーンのキャッシュなどのバイナリの書き出し, 読み込み
+// NOTE: 値はホストのバイト順, 配置のまま書き出すので, 同じ環境で
+// ビルドしたプログラムの間でのみ読み書きできる
+namespace binary_io {
+
+// 配列の先頭をこの倍数の位置に揃える(メモリマップしたまま参照できるように)
+constexpr size_t arrayAlignment = 64;
+
+class Writer {
+ private:
+  std::vector<char> buffer;
+
+  void align() {
+    buffer.resize((buffer.size() + arrayAlignment - 1) / arrayAlignment *
+                  arrayAlignment);
+  }
+
+ public:
+  const std::vector<char>& getBuffer() const { return buffer; }
+
+  template <typename T>
+  void write(const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    const char* p = reinterpret_cast<const char*>(&value);
+    buffer.insert(buffer.end(), p, p + sizeof(T));
+  }
+
+  // 要素数と要素を書き出す
+  template <typename T>
+  void writeArray(const std::vector<T>& values) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    write<uint64_t>(values.size());
+    align();
+    const char* p = reinterpret_cast<const char*>(values.data());
+    buffer.insert(buffer.end(), p, p + sizeof(T) * values.size());
+  }
+
+  void writeString(const std::string& str) {
+    write<uint64_t>(str.size());
+    buffer.insert(buffer.end(), str.begin(), str.end());
+  }
+};
+
+// メモリ上のバイト列から順に読む
+// NOTE: 範囲外を読もうとした場合はfalseを返し, 以降の読み込みも全て失敗する
+class Reader {
+ private:
+  const char* begin;
+  const char* p;
+  const char* end;
+
+  bool align() {
+    const size_t offset = p - begin;
+    const size_t aligned = (offset + arrayAlignment - 1) / arrayAlignment *
+                           arrayAlignment;
+    return skip(aligned - offset);
+  }
+
+  bool skip(size_t size) {
+    if (!p || size > size_t(end - p)) {
+      p = nullptr;
+      return false;
+    }
+    p += size;
+    return true;
+  }
+
+ public:
+  Reader(const char* data, size_t size)
+      : begin(data), p(data), end(data + size) {}
+
+  bool isGood() const { return p != nullptr; }
+
+  template <typename T>
+  bool read(T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    const char* src = p;
+    if (!skip(sizeof(T))) return false;
+    std::memcpy(&value, src, sizeof(T));
+    return true;
+  }
+
+  template <typename T>
+  bool readArray(std::vector<T>& values) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    uint64_t n;
+    if (!read(n) || !align()) return false;
+    if (n > size_t(end - p) / sizeof(T)) {
+      p = nullptr;
+      return false;
+    }
+    const char* src = p;
+    skip(sizeof(T) * n);
+    values.resize(n);
+    std::memcpy(values.data(), src, sizeof(T) * n);
+    return true;
+  }
+
+  bool readString(std::string& str) {
+    uint64_t n;
+    if (!read(n)) return false;
+    const char* src = p;
+    if (!skip(n)) return false;
+    str.assign(src, n);
+    return true;
+  }
+};
+
+}  // namespace binary_io
+
+#endif
@@ -1,8 +1,12 @@
 #ifndef _BSDF_H
 #define _BSDF_H
+#include <memory>
+
 #include "constant.h"
-#include "rng.h"
+#include "dispatch.h"
+#include "sampler.h"
 #include "sampling.h"
+#include "texture.h"
 #include "vec3.h"
 
 inline float cosTheta(const Vec3f& w) { return w[1]; }
@@ -14,56 +18,100 @@ inline float fresnel(const Vec3f& w, const Vec3f& n, float ior1, float ior2) {
   return f0 + (1.0f - f0) * std::pow(1.0f - std::abs(dot(w, n)), 5.0f);
 }
 
+// NOTE: eval, sample, albedoは交差点のテクスチャ座標tcを受け取る.
+// pdfはテクスチャに依存しない
 class BSDF {
  public:
   // BSDFの値を計算して返す
-  virtual Vec3f eval(const Vec3f& wo, const Vec3f& wi) const = 0;
+  virtual Vec3f eval(const TexCoord& tc, const Vec3f& wo,
+                     const Vec3f& wi) const = 0;
 
   // BSDF x cosに比例するように方向サンプリングを行う
   // 返り値としてBSDFの値, 方向ベクトル, pdfを返す
-  virtual Vec3f sample(RNG& rng, const Vec3f& wo, Vec3f& wi,
-                       float& pdf) const = 0;
+  virtual Vec3f sample(const TexCoord& tc, Sampler& sampler, const Vec3f& wo,
+                       Vec3f& wi, float& pdf) const = 0;
+
+  // sampleで方向wiが選ばれるpdfを返す
+  virtual float pdf(const Vec3f& wo, const Vec3f& wi) const = 0;
+
+  // デルタ関数で表されるBSDFかどうか
+  // NOTE: デルタ関数のBSDFでは光源サンプリングを行わない
+  virtual bool isDelta() const = 0;
+
+  // 反射率(デノイザーのガイドに使うAOV)
+  virtual Vec3f albedo(const TexCoord& tc) const = 0;
+
+  // 内部の屈折率(屈折しないBSDFは1)
+  // NOTE: 光源から光を追跡する場合に, 屈折による補正に使う
+  virtual float getIOR() const { return 1.0f; }
 };
 
 // Lambert BRDF
-class Lambert : public BSDF {
+// textureを指定した場合は反射率にテクスチャの値を掛ける
+class Lambert final : public BSDF {
  private:
   const Vec3f rho;
+  const std::shared_ptr<ImageTexture> texture;
+
+  Vec3f rhoAt(const TexCoord& tc) const {
+    return texture ? rho * texture->lookup(tc) : rho;
+  }
 
  public:
-  Lambert(const Vec3f& rho) : rho(rho) {}
+  Lambert(const Vec3f& rho,
+          const std::shared_ptr<ImageTexture>& texture = nullptr)
+      : rho(rho), texture(texture) {}
+
+  // NOTE: sampleは接空間の上側の半球だけをサンプリングするので,
+  // evalとpdfもそれに合わせて上側の半球だけで値を持つようにしている
+  Vec3f eval(const TexCoord& tc, const Vec3f& wo,
+             const Vec3f& wi) const override {
+    if (cosTheta(wi) <= 0) return Vec3f(0);
+    return rhoAt(tc) * PI_INV;
+  }
 
-  Vec3f eval(const Vec3f& wo, const Vec3f& wi) const override {
-    return rho * PI_INV;
+  Vec3f sample(const TexCoord& tc, Sampler& sampler, const Vec3f& wo,
+               Vec3f& wi, float& pdf) const override {
+    wi = sampleCosineHemisphere(sampler.getNext(), sampler.getNext(), pdf);
+    return rhoAt(tc) * PI_INV;
   }
 
-  Vec3f sample(RNG& rng, const Vec3f& wo, Vec3f& wi,
-               float& pdf) const override {
-    wi = sampleCosineHemisphere(rng.getNext(), rng.getNext(), pdf);
-    return rho * PI_INV;
+  float pdf(const Vec3f& wo, const Vec3f& wi) const override {
+    return std::max(cosTheta(wi), 0.0f) * PI_INV;
   }
+
+  bool isDelta() const override { return false; }
+
+  Vec3f albedo(const TexCoord& tc) const override { return rhoAt(tc); }
 };
 
-class Mirror : public BSDF {
+class Mirror final : public BSDF {
  private:
   const Vec3f rho;  // 反射率
 
  public:
   Mirror(const Vec3f& rho) : rho(rho) {}
 
-  Vec3f eval(const Vec3f& wo, const Vec3f& wi) const override {
+  Vec3f eval(const TexCoord& tc, const Vec3f& wo,
+             const Vec3f& wi) const override {
     return Vec3f(0);
   }
 
-  Vec3f sample(RNG& rng, const Vec3f& wo, Vec3f& wi,
-               float& pdf) const override {
+  Vec3f sample(const TexCoord& tc, Sampler& sampler, const Vec3f& wo,
+               Vec3f& wi, float& pdf) const override {
     wi = reflect(wo, Vec3f(0, 1, 0));
     pdf = 1;
     return rho / absCosTheta(wi);
   }
+
+  float pdf(const Vec3f& wo, const Vec3f& wi) const override { return 0; }
+
+  bool isDelta() const override { return true; }
+
+  Vec3f albedo(const TexCoord& tc) const override { return rho; }
 };
 
-class Glass : public BSDF {
+class Glass final : public BSDF {
  private:
   const Vec3f rho;  // 反射率
   const float ior;  // 屈折率
@@ -71,12 +119,13 @@ class Glass : public BSDF {
  public:
   Glass(const Vec3f& rho, float ior) : rho(rho), ior(ior) {}
 
-  Vec3f eval(const Vec3f& wo, const Vec3f& wi) const override {
+  Vec3f eval(const TexCoord& tc, const Vec3f& wo,
+             const Vec3f& wi) const override {
     return Vec3f(0);
   }
 
-  Vec3f sample(RNG& rng, const Vec3f& wo, Vec3f& wi,
-               float& pdf) const override {
+  Vec3f sample(const TexCoord& tc, Sampler& sampler, const Vec3f& wo,
+               Vec3f& wi, float& pdf) const override {
     // 物体外部 or 内部に応じて適切なパラメーターを設定
     float ior1, ior2;
     Vec3f n;
@@ -94,7 +143,7 @@ class Glass : public BSDF {
     const float fr = fresnel(wo, n, ior1, ior2);
 
     // 反射の場合
-    if (rng.getNext() < fr) {
+    if (sampler.getNext() < fr) {
       wi = reflect(wo, n);
       pdf = 1;
       return rho / absCosTheta(wi);
@@ -115,6 +164,55 @@ class Glass : public BSDF {
       }
     }
   }
+
+  float pdf(const Vec3f& wo, const Vec3f& wi) const override { return 0; }
+
+  bool isDelta() const override { return true; }
+
+  Vec3f albedo(const TexCoord& tc) const override { return rho; }
+
+  float getIOR() const override { return ior; }
+};
+
+// 仮想関数を介さずにBSDFの関数を呼ぶための参照
+// Lambert, Mirror, Glassはswitchで分岐し, それ以外は仮想関数で呼ぶ
+class BSDFRef {
+ private:
+  VariantRef<BSDF, Lambert, Mirror, Glass> ref;
+
+ public:
+  BSDFRef() {}
+  BSDFRef(const BSDF* bsdf) : ref(bsdf) {}
+
+  // 参照しているBSDF
+  const BSDF* get() const { return ref.get(); }
+
+  Vec3f eval(const TexCoord& tc, const Vec3f& wo, const Vec3f& wi) const {
+    return ref.visit([&](const auto& bsdf) { return bsdf.eval(tc, wo, wi); });
+  }
+
+  Vec3f sample(const TexCoord& tc, Sampler& sampler, const Vec3f& wo,
+               Vec3f& wi, float& pdf) const {
+    return ref.visit([&](const auto& bsdf) {
+      return bsdf.sample(tc, sampler, wo, wi, pdf);
+    });
+  }
+
+  float pdf(const Vec3f& wo, const Vec3f& wi) const {
+    return ref.visit([&](const auto& bsdf) { return bsdf.pdf(wo, wi); });
+  }
+
+  bool isDelta() const {
+    return ref.visit([&](const auto& bsdf) { return bsdf.isDelta(); });
+  }
+
+  Vec3f albedo(const TexCoord& tc) const {
+    return ref.visit([&](const auto& bsdf) { return bsdf.albedo(tc); });
+  }
+
+  float getIOR() const {
+    return ref.visit([&](const auto& bsdf) { return bsdf.getIOR(); });
+  }
 };
 
 #endif
\ No newline at end of file
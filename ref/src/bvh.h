@@ -0,0 +1,317 @@
+#ifndef _BVH_H
+#define _BVH_H
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "aabb.h"
+#include "binary-io.h"
+#include "ray.h"
+#include "stats.h"
+
+// SAHで構築するBounding Volume Hierarchy
+// NOTE: 要素のAABBの配列から構築し, 要素との交差判定は呼び出し側が与える
+// SceneではPrimitive, TriangleMeshでは三角形を要素として使う
+class BVH {
+ private:
+  template <int N>
+  friend class WideBVH;  // 二分木からN分木への変換のため
+
+  // ノード(32 byte)
+  // NOTE: 内部ノードの左の子は常に直後に配置されるので右の子の番号だけ持つ
+  struct Node {
+    AABB bbox;             // ノードのAABB
+    uint32_t offset;       // 葉: primIndicesの開始位置, 内部: 右の子の番号
+    uint16_t nPrimitives;  // 葉に含まれるPrimitiveの数(内部ノードでは0)
+    uint16_t axis;         // 分割軸
+  };
+
+  // 構築時に使う各Primitiveの情報
+  struct BuildPrimitive {
+    AABB bbox;
+    Vec3f centroid;
+    uint32_t index;
+  };
+
+  static constexpr int nBuckets = 16;           // SAHのビンの数
+  static constexpr int maxPrimsInLeaf = 4;      // 葉に含めるPrimitiveの最大数
+  static constexpr float costTraversal = 1.0f;  // ノード走査のコスト
+  static constexpr float costIntersect = 1.0f;  // 交差判定のコスト
+
+  bool built = false;
+  std::vector<uint32_t> primIndices;  // 葉から参照される要素の番号
+  std::vector<Node> nodes;            // 深さ優先順に並べたノード
+
+  // [start, end)のPrimitiveからノードを再帰的に構築し, ノード番号を返す
+  uint32_t buildNode(std::vector<BuildPrimitive>& buildPrims, int start,
+                     int end) {
+    const uint32_t nodeIdx = nodes.size();
+    nodes.emplace_back();
+
+    AABB bbox, centroidBox;
+    for (int i = start; i < end; ++i) {
+      bbox = mergeAABB(bbox, buildPrims[i].bbox);
+      centroidBox = mergeAABB(centroidBox, buildPrims[i].centroid);
+    }
+    nodes[nodeIdx].bbox = bbox;
+
+    const int nPrims = end - start;
+    const int axis = centroidBox.longestAxis();
+
+    if (nPrims <= 1) {
+      return makeLeaf(nodeIdx, buildPrims, start, end);
+    }
+
+    // 重心が全て一致する場合はSAHで分割できないので数で半分に分ける
+    if (centroidBox[1][axis] == centroidBox[0][axis]) {
+      if (nPrims <= maxPrimsInLeaf) {
+        return makeLeaf(nodeIdx, buildPrims, start, end);
+      }
+      return makeInterior(nodeIdx, buildPrims, start, (start + end) / 2, end,
+                          axis);
+    }
+
+    // ビンに分けてSAHコストを計算する
+    AABB bucketBox[nBuckets];
+    int bucketCount[nBuckets] = {0};
+    const auto bucketOf = [&](const BuildPrimitive& p) {
+      const int b = nBuckets * centroidBox.offset(p.centroid)[axis];
+      return std::min(b, nBuckets - 1);
+    };
+    for (int i = start; i < end; ++i) {
+      const int b = bucketOf(buildPrims[i]);
+      bucketCount[b]++;
+      bucketBox[b] = mergeAABB(bucketBox[b], buildPrims[i].bbox);
+    }
+
+    // 右からの累積を先に計算し, 左から走査して各分割位置のコストを求める
+    float rightArea[nBuckets];
+    int rightCount[nBuckets];
+    AABB acc;
+    int count = 0;
+    for (int b = nBuckets - 1; b > 0; --b) {
+      acc = mergeAABB(acc, bucketBox[b]);
+      count += bucketCount[b];
+      rightArea[b] = acc.surfaceArea();
+      rightCount[b] = count;
+    }
+
+    float minCost = std::numeric_limits<float>::max();
+    int minBucket = -1;
+    acc = AABB();
+    count = 0;
+    for (int b = 0; b < nBuckets - 1; ++b) {
+      acc = mergeAABB(acc, bucketBox[b]);
+      count += bucketCount[b];
+      if (count == 0 || rightCount[b + 1] == 0) continue;
+      const float cost = count * acc.surfaceArea() +
+                         rightCount[b + 1] * rightArea[b + 1];
+      if (cost < minCost) {
+        minCost = cost;
+        minBucket = b;
+      }
+    }
+
+    // 分割しない方が安い場合は葉にする
+    const float leafCost = costIntersect * nPrims;
+    minCost = costTraversal + costIntersect * minCost / bbox.surfaceArea();
+    if (minBucket == -1 ||
+        (nPrims <= maxPrimsInLeaf && leafCost <= minCost)) {
+      return makeLeaf(nodeIdx, buildPrims, start, end);
+    }
+
+    const auto midIter = std::partition(
+        buildPrims.begin() + start, buildPrims.begin() + end,
+        [&](const BuildPrimitive& p) { return bucketOf(p) <= minBucket; });
+    const int mid = midIter - buildPrims.begin();
+
+    return makeInterior(nodeIdx, buildPrims, start, mid, end, axis);
+  }
+
+  uint32_t makeInterior(uint32_t nodeIdx,
+                        std::vector<BuildPrimitive>& buildPrims, int start,
+                        int mid, int end, int axis) {
+    buildNode(buildPrims, start, mid);
+    const uint32_t rightIdx = buildNode(buildPrims, mid, end);
+
+    // NOTE: emplace_backでnodesが再確保されるので参照は取らずに番号で書き込む
+    nodes[nodeIdx].offset = rightIdx;
+    nodes[nodeIdx].nPrimitives = 0;
+    nodes[nodeIdx].axis = axis;
+    return nodeIdx;
+  }
+
+  uint32_t makeLeaf(uint32_t nodeIdx,
+                    const std::vector<BuildPrimitive>& buildPrims, int start,
+                    int end) {
+    nodes[nodeIdx].offset = primIndices.size();
+    nodes[nodeIdx].nPrimitives = end - start;
+    nodes[nodeIdx].axis = 0;
+    for (int i = start; i < end; ++i) {
+      primIndices.push_back(buildPrims[i].index);
+    }
+    return nodeIdx;
+  }
+
+ public:
+  BVH() {}
+
+  // 各要素のAABBからBVHを構築する
+  void build(const std::vector<AABB>& primBounds) {
+    built = true;
+    primIndices.clear();
+    nodes.clear();
+    if (primBounds.empty()) return;
+
+    std::vector<BuildPrimitive> buildPrims(primBounds.size());
+    for (uint32_t i = 0; i < primBounds.size(); ++i) {
+      buildPrims[i].bbox = primBounds[i];
+      buildPrims[i].centroid = primBounds[i].center();
+      buildPrims[i].index = i;
+    }
+
+    primIndices.reserve(primBounds.size());
+    nodes.reserve(2 * primBounds.size());
+    buildNode(buildPrims, 0, buildPrims.size());
+  }
+
+  bool isBuilt() const { return built; }
+
+  int nNodes() const { return nodes.size(); }
+
+  // 構築済みのBVHを書き出す(シーンのキャッシュ用)
+  void write(binary_io::Writer& writer) const {
+    writer.write<uint8_t>(built);
+    writer.writeArray(nodes);
+    writer.writeArray(primIndices);
+  }
+
+  // writeで書き出したBVHを読み込む
+  bool read(binary_io::Reader& reader) {
+    uint8_t b;
+    if (!reader.read(b) || !reader.readArray(nodes) ||
+        !reader.readArray(primIndices)) {
+      return false;
+    }
+    built = b;
+    return true;
+  }
+
+  // 全体のAABB
+  AABB getBounds() const { return nodes.empty() ? AABB() : nodes[0].bbox; }
+
+  // 木の構造はそのままで, 要素のAABBが変わった後のノードのAABBを更新する
+  // NOTE: 子は常に親より後ろに配置されているので, 後ろから順に更新する
+  void refit(const std::vector<AABB>& primBounds) {
+    for (int i = int(nodes.size()) - 1; i >= 0; --i) {
+      Node& node = nodes[i];
+      if (node.nPrimitives > 0) {
+        AABB bbox;
+        for (int k = 0; k < node.nPrimitives; ++k) {
+          bbox = mergeAABB(bbox, primBounds[primIndices[node.offset + k]]);
+        }
+        node.bbox = bbox;
+      } else {
+        node.bbox = mergeAABB(nodes[i + 1].bbox, nodes[node.offset].bbox);
+      }
+    }
+  }
+
+  // 木全体のSAHコスト(根の表面積あたり)
+  // refitで木の品質がどれだけ悪くなったかの指標に使う
+  float sahCost() const {
+    if (nodes.empty()) return 0;
+    float cost = 0;
+    for (const auto& node : nodes) {
+      cost += node.bbox.surfaceArea() *
+              (node.nPrimitives > 0 ? costIntersect * node.nPrimitives
+                                    : costTraversal);
+    }
+    return cost / std::max(nodes[0].bbox.surfaceArea(), 1e-20f);
+  }
+
+  // 最も近い交差点を求める
+  // intersectPrim(index, tmax)は要素indexとの交差判定を行い,
+  // tmaxより近くで交差した場合にtmaxを更新してtrueを返す
+  template <typename F>
+  bool intersect(const Ray& ray, float tmax, F&& intersectPrim) const {
+    if (nodes.empty()) return false;
+
+    const Vec3f invDir = 1.0f / ray.direction;
+    const int dirIsNeg[3] = {invDir[0] < 0, invDir[1] < 0, invDir[2] < 0};
+
+    bool hit = false;
+
+    uint32_t stack[64];
+    int stackSize = 0;
+    uint32_t current = 0;
+    while (true) {
+      STATS_INC(BVHNodeVisits);
+      const Node& node = nodes[current];
+      if (node.bbox.intersect(ray, invDir, dirIsNeg, tmax)) {
+        if (node.nPrimitives > 0) {
+          // 葉の場合は含まれる要素と交差判定
+          for (int i = 0; i < node.nPrimitives; ++i) {
+            if (intersectPrim(primIndices[node.offset + i], tmax)) {
+              hit = true;
+            }
+          }
+          if (stackSize == 0) break;
+          current = stack[--stackSize];
+        } else {
+          // レイの方向に応じて近い方の子から走査する
+          if (dirIsNeg[node.axis]) {
+            stack[stackSize++] = current + 1;
+            current = node.offset;
+          } else {
+            stack[stackSize++] = node.offset;
+            current = current + 1;
+          }
+        }
+      } else {
+        if (stackSize == 0) break;
+        current = stack[--stackSize];
+      }
+    }
+
+    return hit;
+  }
+
+  // (ray.tmin, tmax)内に交差点があるかを判定する
+  // occludedPrim(index)は要素indexと(ray.tmin, tmax)内で交差するかを返す
+  // NOTE: 最初に交差が見つかった時点で走査を終える
+  template <typename F>
+  bool occluded(const Ray& ray, float tmax, F&& occludedPrim) const {
+    if (nodes.empty()) return false;
+
+    const Vec3f invDir = 1.0f / ray.direction;
+    const int dirIsNeg[3] = {invDir[0] < 0, invDir[1] < 0, invDir[2] < 0};
+
+    uint32_t stack[64];
+    int stackSize = 0;
+    uint32_t current = 0;
+    while (true) {
+      STATS_INC(BVHNodeVisits);
+      const Node& node = nodes[current];
+      if (node.bbox.intersect(ray, invDir, dirIsNeg, tmax)) {
+        if (node.nPrimitives > 0) {
+          for (int i = 0; i < node.nPrimitives; ++i) {
+            if (occludedPrim(primIndices[node.offset + i])) return true;
+          }
+          if (stackSize == 0) break;
+          current = stack[--stackSize];
+        } else {
+          stack[stackSize++] = node.offset;
+          current = current + 1;
+        }
+      } else {
+        if (stackSize == 0) break;
+        current = stack[--stackSize];
+      }
+    }
+
+    return false;
+  }
+};
+
+#endif
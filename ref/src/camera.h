@@ -11,10 +11,8 @@ class Camera {
   Vec3f camUp;       // カメラの上方向
 
  public:
-  Camera(const Vec3f& camPos, const Vec3f& camForward)
-      : camPos(camPos), camForward(camForward) {
-    camRight = normalize(cross(camForward, Vec3f(0, 1, 0)));
-    camUp = normalize(cross(camRight, camForward));
+  Camera(const Vec3f& camPos, const Vec3f& camForward) {
+    setPose(camPos, camForward);
 
     std::cout << "[Camera] camPos: " << camPos << std::endl;
     std::cout << "[Camera] camForward: " << camForward << std::endl;
@@ -22,7 +20,19 @@ class Camera {
     std::cout << "[Camera] camUp: " << camUp << std::endl;
   }
 
+  // カメラの位置と向きを変更する(アニメーション用)
+  void setPose(const Vec3f& camPos, const Vec3f& camForward) {
+    this->camPos = camPos;
+    this->camForward = camForward;
+    camRight = normalize(cross(camForward, Vec3f(0, 1, 0)));
+    camUp = normalize(cross(camRight, camForward));
+  }
+
   virtual Ray sampleRay(float u, float v) const = 0;
+
+  // 画像面上の大きさpixelSizeの画素を通るレイの広がり[rad]
+  // (レイのコーンの初期値)
+  virtual float pixelSpread(float pixelSize) const { return 0; }
 };
 
 class PinholeCamera : public Camera {
@@ -40,6 +50,8 @@ class PinholeCamera : public Camera {
     const Vec3f P = camPos + f * camForward;  // ピンホールの位置
     return Ray(I, normalize(P - I));
   }
+
+  float pixelSpread(float pixelSize) const override { return pixelSize / f; }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,46 @@
+#ifndef _CHECKPOINT_H
+#define _CHECKPOINT_H
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "image.h"
+
+// レンダリングの途中経過をバックグラウンドのスレッドで書き出す
+// NOTE: 一時ファイルに書いてからrenameするので, 書き込み中に
+// プロセスが終了しても前回の途中経過は壊れない
+class CheckpointWriter {
+ private:
+  std::thread thread;
+
+ public:
+  CheckpointWriter() = default;
+  ~CheckpointWriter() { wait(); }
+
+  CheckpointWriter(const CheckpointWriter&) = delete;
+  CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+  // bufferをfilenameに書き出し始める
+  // NOTE: 前回の書き出しが終わっていなければ終わるまで待つ
+  void write(const std::string& filename, std::vector<char>&& buffer) {
+    wait();
+    thread = std::thread([filename, buffer = std::move(buffer)]() {
+      const std::string tmp = filename + ".tmp";
+      if (!image_io::writeFile(tmp, buffer)) return;
+      if (std::rename(tmp.c_str(), filename.c_str()) != 0) {
+        std::cerr << "failed to rename " << tmp << " to " << filename
+                  << std::endl;
+      }
+    });
+  }
+
+  // 書き出しが終わるまで待つ
+  void wait() {
+    if (thread.joinable()) thread.join();
+  }
+};
+
+#endif
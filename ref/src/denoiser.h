@@ -0,0 +1,230 @@
+#ifndef _DENOISER_H
+#define _DENOISER_H
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "accumulation-buffer.h"
+#include "aov.h"
+#include "image.h"
+#include "vec3.h"
+
+// デノイザーの設定
+struct DenoiseSettings {
+  int iterations = 5;           // 反復回数(i回目は2^i画素おきの5x5カーネル)
+  float sigmaLuminance = 4.0f;  // 輝度の差の許容幅(標準偏差の何倍か)
+  float sigmaNormal = 128.0f;   // 法線の重みexp(-sigmaNormal * (1 - 内積))
+  float sigmaDepth = 1.0f;      // 距離の差の許容幅(距離の勾配の何倍か)
+};
+
+// AOVをガイドにした エッジを保存するÀ-Trousフィルタ
+// Dammertz et al. 2010, "Edge-Avoiding À-Trous Wavelet Transform for fast
+// Global Illumination Filtering"
+// Schied et al. 2017, "Spatiotemporal Variance-Guided Filtering"
+// 色を反射率で割った照度をフィルタし, 最後に反射率を掛けて戻す.
+// 重みは法線の内積, 距離の差, 輝度の差(分散で正規化)から求める
+// NOTE: 画素を成分ごとの配列で持ち, 行ごとにカーネルの各要素について
+// 連続した画素を処理するので内側のループが自動ベクトル化される
+class ATrousDenoiser {
+ private:
+  DenoiseSettings settings;
+
+  // 反射率として割るのに使う値(0に近い場合は割らない)
+  static float safeAlbedo(float a) { return a > 1e-3f ? a : 1.0f; }
+
+ public:
+  ATrousDenoiser(const DenoiseSettings& settings = DenoiseSettings())
+      : settings(settings) {}
+
+  // colorをaovをガイドにしてデノイズした画像を返す
+  Image denoise(const Image& color, const AOVBuffer& aov) const {
+    const int width = color.getWidth();
+    const int height = color.getHeight();
+    const int n = width * height;
+
+    // 反射率で割った照度と分散
+    std::vector<float> albedo[3], irr[3];
+    for (int c = 0; c < 3; ++c) {
+      albedo[c].resize(n);
+      irr[c].resize(n);
+    }
+    std::vector<float> variance(n);
+#pragma omp parallel for
+    for (int j = 0; j < height; ++j) {
+      for (int i = 0; i < width; ++i) {
+        const int idx = i + width * j;
+        const Vec3f rgb = color.getPixel(i, j);
+        Vec3f a;
+        for (int c = 0; c < 3; ++c) {
+          a[c] = safeAlbedo(aov.getAlbedo(c)[idx]);
+          albedo[c][idx] = a[c];
+          irr[c][idx] = rgb[c] / a[c];
+        }
+        const float lum = luminance(a);
+        variance[idx] = aov.getVariance()[idx] / (lum * lum);
+      }
+    }
+
+    // 距離の画面上での勾配(隣の画素との差)
+    const std::vector<float>& depth = aov.getDepth();
+    std::vector<float> depthGradX(n), depthGradY(n);
+#pragma omp parallel for
+    for (int j = 0; j < height; ++j) {
+      for (int i = 0; i < width; ++i) {
+        const int idx = i + width * j;
+        const int x0 = std::max(i - 1, 0), x1 = std::min(i + 1, width - 1);
+        const int y0 = std::max(j - 1, 0), y1 = std::min(j + 1, height - 1);
+        depthGradX[idx] = settings.sigmaDepth *
+                          std::abs(depth[x1 + width * j] -
+                                   depth[x0 + width * j]) /
+                          std::max(x1 - x0, 1);
+        depthGradY[idx] = settings.sigmaDepth *
+                          std::abs(depth[i + width * y1] -
+                                   depth[i + width * y0]) /
+                          std::max(y1 - y0, 1);
+      }
+    }
+
+    const float* nx = aov.getNormal(0).data();
+    const float* ny = aov.getNormal(1).data();
+    const float* nz = aov.getNormal(2).data();
+    const float* z = depth.data();
+    const float* gx = depthGradX.data();
+    const float* gy = depthGradY.data();
+
+    // B3スプラインのカーネル
+    constexpr float kernel[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4,
+                                 1.0f / 16};
+    constexpr float log2e = 1.4426950408889634f;
+    const float sigmaNormal = settings.sigmaNormal;
+
+    std::vector<float> next[3], nextVariance(n), lum(n), invSigmaLum(n);
+    for (int c = 0; c < 3; ++c) {
+      next[c].resize(n);
+    }
+
+    for (int it = 0; it < settings.iterations; ++it) {
+      const int step = 1 << it;
+
+      // 輝度と, 3x3のガウシアンでぼかした分散から求めた輝度の許容幅
+#pragma omp parallel for
+      for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+          const int idx = i + width * j;
+          lum[idx] = luminance(
+              Vec3f(irr[0][idx], irr[1][idx], irr[2][idx]));
+
+          float v = 0, wSum = 0;
+          for (int y = std::max(j - 1, 0); y <= std::min(j + 1, height - 1);
+               ++y) {
+            for (int x = std::max(i - 1, 0); x <= std::min(i + 1, width - 1);
+                 ++x) {
+              const float w = (x == i ? 2 : 1) * (y == j ? 2 : 1);
+              v += w * variance[x + width * y];
+              wSum += w;
+            }
+          }
+          invSigmaLum[idx] =
+              log2e / (settings.sigmaLuminance * std::sqrt(v / wSum) + 1e-4f);
+        }
+      }
+
+#pragma omp parallel
+      {
+        // 行ごとの重み付き和
+        std::vector<float> sum[3], sumW(width), sumW2V(width);
+        for (int c = 0; c < 3; ++c) {
+          sum[c].resize(width);
+        }
+
+#pragma omp for
+        for (int j = 0; j < height; ++j) {
+          for (int c = 0; c < 3; ++c) {
+            std::fill(sum[c].begin(), sum[c].end(), 0);
+          }
+          std::fill(sumW.begin(), sumW.end(), 0);
+          std::fill(sumW2V.begin(), sumW2V.end(), 0);
+
+          for (int ky = -2; ky <= 2; ++ky) {
+            const int qy = j + ky * step;
+            if (qy < 0 || qy >= height) continue;
+
+            for (int kx = -2; kx <= 2; ++kx) {
+              const int dx = kx * step;
+              const float h = kernel[kx + 2] * kernel[ky + 2];
+              const float distX = std::abs(dx);
+              const float distY = std::abs(ky * step);
+
+              // 画像内に収まる範囲だけ処理する
+              const int x0 = std::max(0, -dx);
+              const int x1 = std::min(width, width - dx);
+              const int rowP = width * j;
+              const int rowQ = width * qy + dx;
+#pragma omp simd
+              for (int x = x0; x < x1; ++x) {
+                const int p = rowP + x;
+                const int q = rowQ + x;
+
+                // NOTE: 空の画素は法線が0なので, 長さの2乗が0のもの同士は
+                // 内積を1, 片方だけの場合は0として扱う
+                const float np2 = nx[p] * nx[p] + ny[p] * ny[p] + nz[p] * nz[p];
+                const float nq2 = nx[q] * nx[q] + ny[q] * ny[q] + nz[q] * nz[q];
+                const float nDot = nx[p] * nx[q] + ny[p] * ny[q] +
+                                   nz[p] * nz[q] + (1 - np2) * (1 - nq2);
+                const float eNormal = sigmaNormal * (1 - nDot);
+
+                const float eDepth =
+                    std::abs(z[p] - z[q]) /
+                    (gx[p] * distX + gy[p] * distY + 1e-3f);
+                const float eLum = std::abs(lum[p] - lum[q]) * invSigmaLum[p];
+
+                // NOTE: fastExp2の範囲に収まるように下限を-126にする.
+                // std::maxを使うと自動ベクトル化されないのでabsで求める
+                const float e0 = -log2e * (eNormal + eDepth) - eLum;
+                const float e = 0.5f * (e0 - 126.0f + std::abs(e0 + 126.0f));
+                const float w = h * image_io::fastExp2(e);
+
+                sumW[x] += w;
+                sumW2V[x] += w * w * variance[q];
+                sum[0][x] += w * irr[0][q];
+                sum[1][x] += w * irr[1][q];
+                sum[2][x] += w * irr[2][q];
+              }
+            }
+          }
+
+          for (int x = 0; x < width; ++x) {
+            const int p = width * j + x;
+            const float invW = 1.0f / sumW[x];
+            for (int c = 0; c < 3; ++c) {
+              next[c][p] = sum[c][x] * invW;
+            }
+            nextVariance[p] = sumW2V[x] * invW * invW;
+          }
+        }
+      }
+
+      for (int c = 0; c < 3; ++c) {
+        std::swap(irr[c], next[c]);
+      }
+      std::swap(variance, nextVariance);
+    }
+
+    // 反射率を掛けて戻す
+    Image result(width, height);
+#pragma omp parallel for
+    for (int j = 0; j < height; ++j) {
+      for (int i = 0; i < width; ++i) {
+        const int idx = i + width * j;
+        result.setPixel(i, j,
+                        Vec3f(irr[0][idx] * albedo[0][idx],
+                              irr[1][idx] * albedo[1][idx],
+                              irr[2][idx] * albedo[2][idx]));
+      }
+    }
+    return result;
+  }
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef _DISPATCH_H
+#define _DISPATCH_H
+#include <tuple>
+#include <typeinfo>
+
+// 基底クラスBaseへの参照を, 派生クラスの閉じた集合Ts...のいずれかとして
+// 保持するタグ付きポインタ
+// visitはタグで分岐してfを具体的な型で呼ぶので, Tsがfinalであれば
+// 仮想関数呼び出しを介さずにインライン展開できる
+// NOTE: Tsに含まれない型はBaseとして渡し, 通常の仮想関数呼び出しで扱う
+template <typename Base, typename... Ts>
+class VariantRef {
+ private:
+  static constexpr int nTypes = sizeof...(Ts);
+
+  const Base* ptr = nullptr;
+  int tag = nTypes;  // Tsでの番号(含まれない場合はnTypes)
+
+  // ptrの動的な型と一致するTsの番号を返す
+  template <int I = 0>
+  static int findTag(const Base* p) {
+    if constexpr (I == nTypes) {
+      return nTypes;
+    } else {
+      using T = std::tuple_element_t<I, std::tuple<Ts...>>;
+      // NOTE: Tの派生クラスを誤ってTとして扱わないように型が完全に一致する
+      // 場合だけ選ぶ
+      if (typeid(*p) == typeid(T)) return I;
+      return findTag<I + 1>(p);
+    }
+  }
+
+  template <int I, typename F>
+  decltype(auto) visitFrom(F& f) const {
+    if constexpr (I == nTypes) {
+      return f(*ptr);
+    } else {
+      using T = std::tuple_element_t<I, std::tuple<Ts...>>;
+      if (tag == I) return f(static_cast<const T&>(*ptr));
+      return visitFrom<I + 1>(f);
+    }
+  }
+
+ public:
+  VariantRef() {}
+  VariantRef(const Base* ptr) : ptr(ptr), tag(ptr ? findTag(ptr) : nTypes) {}
+
+  const Base* get() const { return ptr; }
+
+  // 具体的な型の参照でf(obj)を呼ぶ
+  // NOTE: fは全ての型で同じ型の値を返す必要がある
+  template <typename F>
+  decltype(auto) visit(F&& f) const {
+    return visitFrom<0>(f);
+  }
+};
+
+#endif
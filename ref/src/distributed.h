@@ -0,0 +1,114 @@
+#ifndef _DISTRIBUTED_H
+#define _DISTRIBUTED_H
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "accumulation-buffer.h"
+#include "binary-io.h"
+#include "image.h"
+#include "mesh-loader.h"
+
+// 複数のプロセス(マシン)で1枚の画像を分担するレンダリング
+// コーディネーターが画像をn個の範囲に分け, 各ワーカーが自分の範囲を
+// レンダリングして蓄積バッファを部分結果のファイルに書き出す.
+// コーディネーターは全ての部分結果をmergeして最終的な画像を作る
+// NOTE: 蓄積バッファは整数で和を持つので, 分け方によらず結果は同じになる
+
+// 1つのワーカーが担当する画素 [x0, x1) x [y0, y1) とサンプル番号
+// [sampleBegin, sampleEnd)
+struct RenderRange {
+  int x0, y0;
+  int x1, y1;
+  int sampleBegin, sampleEnd;
+};
+
+// 画像の分け方
+enum class SplitMode {
+  Tiles,    // タイルの行ごとに分ける
+  Samples,  // 全ての画素のサンプル番号の範囲を分ける
+};
+
+// n個に分けたk番目の範囲を返す
+// NOTE: Tilesではタイルの境界で分けるので, タイルの行数がnより少ないと
+// 空の範囲ができる
+inline RenderRange splitRenderRange(SplitMode mode, int k, int n, int width,
+                                    int height, int samples,
+                                    int tileSize = 16) {
+  RenderRange range = {0, 0, width, height, 0, samples};
+  if (mode == SplitMode::Tiles) {
+    const int nRows = (height + tileSize - 1) / tileSize;
+    range.y0 = std::min(int64_t(nRows) * k / n * tileSize, int64_t(height));
+    range.y1 =
+        std::min(int64_t(nRows) * (k + 1) / n * tileSize, int64_t(height));
+  } else {
+    range.sampleBegin = int64_t(samples) * k / n;
+    range.sampleEnd = int64_t(samples) * (k + 1) / n;
+  }
+  return range;
+}
+
+// 範囲に含まれる(画素, サンプル番号)の組の数
+inline int64_t rangeVolume(const RenderRange& r) {
+  if (r.x1 <= r.x0 || r.y1 <= r.y0 || r.sampleEnd <= r.sampleBegin) return 0;
+  return int64_t(r.x1 - r.x0) * (r.y1 - r.y0) * (r.sampleEnd - r.sampleBegin);
+}
+
+// 2つの範囲が同じ(画素, サンプル番号)の組を含むか
+inline bool rangesOverlap(const RenderRange& a, const RenderRange& b) {
+  return std::max(a.x0, b.x0) < std::min(a.x1, b.x1) &&
+         std::max(a.y0, b.y0) < std::min(a.y1, b.y1) &&
+         std::max(a.sampleBegin, b.sampleBegin) <
+             std::min(a.sampleEnd, b.sampleEnd);
+}
+
+// 範囲rが全体(width x height画素, samples個のサンプル番号)の中にあるか
+inline bool rangeInside(const RenderRange& r, int width, int height,
+                        int samples) {
+  return r.x0 >= 0 && r.y0 >= 0 && r.x1 <= width && r.y1 <= height &&
+         r.sampleBegin >= 0 && r.sampleEnd <= samples;
+}
+
+// 部分結果のファイルの形式の版(形式を変えたら上げる)
+constexpr uint32_t partialVersion = 1;
+
+struct PartialHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  RenderRange range;
+};
+
+// ワーカーの蓄積バッファを部分結果のファイルに書き出す
+inline bool writePartial(const std::string& filename,
+                         const RenderRange& range,
+                         const AccumulationBuffer& accumulation) {
+  binary_io::Writer writer;
+  writer.write(PartialHeader{
+      {'P', 'B', 'R', 'P', 'A', 'R', 'T', '\0'}, partialVersion, 0, range});
+  accumulation.write(writer);
+  return image_io::writeFile(filename, writer.getBuffer());
+}
+
+// 部分結果のファイルを読み込む
+inline bool readPartial(const std::string& filename, RenderRange& range,
+                        AccumulationBuffer& accumulation) {
+  MappedFile file(filename);
+  if (!file.isOpen()) {
+    std::cerr << "failed to open " << filename << std::endl;
+    return false;
+  }
+  binary_io::Reader reader(file.getData(), file.getSize());
+
+  PartialHeader header;
+  if (!reader.read(header) || std::string(header.magic, 7) != "PBRPART" ||
+      header.version != partialVersion || !accumulation.read(reader)) {
+    std::cerr << "failed to read " << filename << std::endl;
+    return false;
+  }
+  range = header.range;
+  return true;
+}
+
+#endif
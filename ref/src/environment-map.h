@@ -0,0 +1,125 @@
+#ifndef _ENVIRONMENT_MAP_H
+#define _ENVIRONMENT_MAP_H
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "accumulation-buffer.h"
+#include "constant.h"
+#include "image.h"
+#include "sampling.h"
+#include "vec3.h"
+
+// 緯度経度形式のHDR環境マップ
+// 画像の上端が+y方向(天頂), 横方向が+yまわりの方位角phiに対応する
+// NOTE: 放射輝度は画素ごとに一定とし, 輝度 x sin(theta)に比例する
+// 2次元の分布(行の周辺分布と行ごとの条件付き分布のエイリアステーブル)で
+// 方向を重点的にサンプリングする
+class EnvironmentMap {
+ public:
+  // rgbは上の行から順に並べた線形のRGB
+  EnvironmentMap(int width, int height, std::vector<float> rgb)
+      : width(width), height(height), rgb(std::move(rgb)) {
+    std::vector<float> rowWeights(height);
+    std::vector<float> weights(width);
+    for (int j = 0; j < height; ++j) {
+      const float sinTheta = std::sin(PI * (j + 0.5f) / height);
+      float sum = 0;
+      for (int i = 0; i < width; ++i) {
+        weights[i] = std::max(luminance(texel(i, j)), 0.0f) * sinTheta;
+        sum += weights[i];
+      }
+      rows.emplace_back(weights);
+      rowWeights[j] = sum;
+    }
+    marginal = AliasTable(rowWeights);
+  }
+
+  // PFM, Radiance HDR画像を読み込む(失敗した場合はnullptr)
+  static std::shared_ptr<EnvironmentMap> load(const std::string& filename) {
+    const auto ext = filename.substr(filename.find_last_of('.') + 1);
+    int width, height;
+    std::vector<float> rgb;
+    bool loaded;
+    if (ext == "pfm" || ext == "PFM") {
+      loaded = image_io::readPFM(filename, width, height, rgb);
+    } else if (ext == "hdr" || ext == "HDR") {
+      loaded = image_io::readHDR(filename, width, height, rgb);
+    } else {
+      std::cerr << "unsupported environment map format: " << filename
+                << std::endl;
+      return nullptr;
+    }
+    if (!loaded) return nullptr;
+    return std::make_shared<EnvironmentMap>(width, height, std::move(rgb));
+  }
+
+  int getWidth() const { return width; }
+  int getHeight() const { return height; }
+
+  // 方向dirから来る放射輝度
+  Vec3f Le(const Vec3f& dir) const {
+    int i, j;
+    toPixel(dir, i, j);
+    return texel(i, j);
+  }
+
+  // 方向wiをサンプリングし, その放射輝度を返す
+  // pdfに立体角測度のpdfを返す
+  Vec3f sample(float u, float v, Vec3f& wi, float& pdf) const {
+    float rowPmf, colPmf, du, dv;
+    const int j = marginal.sample(u, rowPmf, dv);
+    const int i = rows[j].sample(v, colPmf, du);
+
+    // 画素内で一様に選ぶ
+    const float phi = 2 * PI * (i + du) / width;
+    const float theta = PI * (j + dv) / height;
+    const float sinTheta = std::sin(theta);
+    wi = Vec3f(sinTheta * std::cos(phi), std::cos(theta),
+               sinTheta * std::sin(phi));
+    pdf = toSolidAngle(rowPmf * colPmf, sinTheta);
+    return texel(i, j);
+  }
+
+  // sampleで方向dirが選ばれるpdf
+  float pdf(const Vec3f& dir) const {
+    int i, j;
+    toPixel(dir, i, j);
+    const float sinTheta =
+        std::sqrt(std::max(1 - dir[1] * dir[1], 0.0f));
+    return toSolidAngle(marginal.pmf(j) * rows[j].pmf(i), sinTheta);
+  }
+
+ private:
+  int width;
+  int height;
+  std::vector<float> rgb;
+  AliasTable marginal;          // 行の分布
+  std::vector<AliasTable> rows;  // 行ごとの画素の分布
+
+  Vec3f texel(int i, int j) const {
+    const float* p = &rgb[3 * (size_t(width) * j + i)];
+    return Vec3f(p[0], p[1], p[2]);
+  }
+
+  // 方向dirが含まれる画素
+  void toPixel(const Vec3f& dir, int& i, int& j) const {
+    float phi = std::atan2(dir[2], dir[0]);
+    if (phi < 0) phi += 2 * PI;
+    const float theta = std::acos(std::clamp(dir[1], -1.0f, 1.0f));
+    i = std::min(int(phi * PI_MUL_2_INV * width), width - 1);
+    j = std::min(int(theta * PI_INV * height), height - 1);
+  }
+
+  // 画素の確率pmfを立体角測度のpdfに変換する
+  // NOTE: 画素の立体角は(2pi / width)(pi / height)sin(theta)
+  float toSolidAngle(float pmf, float sinTheta) const {
+    if (sinTheta == 0) return 0;
+    return pmf * width * height / (2 * PI * PI * sinTheta);
+  }
+};
+
+#endif
@@ -1,37 +1,312 @@
 #ifndef _IMAGE_H
 #define _IMAGE_H
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <iostream>
+#include <sstream>
 #include <string>
+#include <vector>
 
 #include "vec3.h"
 
-class Image {
- private:
-  unsigned int width;   // 横の画素数
-  unsigned int height;  // 縦の画素数
-  float* pixels;        // 画素のRGB配列
+// 画像の入出力に使う補助関数
+namespace image_io {
 
- public:
-  Image(unsigned int width, unsigned int height)
-      : width(width), height(height) {
-    pixels = new float[3 * width * height];
+// exp2, log2の高速な近似(相対誤差1e-4程度)
+// fastapprox / (c) 2011 Paul Mineiro / BSD license
+// NOTE: 分岐を含まないのでループ内で自動ベクトル化される
+inline float fastLog2(float x) {
+  uint32_t i;
+  std::memcpy(&i, &x, sizeof(float));
+  const uint32_t mi = (i & 0x007fffff) | 0x3f000000;
+  float m;
+  std::memcpy(&m, &mi, sizeof(float));
+  return i * 1.1920928955078125e-7f - 124.22551499f - 1.498030302f * m -
+         1.72587999f / (0.3520887068f + m);
+}
 
-    // 0で初期化
-    for (int j = 0; j < height; ++j) {
-      for (int i = 0; i < width; ++i) {
-        const int idx = 3 * i + 3 * width * j;
-        pixels[idx] = 0;
-        pixels[idx + 1] = 0;
-        pixels[idx + 2] = 0;
+// NOTE: p >= -126の範囲でのみ有効
+inline float fastExp2(float p) {
+  const float offset = p < 0 ? 1.0f : 0.0f;
+  const float z = p - static_cast<int>(p) + offset;
+  const int32_t i = static_cast<int32_t>(
+      (1 << 23) * (p + 121.2740575f + 27.7280233f / (4.84252568f - z) -
+                   1.49012907f * z));
+  float y;
+  std::memcpy(&y, &i, sizeof(float));
+  return y;
+}
+
+// x^pの近似(x >= 0)
+inline float fastPow(float x, float p) {
+  // NOTE: 分岐にするとベクトル化されないので0か1を掛ける
+  const float y = fastExp2(p * fastLog2(x));
+  return y * (x > 0 ? 1.0f : 0.0f);
+}
+
+// バッファの末尾にリトルエンディアンで値を追加する
+// NOTE: ホストがリトルエンディアンであることを仮定している
+template <typename T>
+inline void append(std::vector<char>& buffer, const T& value) {
+  const char* p = reinterpret_cast<const char*>(&value);
+  buffer.insert(buffer.end(), p, p + sizeof(T));
+}
+
+inline void append(std::vector<char>& buffer, const std::string& str) {
+  buffer.insert(buffer.end(), str.begin(), str.end());
+}
+
+// ビッグエンディアンで32bit整数を追加する(PNG用)
+inline void appendBigEndian(std::vector<char>& buffer, uint32_t value) {
+  for (int k = 3; k >= 0; --k) {
+    buffer.push_back(static_cast<char>((value >> (8 * k)) & 0xff));
+  }
+}
+
+inline uint32_t crc32(const char* data, size_t size, uint32_t crc = 0) {
+  static const auto table = []() {
+    std::vector<uint32_t> t(256);
+    for (uint32_t n = 0; n < 256; ++n) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; ++k) {
+        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
       }
+      t[n] = c;
     }
+    return t;
+  }();
+
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i) {
+    crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
   }
-  ~Image() { delete[] pixels; }
+  return ~crc;
+}
+
+inline uint32_t adler32(const char* data, size_t size) {
+  // NOTE: 5552バイトまでは剰余を取らなくても32bitで溢れない
+  constexpr size_t blockSize = 5552;
+  uint32_t a = 1, b = 0;
+  for (size_t start = 0; start < size; start += blockSize) {
+    const size_t end = std::min(start + blockSize, size);
+    for (size_t i = start; i < end; ++i) {
+      a += static_cast<uint8_t>(data[i]);
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  return (b << 16) | a;
+}
+
+// PNGのチャンクを追加する
+inline void appendPNGChunk(std::vector<char>& buffer, const char* type,
+                           const std::vector<char>& data) {
+  appendBigEndian(buffer, data.size());
+  const size_t start = buffer.size();
+  buffer.insert(buffer.end(), type, type + 4);
+  buffer.insert(buffer.end(), data.begin(), data.end());
+  appendBigEndian(buffer,
+                  crc32(buffer.data() + start, buffer.size() - start));
+}
+
+// バッファを1回の書き込みでファイルに出力する
+inline bool writeFile(const std::string& filename,
+                      const std::vector<char>& buffer) {
+  std::ofstream file(filename, std::ios::binary);
+  if (!file) {
+    std::cerr << "failed to open " << filename << std::endl;
+    return false;
+  }
+  file.write(buffer.data(), buffer.size());
+  if (!file) {
+    std::cerr << "failed to write " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// ファイル全体をbufferに読み込む
+inline bool readFile(const std::string& filename, std::vector<char>& buffer) {
+  std::ifstream file(filename, std::ios::binary | std::ios::ate);
+  if (!file) {
+    std::cerr << "failed to open " << filename << std::endl;
+    return false;
+  }
+  buffer.resize(file.tellg());
+  file.seekg(0);
+  file.read(buffer.data(), buffer.size());
+  if (!file) {
+    std::cerr << "failed to read " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// PFM画像(PF, 3チャンネル)を読み込む
+// rgbには上の行から順にRGBを格納する
+inline bool readPFM(const std::string& filename, int& width, int& height,
+                    std::vector<float>& rgb) {
+  std::vector<char> buffer;
+  if (!readFile(filename, buffer)) return false;
+
+  // ヘッダーは空白で区切られた4つの値で, 直後の1文字の後から画素が続く
+  std::istringstream header(
+      std::string(buffer.data(), std::min<size_t>(buffer.size(), 256)));
+  std::string magic;
+  float scale;
+  if (!(header >> magic >> width >> height >> scale) || magic != "PF" ||
+      width <= 0 || height <= 0) {
+    std::cerr << "failed to read " << filename << " (expected PF)"
+              << std::endl;
+    return false;
+  }
+  const size_t start = size_t(header.tellg()) + 1;
+  const size_t rowSize = 3 * size_t(width) * sizeof(float);
+  if (start + rowSize * height > buffer.size()) {
+    std::cerr << "failed to read " << filename << " (truncated)" << std::endl;
+    return false;
+  }
+
+  // NOTE: scaleが負ならリトルエンディアン. PFMは下の行から順に格納する
+  rgb.resize(3 * size_t(width) * height);
+  for (int j = 0; j < height; ++j) {
+    std::memcpy(rgb.data() + 3 * size_t(width) * j,
+                buffer.data() + start + rowSize * (height - 1 - j), rowSize);
+  }
+  if (scale > 0) {
+    for (float& v : rgb) {
+      uint32_t i;
+      std::memcpy(&i, &v, 4);
+      i = __builtin_bswap32(i);
+      std::memcpy(&v, &i, 4);
+    }
+  }
+  return true;
+}
+
+// Radiance HDR画像(RGBE, -Y H +X W)を読み込む
+// 新しい形式のランレングス圧縮と, 圧縮しない形式に対応する
+// rgbには上の行から順にRGBを格納する
+inline bool readHDR(const std::string& filename, int& width, int& height,
+                    std::vector<float>& rgb) {
+  std::vector<char> buffer;
+  if (!readFile(filename, buffer)) return false;
+  const auto fail = [&](const char* message) {
+    std::cerr << "failed to read " << filename << " (" << message << ")"
+              << std::endl;
+    return false;
+  };
+
+  // ヘッダー: 空行までの設定と, 解像度の行
+  size_t p = 0;
+  const auto readLine = [&]() {
+    std::string line;
+    while (p < buffer.size() && buffer[p] != '\n') line += buffer[p++];
+    ++p;
+    return line;
+  };
+  const std::string magic = readLine();
+  if (magic.rfind("#?", 0) != 0) return fail("expected #?RADIANCE");
+  while (true) {
+    if (p >= buffer.size()) return fail("truncated header");
+    const std::string line = readLine();
+    if (line.empty()) break;
+    if (line.rfind("FORMAT=", 0) == 0 && line != "FORMAT=32-bit_rle_rgbe") {
+      return fail("unsupported format");
+    }
+  }
+  if (std::sscanf(readLine().c_str(), "-Y %d +X %d", &height, &width) != 2 ||
+      width <= 0 || height <= 0) {
+    return fail("unsupported orientation");
+  }
+
+  const auto data = [&](size_t i) { return uint8_t(buffer[p + i]); };
+  std::vector<uint8_t> scanline(4 * size_t(width));
+  rgb.resize(3 * size_t(width) * height);
+  for (int j = 0; j < height; ++j) {
+    if (p + 4 > buffer.size()) return fail("truncated");
+    const bool rle = width >= 8 && width < 32768 && data(0) == 2 &&
+                     data(1) == 2 && (data(2) << 8 | data(3)) == width;
+    if (rle) {
+      // 成分ごとに(個数, 値)の連続か(個数, 値の列)で格納されている
+      p += 4;
+      for (int c = 0; c < 4; ++c) {
+        int x = 0;
+        while (x < width) {
+          if (p >= buffer.size()) return fail("truncated");
+          int count = data(0);
+          ++p;
+          const bool run = count > 128;
+          if (run) count -= 128;
+          if (count == 0 || x + count > width ||
+              p + (run ? 1 : count) > buffer.size()) {
+            return fail("invalid run length");
+          }
+          for (int k = 0; k < count; ++k, ++x) {
+            scanline[4 * x + c] = data(run ? 0 : k);
+          }
+          p += run ? 1 : count;
+        }
+      }
+    } else {
+      if (p + scanline.size() > buffer.size()) return fail("truncated");
+      std::memcpy(scanline.data(), buffer.data() + p, scanline.size());
+      p += scanline.size();
+    }
+
+    // RGBE: 共通の指数eで(r, g, b) * 2^(e - 136)
+    for (int x = 0; x < width; ++x) {
+      const uint8_t* e = &scanline[4 * x];
+      const float f = e[3] == 0 ? 0.0f : std::ldexp(1.0f, int(e[3]) - 136);
+      for (int c = 0; c < 3; ++c) {
+        rgb[3 * (size_t(width) * j + x) + c] = e[c] * f;
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace image_io
+
+class Image {
+ private:
+  unsigned int width;         // 横の画素数
+  unsigned int height;        // 縦の画素数
+  std::vector<float> pixels;  // 画素のRGB配列
+
+  // 各成分を[0, 255]に含まれるように変換した8bitの画素配列
+  std::vector<uint8_t> toRGB8() const {
+    std::vector<uint8_t> rgb(pixels.size());
+    // NOTE: uint8_tへの書き込みは任意の型とエイリアスし得るので,
+    // ポインタと要素数を先に取り出してベクトル化できるようにする
+    const float* src = pixels.data();
+    uint8_t* dst = rgb.data();
+    const size_t n = pixels.size();
+    for (size_t i = 0; i < n; ++i) {
+      // NOTE: NaNは0にする
+      const float v = 255.0f * src[i];
+      dst[i] = static_cast<uint8_t>(v > 0 ? (v < 255.0f ? v : 255.0f) : 0.0f);
+    }
+    return rgb;
+  }
+
+ public:
+  Image(unsigned int width, unsigned int height)
+      : width(width), height(height), pixels(3 * width * height, 0) {}
 
   unsigned int getWidth() const { return width; }
   unsigned int getHeight() const { return height; }
 
+  Vec3f getPixel(unsigned int i, unsigned int j) const {
+    const int idx = 3 * i + 3 * width * j;
+    return Vec3f(pixels[idx], pixels[idx + 1], pixels[idx + 2]);
+  }
+
   void setPixel(unsigned int i, unsigned int j, const Vec3f& RGB) {
     const int idx = 3 * i + 3 * width * j;
     pixels[idx] = RGB[0];      // R
@@ -39,46 +314,185 @@ class Image {
     pixels[idx + 2] = RGB[2];  // B
   }
 
-  void writePPM(const std::string& filename) const {
-    std::ofstream file(filename);
-    if (!file) {
-      std::cerr << "failed to open " << filename << std::endl;
-      return;
+  // 8bitのPPM画像(P6)を出力する
+  bool writePPM(const std::string& filename) const {
+    const std::vector<uint8_t> rgb = toRGB8();
+
+    std::vector<char> buffer;
+    buffer.reserve(rgb.size() + 32);
+    image_io::append(buffer, "P6\n" + std::to_string(width) + " " +
+                                 std::to_string(height) + "\n255\n");
+    buffer.insert(buffer.end(), rgb.begin(), rgb.end());
+    return image_io::writeFile(filename, buffer);
+  }
+
+  // 8bitのPNG画像を出力する
+  // NOTE: 圧縮は行わず, deflateの無圧縮ブロックに格納する
+  bool writePNG(const std::string& filename) const {
+    const std::vector<uint8_t> rgb = toRGB8();
+
+    // 各行の先頭にフィルタの種類(0: なし)を付けたデータ
+    std::vector<char> raw;
+    raw.reserve((3 * width + 1) * height);
+    for (int j = 0; j < height; ++j) {
+      raw.push_back(0);
+      raw.insert(raw.end(), rgb.begin() + 3 * width * j,
+                 rgb.begin() + 3 * width * (j + 1));
+    }
+
+    // zlib形式(無圧縮ブロックの列)
+    std::vector<char> zlib = {0x78, 0x01};
+    constexpr size_t maxBlockSize = 65535;
+    for (size_t start = 0; start < raw.size(); start += maxBlockSize) {
+      const uint16_t size = std::min(maxBlockSize, raw.size() - start);
+      const bool isFinal = start + size == raw.size();
+      zlib.push_back(isFinal ? 1 : 0);
+      image_io::append(zlib, size);
+      image_io::append(zlib, static_cast<uint16_t>(~size));
+      zlib.insert(zlib.end(), raw.begin() + start,
+                  raw.begin() + start + size);
+    }
+    image_io::appendBigEndian(zlib, image_io::adler32(raw.data(), raw.size()));
+
+    // ヘッダ(8bit, RGB)
+    std::vector<char> ihdr;
+    image_io::appendBigEndian(ihdr, width);
+    image_io::appendBigEndian(ihdr, height);
+    ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0});
+
+    std::vector<char> buffer = {'\x89', 'P', 'N', 'G', '\r', '\n', '\x1a',
+                                '\n'};
+    buffer.reserve(zlib.size() + 64);
+    image_io::appendPNGChunk(buffer, "IHDR", ihdr);
+    image_io::appendPNGChunk(buffer, "IDAT", zlib);
+    image_io::appendPNGChunk(buffer, "IEND", {});
+    return image_io::writeFile(filename, buffer);
+  }
+
+  // 浮動小数点数のPFM画像を出力する
+  bool writePFM(const std::string& filename) const {
+    const std::string header = "PF\n" + std::to_string(width) + " " +
+                               std::to_string(height) + "\n-1.0\n";
+
+    std::vector<char> buffer(header.begin(), header.end());
+    const size_t start = buffer.size();
+    const size_t rowSize = 3 * width * sizeof(float);
+    buffer.resize(start + rowSize * height);
+    // NOTE: PFMは下の行から順に格納する
+    for (int j = 0; j < height; ++j) {
+      std::memcpy(buffer.data() + start + rowSize * (height - 1 - j),
+                  pixels.data() + 3 * width * j, rowSize);
+    }
+    return image_io::writeFile(filename, buffer);
+  }
+
+  // 浮動小数点数のOpenEXR画像(無圧縮のスキャンライン形式)を出力する
+  bool writeEXR(const std::string& filename) const {
+    using image_io::append;
+
+    std::vector<char> buffer;
+    append(buffer, uint32_t(20000630));  // マジックナンバー
+    append(buffer, uint32_t(2));         // バージョン
+
+    // 属性の追加
+    const auto attribute = [&](const std::string& name,
+                               const std::string& type, uint32_t size) {
+      append(buffer, name);
+      buffer.push_back(0);
+      append(buffer, type);
+      buffer.push_back(0);
+      append(buffer, size);
+    };
+
+    // チャンネルはアルファベット順に並べる
+    const char channelNames[3] = {'B', 'G', 'R'};
+    attribute("channels", "chlist", 3 * 18 + 1);
+    for (const char name : channelNames) {
+      buffer.push_back(name);
+      buffer.push_back(0);
+      append(buffer, int32_t(2));  // FLOAT
+      append(buffer, uint32_t(0));  // pLinear, reserved
+      append(buffer, int32_t(1));  // xSampling
+      append(buffer, int32_t(1));  // ySampling
+    }
+    buffer.push_back(0);
+
+    attribute("compression", "compression", 1);
+    buffer.push_back(0);  // NO_COMPRESSION
+
+    for (const std::string name : {"dataWindow", "displayWindow"}) {
+      attribute(name, "box2i", 16);
+      append(buffer, int32_t(0));
+      append(buffer, int32_t(0));
+      append(buffer, int32_t(width - 1));
+      append(buffer, int32_t(height - 1));
     }
 
-    file << "P3" << std::endl;
-    file << width << " " << height << std::endl;
-    file << "255" << std::endl;
+    attribute("lineOrder", "lineOrder", 1);
+    buffer.push_back(0);  // INCREASING_Y
+
+    attribute("pixelAspectRatio", "float", 4);
+    append(buffer, 1.0f);
+
+    attribute("screenWindowCenter", "v2f", 8);
+    append(buffer, 0.0f);
+    append(buffer, 0.0f);
+
+    attribute("screenWindowWidth", "float", 4);
+    append(buffer, 1.0f);
+
+    buffer.push_back(0);  // ヘッダの終わり
+
+    // 各行の位置のテーブルと各行のデータ
+    const uint32_t rowDataSize = 3 * width * sizeof(float);
+    const size_t rowBlockSize = 2 * sizeof(int32_t) + rowDataSize;
+    const size_t tableStart = buffer.size();
+    const size_t dataStart = tableStart + sizeof(uint64_t) * height;
+    buffer.resize(dataStart + rowBlockSize * height);
     for (int j = 0; j < height; ++j) {
-      for (int i = 0; i < width; ++i) {
-        const int idx = 3 * i + 3 * width * j;
-        float R = pixels[idx];
-        float G = pixels[idx + 1];
-        float B = pixels[idx + 2];
-
-        // 各成分を[0, 255]に含まれるように変換し出力
-        file << static_cast<unsigned int>(std::clamp(255.0f * R, 0.0f, 255.0f))
-             << " ";
-        file << static_cast<unsigned int>(std::clamp(255.0f * G, 0.0f, 255.0f))
-             << " ";
-        file << static_cast<unsigned int>(std::clamp(255.0f * B, 0.0f, 255.0f))
-             << std::endl;
+      const uint64_t offset = dataStart + rowBlockSize * j;
+      std::memcpy(buffer.data() + tableStart + sizeof(uint64_t) * j, &offset,
+                  sizeof(uint64_t));
+
+      char* row = buffer.data() + offset;
+      std::memcpy(row, &j, sizeof(int32_t));
+      std::memcpy(row + sizeof(int32_t), &rowDataSize, sizeof(uint32_t));
+      float* data = reinterpret_cast<float*>(row + 2 * sizeof(int32_t));
+      for (int c = 0; c < 3; ++c) {
+        // B, G, Rの順に1行分ずつ並べる
+        const int channel = 2 - c;
+        for (int i = 0; i < width; ++i) {
+          data[width * c + i] = pixels[3 * i + 3 * width * j + channel];
+        }
       }
     }
-    file.close();
+    return image_io::writeFile(filename, buffer);
+  }
+
+  // 露出を掛けてReinhardのトーンマッピングを行う
+  // NOTE: 色相が変わらないように輝度に基づいて各成分を同じ比率で縮める
+  void toneMapping(float exposure) {
+    const size_t nPixels = width * height;
+    for (size_t k = 0; k < nPixels; ++k) {
+      float* p = pixels.data() + 3 * k;
+      const float R = exposure * p[0];
+      const float G = exposure * p[1];
+      const float B = exposure * p[2];
+      const float L = 0.2126f * R + 0.7152f * G + 0.0722f * B;
+      const float scale = 1.0f / (1.0f + L);
+      p[0] = R * scale;
+      p[1] = G * scale;
+      p[2] = B * scale;
+    }
   }
 
   // ガンマ補正
+  // NOTE: std::powの代わりに近似を使い, 全画素を1つのループで処理する
   void gammaCorrection() {
-    for (int j = 0; j < height; ++j) {
-      for (int i = 0; i < width; ++i) {
-        const int idx = 3 * i + 3 * width * j;
-        pixels[idx] = std::pow(pixels[idx], 1 / 2.2f);          // R
-        pixels[idx + 1] = std::pow(pixels[idx + 1], 1 / 2.2f);  // G
-        pixels[idx + 2] = std::pow(pixels[idx + 2], 1 / 2.2f);  // B
-      }
+    for (size_t i = 0; i < pixels.size(); ++i) {
+      pixels[i] = image_io::fastPow(pixels[i], 1 / 2.2f);
     }
   }
 };
 
-#endif
\ No newline at end of file
+#endif
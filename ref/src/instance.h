@@ -0,0 +1,206 @@
+#ifndef _INSTANCE_H
+#define _INSTANCE_H
+#include <cmath>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "aabb.h"
+#include "intersect-info.h"
+#include "ray.h"
+#include "shape.h"
+#include "transform.h"
+#include "vec3.h"
+#include "wide-bvh.h"
+
+// 複数の形状をまとめた形状
+// 内部にメンバーのBVHを持ち, Instanceで共有するジオメトリに使う
+// NOTE: 光源サンプリングには対応しない(pdfは0). 光源にした場合は
+// BSDFサンプリングだけで寄与を計算する
+class ShapeGroup final : public Shape {
+ public:
+  ShapeGroup(std::vector<std::shared_ptr<Shape>> shapes)
+      : shapes(std::move(shapes)) {
+    std::vector<AABB> shapeBounds(this->shapes.size());
+    for (int i = 0; i < this->shapes.size(); ++i) {
+      refs.emplace_back(this->shapes[i].get());
+      shapeBounds[i] = refs[i].getBounds();
+    }
+    bvh.build(shapeBounds);
+  }
+
+  int nShapes() const { return shapes.size(); }
+
+  bool intersect(const Ray& ray, IntersectInfo& info) const override {
+    IntersectInfo info_each;
+    return bvh.intersect(ray, ray.tmax, [&](uint32_t idx, float& tmax) {
+      if (refs[idx].intersect(ray, info_each) && info_each.t < tmax) {
+        info = info_each;
+        tmax = info_each.t;
+        return true;
+      }
+      return false;
+    });
+  }
+
+  bool occluded(const Ray& ray, float tmax) const override {
+    return bvh.occluded(ray, tmax, [&](uint32_t idx) {
+      return refs[idx].occluded(ray, tmax);
+    });
+  }
+
+  AABB getBounds() const override { return bvh.getBounds(); }
+
+  Vec3f sample(const Vec3f& ref, float u, float v, Vec3f& n,
+               float& pdf) const override {
+    const Vec3f p = refs[0].sample(ref, u, v, n, pdf);
+    pdf = 0;
+    return p;
+  }
+
+  float pdf(const Vec3f& ref, const Vec3f& p, const Vec3f& n) const override {
+    return 0;
+  }
+
+  // NOTE: 光源サンプリングに対応しないので使われない
+  Vec3f samplePoint(float u, float v, Vec3f& n) const override {
+    return shapes[0]->samplePoint(u, v, n);
+  }
+
+  float area() const override { return 0; }
+
+ private:
+  std::vector<std::shared_ptr<Shape>> shapes;
+  std::vector<ShapeRef> refs;  // shapesと同じ順の参照
+  AccelBVH bvh;                // メンバーのBVH
+};
+
+// 共有するジオメトリをアフィン変換して配置した形状
+// ジオメトリ(TriangleMeshやShapeGroupなど)とその内部のBVHは1つだけ作り,
+// 全てのインスタンスで共有する. SceneのトップレベルのBVHがインスタンスを,
+// ジオメトリ内部のBVHがその中身を探索する2段階の構造になる
+// NOTE: レイをジオメトリの座標系に逆変換して交差判定し, 結果を戻す.
+// 逆変換したレイの方向は正規化し, 交差距離はワールド座標系に換算する
+class Instance final : public Shape {
+ public:
+  Instance(const std::shared_ptr<Shape>& geometry,
+           const Transform& objectToWorld)
+      : geometry(geometry), geometryRef(geometry.get()) {
+    setTransform(objectToWorld);
+  }
+
+  const std::shared_ptr<Shape>& getGeometry() const { return geometry; }
+  const Transform& getTransform() const { return objectToWorld; }
+
+  // 変換を差し替える(アニメーション用)
+  // NOTE: commit後に変更した場合はScene::updateでBVHを更新する
+  void setTransform(const Transform& objectToWorld) {
+    this->objectToWorld = objectToWorld;
+    worldToObject = objectToWorld.inverse();
+    bounds = objectToWorld.apply(geometryRef.getBounds());
+    areaScale = std::pow(std::abs(objectToWorld.determinant()), 2.0f / 3);
+    invLengthScale = 1.0f / std::sqrt(areaScale);
+  }
+
+  bool intersect(const Ray& ray, IntersectInfo& info) const override {
+    float scale;
+    const Ray localRay = toObject(ray, scale);
+    if (!geometryRef.intersect(localRay, info)) return false;
+
+    info.t /= scale;
+    info.hitPos = ray(info.t);
+    info.hitNormal = normalize(worldToObject.applyTransposed(info.hitNormal));
+    info.uvDensity *= invLengthScale;
+    return true;
+  }
+
+  bool occluded(const Ray& ray, float tmax) const override {
+    float scale;
+    const Ray localRay = toObject(ray, scale);
+    return geometryRef.occluded(localRay, tmax * scale);
+  }
+
+  AABB getBounds() const override { return bounds; }
+
+  // ジオメトリの座標系でサンプリングし, ワールド座標系に戻す
+  // NOTE: 面積の拡大率は行列式から求めるので, 一様でない拡大縮小では
+  // pdfは近似になる
+  Vec3f sample(const Vec3f& ref, float u, float v, Vec3f& n,
+               float& pdf) const override {
+    const Vec3f localRef = worldToObject.applyPoint(ref);
+    Vec3f localN;
+    float localPdf;
+    const Vec3f localP = geometryRef.sample(localRef, u, v, localN, localPdf);
+
+    const Vec3f p = objectToWorld.applyPoint(localP);
+    n = normalize(worldToObject.applyTransposed(localN));
+    pdf = toWorldPdf(localPdf, localRef, localP, localN, ref, p, n);
+    return p;
+  }
+
+  float pdf(const Vec3f& ref, const Vec3f& p, const Vec3f& n) const override {
+    const Vec3f localRef = worldToObject.applyPoint(ref);
+    const Vec3f localP = worldToObject.applyPoint(p);
+    const Vec3f localN = normalize(objectToWorld.applyTransposed(n));
+    const float localPdf = geometryRef.pdf(localRef, localP, localN);
+    return toWorldPdf(localPdf, localRef, localP, localN, ref, p, n);
+  }
+
+  // NOTE: 一様でない拡大縮小ではワールド座標系で一様にならない
+  Vec3f samplePoint(float u, float v, Vec3f& n) const override {
+    Vec3f localN;
+    const Vec3f localP = geometry->samplePoint(u, v, localN);
+    n = normalize(worldToObject.applyTransposed(localN));
+    return objectToWorld.applyPoint(localP);
+  }
+
+  float area() const override { return geometry->area() * areaScale; }
+
+  // NOTE: 向きが1つに決まる場合だけ変換し, それ以外は全方向とする
+  // (一様でない拡大縮小では円錐の角度が保たれないため)
+  void normalCone(Vec3f& axis, float& cosTheta) const override {
+    geometry->normalCone(axis, cosTheta);
+    if (cosTheta < 1) {
+      Shape::normalCone(axis, cosTheta);
+      return;
+    }
+    axis = normalize(worldToObject.applyTransposed(axis));
+  }
+
+ private:
+  std::shared_ptr<Shape> geometry;
+  ShapeRef geometryRef;
+  Transform objectToWorld;
+  Transform worldToObject;
+  AABB bounds;      // ワールド座標系のAABB
+  float areaScale;       // 面積の拡大率
+  float invLengthScale;  // 長さの拡大率の逆数(テクスチャの参照範囲用)
+
+  // rayをジオメトリの座標系に変換する
+  // scaleに方向ベクトルの長さの倍率(距離の換算に使う)を返す
+  // NOTE: 方向を正規化するので, 許容する交差距離の範囲もジオメトリの
+  // 座標系の距離に換算する(拡大縮小しても自己交差の判定が変わらない)
+  Ray toObject(const Ray& ray, float& scale) const {
+    const Vec3f d = worldToObject.applyVector(ray.direction);
+    scale = length(d);
+    Ray localRay(worldToObject.applyPoint(ray.origin), d / scale);
+    localRay.tmin = ray.tmin * scale;
+    localRay.tmax = ray.tmax * scale;
+    return localRay;
+  }
+
+  // ジオメトリの座標系の立体角測度のpdfをワールド座標系に換算する
+  // 一度面積測度に直し, 面積の拡大率で割ってから立体角測度に戻す
+  float toWorldPdf(float localPdf, const Vec3f& localRef, const Vec3f& localP,
+                   const Vec3f& localN, const Vec3f& ref, const Vec3f& p,
+                   const Vec3f& n) const {
+    if (localPdf == 0) return 0;
+    const Vec3f ld = localP - localRef;
+    const float localDist2 = length2(ld);
+    const float localCos = std::abs(dot(localN, ld)) / std::sqrt(localDist2);
+    const float pdfArea = localPdf * localCos / localDist2 / areaScale;
+    return areaToSolidAngle(pdfArea, ref, p, n);
+  }
+};
+
+#endif
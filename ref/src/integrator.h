@@ -1,49 +1,117 @@
 #ifndef _INTEGRATOR_H
 #define _INTEGRATOR_H
 #include "ray.h"
-#include "rng.h"
+#include "sampler.h"
 #include "scene.h"
+#include "stats.h"
+#include "texture.h"
 
 class Integrator {
  public:
   // 放射輝度を計算する
   virtual Vec3f radiance(const Ray& ray, const Scene& scene,
-                         RNG& rng) const = 0;
+                         Sampler& sampler) const = 0;
 };
 
 class PathTracing : public Integrator {
  private:
   int maxDepth = 100;  // 最大反射回数
+  bool useNEE = true;  // 光源サンプリング(Next Event Estimation)を行うか
+
+  // 光源サンプリングによる直接光の寄与を計算する
+  // BSDF Samplingとの重みはpower heuristicで計算する
+  Vec3f sampleLight(const Scene& scene, const IntersectInfo& info,
+                    const TexCoord& tc, const Vec3f& woTangent,
+                    const Vec3f& t, const Vec3f& b, Sampler& sampler) const {
+    // 光源(または環境マップの空)を選び, その方向をサンプリング
+    const float uSelect = sampler.getNext();
+    const float u = sampler.getNext();
+    const float v = sampler.getNext();
+    Vec3f wi;
+    float dist, lightPdf;
+    const Vec3f le = scene.sampleLightDirection(
+        info.hitPos, info.hitNormal, uSelect, u, v, wi, dist, lightPdf);
+    if (lightPdf == 0) return Vec3f(0);
+
+    // BSDFの値が0なら遮蔽判定を省略する
+    const Vec3f wiTangent = worldToLocal(wi, t, info.hitNormal, b);
+    const Vec3f f =
+        info.hitPrimitive->getBSDF().eval(tc, woTangent, wiTangent);
+    if (f[0] == 0 && f[1] == 0 && f[2] == 0) return Vec3f(0);
+
+    // 光源までの間に遮蔽物があるか
+    STATS_INC(ShadowRays);
+    if (scene.occluded(Ray(info.hitPos, wi), dist)) {
+      return Vec3f(0);
+    }
+
+    const float bsdfPdf =
+        info.hitPrimitive->getBSDF().pdf(woTangent, wiTangent);
+    const float weight = powerHeuristic(lightPdf, bsdfPdf);
+    const float cos = std::abs(dot(wi, info.hitNormal));
+    return weight * f * cos * le / lightPdf;
+  }
 
  public:
-  PathTracing(int maxDepth = 100) : maxDepth(maxDepth) {}
+  PathTracing(int maxDepth = 100, bool useNEE = true)
+      : maxDepth(maxDepth), useNEE(useNEE) {}
 
   Vec3f radiance(const Ray& ray_in, const Scene& scene,
-                 RNG& rng) const override {
+                 Sampler& sampler) const override {
+    STATS_TIMER(Integrator);
     Vec3f radiance = {0};          // 放射輝度
     Vec3f throughput = {1, 1, 1};  // f*cos / pdfの積
     Ray ray = ray_in;
+
+    // 光源サンプリングを行うか
+    const bool nee = useNEE && scene.canSampleLights();
+    // 直前の反射の情報(MISの重みの計算に使う)
+    bool prevDelta = true;  // デルタ関数のBSDFで反射したか(カメラも含む)
+    float prevPdf = 0;      // BSDF Samplingのpdf
+    Vec3f prevPos;          // 反射した位置
+    Vec3f prevNormal;       // 反射した位置の法線
+
     for (int i = 0; i < maxDepth; ++i) {
       // ロシアンルーレット
       const float russianRouletteProb = std::min(
           std::max(std::max(throughput[0], throughput[1]), throughput[2]),
           1.0f);
-      if (rng.getNext() > russianRouletteProb) {
+      if (sampler.getNext() > russianRouletteProb) {
+        STATS_INC(RussianRouletteTerminations);
         break;
       }
       throughput /= russianRouletteProb;
 
       // レイを飛ばして交差点を計算
+      if (i == 0) {
+        STATS_INC(PrimaryRays);
+      } else {
+        STATS_INC(SecondaryRays);
+      }
       IntersectInfo info;
       if (!scene.intersect(ray, info)) {
         // 空に飛んでいった場合
-        radiance += throughput * scene.sky.Le();
+        // 環境マップは光源サンプリングでも計算しているのでMISの重みをかける
+        float weight = 1.0f;
+        if (nee && !prevDelta && scene.sky.hasEnvironmentMap()) {
+          weight = powerHeuristic(prevPdf, scene.skyPdf(ray.direction));
+        }
+        radiance += weight * throughput * scene.sky.Le(ray.direction);
         break;
       }
 
       // 光源に当たった場合
       if (info.hitPrimitive->areaLight) {
-        radiance += throughput * info.hitPrimitive->areaLight->Le();
+        // 光源サンプリングでも計算している経路はMISの重みをかける
+        float weight = 1.0f;
+        if (nee && !prevDelta) {
+          const float lightPdf =
+              scene.lightPdf(*info.hitPrimitive, prevPos, prevNormal) *
+              info.hitPrimitive->getShape().pdf(prevPos, info.hitPos,
+                                                info.hitNormal);
+          weight = powerHeuristic(prevPdf, lightPdf);
+        }
+        radiance += weight * throughput * info.hitPrimitive->areaLight->Le();
         break;
       }
 
@@ -55,11 +123,25 @@ class PathTracing : public Integrator {
       const Vec3f woTangent =
           worldToLocal(-ray.direction, t, info.hitNormal, b);
 
+      // テクスチャ座標と参照範囲
+      const TexCoord tc = texCoordAt(ray, info);
+
+      // 光源サンプリング
+      const BSDFRef& bsdfModel = info.hitPrimitive->getBSDF();
+      if (nee && !bsdfModel.isDelta()) {
+        radiance += throughput *
+                    sampleLight(scene, info, tc, woTangent, t, b, sampler);
+      }
+
       // BSDF Sampling
       float pdf;
       Vec3f wiTangent;
       const Vec3f bsdf =
-          info.hitPrimitive->bsdf->sample(rng, woTangent, wiTangent, pdf);
+          bsdfModel.sample(tc, sampler, woTangent, wiTangent, pdf);
+      // NOTE: 接平面上の方向がサンプリングされた場合はBSDFが発散するので
+      // 経路を打ち切る(臨界角付近の屈折で起こる)
+      if (pdf == 0 || wiTangent[1] == 0) break;
+      STATS_INC(Bounces);
       // 接空間からワールド座標系への変換
       const Vec3f wi = localToWorld(wiTangent, t, info.hitNormal, b);
 
@@ -74,6 +156,16 @@ class PathTracing : public Integrator {
       // 次のレイの生成
       ray.origin = info.hitPos;
       ray.direction = wi;
+      // NOTE: 拡散反射ではコーンを広げ, 以降は粗いmipmapを参照させる
+      ray.coneWidth = ray.coneWidthAt(info.t);
+      if (!bsdfModel.isDelta()) {
+        ray.coneSpread = std::max(ray.coneSpread, diffuseConeSpread);
+      }
+
+      prevDelta = bsdfModel.isDelta();
+      prevPdf = pdf;
+      prevPos = info.hitPos;
+      prevNormal = info.hitNormal;
     }
 
     return radiance;
@@ -8,6 +8,9 @@ struct IntersectInfo {
   float t;                        // 交差位置までの距離
   Vec3f hitPos;                   // 交差位置
   Vec3f hitNormal;                // 交差位置における法線
+  float u, v;                     // テクスチャ座標
+  // ワールド座標系の長さあたりのテクスチャ座標の変化(mipmapの選択用)
+  float uvDensity;
   const Primitive* hitPrimitive;  // 交差したPrimitiveへのポインタ
 };
 
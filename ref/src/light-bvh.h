@@ -0,0 +1,377 @@
+#ifndef _LIGHT_BVH_H
+#define _LIGHT_BVH_H
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "aabb.h"
+#include "constant.h"
+#include "vec3.h"
+
+// 光源(の集合)の位置, 放射束, 法線の向きの範囲
+// 法線の向きは軸axisと半頂角thetaOの円錐で表す
+// NOTE: AreaLightは両面から全ての方向に放射するので, 法線の符号は区別せず
+// 放射する範囲は法線から90度とする
+struct LightBounds {
+  AABB bounds;
+  Vec3f axis = Vec3f(0, 0, 1);  // 法線の円錐の軸
+  float power = 0;              // 放射束
+  float cosThetaO = 1;          // 法線の円錐の半頂角のcos(全方向なら-1)
+
+  LightBounds() {}
+  LightBounds(const AABB& bounds, const Vec3f& axis, float power,
+              float cosThetaO)
+      : bounds(bounds), axis(axis), power(power), cosThetaO(cosThetaO) {}
+
+  // 点pos(法線n)から見た重要度(寄与の見積もり)
+  // 放射束 x 光源側のcosの上限 x 受光側のcosの上限 / 距離^2
+  // 角度の上限はAABBの見える範囲と法線の円錐の広がりを考慮して求める
+  // NOTE: nが0ベクトルの場合は受光側のcosを考慮しない
+  float importance(const Vec3f& pos, const Vec3f& n) const {
+    const Vec3f pc = bounds.center();
+    const float radius2 = 0.25f * length2(bounds.diagonal());
+    const float dist2 = length2(pos - pc);
+    // NOTE: 距離が0に近いと発散するのでAABBの大きさで下限を設ける
+    const float dist2Clamped = std::max(dist2, std::sqrt(radius2));
+    if (dist2 == 0) return power / dist2Clamped;
+    const Vec3f wi = (pos - pc) / std::sqrt(dist2);
+
+    // AABBの外接球がposから見える範囲の半頂角thetaB
+    // NOTE: posが外接球の内部にある場合は全方向
+    float sinThetaB = 1, cosThetaB = -1;
+    if (dist2 > radius2) {
+      sinThetaB = std::sqrt(radius2 / dist2);
+      cosThetaB = safeSqrt(1 - sinThetaB * sinThetaB);
+    }
+
+    // 光源側: 軸とwiの角度thetaWから円錐とAABBの分だけ引いた角度
+    const float cosThetaW = std::abs(dot(axis, wi));
+    const float sinThetaW = safeSqrt(1 - cosThetaW * cosThetaW);
+    const float sinThetaO = safeSqrt(1 - cosThetaO * cosThetaO);
+    float cosThetaX, sinThetaX;
+    subtractAngle(sinThetaW, cosThetaW, sinThetaO, cosThetaO, sinThetaX,
+                  cosThetaX);
+    float sinThetaP, cosThetaP;
+    subtractAngle(sinThetaX, cosThetaX, sinThetaB, cosThetaB, sinThetaP,
+                  cosThetaP);
+    if (cosThetaP <= 0) return 0;
+
+    float result = power * cosThetaP / dist2Clamped;
+
+    // 受光側: 法線とwiの角度からAABBの分だけ引いた角度
+    if (n[0] != 0 || n[1] != 0 || n[2] != 0) {
+      const float cosThetaI = std::abs(dot(wi, n));
+      const float sinThetaI = safeSqrt(1 - cosThetaI * cosThetaI);
+      float sinThetaIP, cosThetaIP;
+      subtractAngle(sinThetaI, cosThetaI, sinThetaB, cosThetaB, sinThetaIP,
+                    cosThetaIP);
+      result *= std::max(cosThetaIP, 0.0f);
+    }
+    return result;
+  }
+
+ private:
+  static float safeSqrt(float x) { return std::sqrt(std::max(x, 0.0f)); }
+
+  // 角度a - bのsin, cosを求める(a < bなら0とする)
+  static void subtractAngle(float sinA, float cosA, float sinB, float cosB,
+                            float& sinR, float& cosR) {
+    if (cosA > cosB) {
+      sinR = 0;
+      cosR = 1;
+      return;
+    }
+    sinR = sinA * cosB - cosA * sinB;
+    cosR = cosA * cosB + sinA * sinB;
+  }
+};
+
+// 2つの法線の円錐を含む円錐
+// NOTE: 法線の符号は区別しないので, 軸が逆向きなら反転して合わせる
+inline void mergeNormalCone(const Vec3f& axisA, float cosA, Vec3f axisB,
+                            float cosB, Vec3f& axis, float& cosTheta) {
+  // 全方向の円錐を含む場合
+  if (cosA <= -1 || cosB <= -1) {
+    axis = axisA;
+    cosTheta = -1;
+    return;
+  }
+  if (dot(axisA, axisB) < 0) axisB = -axisB;
+
+  const float thetaA = std::acos(std::clamp(cosA, -1.0f, 1.0f));
+  const float thetaB = std::acos(std::clamp(cosB, -1.0f, 1.0f));
+  const float thetaD =
+      std::acos(std::clamp(dot(axisA, axisB), -1.0f, 1.0f));
+  // 一方が他方を含む場合
+  if (std::min(thetaD + thetaB, PI) <= thetaA) {
+    axis = axisA;
+    cosTheta = cosA;
+    return;
+  }
+  if (std::min(thetaD + thetaA, PI) <= thetaB) {
+    axis = axisB;
+    cosTheta = cosB;
+    return;
+  }
+
+  // 両方の端を通る円錐. 軸はaxisAをaxisBの方へthetaRだけ回転させる
+  const float thetaO = 0.5f * (thetaA + thetaD + thetaB);
+  const Vec3f k = cross(axisA, axisB);
+  if (thetaO >= PI || length2(k) == 0) {
+    axis = axisA;
+    cosTheta = -1;
+    return;
+  }
+  const float thetaR = thetaO - thetaA;
+  const Vec3f kn = normalize(k);
+  // Rodriguesの回転公式(kn ⊥ axisA)
+  axis = normalize(std::cos(thetaR) * axisA +
+                   std::sin(thetaR) * cross(kn, axisA));
+  cosTheta = std::cos(thetaO);
+}
+
+// 2つのLightBoundsを含むLightBounds
+inline LightBounds mergeLightBounds(const LightBounds& a,
+                                    const LightBounds& b) {
+  if (a.power == 0) return b;
+  if (b.power == 0) return a;
+  LightBounds result;
+  result.bounds = mergeAABB(a.bounds, b.bounds);
+  result.power = a.power + b.power;
+  mergeNormalCone(a.axis, a.cosThetaO, b.axis, b.cosThetaO, result.axis,
+                  result.cosThetaO);
+  return result;
+}
+
+// 光源を選ぶためのBVH(Light BVH)
+// 葉は光源1つで, 内部ノードは子のLightBoundsを含むLightBoundsを持つ.
+// 根から2つの子の重要度に比例した確率で降りていくので, 光源の数の対数の
+// 時間で寄与の大きそうな光源を選べる
+// NOTE: 放射束が0の光源は含めない(選ばれる確率は0)
+class LightBVH {
+ public:
+  LightBVH() {}
+
+  // 各光源のLightBoundsから構築する
+  void build(const std::vector<LightBounds>& lights) {
+    nodes.clear();
+    leafOf.assign(lights.size(), invalidNode);
+
+    std::vector<BuildLight> buildLights;
+    for (uint32_t i = 0; i < lights.size(); ++i) {
+      if (!(lights[i].power > 0)) continue;
+      buildLights.push_back({lights[i], lights[i].bounds.center(), i});
+    }
+    if (buildLights.empty()) return;
+
+    nodes.reserve(2 * buildLights.size() - 1);
+    buildNode(buildLights, 0, buildLights.size(), invalidNode);
+  }
+
+  bool empty() const { return nodes.empty(); }
+  int nNodes() const { return nodes.size(); }
+
+  // 点pos(法線n)から重要度に比例して光源を選び, その番号を返す
+  // pmfに選ばれる確率を返す(選べない場合は-1)
+  // NOTE: uは各ノードで選んだ側の範囲に引き伸ばして使い回す
+  int sample(const Vec3f& pos, const Vec3f& n, float u, float& pmf) const {
+    pmf = 0;
+    if (nodes.empty()) return -1;
+    if (nodes[0].isLeaf()) {
+      if (nodes[0].lightBounds.importance(pos, n) == 0) return -1;
+      pmf = 1;
+      return nodes[0].offset;
+    }
+
+    uint32_t nodeIdx = 0;
+    float p = 1;
+    while (!nodes[nodeIdx].isLeaf()) {
+      const uint32_t left = nodeIdx + 1;
+      const uint32_t right = nodes[nodeIdx].offset;
+      const float impLeft = nodes[left].lightBounds.importance(pos, n);
+      const float impRight = nodes[right].lightBounds.importance(pos, n);
+      if (impLeft == 0 && impRight == 0) return -1;
+
+      const float pLeft = impLeft / (impLeft + impRight);
+      if (u < pLeft) {
+        nodeIdx = left;
+        u = std::min(u / pLeft, oneMinusEpsilon);
+        p *= pLeft;
+      } else {
+        nodeIdx = right;
+        u = std::min((u - pLeft) / (1 - pLeft), oneMinusEpsilon);
+        p *= impRight / (impLeft + impRight);
+      }
+    }
+    pmf = p;
+    return nodes[nodeIdx].offset;
+  }
+
+  // 点pos(法線n)からsampleで光源lightが選ばれる確率
+  // 光源の葉から根まで親をたどり, 各ノードで選ばれる確率を掛ける
+  float pmf(int light, const Vec3f& pos, const Vec3f& n) const {
+    if (light < 0 || light >= leafOf.size()) return 0;
+    uint32_t nodeIdx = leafOf[light];
+    if (nodeIdx == invalidNode) return 0;
+    if (nodeIdx == 0) {
+      return nodes[0].lightBounds.importance(pos, n) > 0 ? 1 : 0;
+    }
+
+    float p = 1;
+    while (nodeIdx != 0) {
+      const uint32_t parent = nodes[nodeIdx].parent;
+      const uint32_t left = parent + 1;
+      const uint32_t right = nodes[parent].offset;
+      const float impLeft = nodes[left].lightBounds.importance(pos, n);
+      const float impRight = nodes[right].lightBounds.importance(pos, n);
+      const float imp = nodeIdx == left ? impLeft : impRight;
+      if (imp == 0) return 0;
+      p *= imp / (impLeft + impRight);
+      nodeIdx = parent;
+    }
+    return p;
+  }
+
+ private:
+  static constexpr uint32_t invalidNode = ~uint32_t(0);
+  static constexpr float oneMinusEpsilon = 0x1.fffffep-1f;
+  static constexpr int nBuckets = 12;  // 分割を探すビンの数
+
+  // ノード
+  // NOTE: 内部ノードの左の子は常に直後に配置されるので右の子の番号だけ持つ
+  struct Node {
+    LightBounds lightBounds;
+    uint32_t offset;  // 葉: 光源の番号, 内部: 右の子の番号
+    uint32_t parent;  // 親の番号(根はinvalidNode)
+    bool leaf;
+
+    bool isLeaf() const { return leaf; }
+  };
+
+  // 構築時に使う各光源の情報
+  struct BuildLight {
+    LightBounds lightBounds;
+    Vec3f centroid;
+    uint32_t index;
+  };
+
+  std::vector<Node> nodes;        // 深さ優先順に並べたノード
+  std::vector<uint32_t> leafOf;  // 光源ごとの葉の番号
+
+  // 分割のコスト: 放射束 x 向きの広がり x AABBの表面積
+  // 向きの広がりは法線の円錐から90度広げた範囲の立体角の重み付き積分
+  // NOTE: axisの方向に細長い分割を選ばないように, 最も長い辺との比を掛ける
+  static float splitCost(const LightBounds& lb, const AABB& parentBounds,
+                         int axis) {
+    const float thetaO = std::acos(std::clamp(lb.cosThetaO, -1.0f, 1.0f));
+    const float thetaW = std::min(thetaO + 0.5f * PI, PI);
+    const float sinThetaO = std::sin(thetaO);
+    const float mOmega =
+        2 * PI * (1 - lb.cosThetaO) +
+        0.5f * PI *
+            (2 * thetaW * sinThetaO - std::cos(thetaO - 2 * thetaW) -
+             2 * thetaO * sinThetaO + lb.cosThetaO);
+    const Vec3f d = parentBounds.diagonal();
+    const float maxExtent = std::max(std::max(d[0], d[1]), d[2]);
+    const float kr = d[axis] > 0 ? maxExtent / d[axis] : 0;
+    return lb.power * mOmega * kr * lb.bounds.surfaceArea();
+  }
+
+  // [start, end)の光源からノードを再帰的に構築し, ノード番号を返す
+  uint32_t buildNode(std::vector<BuildLight>& buildLights, int start,
+                     int end, uint32_t parent) {
+    const uint32_t nodeIdx = nodes.size();
+    nodes.emplace_back();
+    nodes[nodeIdx].parent = parent;
+
+    if (end - start == 1) {
+      nodes[nodeIdx].lightBounds = buildLights[start].lightBounds;
+      nodes[nodeIdx].offset = buildLights[start].index;
+      nodes[nodeIdx].leaf = true;
+      leafOf[buildLights[start].index] = nodeIdx;
+      return nodeIdx;
+    }
+
+    AABB bbox, centroidBox;
+    for (int i = start; i < end; ++i) {
+      bbox = mergeAABB(bbox, buildLights[i].lightBounds.bounds);
+      centroidBox = mergeAABB(centroidBox, buildLights[i].centroid);
+    }
+
+    // 3軸それぞれでビンに分け, コストが最小になる分割を探す
+    float minCost = std::numeric_limits<float>::max();
+    int minAxis = -1, minBucket = -1;
+    for (int axis = 0; axis < 3; ++axis) {
+      if (centroidBox[1][axis] == centroidBox[0][axis]) continue;
+
+      LightBounds bucketBounds[nBuckets];
+      int bucketCount[nBuckets] = {0};
+      for (int i = start; i < end; ++i) {
+        const int b = bucketOf(buildLights[i], centroidBox, axis);
+        bucketCount[b]++;
+        bucketBounds[b] =
+            mergeLightBounds(bucketBounds[b], buildLights[i].lightBounds);
+      }
+
+      // 右からの累積を先に計算し, 左から走査して各分割位置のコストを求める
+      float rightCost[nBuckets];
+      int rightCount[nBuckets];
+      LightBounds acc;
+      int count = 0;
+      for (int b = nBuckets - 1; b > 0; --b) {
+        acc = mergeLightBounds(acc, bucketBounds[b]);
+        count += bucketCount[b];
+        rightCost[b] = splitCost(acc, bbox, axis);
+        rightCount[b] = count;
+      }
+
+      acc = LightBounds();
+      count = 0;
+      for (int b = 0; b < nBuckets - 1; ++b) {
+        acc = mergeLightBounds(acc, bucketBounds[b]);
+        count += bucketCount[b];
+        if (count == 0 || rightCount[b + 1] == 0) continue;
+        const float cost = splitCost(acc, bbox, axis) + rightCost[b + 1];
+        if (cost < minCost) {
+          minCost = cost;
+          minAxis = axis;
+          minBucket = b;
+        }
+      }
+    }
+
+    // 分割できない場合(重心が全て一致するなど)は数で半分に分ける
+    int mid;
+    if (minAxis == -1) {
+      mid = (start + end) / 2;
+    } else {
+      mid = std::partition(buildLights.begin() + start,
+                           buildLights.begin() + end,
+                           [&](const BuildLight& l) {
+                             return bucketOf(l, centroidBox, minAxis) <=
+                                    minBucket;
+                           }) -
+            buildLights.begin();
+    }
+
+    buildNode(buildLights, start, mid, nodeIdx);
+    const uint32_t rightIdx = buildNode(buildLights, mid, end, nodeIdx);
+
+    // NOTE: emplace_backでnodesが再確保されるので参照は取らずに番号で書き込む
+    nodes[nodeIdx].lightBounds = mergeLightBounds(
+        nodes[nodeIdx + 1].lightBounds, nodes[rightIdx].lightBounds);
+    nodes[nodeIdx].offset = rightIdx;
+    nodes[nodeIdx].leaf = false;
+    return nodeIdx;
+  }
+
+  static int bucketOf(const BuildLight& l, const AABB& centroidBox,
+                      int axis) {
+    const int b = nBuckets * centroidBox.offset(l.centroid)[axis];
+    return std::min(b, nBuckets - 1);
+  }
+};
+
+#endif
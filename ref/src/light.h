@@ -1,5 +1,8 @@
 #ifndef _LIGHT_H
 #define _LIGHT_H
+#include <memory>
+
+#include "environment-map.h"
 #include "vec3.h"
 
 class Light {
@@ -7,7 +10,7 @@ class Light {
   virtual Vec3f Le() const = 0;
 };
 
-class AreaLight : public Light {
+class AreaLight final : public Light {
  private:
   const Vec3f le;
 
@@ -17,14 +20,36 @@ class AreaLight : public Light {
   Vec3f Le() const override { return le; }
 };
 
-class Sky : public Light {
+// 無限遠の空
+// 一様な放射輝度か, 環境マップの放射輝度にscaleを掛けたものを返す
+// NOTE: 方向に依存するのでLightは継承しない. 環境マップの場合だけ
+// 光源サンプリングの対象にする(Scene::skySelectPdfを参照)
+class Sky {
  private:
-  const Vec3f le;
+  Vec3f le;  // 一様な放射輝度(環境マップの場合は倍率)
+  std::shared_ptr<const EnvironmentMap> envMap;
 
  public:
   Sky(const Vec3f& le) : le(le) {}
+  Sky(const std::shared_ptr<const EnvironmentMap>& envMap,
+      const Vec3f& scale = Vec3f(1))
+      : le(scale), envMap(envMap) {}
 
-  Vec3f Le() const override { return le; }
+  bool hasEnvironmentMap() const { return envMap != nullptr; }
+
+  // 方向dirから来る放射輝度
+  Vec3f Le(const Vec3f& dir) const {
+    return envMap ? le * envMap->Le(dir) : le;
+  }
+
+  // 環境マップの方向をサンプリングし, その放射輝度を返す
+  // NOTE: hasEnvironmentMapがtrueの場合だけ呼ぶ
+  Vec3f sample(float u, float v, Vec3f& wi, float& pdf) const {
+    return le * envMap->sample(u, v, wi, pdf);
+  }
+
+  // sampleで方向dirが選ばれるpdf
+  float pdf(const Vec3f& dir) const { return envMap->pdf(dir); }
 };
 
 #endif
\ No newline at end of file
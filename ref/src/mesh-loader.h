@@ -0,0 +1,660 @@
+#ifndef _MESH_LOADER_H
+#define _MESH_LOADER_H
+#include <fcntl.h>
+#include <omp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "shape.h"
+#include "vec3.h"
+
+// 読み込み専用でメモリマップしたファイル
+class MappedFile {
+ private:
+  const char* data = nullptr;  // ファイルの先頭
+  size_t size = 0;             // ファイルサイズ[byte]
+
+ public:
+  MappedFile(const std::string& filename) {
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (ptr != MAP_FAILED) {
+        data = static_cast<const char*>(ptr);
+        size = st.st_size;
+        // 先頭から順に読むことをOSに伝えておく
+        madvise(ptr, size, MADV_SEQUENTIAL | MADV_WILLNEED);
+      }
+    }
+    // NOTE: mmapした領域はfdを閉じても有効
+    close(fd);
+  }
+  ~MappedFile() {
+    if (data) munmap(const_cast<char*>(data), size);
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool isOpen() const { return data != nullptr; }
+  const char* getData() const { return data; }
+  size_t getSize() const { return size; }
+};
+
+namespace mesh_loader {
+
+// ファイルを並列処理用にn個の区間に分割する
+// 各区間の境界は行頭に揃える
+inline std::vector<const char*> splitLines(const char* begin, const char* end,
+                                           int n) {
+  std::vector<const char*> bounds(n + 1);
+  bounds[0] = begin;
+  bounds[n] = end;
+  for (int k = 1; k < n; ++k) {
+    const char* p = std::max(begin + (end - begin) * k / n, bounds[k - 1]);
+    while (p > begin && p < end && *(p - 1) != '\n') ++p;
+    bounds[k] = p;
+  }
+  return bounds;
+}
+
+inline const char* skipSpace(const char* p, const char* end) {
+  while (p < end && (*p == ' ' || *p == '\t')) ++p;
+  return p;
+}
+
+inline const char* skipLine(const char* p, const char* end) {
+  while (p < end && *p != '\n') ++p;
+  return p < end ? p + 1 : end;
+}
+
+inline const char* parseFloat(const char* p, const char* end, float& x) {
+  p = skipSpace(p, end);
+  if (p < end && *p == '+') ++p;
+  const auto res = std::from_chars(p, end, x);
+  return res.ec == std::errc() ? res.ptr : nullptr;
+}
+
+// OBJの1区間のパース結果
+// NOTE: 負のインデックス(相対参照)は区間の頂点数が確定するまで解決できないので,
+// relativeIndexBiasを引いた値として保存しておき, 結合時に解決する
+struct ObjChunk {
+  static constexpr int64_t relativeIndexBias = int64_t(1) << 40;
+
+  std::vector<Vec3f> positions;
+  std::vector<Vec3f> normals;
+  std::vector<float> texcoords;          // テクスチャ座標(u, vの組)
+  std::vector<int64_t> indices;          // 頂点位置の番号
+  std::vector<int64_t> normalIndices;    // 頂点法線の番号
+  std::vector<int64_t> texcoordIndices;  // テクスチャ座標の番号
+  bool hasAllNormals = true;    // 全ての面が法線の番号を持っているか
+  bool hasAllTexcoords = true;  // 全ての面がテクスチャ座標の番号を持っているか
+  bool valid = true;            // パースに成功したか
+};
+
+// OBJの面の頂点番号を区間内の表現に変換する
+inline int64_t objIndex(int64_t idx, size_t count) {
+  if (idx > 0) return idx - 1;
+  return int64_t(count) + idx - ObjChunk::relativeIndexBias;
+}
+
+inline void parseObjChunk(const char* p, const char* end, ObjChunk& chunk) {
+  std::vector<int64_t> facePos, faceNrm, faceTex;
+  while (p < end) {
+    p = skipSpace(p, end);
+    if (p + 1 < end && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+      // 頂点位置
+      Vec3f v;
+      p += 1;
+      for (int i = 0; i < 3 && p; ++i) p = parseFloat(p, end, v[i]);
+      if (!p) {
+        chunk.valid = false;
+        return;
+      }
+      chunk.positions.push_back(v);
+    } else if (p + 2 < end && p[0] == 'v' && p[1] == 'n' &&
+               (p[2] == ' ' || p[2] == '\t')) {
+      // 頂点法線
+      Vec3f n;
+      p += 2;
+      for (int i = 0; i < 3 && p; ++i) p = parseFloat(p, end, n[i]);
+      if (!p) {
+        chunk.valid = false;
+        return;
+      }
+      chunk.normals.push_back(n);
+    } else if (p + 2 < end && p[0] == 'v' && p[1] == 't' &&
+               (p[2] == ' ' || p[2] == '\t')) {
+      // テクスチャ座標(3つ目の成分は無視する)
+      float uv[2];
+      p += 2;
+      for (int i = 0; i < 2 && p; ++i) p = parseFloat(p, end, uv[i]);
+      if (!p) {
+        chunk.valid = false;
+        return;
+      }
+      chunk.texcoords.push_back(uv[0]);
+      chunk.texcoords.push_back(uv[1]);
+    } else if (p + 1 < end && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+      // 面(v, v/vt, v//vn, v/vt/vn)
+      p += 1;
+      facePos.clear();
+      faceNrm.clear();
+      faceTex.clear();
+      while (true) {
+        p = skipSpace(p, end);
+        if (p >= end || *p == '\n' || *p == '\r' || *p == '#') break;
+
+        int64_t v = 0, vt = 0, vn = 0;
+        auto res = std::from_chars(p, end, v);
+        if (res.ec != std::errc() || v == 0) {
+          chunk.valid = false;
+          return;
+        }
+        p = res.ptr;
+        if (p < end && *p == '/') {
+          ++p;
+          if (p < end && *p != '/') p = std::from_chars(p, end, vt).ptr;
+          if (p < end && *p == '/') {
+            ++p;
+            p = std::from_chars(p, end, vn).ptr;
+          }
+        }
+
+        facePos.push_back(objIndex(v, chunk.positions.size()));
+        faceNrm.push_back(vn == 0 ? 0 : objIndex(vn, chunk.normals.size()));
+        if (vn == 0) chunk.hasAllNormals = false;
+        faceTex.push_back(
+            vt == 0 ? 0 : objIndex(vt, chunk.texcoords.size() / 2));
+        if (vt == 0) chunk.hasAllTexcoords = false;
+      }
+
+      // 多角形は扇状に三角形分割する
+      for (size_t k = 1; k + 1 < facePos.size(); ++k) {
+        chunk.indices.push_back(facePos[0]);
+        chunk.indices.push_back(facePos[k]);
+        chunk.indices.push_back(facePos[k + 1]);
+        chunk.normalIndices.push_back(faceNrm[0]);
+        chunk.normalIndices.push_back(faceNrm[k]);
+        chunk.normalIndices.push_back(faceNrm[k + 1]);
+        chunk.texcoordIndices.push_back(faceTex[0]);
+        chunk.texcoordIndices.push_back(faceTex[k]);
+        chunk.texcoordIndices.push_back(faceTex[k + 1]);
+      }
+    }
+    p = skipLine(p, end);
+  }
+}
+
+// PLYのプロパティの型
+enum class PlyType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float, Double };
+
+inline bool parsePlyType(const std::string& s, PlyType& type) {
+  static const std::pair<const char*, PlyType> names[] = {
+      {"char", PlyType::Int8},      {"int8", PlyType::Int8},
+      {"uchar", PlyType::UInt8},    {"uint8", PlyType::UInt8},
+      {"short", PlyType::Int16},    {"int16", PlyType::Int16},
+      {"ushort", PlyType::UInt16},  {"uint16", PlyType::UInt16},
+      {"int", PlyType::Int32},      {"int32", PlyType::Int32},
+      {"uint", PlyType::UInt32},    {"uint32", PlyType::UInt32},
+      {"float", PlyType::Float},    {"float32", PlyType::Float},
+      {"double", PlyType::Double},  {"float64", PlyType::Double}};
+  for (const auto& [name, t] : names) {
+    if (s == name) {
+      type = t;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline int plyTypeSize(PlyType type) {
+  switch (type) {
+    case PlyType::Int8:
+    case PlyType::UInt8:
+      return 1;
+    case PlyType::Int16:
+    case PlyType::UInt16:
+      return 2;
+    case PlyType::Int32:
+    case PlyType::UInt32:
+    case PlyType::Float:
+      return 4;
+    case PlyType::Double:
+      return 8;
+  }
+  return 0;
+}
+
+// バイナリのPLYから値を1つ読む
+// swapがtrueの場合はバイト順を入れ替える
+template <typename T>
+inline T readPly(const char* p, PlyType type, bool swap) {
+  unsigned char buf[8];
+  const int size = plyTypeSize(type);
+  std::memcpy(buf, p, size);
+  if (swap) std::reverse(buf, buf + size);
+
+  switch (type) {
+    case PlyType::Int8: {
+      int8_t v;
+      std::memcpy(&v, buf, 1);
+      return T(v);
+    }
+    case PlyType::UInt8:
+      return T(buf[0]);
+    case PlyType::Int16: {
+      int16_t v;
+      std::memcpy(&v, buf, 2);
+      return T(v);
+    }
+    case PlyType::UInt16: {
+      uint16_t v;
+      std::memcpy(&v, buf, 2);
+      return T(v);
+    }
+    case PlyType::Int32: {
+      int32_t v;
+      std::memcpy(&v, buf, 4);
+      return T(v);
+    }
+    case PlyType::UInt32: {
+      uint32_t v;
+      std::memcpy(&v, buf, 4);
+      return T(v);
+    }
+    case PlyType::Float: {
+      float v;
+      std::memcpy(&v, buf, 4);
+      return T(v);
+    }
+    case PlyType::Double: {
+      double v;
+      std::memcpy(&v, buf, 8);
+      return T(v);
+    }
+  }
+  return T(0);
+}
+
+struct PlyProperty {
+  std::string name;
+  PlyType type;
+  bool isList = false;
+  PlyType countType;  // リストの要素数の型
+};
+
+struct PlyElement {
+  std::string name;
+  size_t count;
+  std::vector<PlyProperty> properties;
+
+  // 全てのプロパティが固定長の場合の1要素のサイズ(リストを含む場合は-1)
+  int stride() const {
+    int size = 0;
+    for (const auto& prop : properties) {
+      if (prop.isList) return -1;
+      size += plyTypeSize(prop.type);
+    }
+    return size;
+  }
+
+  // プロパティの先頭からのオフセット(見つからない場合は-1)
+  int offsetOf(const std::string& name) const {
+    int offset = 0;
+    for (const auto& prop : properties) {
+      if (prop.name == name) return offset;
+      offset += plyTypeSize(prop.type);
+    }
+    return -1;
+  }
+
+  const PlyProperty* find(const std::string& name) const {
+    for (const auto& prop : properties) {
+      if (prop.name == name) return &prop;
+    }
+    return nullptr;
+  }
+};
+
+}  // namespace mesh_loader
+
+// OBJファイルを読み込む
+// ファイルをメモリマップし, 行単位に分割した区間を並列にパースする
+inline std::shared_ptr<TriangleMesh> loadOBJ(const std::string& filename) {
+  using namespace mesh_loader;
+
+  MappedFile file(filename);
+  if (!file.isOpen()) {
+    std::cerr << "failed to open " << filename << std::endl;
+    return nullptr;
+  }
+
+  const int nChunks = 4 * omp_get_max_threads();
+  const auto bounds = splitLines(
+      file.getData(), file.getData() + file.getSize(), nChunks);
+  std::vector<ObjChunk> chunks(nChunks);
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int k = 0; k < nChunks; ++k) {
+    parseObjChunk(bounds[k], bounds[k + 1], chunks[k]);
+  }
+
+  // 各区間の先頭の要素番号を計算する
+  std::vector<size_t> posOffset(nChunks + 1, 0), nrmOffset(nChunks + 1, 0),
+      texOffset(nChunks + 1, 0), idxOffset(nChunks + 1, 0);
+  bool hasAllNormals = true, hasAllTexcoords = true;
+  for (int k = 0; k < nChunks; ++k) {
+    if (!chunks[k].valid) {
+      std::cerr << "failed to parse " << filename << std::endl;
+      return nullptr;
+    }
+    posOffset[k + 1] = posOffset[k] + chunks[k].positions.size();
+    nrmOffset[k + 1] = nrmOffset[k] + chunks[k].normals.size();
+    texOffset[k + 1] = texOffset[k] + chunks[k].texcoords.size() / 2;
+    idxOffset[k + 1] = idxOffset[k] + chunks[k].indices.size();
+    hasAllNormals = hasAllNormals && chunks[k].hasAllNormals;
+    hasAllTexcoords = hasAllTexcoords && chunks[k].hasAllTexcoords;
+  }
+  // NOTE: 法線の番号を持たない面が1つでもあれば全て面法線を使う.
+  // テクスチャ座標も同様で, 持たない場合は重心座標を使う
+  hasAllNormals = hasAllNormals && nrmOffset[nChunks] > 0;
+  hasAllTexcoords = hasAllTexcoords && texOffset[nChunks] > 0;
+
+  std::vector<Vec3f> positions(posOffset[nChunks]);
+  std::vector<Vec3f> normals(hasAllNormals ? nrmOffset[nChunks] : 0);
+  std::vector<uint32_t> indices(idxOffset[nChunks]);
+  std::vector<uint32_t> normalIndices(hasAllNormals ? idxOffset[nChunks] : 0);
+  std::vector<float> texcoords(hasAllTexcoords ? 2 * texOffset[nChunks] : 0);
+  std::vector<uint32_t> texcoordIndices(hasAllTexcoords ? idxOffset[nChunks]
+                                                        : 0);
+
+  // 区間ごとの結果を結合し, 相対参照を解決する
+  bool outOfRange = false;
+#pragma omp parallel for schedule(dynamic, 1) reduction(|| : outOfRange)
+  for (int k = 0; k < nChunks; ++k) {
+    const ObjChunk& chunk = chunks[k];
+    std::copy(chunk.positions.begin(), chunk.positions.end(),
+              positions.begin() + posOffset[k]);
+    const auto resolve = [](int64_t idx, size_t offset) {
+      return idx < 0 ? idx + ObjChunk::relativeIndexBias + int64_t(offset)
+                     : idx;
+    };
+    for (size_t i = 0; i < chunk.indices.size(); ++i) {
+      const int64_t idx = resolve(chunk.indices[i], posOffset[k]);
+      outOfRange = outOfRange || idx < 0 || idx >= int64_t(positions.size());
+      indices[idxOffset[k] + i] = idx;
+    }
+    if (hasAllNormals) {
+      std::copy(chunk.normals.begin(), chunk.normals.end(),
+                normals.begin() + nrmOffset[k]);
+      for (size_t i = 0; i < chunk.normalIndices.size(); ++i) {
+        const int64_t idx = resolve(chunk.normalIndices[i], nrmOffset[k]);
+        outOfRange = outOfRange || idx < 0 || idx >= int64_t(normals.size());
+        normalIndices[idxOffset[k] + i] = idx;
+      }
+    }
+    if (hasAllTexcoords) {
+      std::copy(chunk.texcoords.begin(), chunk.texcoords.end(),
+                texcoords.begin() + 2 * texOffset[k]);
+      for (size_t i = 0; i < chunk.texcoordIndices.size(); ++i) {
+        const int64_t idx = resolve(chunk.texcoordIndices[i], texOffset[k]);
+        outOfRange =
+            outOfRange || idx < 0 || idx >= int64_t(texcoords.size() / 2);
+        texcoordIndices[idxOffset[k] + i] = idx;
+      }
+    }
+  }
+  if (outOfRange) {
+    std::cerr << "invalid vertex index in " << filename << std::endl;
+    return nullptr;
+  }
+
+  return std::make_shared<TriangleMesh>(
+      std::move(positions), std::move(normals), std::move(indices),
+      std::move(normalIndices), std::move(texcoords),
+      std::move(texcoordIndices));
+}
+
+// バイナリPLYファイルを読み込む
+// 頂点と, 全ての面が三角形の場合の面は並列に読み込む
+inline std::shared_ptr<TriangleMesh> loadPLY(const std::string& filename) {
+  using namespace mesh_loader;
+
+  MappedFile file(filename);
+  if (!file.isOpen()) {
+    std::cerr << "failed to open " << filename << std::endl;
+    return nullptr;
+  }
+  const char* const fileEnd = file.getData() + file.getSize();
+
+  // ヘッダーの読み込み
+  const char* p = file.getData();
+  std::vector<PlyElement> elements;
+  bool swap = false;
+  bool headerEnded = false;
+  bool isPLY = false;
+  while (p < fileEnd) {
+    const char* lineEnd = p;
+    while (lineEnd < fileEnd && *lineEnd != '\n') ++lineEnd;
+    std::istringstream line(std::string(p, lineEnd));
+    p = lineEnd < fileEnd ? lineEnd + 1 : fileEnd;
+
+    std::string keyword;
+    line >> keyword;
+    if (keyword == "ply") {
+      isPLY = true;
+    } else if (keyword == "format") {
+      std::string format;
+      line >> format;
+      if (format == "binary_big_endian") {
+        swap = true;
+      } else if (format != "binary_little_endian") {
+        std::cerr << "unsupported PLY format " << format << " in " << filename
+                  << std::endl;
+        return nullptr;
+      }
+    } else if (keyword == "element") {
+      PlyElement element;
+      line >> element.name >> element.count;
+      elements.push_back(element);
+    } else if (keyword == "property" && !elements.empty()) {
+      PlyProperty prop;
+      std::string type;
+      line >> type;
+      bool ok;
+      if (type == "list") {
+        std::string countType, indexType;
+        line >> countType >> indexType;
+        prop.isList = true;
+        ok = parsePlyType(countType, prop.countType) &&
+             parsePlyType(indexType, prop.type);
+      } else {
+        ok = parsePlyType(type, prop.type);
+      }
+      line >> prop.name;
+      if (!ok) {
+        std::cerr << "unsupported PLY property type in " << filename
+                  << std::endl;
+        return nullptr;
+      }
+      elements.back().properties.push_back(prop);
+    } else if (keyword == "end_header") {
+      headerEnded = true;
+      break;
+    }
+  }
+  if (!isPLY || !headerEnded) {
+    std::cerr << "invalid PLY header in " << filename << std::endl;
+    return nullptr;
+  }
+
+  // NOTE: 本体のサイズが足りない場合は途中で失敗として扱う
+  const auto fail = [&]() -> std::shared_ptr<TriangleMesh> {
+    std::cerr << "failed to parse " << filename << std::endl;
+    return nullptr;
+  };
+
+  std::vector<Vec3f> positions, normals;
+  std::vector<float> texcoords;
+  std::vector<uint32_t> indices;
+  for (const auto& element : elements) {
+    const int stride = element.stride();
+
+    if (element.name == "vertex") {
+      const PlyProperty* props[8] = {element.find("x"),  element.find("y"),
+                                     element.find("z"),  element.find("nx"),
+                                     element.find("ny"), element.find("nz"),
+                                     nullptr,            nullptr};
+      // テクスチャ座標のプロパティ名は書き出したツールによって異なる
+      static const char* const uvNames[][2] = {
+          {"u", "v"}, {"s", "t"}, {"texture_u", "texture_v"}};
+      for (const auto& names : uvNames) {
+        if (element.find(names[0]) && element.find(names[1])) {
+          props[6] = element.find(names[0]);
+          props[7] = element.find(names[1]);
+          break;
+        }
+      }
+      if (stride < 0 || !props[0] || !props[1] || !props[2]) return fail();
+      if (p + stride * element.count > fileEnd) return fail();
+      const bool hasNormals = props[3] && props[4] && props[5];
+      const bool hasTexcoords = props[6] && props[7];
+      int offsets[8];
+      for (int i = 0; i < 8; ++i) {
+        offsets[i] = props[i] ? element.offsetOf(props[i]->name) : 0;
+      }
+
+      positions.resize(element.count);
+      normals.resize(hasNormals ? element.count : 0);
+      texcoords.resize(hasTexcoords ? 2 * element.count : 0);
+      const char* base = p;
+#pragma omp parallel for
+      for (int64_t i = 0; i < int64_t(element.count); ++i) {
+        const char* v = base + stride * i;
+        for (int k = 0; k < 3; ++k) {
+          positions[i][k] =
+              readPly<float>(v + offsets[k], props[k]->type, swap);
+        }
+        if (hasNormals) {
+          for (int k = 0; k < 3; ++k) {
+            normals[i][k] =
+                readPly<float>(v + offsets[3 + k], props[3 + k]->type, swap);
+          }
+        }
+        if (hasTexcoords) {
+          for (int k = 0; k < 2; ++k) {
+            texcoords[2 * i + k] =
+                readPly<float>(v + offsets[6 + k], props[6 + k]->type, swap);
+          }
+        }
+      }
+      p += stride * element.count;
+    } else if (element.name == "face") {
+      const PlyProperty* list = element.find("vertex_indices");
+      if (!list) list = element.find("vertex_index");
+      if (!list || !list->isList) return fail();
+
+      // 面が三角形のリストだけで構成されていれば固定長として並列に読む
+      const int countSize = plyTypeSize(list->countType);
+      const int indexSize = plyTypeSize(list->type);
+      const int triStride = countSize + 3 * indexSize;
+      bool allTriangles = element.properties.size() == 1 &&
+                          p + triStride * element.count <= fileEnd;
+      if (allTriangles) {
+        const char* base = p;
+#pragma omp parallel for reduction(&& : allTriangles)
+        for (int64_t i = 0; i < int64_t(element.count); ++i) {
+          allTriangles = allTriangles &&
+                         readPly<int>(base + triStride * i, list->countType,
+                                      swap) == 3;
+        }
+      }
+
+      if (allTriangles) {
+        indices.resize(3 * element.count);
+        const char* base = p;
+#pragma omp parallel for
+        for (int64_t i = 0; i < int64_t(element.count); ++i) {
+          const char* f = base + triStride * i + countSize;
+          for (int k = 0; k < 3; ++k) {
+            indices[3 * i + k] =
+                readPly<uint32_t>(f + k * indexSize, list->type, swap);
+          }
+        }
+        p += triStride * element.count;
+      } else {
+        // 多角形を含む場合は逐次に読み, 扇状に三角形分割する
+        std::vector<uint32_t> face;
+        for (size_t i = 0; i < element.count; ++i) {
+          for (const auto& prop : element.properties) {
+            if (!prop.isList) {
+              p += plyTypeSize(prop.type);
+              continue;
+            }
+            if (p + plyTypeSize(prop.countType) > fileEnd) return fail();
+            const int n = readPly<int>(p, prop.countType, swap);
+            p += plyTypeSize(prop.countType);
+            if (n < 0 || p + n * plyTypeSize(prop.type) > fileEnd) {
+              return fail();
+            }
+            if (&prop == list) {
+              face.resize(n);
+              for (int k = 0; k < n; ++k) {
+                face[k] = readPly<uint32_t>(p + k * plyTypeSize(prop.type),
+                                            prop.type, swap);
+              }
+              for (int k = 1; k + 1 < n; ++k) {
+                indices.push_back(face[0]);
+                indices.push_back(face[k]);
+                indices.push_back(face[k + 1]);
+              }
+            }
+            p += n * plyTypeSize(prop.type);
+          }
+        }
+      }
+    } else {
+      // その他の要素は読み飛ばす
+      if (stride < 0) break;
+      p += stride * element.count;
+    }
+  }
+
+  for (const uint32_t idx : indices) {
+    if (idx >= positions.size()) {
+      std::cerr << "invalid vertex index in " << filename << std::endl;
+      return nullptr;
+    }
+  }
+
+  return std::make_shared<TriangleMesh>(
+      std::move(positions), std::move(normals), std::move(indices),
+      std::vector<uint32_t>(), std::move(texcoords));
+}
+
+// 拡張子に応じてOBJ, PLYファイルを読み込む
+inline std::shared_ptr<TriangleMesh> loadMesh(const std::string& filename) {
+  const auto ext = filename.substr(filename.find_last_of('.') + 1);
+  if (ext == "obj" || ext == "OBJ") return loadOBJ(filename);
+  if (ext == "ply" || ext == "PLY") return loadPLY(filename);
+
+  std::cerr << "unsupported mesh format: " << filename << std::endl;
+  return nullptr;
+}
+
+#endif
@@ -0,0 +1,565 @@
+#ifndef _PHOTON_MAPPING_H
+#define _PHOTON_MAPPING_H
+#include <omp.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "camera.h"
+#include "image.h"
+#include "intersect-info.h"
+#include "ray.h"
+#include "sampler.h"
+#include "sampling.h"
+#include "scene.h"
+#include "stats.h"
+#include "texture.h"
+
+// 確率的プログレッシブフォトンマッピング(SPPM)の設定
+struct PhotonMappingSettings {
+  int iterations = 64;               // 反復回数
+  int photonsPerIteration = 200000;  // 1回の反復で放射するフォトン数
+  float initialRadius = 0;  // 収集半径の初期値(0ならシーンの大きさで決める)
+  float alpha = 2.0f / 3;   // 収集したフォトンのうち次に残す割合(0, 1)
+  int maxDepth = 16;        // 最大反射回数
+  float timeBudget = 0;     // 制限時間[s](0なら制限しない)
+};
+
+// 物体表面に到達したフォトン
+struct Photon {
+  Vec3f pos;    // 位置
+  Vec3f wi;     // 来た方向(表面から外向き)
+  Vec3f power;  // 放射束(放射したフォトン数で割る前)
+};
+
+// フォトンを一様格子のセルごとにまとめたハッシュ表
+// セルの一辺は収集半径の2倍以上にして, 半径内のフォトンは各軸2個ずつ,
+// 高々8個のセルだけから探す
+// NOTE: 構築はセルごとの数え上げ, 累積和, 書き込みの計数ソートで並列に
+// 行う. 同じセル内はフォトンの番号順に並べ直すので, 結果はスレッド数に
+// よらない
+class PhotonGrid {
+ public:
+  // photonsを一辺cellSizeのセルに分けて登録する
+  void build(const std::vector<Photon>& photons, float cellSize,
+             int nThreads) {
+    const int n = photons.size();
+    invCellSize = 1.0f / cellSize;
+    // バケット数はフォトン数以上の2のべき乗
+    nBuckets = 1;
+    while (nBuckets < n) nBuckets <<= 1;
+
+    // フォトンごとのバケットの番号
+    std::vector<uint32_t> bucket(n);
+    bucketStart.assign(nBuckets + 1, 0);
+#pragma omp parallel for num_threads(nThreads)
+    for (int k = 0; k < n; ++k) {
+      bucket[k] = bucketOf(cellOf(photons[k].pos));
+#pragma omp atomic
+      ++bucketStart[bucket[k] + 1];
+    }
+    for (uint32_t b = 0; b < nBuckets; ++b) {
+      bucketStart[b + 1] += bucketStart[b];
+    }
+
+    // バケットの範囲にフォトンの番号を書き込み, 番号順に並べ直す
+    std::vector<uint32_t> cursor(bucketStart.begin(), bucketStart.end() - 1);
+    std::vector<uint32_t> order(n);
+#pragma omp parallel for num_threads(nThreads)
+    for (int k = 0; k < n; ++k) {
+      uint32_t idx;
+#pragma omp atomic capture
+      idx = cursor[bucket[k]]++;
+      order[idx] = k;
+    }
+#pragma omp parallel for schedule(dynamic, 1024) num_threads(nThreads)
+    for (int b = 0; b < int(nBuckets); ++b) {
+      std::sort(order.begin() + bucketStart[b],
+                order.begin() + bucketStart[b + 1]);
+    }
+
+    sorted.resize(n);
+#pragma omp parallel for num_threads(nThreads)
+    for (int k = 0; k < n; ++k) {
+      sorted[k] = photons[order[k]];
+    }
+  }
+
+  // 点posから距離radius以内のフォトンについてf(photon)を呼ぶ
+  // NOTE: radiusはセルの一辺の半分より小さくなければならない.
+  // 丸め誤差で3個のセルにかかっても, 各軸2個までしか探さない
+  template <typename F>
+  void lookup(const Vec3f& pos, float radius, F&& f) const {
+    if (sorted.empty()) return;
+    const Cell c0 = cellOf(pos - Vec3f(radius));
+    Cell c1 = cellOf(pos + Vec3f(radius));
+    c1.x = std::min(c1.x, c0.x + 1);
+    c1.y = std::min(c1.y, c0.y + 1);
+    c1.z = std::min(c1.z, c0.z + 1);
+
+    // 異なるセルが同じバケットになる場合は1回だけ探す
+    uint32_t buckets[8];
+    int nVisited = 0;
+    for (int z = c0.z; z <= c1.z; ++z) {
+      for (int y = c0.y; y <= c1.y; ++y) {
+        for (int x = c0.x; x <= c1.x; ++x) {
+          const uint32_t b = bucketOf({x, y, z});
+          if (std::find(buckets, buckets + nVisited, b) !=
+              buckets + nVisited) {
+            continue;
+          }
+          buckets[nVisited++] = b;
+
+          for (uint32_t k = bucketStart[b]; k < bucketStart[b + 1]; ++k) {
+            if (length2(sorted[k].pos - pos) <= radius * radius) {
+              f(sorted[k]);
+            }
+          }
+        }
+      }
+    }
+  }
+
+ private:
+  struct Cell {
+    int x, y, z;
+  };
+
+  float invCellSize = 1;
+  uint32_t nBuckets = 1;
+  std::vector<uint32_t> bucketStart;  // バケットの先頭(nBuckets + 1個)
+  std::vector<Photon> sorted;         // バケット順に並べたフォトン
+
+  Cell cellOf(const Vec3f& p) const {
+    return {int(std::floor(p[0] * invCellSize)),
+            int(std::floor(p[1] * invCellSize)),
+            int(std::floor(p[2] * invCellSize))};
+  }
+
+  uint32_t bucketOf(const Cell& c) const {
+    const uint32_t h = (uint32_t(c.x) * 73856093u) ^
+                       (uint32_t(c.y) * 19349663u) ^
+                       (uint32_t(c.z) * 83492791u);
+    return h & (nBuckets - 1);
+  }
+};
+
+// 確率的プログレッシブフォトンマッピング(SPPM)
+// 反復ごとに, カメラから最初の拡散面までレイを追跡して画素ごとの可視点を
+// 求め, 光源から放射したフォトンを可視点の周りの収集半径内で集める.
+// 集めたフォトン数に応じて半径を縮めていくので, 反復を重ねると偏りが
+// 消えていく. 光源サンプリングでは届かない屈折や鏡面反射を経た光
+// (コースティクス)がパストレーシングより速く収束する
+// NOTE: 可視点での直接光はPathTracingと同じ光源サンプリングとBSDF
+// SamplingのMISで計算し, フォトンは1回以上反射したものだけを集める.
+// フォトンは光源(AreaLight)からだけ放射するので, 空の光の相互反射は
+// 含まれない
+class ProgressivePhotonMapping {
+ public:
+  ProgressivePhotonMapping(const PhotonMappingSettings& settings)
+      : settings(settings) {}
+
+  // sceneをcameraから見た画像をimageに書き込み, 行った反復回数を返す
+  // samplers, threadStatsはスレッドごとに用意する. onIterationを指定した
+  // 場合は各反復の後に画像を更新してonIteration(iteration)を呼ぶ
+  int render(const Scene& scene, const Camera& camera, Image& image,
+             const std::vector<std::unique_ptr<Sampler>>& samplers,
+             std::vector<stats::RenderStats>& threadStats,
+             const std::function<void(int)>& onIteration = nullptr) {
+    using Clock = std::chrono::steady_clock;
+    const auto deadline =
+        Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                           std::chrono::duration<float>(settings.timeBudget));
+    const int nThreads = samplers.size();
+    const int width = image.getWidth();
+    const int height = image.getHeight();
+
+    pixels.assign(width * height, Pixel());
+    const float radius = settings.initialRadius > 0
+                             ? settings.initialRadius
+                             : defaultRadius(scene);
+    for (Pixel& px : pixels) px.radius = radius;
+    prepareLights(scene);
+
+    int iteration = 0;
+    while (iteration < settings.iterations) {
+      traceCameraPaths(scene, camera, width, height, iteration, samplers,
+                       threadStats);
+      tracePhotons(scene, iteration, samplers, threadStats);
+      gatherPhotons(nThreads);
+      ++iteration;
+
+      if (onIteration) {
+        resolve(image, iteration);
+        onIteration(iteration);
+      }
+      if (settings.timeBudget > 0 && Clock::now() >= deadline) break;
+    }
+
+    resolve(image, iteration);
+    return iteration;
+  }
+
+ private:
+  // 画素ごとの状態
+  struct Pixel {
+    Vec3f ld{0};   // 直接光(カメラから見えた光源を含む)の和
+    Vec3f tau{0};  // 集めたフォトンの寄与(半径の縮小に合わせて補正)
+    float n = 0;   // 集めたフォトン数(半径の縮小に合わせて補正)
+    float radius;  // 収集半径
+
+    // 今回の反復の可視点(primがnullptrなら無し)
+    const Primitive* prim = nullptr;
+    Vec3f pos, normal, t, b;
+    Vec3f woTangent;
+    Vec3f beta;  // カメラから可視点までのf*cos / pdfの積
+    TexCoord tc;
+  };
+
+  static constexpr int chunkSize = 4096;  // 並列処理の単位のフォトン数
+
+  PhotonMappingSettings settings;
+  std::vector<Pixel> pixels;
+  std::vector<const Primitive*> lights;   // 放射束が正の光源
+  AliasTable lightTable;                  // 放射束に比例して光源を選ぶ
+  std::vector<std::vector<Photon>> chunkPhotons;  // チャンクごとのフォトン
+  std::vector<Photon> photons;
+  PhotonGrid grid;
+
+  // シーンのAABBの対角線の長さの0.5%
+  static float defaultRadius(const Scene& scene) {
+    if (scene.primitives.empty()) return 1.0f;
+    AABB bounds = scene.primitives[0].getShape().getBounds();
+    for (const auto& primitive : scene.primitives) {
+      bounds = mergeAABB(bounds, primitive.getShape().getBounds());
+    }
+    return 0.005f * length(bounds[1] - bounds[0]);
+  }
+
+  // 光源ごとの放射束(輝度 x 面積)の表を作る
+  void prepareLights(const Scene& scene) {
+    lights.clear();
+    std::vector<float> weights;
+    for (const auto& primitive : scene.primitives) {
+      if (!primitive.areaLight) continue;
+      const float power =
+          luminance(primitive.areaLight->Le()) * primitive.shape->area();
+      if (power <= 0) continue;
+      lights.push_back(&primitive);
+      weights.push_back(power);
+    }
+    lightTable = AliasTable(weights);
+  }
+
+  // 可視点での直接光をPathTracingと同じMISで計算する
+  Vec3f directLight(const Scene& scene, const IntersectInfo& info,
+                    const Pixel& px, Sampler& sampler) const {
+    const BSDFRef& bsdfModel = info.hitPrimitive->getBSDF();
+    const bool nee = scene.canSampleLights();
+    Vec3f radiance(0);
+
+    // 光源サンプリング
+    if (nee) {
+      const float uSelect = sampler.getNext();
+      const float u = sampler.getNext();
+      const float v = sampler.getNext();
+      Vec3f wi;
+      float dist, lightPdf;
+      const Vec3f le = scene.sampleLightDirection(
+          info.hitPos, info.hitNormal, uSelect, u, v, wi, dist, lightPdf);
+      if (lightPdf > 0) {
+        const Vec3f wiTangent = worldToLocal(wi, px.t, px.normal, px.b);
+        const Vec3f f = bsdfModel.eval(px.tc, px.woTangent, wiTangent);
+        STATS_INC(ShadowRays);
+        if ((f[0] > 0 || f[1] > 0 || f[2] > 0) &&
+            !scene.occluded(Ray(info.hitPos, wi), dist)) {
+          const float bsdfPdf = bsdfModel.pdf(px.woTangent, wiTangent);
+          const float weight = powerHeuristic(lightPdf, bsdfPdf);
+          const float cos = std::abs(dot(wi, info.hitNormal));
+          radiance += weight * f * cos * le / lightPdf;
+        }
+      }
+    }
+
+    // BSDF Sampling(光源か空に直接当たった場合だけ加える)
+    float pdf;
+    Vec3f wiTangent;
+    const Vec3f f =
+        bsdfModel.sample(px.tc, sampler, px.woTangent, wiTangent, pdf);
+    if (pdf == 0 || wiTangent[1] == 0) return radiance;
+    const Vec3f wi = localToWorld(wiTangent, px.t, px.normal, px.b);
+    const Vec3f beta = f * std::abs(dot(wi, info.hitNormal)) / pdf;
+
+    STATS_INC(SecondaryRays);
+    IntersectInfo hit;
+    if (!scene.intersect(Ray(info.hitPos, wi), hit)) {
+      float weight = 1.0f;
+      if (nee && scene.sky.hasEnvironmentMap()) {
+        weight = powerHeuristic(pdf, scene.skyPdf(wi));
+      }
+      radiance += weight * beta * scene.sky.Le(wi);
+    } else if (hit.hitPrimitive->areaLight) {
+      float weight = 1.0f;
+      if (nee) {
+        const float lightPdf =
+            scene.lightPdf(*hit.hitPrimitive, info.hitPos, info.hitNormal) *
+            hit.hitPrimitive->getShape().pdf(info.hitPos, hit.hitPos,
+                                             hit.hitNormal);
+        weight = powerHeuristic(pdf, lightPdf);
+      }
+      radiance += weight * beta * hit.hitPrimitive->areaLight->Le();
+    }
+    return radiance;
+  }
+
+  // 画素ごとにカメラからデルタ関数のBSDFを辿り, 最初の拡散面を可視点に
+  // する. 途中で当たった光源と空, 可視点での直接光をldに加える
+  void traceCameraPaths(const Scene& scene, const Camera& camera, int width,
+                        int height, int iteration,
+                        const std::vector<std::unique_ptr<Sampler>>& samplers,
+                        std::vector<stats::RenderStats>& threadStats) {
+#pragma omp parallel num_threads(samplers.size())
+    {
+      const int threadIdx = omp_get_thread_num();
+      stats::current = &threadStats[threadIdx];
+      Sampler& sampler = *samplers[threadIdx];
+#pragma omp for schedule(dynamic, 1)
+      for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+          Pixel& px = pixels[i + width * j];
+          px.prim = nullptr;
+          sampler.startPixelSample(i, j, iteration);
+
+          const float u = (2.0f * (i + sampler.getNext()) - width) / height;
+          const float v = (2.0f * (j + sampler.getNext()) - height) / height;
+          Ray ray = camera.sampleRay(u, v);
+          ray.coneSpread = camera.pixelSpread(2.0f / height);
+          STATS_INC(PrimaryRays);
+
+          Vec3f beta(1);
+          for (int depth = 0; depth < settings.maxDepth; ++depth) {
+            IntersectInfo info;
+            if (!scene.intersect(ray, info)) {
+              px.ld += beta * scene.sky.Le(ray.direction);
+              break;
+            }
+            if (info.hitPrimitive->areaLight) {
+              px.ld += beta * info.hitPrimitive->areaLight->Le();
+              break;
+            }
+
+            tangentSpaceBasis(info.hitNormal, px.t, px.b);
+            px.normal = info.hitNormal;
+            px.woTangent =
+                worldToLocal(-ray.direction, px.t, info.hitNormal, px.b);
+            px.tc = texCoordAt(ray, info);
+
+            const BSDFRef& bsdfModel = info.hitPrimitive->getBSDF();
+            if (!bsdfModel.isDelta()) {
+              px.ld += beta * directLight(scene, info, px, sampler);
+              px.prim = info.hitPrimitive;
+              px.pos = info.hitPos;
+              px.beta = beta;
+              break;
+            }
+
+            float pdf;
+            Vec3f wiTangent;
+            const Vec3f f =
+                bsdfModel.sample(px.tc, sampler, px.woTangent, wiTangent, pdf);
+            if (pdf == 0 || wiTangent[1] == 0) break;
+            STATS_INC(Bounces);
+            const Vec3f wi =
+                localToWorld(wiTangent, px.t, info.hitNormal, px.b);
+            beta *= f * std::abs(dot(wi, info.hitNormal)) / pdf;
+
+            ray.coneWidth = ray.coneWidthAt(info.t);
+            ray.origin = info.hitPos;
+            ray.direction = wi;
+            STATS_INC(SecondaryRays);
+          }
+        }
+      }
+      stats::current = nullptr;
+    }
+  }
+
+  // 光源からフォトンを放射して追跡し, 拡散面に到達したものを記録する
+  // NOTE: チャンクごとに記録して番号順につなげるので, 結果はスレッド数に
+  // よらない
+  void tracePhotons(const Scene& scene, int iteration,
+                    const std::vector<std::unique_ptr<Sampler>>& samplers,
+                    std::vector<stats::RenderStats>& threadStats) {
+    const int nPhotons = lights.empty() ? 0 : settings.photonsPerIteration;
+    const int nChunks = (nPhotons + chunkSize - 1) / chunkSize;
+    chunkPhotons.resize(nChunks);
+
+#pragma omp parallel num_threads(samplers.size())
+    {
+      const int threadIdx = omp_get_thread_num();
+      stats::current = &threadStats[threadIdx];
+      Sampler& sampler = *samplers[threadIdx];
+#pragma omp for schedule(dynamic, 1)
+      for (int c = 0; c < nChunks; ++c) {
+        chunkPhotons[c].clear();
+        const int end = std::min((c + 1) * chunkSize, nPhotons);
+        for (int k = c * chunkSize; k < end; ++k) {
+          // NOTE: カメラのサンプルと重ならないように負の画素番号を使う
+          sampler.startPixelSample(iteration, -1, k);
+          tracePhoton(scene, sampler, chunkPhotons[c]);
+        }
+      }
+      stats::current = nullptr;
+    }
+
+    size_t total = 0;
+    for (const auto& chunk : chunkPhotons) total += chunk.size();
+    photons.clear();
+    photons.reserve(total);
+    for (const auto& chunk : chunkPhotons) {
+      photons.insert(photons.end(), chunk.begin(), chunk.end());
+    }
+  }
+
+  // フォトンを1つ放射して追跡する
+  void tracePhoton(const Scene& scene, Sampler& sampler,
+                   std::vector<Photon>& out) const {
+    // 放射束に比例して光源を選び, 面上の点を一様に選ぶ
+    float pmf, uRemapped;
+    const Primitive& light =
+        *lights[lightTable.sample(sampler.getNext(), pmf, uRemapped)];
+    const Shape& shape = *light.shape;
+    const float u = sampler.getNext();
+    const float v = sampler.getNext();
+    Vec3f n;
+    const Vec3f p = shape.samplePoint(u, v, n);
+
+    // 両面のどちらかからcosに比例した方向に放射する
+    if (sampler.getNext() < 0.5f) n = -n;
+    const float u2 = sampler.getNext();
+    const float v2 = sampler.getNext();
+    float pdfDir;
+    Vec3f t, b;
+    tangentSpaceBasis(n, t, b);
+    const Vec3f dir =
+        localToWorld(sampleCosineHemisphere(u2, v2, pdfDir), t, n, b);
+
+    // Le * cos / (pdfの積) = Le * 2 * pi * 面積 / pmf
+    Vec3f beta = light.areaLight->Le() * (2 * PI * shape.area() / pmf);
+    Ray ray(p, dir);
+    // NOTE: 拡散光源からの放射なので粗いmipmapを参照させる
+    ray.coneSpread = diffuseConeSpread;
+
+    for (int depth = 0; depth < settings.maxDepth; ++depth) {
+      STATS_INC(SecondaryRays);
+      IntersectInfo info;
+      if (!scene.intersect(ray, info)) break;
+      // 光源は反射しない
+      if (info.hitPrimitive->areaLight) break;
+
+      const BSDFRef& bsdfModel = info.hitPrimitive->getBSDF();
+      // 光源から直接届いたフォトンは直接光と重なるので記録しない
+      if (depth > 0 && !bsdfModel.isDelta()) {
+        out.push_back({info.hitPos, -ray.direction, beta});
+      }
+
+      Vec3f t, b;
+      tangentSpaceBasis(info.hitNormal, t, b);
+      const Vec3f woTangent =
+          worldToLocal(-ray.direction, t, info.hitNormal, b);
+      const TexCoord tc = texCoordAt(ray, info);
+      float pdf;
+      Vec3f wiTangent;
+      const Vec3f f = bsdfModel.sample(tc, sampler, woTangent, wiTangent, pdf);
+      if (pdf == 0 || wiTangent[1] == 0) break;
+      const Vec3f wi = localToWorld(wiTangent, t, info.hitNormal, b);
+      Vec3f betaNew = beta * f * std::abs(dot(wi, info.hitNormal)) / pdf;
+      // NOTE: BSDFは放射輝度を屈折率の比の2乗で補正しないので,
+      // 光源からの追跡では屈折した側の屈折率に応じて放射束を補正する.
+      // これでカメラからの追跡(PathTracing)と同じ結果に収束する
+      if (woTangent[1] * wiTangent[1] < 0) {
+        const float eta = bsdfModel.getIOR();
+        betaNew *= woTangent[1] > 0 ? 1.0f / (eta * eta) : eta * eta;
+      }
+
+      // ロシアンルーレット
+      // NOTE: 反射率の分だけ打ち切り, 生き残ったフォトンの放射束を保つ
+      const float lum = luminance(beta);
+      if (lum <= 0) break;
+      const float q = std::max(0.0f, 1.0f - luminance(betaNew) / lum);
+      if (sampler.getNext() < q) {
+        STATS_INC(RussianRouletteTerminations);
+        break;
+      }
+      beta = betaNew / (1 - q);
+
+      ray.coneWidth = ray.coneWidthAt(info.t);
+      ray.origin = info.hitPos;
+      ray.direction = wi;
+    }
+  }
+
+  // 可視点の周りのフォトンを集め, 半径と寄与を更新する
+  void gatherPhotons(int nThreads) {
+    const int nPixels = pixels.size();
+    float maxRadius = 0;
+#pragma omp parallel for reduction(max : maxRadius) num_threads(nThreads)
+    for (int k = 0; k < nPixels; ++k) {
+      if (pixels[k].prim) maxRadius = std::max(maxRadius, pixels[k].radius);
+    }
+    if (maxRadius == 0) return;
+    // NOTE: セルの一辺に余裕を持たせ, 丸め誤差があっても半径内の点が
+    // 各軸2個のセルに収まるようにする
+    grid.build(photons, 2.01f * maxRadius, nThreads);
+
+#pragma omp parallel for schedule(dynamic, 256) num_threads(nThreads)
+    for (int k = 0; k < nPixels; ++k) {
+      Pixel& px = pixels[k];
+      if (!px.prim) continue;
+      const BSDFRef& bsdfModel = px.prim->getBSDF();
+
+      Vec3f phi(0);
+      int m = 0;
+      grid.lookup(px.pos, px.radius, [&](const Photon& photon) {
+        const Vec3f wiTangent = worldToLocal(photon.wi, px.t, px.normal, px.b);
+        phi += photon.power * bsdfModel.eval(px.tc, px.woTangent, wiTangent);
+        ++m;
+      });
+      if (m == 0) continue;
+
+      // 集めたフォトンのうちalphaの割合だけ残るように半径を縮める
+      const float nNew = px.n + settings.alpha * m;
+      const float radiusNew = px.radius * std::sqrt(nNew / (px.n + m));
+      px.tau = (px.tau + px.beta * phi) *
+               (radiusNew * radiusNew / (px.radius * px.radius));
+      px.n = nNew;
+      px.radius = radiusNew;
+    }
+  }
+
+  // iteration回の反復の結果をimageに書き込む
+  void resolve(Image& image, int iteration) const {
+    const int width = image.getWidth();
+    const int height = image.getHeight();
+    const float nEmitted =
+        float(iteration) * float(settings.photonsPerIteration);
+#pragma omp parallel for
+    for (int j = 0; j < height; ++j) {
+      for (int i = 0; i < width; ++i) {
+        const Pixel& px = pixels[i + width * j];
+        Vec3f color = px.ld / float(std::max(iteration, 1));
+        if (nEmitted > 0) {
+          color += px.tau / (nEmitted * PI * px.radius * px.radius);
+        }
+        image.setPixel(i, j, color);
+      }
+    }
+  }
+};
+
+#endif
@@ -17,11 +17,20 @@ class Primitive {
   Primitive(const std::shared_ptr<Shape>& shape,
             const std::shared_ptr<BSDF>& bsdf,
             const std::shared_ptr<AreaLight>& areaLight = nullptr)
-      : shape(shape), bsdf(bsdf), areaLight(areaLight) {}
+      : shape(shape),
+        bsdf(bsdf),
+        areaLight(areaLight),
+        shapeRef(shape.get()),
+        bsdfRef(bsdf.get()) {}
+
+  // 仮想関数を介さずに呼び出すための形状, BSDFの参照
+  // NOTE: 構築後にshape, bsdfを差し替えてはいけない
+  const ShapeRef& getShape() const { return shapeRef; }
+  const BSDFRef& getBSDF() const { return bsdfRef; }
 
   bool intersect(const Ray& ray, IntersectInfo& info) const {
     IntersectInfo _info;
-    if (shape->intersect(ray, _info)) {
+    if (shapeRef.intersect(ray, _info)) {
       info = _info;
       info.hitPrimitive = this;
       return true;
@@ -29,6 +38,15 @@ class Primitive {
       return false;
     }
   }
+
+  // (ray.tmin, tmax)内に交差点があるかを判定する
+  bool occluded(const Ray& ray, float tmax) const {
+    return shapeRef.occluded(ray, tmax);
+  }
+
+ private:
+  ShapeRef shapeRef;
+  BSDFRef bsdfRef;
 };
 
 #endif
\ No newline at end of file
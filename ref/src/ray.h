@@ -3,16 +3,32 @@
 #include "vec3.h"
 
 struct Ray {
-  Vec3f origin;                         // 始点
-  Vec3f direction;                      // 方向
-  static constexpr float tmin = 1e-3f;  // 許容最小交差距離
-  static constexpr float tmax = 10000;  // 許容最大交差距離
+  Vec3f origin;     // 始点
+  Vec3f direction;  // 方向
+
+  // 許容する交差距離の既定値
+  static constexpr float defaultTmin = 1e-3f;
+  static constexpr float defaultTmax = 10000;
+
+  // 許容する交差距離の範囲
+  // NOTE: Instanceでジオメトリの座標系に変換したレイでは, 同じ範囲を
+  // その座標系の距離で表す
+  float tmin = defaultTmin;  // 許容最小交差距離
+  float tmax = defaultTmax;  // 許容最大交差距離
+
+  // レイのコーン(テクスチャのmipmapの選択に使う)
+  // NOTE: 可視判定のレイなどでは使わないので0のまま
+  float coneWidth = 0;   // 始点でのコーンの幅
+  float coneSpread = 0;  // 距離あたりのコーンの幅の広がり
 
   Ray(const Vec3f& origin, const Vec3f& direction)
       : origin(origin), direction(direction) {}
 
   // 始点から距離tの点を返す
   Vec3f operator()(float t) const { return origin + t * direction; }
+
+  // 始点から距離tでのコーンの幅
+  float coneWidthAt(float t) const { return coneWidth + t * coneSpread; }
 };
 
 #endif
\ No newline at end of file
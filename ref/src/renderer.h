@@ -2,62 +2,842 @@
 #define _RENDERER_H
 #include <omp.h>
 
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+#include "accumulation-buffer.h"
+#include "aov.h"
 #include "camera.h"
+#include "checkpoint.h"
+#include "denoiser.h"
+#include "distributed.h"
 #include "image.h"
 #include "integrator.h"
+#include "photon-mapping.h"
+#include "sampler.h"
 #include "scene.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "texture.h"
+#include "wavefront.h"
+
+// プログレッシブレンダリングの設定
+struct ProgressiveSettings {
+  int samplesPerPass = 4;        // 1パスで画素に追加するサンプル数
+  int minSamples = 16;           // 収束判定を始めるサンプル数
+  int maxSamples = 1024;         // 画素あたりの最大サンプル数
+  float errorThreshold = 0.05f;  // 目標とする相対誤差(0なら判定しない)
+  float timeBudget = 0;          // 制限時間[s](0なら制限しない)
+
+  // 途中経過の保存
+  // NOTE: サンプルは(画素, サンプル番号)だけで決まるので, 蓄積バッファを
+  // 保存すれば中断せずにレンダリングした場合と全く同じ結果で再開できる
+  std::string checkpointFile;     // 保存先(空なら保存しない)
+  float checkpointInterval = 60;  // 保存する間隔[s]
+  bool resume = false;  // checkpointFileがあれば続きからレンダリングする
+};
+
+// 画素ごとのコストAOVの種類
+enum class CostMetric {
+  None,               // 記録しない
+  Time,               // 1サンプルあたりの時間[ns]
+  IntersectionTests,  // 1サンプルあたりのBVHノードとPrimitiveの判定回数
+};
 
 class Renderer {
  private:
+  using Clock = std::chrono::steady_clock;
+
   Image image;
   std::shared_ptr<Camera> camera;
   std::shared_ptr<Integrator> integrator;
+  std::shared_ptr<Sampler> sampler;  // スレッドごとにcloneして使う
+  WavefrontPathTracing wavefront;  // renderWavefrontで使う
+
+  int tileSize = 16;                     // タイルの一辺の長さ[px]
+  int nThreads = omp_get_max_threads();  // レンダリングに使うスレッド数
+  bool pinThreads = false;               // スレッドをコアに固定するか
+
+  // プログレッシブレンダリング用
+  AccumulationBuffer accumulation;
+  std::vector<uint8_t> active;  // サンプルを追加する画素
+
+  // 統計(ENABLE_STATSを指定しない場合は時間とサンプル数だけ記録される)
+  stats::RenderStats renderStats;  // 全スレッドの統計の和
+  double renderSeconds = 0;        // 直前のレンダリングの経過時間[s]
+  uint64_t renderSamples = 0;      // 直前のレンダリングのサンプル数
+
+  // デノイザーのガイドに使う最初の交差点のAOV
+  bool useAOV = false;
+  AOVBuffer aov{0, 0};
+
+  // 画素ごとのコスト
+  CostMetric costMetric = CostMetric::None;
+  Image costImage{0, 0};
+
+  // 8bit画像の出力設定
+  bool useToneMapping = false;  // トーンマッピングを行うか
+  float exposure = 1.0f;        // 露出
+
+  // 8bit画像として出力するためにトーンマッピング, ガンマ補正した画像
+  // NOTE: レンダリング結果は変更しないので何度でも出力できる
+  Image toLDR() const {
+    Image ldr = image;
+    if (useToneMapping) ldr.toneMapping(exposure);
+    ldr.gammaCorrection();
+    return ldr;
+  }
+
+  // スレッドごとのSamplerを作る
+  std::vector<std::unique_ptr<Sampler>> cloneSamplers() const {
+    std::vector<std::unique_ptr<Sampler>> samplers(nThreads);
+    for (auto& s : samplers) {
+      s = sampler->clone();
+    }
+    return samplers;
+  }
+
+  // 画素(i, j)の放射輝度をindex番目のサンプルとして計算する
+  // aovSampleを指定した場合は最初の交差点のAOVも書き込む
+  Vec3f sample(const Scene& scene, int i, int j, uint32_t index,
+               Sampler& sampler, AOVSample* aovSample = nullptr) const {
+    const int width = image.getWidth();
+    const int height = image.getHeight();
+    sampler.startPixelSample(i, j, index);
+
+    // 最初のレイの生成
+    const Ray ray = [&]() {
+      STATS_TIMER(CameraRay);
+      // (u, v)の計算
+      const float u = (2.0f * (i + sampler.getNext()) - width) / height;
+      const float v = (2.0f * (j + sampler.getNext()) - height) / height;
+      Ray ray = camera->sampleRay(u, v);
+      // 1画素分のコーン
+      ray.coneSpread = camera->pixelSpread(2.0f / height);
+      return ray;
+    }();
+
+    // 最初の交差点のAOV
+    // NOTE: Integratorを変更しないように, 最初のレイの交差判定をもう1回行う
+    if (aovSample) {
+      *aovSample = AOVSample();
+      IntersectInfo info;
+      if (scene.intersect(ray, info)) {
+        aovSample->albedo =
+            info.hitPrimitive->getBSDF().albedo(texCoordAt(ray, info));
+        // 法線はカメラ側に向ける
+        aovSample->normal = dot(info.hitNormal, ray.direction) > 0
+                                ? -info.hitNormal
+                                : info.hitNormal;
+        aovSample->depth = info.t;
+      }
+    }
+
+    // 放射輝度の計算
+    return integrator->radiance(ray, scene, sampler);
+  }
+
+  // スレッドごとの統計を用意してレンダリングの開始時刻を返す
+  // NOTE: 各スレッドはタイルを処理する前にstats::currentを設定する
+  Clock::time_point beginStats(std::vector<stats::RenderStats>& threadStats) {
+    threadStats.assign(nThreads, stats::RenderStats());
+    if (useAOV) {
+      aov = AOVBuffer(image.getWidth(), image.getHeight());
+    }
+    if (costMetric != CostMetric::None) {
+      costImage = Image(image.getWidth(), image.getHeight());
+    }
+    return Clock::now();
+  }
+
+  // スレッドごとの統計をまとめる
+  void endStats(const std::vector<stats::RenderStats>& threadStats,
+                Clock::time_point start, uint64_t samples) {
+    renderSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    renderSamples = samples;
+    renderStats = stats::RenderStats();
+    for (const auto& s : threadStats) {
+      renderStats.merge(s);
+    }
+  }
+
+  // 画素のコストの計測に使う現在の値(時刻[ns]または判定回数)
+  uint64_t readCost() const {
+    if (costMetric == CostMetric::IntersectionTests) {
+      return stats::current->get(stats::Counter::BVHNodeVisits) +
+             stats::current->get(stats::Counter::IntersectionTests);
+    }
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               Clock::now().time_since_epoch())
+        .count();
+  }
+
+  // 収束していない画素を求めてactiveに書き込み, その数を返す
+  // NOTE: 少ないサンプルでは分散を過小評価しやすいので,
+  // 周囲3x3画素の最大の誤差で判定する
+  int updateActivePixels(const ProgressiveSettings& settings) {
+    const int width = image.getWidth();
+    const int height = image.getHeight();
+
+    std::vector<float> error(width * height);
+#pragma omp parallel for
+    for (int j = 0; j < height; ++j) {
+      for (int i = 0; i < width; ++i) {
+        error[i + width * j] = accumulation.getRelativeError(i, j);
+      }
+    }
+
+    int nActive = 0;
+#pragma omp parallel for reduction(+ : nActive)
+    for (int j = 0; j < height; ++j) {
+      for (int i = 0; i < width; ++i) {
+        const int n = accumulation.getCount(i, j);
+        bool isActive = n < settings.maxSamples;
+        if (isActive && n >= settings.minSamples &&
+            settings.errorThreshold > 0) {
+          float maxError = 0;
+          for (int y = std::max(j - 1, 0); y <= std::min(j + 1, height - 1);
+               ++y) {
+            for (int x = std::max(i - 1, 0); x <= std::min(i + 1, width - 1);
+                 ++x) {
+              maxError = std::max(maxError, error[x + width * y]);
+            }
+          }
+          isActive = maxError > settings.errorThreshold;
+        }
+        active[i + width * j] = isActive;
+        nActive += isActive;
+      }
+    }
+    return nActive;
+  }
+
+  // 途中経過の形式の版(形式を変えたら上げる)
+  static constexpr uint32_t checkpointVersion = 1;
+
+  struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint8_t hasAOV;   // AOVを含むか
+    uint8_t hasCost;  // コストを含むか
+    uint16_t reserved;
+    int32_t pass;            // 次に行うパスの番号
+    uint64_t totalSamples;  // それまでに追加したサンプル数
+  };
+
+  // renderProgressiveの途中経過(蓄積バッファ, AOV, コスト)を書き出す
+  std::vector<char> serializeCheckpoint(int pass,
+                                        uint64_t totalSamples) const {
+    binary_io::Writer writer;
+    writer.write(CheckpointHeader{{'P', 'B', 'R', 'C', 'K', 'P', 'T', '\0'},
+                                  checkpointVersion,
+                                  image.getWidth(),
+                                  image.getHeight(),
+                                  useAOV,
+                                  costMetric != CostMetric::None,
+                                  0,
+                                  pass,
+                                  totalSamples});
+    accumulation.write(writer);
+    if (useAOV) aov.write(writer);
+    if (costMetric != CostMetric::None) {
+      std::vector<float> costs;
+      costs.reserve(image.getWidth() * image.getHeight());
+      for (int j = 0; j < image.getHeight(); ++j) {
+        for (int i = 0; i < image.getWidth(); ++i) {
+          costs.push_back(costImage.getPixel(i, j)[0]);
+        }
+      }
+      writer.writeArray(costs);
+    }
+    return writer.getBuffer();
+  }
+
+  // 途中経過を読み込む
+  // NOTE: ファイルが無い場合や設定が異なる場合はfalseを返し,
+  // バッファは変更しない
+  bool readCheckpoint(const std::string& filename, int& pass,
+                      uint64_t& totalSamples) {
+    MappedFile file(filename);
+    if (!file.isOpen()) return false;
+    binary_io::Reader reader(file.getData(), file.getSize());
+
+    const auto fail = [&](const char* message) {
+      std::cerr << "failed to resume from " << filename << ": " << message
+                << std::endl;
+      return false;
+    };
+
+    CheckpointHeader header;
+    if (!reader.read(header) || std::string(header.magic, 7) != "PBRCKPT" ||
+        header.version != checkpointVersion) {
+      return fail("invalid checkpoint");
+    }
+    if (header.width != image.getWidth() ||
+        header.height != image.getHeight() || bool(header.hasAOV) != useAOV ||
+        bool(header.hasCost) != (costMetric != CostMetric::None)) {
+      return fail("settings do not match");
+    }
+
+    AccumulationBuffer loadedAccumulation(0, 0);
+    AOVBuffer loadedAOV(0, 0);
+    std::vector<float> costs;
+    if (!loadedAccumulation.read(reader) ||
+        (useAOV && !loadedAOV.read(reader)) ||
+        (header.hasCost && !reader.readArray(costs))) {
+      return fail("invalid checkpoint");
+    }
+    if (loadedAccumulation.getWidth() != image.getWidth() ||
+        loadedAccumulation.getHeight() != image.getHeight() ||
+        (useAOV && (loadedAOV.getWidth() != image.getWidth() ||
+                    loadedAOV.getHeight() != image.getHeight())) ||
+        (header.hasCost &&
+         costs.size() != image.getWidth() * image.getHeight())) {
+      return fail("invalid checkpoint");
+    }
+
+    accumulation = std::move(loadedAccumulation);
+    if (useAOV) aov = std::move(loadedAOV);
+    if (header.hasCost) {
+      for (int j = 0; j < image.getHeight(); ++j) {
+        for (int i = 0; i < image.getWidth(); ++i) {
+          costImage.setPixel(i, j,
+                             Vec3f(costs[i + image.getWidth() * j]));
+        }
+      }
+    }
+    pass = header.pass;
+    totalSamples = header.totalSamples;
+    return true;
+  }
+
+  // 蓄積バッファの平均を画像に書き込む
+  void resolve() {
+    const int width = image.getWidth();
+    const int height = image.getHeight();
+#pragma omp parallel for
+    for (int j = 0; j < height; ++j) {
+      for (int i = 0; i < width; ++i) {
+        image.setPixel(i, j, accumulation.getMean(i, j));
+      }
+    }
+  }
 
  public:
   Renderer(unsigned int width, unsigned int height,
            const std::shared_ptr<Camera>& camera)
       : image{width, height},
         camera(camera),
-        integrator(std::make_shared<PathTracing>()) {}
+        integrator(std::make_shared<PathTracing>()),
+        sampler(std::make_shared<SobolSampler>()),
+        accumulation{width, height} {}
+
+  // タイルの一辺の長さを設定する
+  void setTileSize(int size) { tileSize = std::max(size, 1); }
+
+  // スレッド数を設定する
+  void setThreads(int n) { nThreads = std::max(n, 1); }
+
+  // レンダリング中にスレッドを論理コアに固定するかを設定する
+  void setPinThreads(bool enable) { pinThreads = enable; }
+
+  // サンプルの生成方法を設定する(デフォルトはSobolSampler)
+  void setSampler(const std::shared_ptr<Sampler>& sampler) {
+    this->sampler = sampler;
+  }
+
+  // 最初の交差点の反射率, 法線, 距離をAOVとして記録するかを設定する
+  // denoiseに必要. 最初のレイの交差判定が1回増える
+  // NOTE: renderWavefrontでは記録しない
+  void setAOV(bool enable) { useAOV = enable; }
+
+  // 画素ごとのコストAOVの種類を設定する
+  // NOTE: IntersectionTestsはENABLE_STATSを指定した場合のみ使える.
+  // renderWavefrontでは記録しない
+  void setCostAOV(CostMetric metric) {
+#ifndef ENABLE_STATS
+    if (metric == CostMetric::IntersectionTests) {
+      std::cerr << "cost AOV of intersection tests requires ENABLE_STATS, "
+                   "using time instead"
+                << std::endl;
+      metric = CostMetric::Time;
+    }
+#endif
+    costMetric = metric;
+  }
 
   // レンダリングする
   void render(const Scene& scene, int samples) {
     const int width = image.getWidth();
     const int height = image.getHeight();
 
-#pragma omp parallel for schedule(dynamic, 1) collapse(2)
-    for (int j = 0; j < height; ++j) {
-      for (int i = 0; i < width; ++i) {
-        // NOTE: 並列化のために画素ごとに乱数生成器を用意する
-        RNG rng(i + width * j);
+    std::vector<stats::RenderStats> threadStats;
+    const auto start = beginStats(threadStats);
+
+    // 画像をタイルに分割し, タイル単位でスレッドに割り振る
+    const auto samplers = cloneSamplers();
+    const TileScheduler scheduler(width, height, tileSize, nThreads,
+                                  pinThreads);
+    scheduler.run([&](const Tile& tile, int threadIdx) {
+      stats::current = &threadStats[threadIdx];
+      Sampler& sampler = *samplers[threadIdx];
+      for (int j = tile.y0; j < tile.y1; ++j) {
+        for (int i = tile.x0; i < tile.x1; ++i) {
+          const uint64_t cost0 =
+              costMetric != CostMetric::None ? readCost() : 0;
+
+          Vec3f color(0);
+          float lumSum = 0, lumSqSum = 0;
+          for (int k = 0; k < samples; ++k) {
+            if (useAOV) {
+              AOVSample aovSample;
+              const Vec3f c = sample(scene, i, j, k, sampler, &aovSample);
+              color += c;
+              aov.addSample(i, j, aovSample);
+              const float lum = luminance(c);
+              lumSum += lum;
+              lumSqSum += lum * lum;
+            } else {
+              color += sample(scene, i, j, k, sampler);
+            }
+          }
+
+          // 平均
+          color /= Vec3f(samples);
+
+          // 画素への書き込み
+          image.setPixel(i, j, color);
 
-        Vec3f color(0);
-        for (int k = 0; k < samples; ++k) {
-          // (u, v)の計算
-          const float u = (2.0f * (i + rng.getNext()) - width) / height;
-          const float v = (2.0f * (j + rng.getNext()) - height) / height;
+          if (useAOV) {
+            aov.normalize(i, j, samples);
 
-          // 最初のレイの生成
-          const Ray ray = camera->sampleRay(u, v);
+            // 平均輝度の分散
+            const float mean = lumSum / samples;
+            const float var =
+                samples > 1 ? std::max(lumSqSum - mean * lumSum, 0.0f) /
+                                  (samples - 1) / samples
+                            : 0.0f;
+            aov.setVariance(i, j, var);
+          }
 
-          // 放射輝度の計算
-          color += integrator->radiance(ray, scene, rng);
+          if (costMetric != CostMetric::None) {
+            costImage.setPixel(i, j, Vec3f(float(readCost() - cost0) /
+                                           float(samples)));
+          }
         }
+      }
+      stats::current = nullptr;
+    });
+
+    endStats(threadStats, start, uint64_t(width) * height * samples);
+  }
+
+  // ウェーブフロント方式でレンダリングする
+  // 各スレッドがタイル内の多数のパスを段階ごとにまとめて処理する
+  void renderWavefront(const Scene& scene, int samples) {
+    const int width = image.getWidth();
+    const int height = image.getHeight();
+
+    std::vector<stats::RenderStats> threadStats;
+    const auto start = beginStats(threadStats);
+
+    std::vector<WavefrontPathTracing::Workspace> workspaces(nThreads);
+    const TileScheduler scheduler(width, height, tileSize, nThreads,
+                                  pinThreads);
+    scheduler.run([&](const Tile& tile, int threadIdx) {
+      stats::current = &threadStats[threadIdx];
+      wavefront.renderTile(scene, *camera, tile, samples, image, *sampler,
+                           workspaces[threadIdx]);
+      stats::current = nullptr;
+    });
+
+    endStats(threadStats, start, uint64_t(width) * height * samples);
+  }
+
+  // プログレッシブにレンダリングする
+  // パスごとに未収束の画素へサンプルを追加し, 全ての画素が収束するか
+  // 制限時間を超えたら終える. onPassを指定した場合は各パスの後に
+  // 画像を更新してonPass(pass)を呼ぶ
+  // settings.checkpointFileを指定した場合は一定の間隔で途中経過を保存し,
+  // settings.resumeなら保存した途中経過から再開する
+  // 追加したサンプルの総数(再開した場合はそれまでの分も含む)を返す
+  uint64_t renderProgressive(
+      const Scene& scene, const ProgressiveSettings& settings,
+      const std::function<void(int)>& onPass = nullptr) {
+    const auto deadline =
+        Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                           std::chrono::duration<float>(settings.timeBudget));
+    const auto isOverBudget = [&]() {
+      return settings.timeBudget > 0 && Clock::now() >= deadline;
+    };
+
+    const int width = image.getWidth();
+    const int height = image.getHeight();
+
+    accumulation.clear();
+    active.assign(width * height, 1);
+
+    std::vector<stats::RenderStats> threadStats;
+    const auto start = beginStats(threadStats);
+
+    // 途中経過から再開する
+    int firstPass = 0;
+    uint64_t resumedSamples = 0;
+    const bool useCheckpoint = !settings.checkpointFile.empty();
+    if (useCheckpoint && settings.resume &&
+        readCheckpoint(settings.checkpointFile, firstPass, resumedSamples)) {
+      std::cout << "[Renderer] resumed from " << settings.checkpointFile
+                << " (pass " << firstPass << ")" << std::endl;
+    }
+    CheckpointWriter checkpointWriter;
+    auto lastCheckpoint = Clock::now();
+
+    const auto samplers = cloneSamplers();
+    const TileScheduler scheduler(width, height, tileSize, nThreads,
+                                  pinThreads);
+    uint64_t totalSamples = resumedSamples;
+    int pass = firstPass;
+    for (; !isOverBudget(); ++pass) {
+      if (updateActivePixels(settings) == 0) break;
+
+      std::vector<uint64_t> threadSamples(nThreads, 0);
+      scheduler.run([&](const Tile& tile, int threadIdx) {
+        // NOTE: 制限時間を超えた場合は残りのタイルを飛ばす
+        if (isOverBudget()) return;
+
+        stats::current = &threadStats[threadIdx];
+        Sampler& sampler = *samplers[threadIdx];
+        for (int j = tile.y0; j < tile.y1; ++j) {
+          for (int i = tile.x0; i < tile.x1; ++i) {
+            if (!active[i + width * j]) continue;
+            const uint64_t cost0 =
+                costMetric != CostMetric::None ? readCost() : 0;
+
+            // NOTE: サンプルの番号はパスをまたいで続けるので,
+            // 同じサンプル数ならrenderと同じ結果になる
+            const int count = accumulation.getCount(i, j);
+            const int n = std::min<int>(settings.samplesPerPass,
+                                        settings.maxSamples - count);
+            for (int k = 0; k < n; ++k) {
+              if (useAOV) {
+                AOVSample aovSample;
+                accumulation.addSample(i, j,
+                                       sample(scene, i, j, count + k, sampler,
+                                              &aovSample));
+                aov.addSample(i, j, aovSample);
+              } else {
+                accumulation.addSample(
+                    i, j, sample(scene, i, j, count + k, sampler));
+              }
+            }
+            threadSamples[threadIdx] += n;
+
+            // NOTE: パスをまたいで合計し, 最後にサンプル数で割る
+            if (costMetric != CostMetric::None) {
+              const float cost = readCost() - cost0;
+              costImage.setPixel(i, j, costImage.getPixel(i, j) + Vec3f(cost));
+            }
+          }
+        }
+        stats::current = nullptr;
+      });
+      for (const uint64_t n : threadSamples) {
+        totalSamples += n;
+      }
+
+      if (onPass) {
+        resolve();
+        onPass(pass);
+      }
+
+      // NOTE: バッファのコピーだけをここで行い, ファイルへの書き込みは
+      // 次のパスと並行して行う
+      if (useCheckpoint &&
+          Clock::now() - lastCheckpoint >=
+              std::chrono::duration<float>(settings.checkpointInterval)) {
+        checkpointWriter.write(settings.checkpointFile,
+                               serializeCheckpoint(pass + 1, totalSamples));
+        lastCheckpoint = Clock::now();
+      }
+    }
+
+    // 最後の状態を保存しておくと, maxSamplesを増やして続けられる
+    if (useCheckpoint) {
+      checkpointWriter.write(settings.checkpointFile,
+                             serializeCheckpoint(pass, totalSamples));
+      checkpointWriter.wait();
+    }
+
+    resolve();
+    if (useAOV) {
+#pragma omp parallel for
+      for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+          aov.normalize(i, j, accumulation.getCount(i, j));
+          aov.setVariance(i, j, accumulation.getVariance(i, j));
+        }
+      }
+    }
+    if (costMetric != CostMetric::None) {
+      for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+          const int n = std::max<int>(accumulation.getCount(i, j), 1);
+          costImage.setPixel(i, j, costImage.getPixel(i, j) / Vec3f(n));
+        }
+      }
+    }
+
+    endStats(threadStats, start, totalSamples - resumedSamples);
+    return totalSamples;
+  }
+
+  // 確率的プログレッシブフォトンマッピングでレンダリングし, 行った反復
+  // 回数を返す. onIterationを指定した場合は各反復の後に画像を更新して
+  // onIteration(iteration)を呼ぶ
+  // NOTE: サンプル数は画素あたりの反復回数として記録する.
+  // AOVとコストは記録しない
+  int renderPhotonMapping(
+      const Scene& scene, const PhotonMappingSettings& settings,
+      const std::function<void(int)>& onIteration = nullptr) {
+    std::vector<stats::RenderStats> threadStats;
+    const auto start = beginStats(threadStats);
+
+    ProgressivePhotonMapping sppm(settings);
+    const int iterations = sppm.render(scene, *camera, image, cloneSamplers(),
+                                       threadStats, onIteration);
+
+    endStats(threadStats, start,
+             uint64_t(image.getWidth()) * image.getHeight() * iterations);
+    return iterations;
+  }
+
+  // rangeの画素のサンプルだけを蓄積バッファにレンダリングする
+  // 分散レンダリングのワーカーで使い, getAccumulationで結果を取り出す
+  // NOTE: 範囲外の画素はサンプル数0のまま. AOVとコストは記録しない
+  void renderRange(const Scene& scene, const RenderRange& range) {
+    const int width = image.getWidth();
+    const int height = image.getHeight();
+
+    accumulation.clear();
+
+    std::vector<stats::RenderStats> threadStats;
+    const auto start = Clock::now();
+    threadStats.assign(nThreads, stats::RenderStats());
 
-        // 平均
-        color /= Vec3f(samples);
+    const auto samplers = cloneSamplers();
+    const TileScheduler scheduler(width, height, tileSize, nThreads,
+                                  pinThreads);
+    scheduler.run([&](const Tile& tile, int threadIdx) {
+      const int x0 = std::max(tile.x0, range.x0);
+      const int x1 = std::min(tile.x1, range.x1);
+      const int y0 = std::max(tile.y0, range.y0);
+      const int y1 = std::min(tile.y1, range.y1);
+      if (x0 >= x1 || y0 >= y1) return;
 
-        // 画素への書き込み
-        image.setPixel(i, j, color);
+      stats::current = &threadStats[threadIdx];
+      Sampler& sampler = *samplers[threadIdx];
+      for (int j = y0; j < y1; ++j) {
+        for (int i = x0; i < x1; ++i) {
+          for (int k = range.sampleBegin; k < range.sampleEnd; ++k) {
+            accumulation.addSample(i, j, sample(scene, i, j, k, sampler));
+          }
+        }
       }
+      stats::current = nullptr;
+    });
+
+    resolve();
+    const uint64_t nPixels =
+        uint64_t(std::max(range.x1 - range.x0, 0)) *
+        std::max(range.y1 - range.y0, 0);
+    endStats(threadStats, start,
+             nPixels * std::max(range.sampleEnd - range.sampleBegin, 0));
+  }
+
+  // 蓄積バッファ(renderProgressive, renderRangeの後のみ有効)
+  const AccumulationBuffer& getAccumulation() const { return accumulation; }
+
+  // 蓄積バッファを置き換え, その平均を画像にする
+  // 分散レンダリングでワーカーの部分結果をmergeしたものを渡す
+  bool setAccumulation(const AccumulationBuffer& buffer) {
+    if (buffer.getWidth() != image.getWidth() ||
+        buffer.getHeight() != image.getHeight()) {
+      std::cerr << "failed to set accumulation buffer: size mismatch"
+                << std::endl;
+      return false;
+    }
+    accumulation = buffer;
+    resolve();
+    return true;
+  }
+
+  // 画素(i, j)のサンプル数(renderProgressiveの後のみ有効)
+  uint32_t getSampleCount(unsigned int i, unsigned int j) const {
+    return accumulation.getCount(i, j);
+  }
+
+  // 最初の交差点のAOV(setAOVを設定した場合のみ有効)
+  const AOVBuffer& getAOV() const { return aov; }
+
+  // AOVをガイドにしてレンダリング結果をデノイズする
+  // NOTE: 画像を置き換えるので, 元の画像が必要な場合は先に出力しておく
+  bool denoise(const DenoiseSettings& settings = DenoiseSettings()) {
+    if (aov.getWidth() != image.getWidth() ||
+        aov.getHeight() != image.getHeight()) {
+      std::cerr << "failed to denoise: AOV is not recorded" << std::endl;
+      return false;
+    }
+    image = ATrousDenoiser(settings).denoise(image, aov);
+    return true;
+  }
+
+  // 直前のレンダリングの統計(全スレッドの和)
+  const stats::RenderStats& getStats() const { return renderStats; }
+
+  // 画素ごとのコスト(setCostAOVを設定した場合のみ有効)
+  const Image& getCostImage() const { return costImage; }
+
+  // 直前のレンダリングの統計をJSONで出力する
+  // NOTE: 処理ごとの時間は全スレッドの和で, shadingはIntegratorから
+  // 交差判定と可視判定を除いたもの
+  bool writeStats(const std::string& filename) const {
+    std::ofstream file(filename);
+    if (!file) {
+      std::cerr << "failed to open " << filename << std::endl;
+      return false;
+    }
+
+#ifdef ENABLE_STATS
+    constexpr bool enabled = true;
+#else
+    constexpr bool enabled = false;
+#endif
+    const auto get = [&](stats::Counter c) { return renderStats.get(c); };
+    const auto seconds = [&](stats::Stage s) {
+      return renderStats.getSeconds(s);
+    };
+    const uint64_t rays = get(stats::Counter::PrimaryRays) +
+                          get(stats::Counter::SecondaryRays) +
+                          get(stats::Counter::ShadowRays);
+    const uint64_t tests = get(stats::Counter::BVHNodeVisits) +
+                           get(stats::Counter::IntersectionTests);
+    const double shading = seconds(stats::Stage::Integrator) -
+                           seconds(stats::Stage::Intersect) -
+                           seconds(stats::Stage::Occluded);
+
+    file << "{\n";
+    file << "  \"enabled\": " << (enabled ? "true" : "false") << ",\n";
+    file << "  \"threads\": " << nThreads << ",\n";
+    file << "  \"samples\": " << renderSamples << ",\n";
+    file << "  \"render_seconds\": " << renderSeconds << ",\n";
+    file << "  \"counters\": {\n";
+    for (int k = 0; k < stats::nCounters; ++k) {
+      const auto c = stats::Counter(k);
+      file << "    \"" << stats::getName(c) << "\": " << get(c)
+           << (k + 1 < stats::nCounters ? ",\n" : "\n");
+    }
+    file << "  },\n";
+    file << "  \"stage_seconds\": {\n";
+    for (int k = 0; k < stats::nStages; ++k) {
+      const auto s = stats::Stage(k);
+      file << "    \"" << stats::getName(s) << "\": " << seconds(s) << ",\n";
     }
+    file << "    \"shading\": " << std::max(shading, 0.0) << "\n";
+    file << "  },\n";
+    file << "  \"derived\": {\n";
+    file << "    \"rays\": " << rays << ",\n";
+    file << "    \"mrays_per_second\": "
+         << (renderSeconds > 0 ? 1e-6 * rays / renderSeconds : 0) << ",\n";
+    file << "    \"bounces_per_path\": "
+         << (renderSamples > 0
+                 ? double(get(stats::Counter::Bounces)) / renderSamples
+                 : 0)
+         << ",\n";
+    file << "    \"tests_per_ray\": "
+         << (rays > 0 ? double(tests) / rays : 0) << "\n";
+    file << "  }\n";
+    file << "}\n";
+
+    if (!file) {
+      std::cerr << "failed to write " << filename << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // 画素ごとのコストをヒートマップにしたPNG画像を出力する
+  // NOTE: 外れ値で全体が暗くならないように99パーセンタイルで正規化する
+  bool writeCostMap(const std::string& filename) const {
+    if (costMetric == CostMetric::None) {
+      std::cerr << "failed to write " << filename
+                << ": cost AOV is not enabled" << std::endl;
+      return false;
+    }
+
+    const int width = costImage.getWidth();
+    const int height = costImage.getHeight();
+    std::vector<float> costs;
+    costs.reserve(width * height);
+    for (int j = 0; j < height; ++j) {
+      for (int i = 0; i < width; ++i) {
+        costs.push_back(costImage.getPixel(i, j)[0]);
+      }
+    }
+    if (costs.empty()) return costImage.writePNG(filename);
+    const auto nth = costs.begin() + (costs.size() - 1) * 99 / 100;
+    std::nth_element(costs.begin(), nth, costs.end());
+    const float maxCost = std::max(*nth, 1e-6f);
+
+    // 黒, 紫, 赤, 橙, 黄, 白を補間するカラーマップ
+    const Vec3f colors[] = {Vec3f(0.0f, 0.0f, 0.0f), Vec3f(0.3f, 0.0f, 0.5f),
+                            Vec3f(0.8f, 0.1f, 0.3f), Vec3f(1.0f, 0.5f, 0.0f),
+                            Vec3f(1.0f, 0.9f, 0.2f), Vec3f(1.0f, 1.0f, 1.0f)};
+    constexpr int nColors = sizeof(colors) / sizeof(colors[0]);
+
+    Image heatmap(width, height);
+    for (int j = 0; j < height; ++j) {
+      for (int i = 0; i < width; ++i) {
+        const float x = std::min(costImage.getPixel(i, j)[0] / maxCost, 1.0f) *
+                        (nColors - 1);
+        const int k = std::min(int(x), nColors - 2);
+        const float t = x - k;
+        heatmap.setPixel(i, j, (1.0f - t) * colors[k] + t * colors[k + 1]);
+      }
+    }
+    return heatmap.writePNG(filename);
+  }
+
+  // 8bit画像の出力時にトーンマッピングを行うかと露出を設定する
+  void setToneMapping(bool enable, float exposure = 1.0f) {
+    useToneMapping = enable;
+    this->exposure = exposure;
+  }
+
+  // 8bitのPPM画像を出力する
+  bool writePPM(const std::string& filename) const {
+    return toLDR().writePPM(filename);
+  }
+
+  // 8bitのPNG画像を出力する
+  bool writePNG(const std::string& filename) const {
+    return toLDR().writePNG(filename);
+  }
+
+  // HDRのPFM画像を出力する
+  bool writePFM(const std::string& filename) const {
+    return image.writePFM(filename);
   }
 
-  // PPM画像を出力する
-  void writePPM(const std::string& filename) {
-    image.gammaCorrection();
-    image.writePPM(filename);
+  // HDRのOpenEXR画像を出力する
+  bool writeEXR(const std::string& filename) const {
+    return image.writeEXR(filename);
   }
 };
 
-#endif
\ No newline at end of file
+#endif
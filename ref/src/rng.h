@@ -1,7 +1,6 @@
 #ifndef _RNG_H
 #define _RNG_H
 #include <cstdint>
-#include <limits>
 
 // *Really* minimal PCG32 code / (c) 2014 M.E. O'Neill / pcg-random.org
 // Licensed under Apache License 2.0 (NO WARRANTY, etc. see website)
@@ -25,20 +24,41 @@ class RNG {
   pcg32_random_t state;  // 乱数生成器の状態
 
  public:
-  RNG() {
-    state.state = 1;
-    state.inc = 1;
-  }
+  RNG() : RNG(1) {}
 
-  RNG(uint64_t seed) {
-    state.state = seed;
-    state.inc = 1;
+  // seedで初期化し, streamで系列を選ぶ(pcg32_srandom_r)
+  // NOTE: streamが異なれば系列は重ならないので, 画素ごとに異なるstreamを使う
+  RNG(uint64_t seed, uint64_t stream = 0) {
+    state.state = 0;
+    state.inc = (stream << 1u) | 1u;
+    pcg32_random_r(&state);
+    state.state += seed;
+    pcg32_random_r(&state);
   }
 
-  float getNext() {
-    constexpr float divider = 1.0f / std::numeric_limits<uint32_t>::max();
-    return pcg32_random_r(&state) * divider;
+  // 状態をdelta回分進める(pcg32_advance_r)
+  void advance(uint64_t delta) {
+    uint64_t curMult = 6364136223846793005ULL;
+    uint64_t curPlus = state.inc;
+    uint64_t accMult = 1;
+    uint64_t accPlus = 0;
+    while (delta > 0) {
+      if (delta & 1) {
+        accMult *= curMult;
+        accPlus = accPlus * curMult + curPlus;
+      }
+      curPlus = (curMult + 1) * curPlus;
+      curMult *= curMult;
+      delta /= 2;
+    }
+    state.state = accMult * state.state + accPlus;
   }
+
+  uint32_t getNextUInt() { return pcg32_random_r(&state); }
+
+  // [0, 1)の一様乱数
+  // NOTE: 上位24bitを使い, 1に丸められないようにしている
+  float getNext() { return (pcg32_random_r(&state) >> 8) * 0x1p-24f; }
 };
 
 #endif
\ No newline at end of file
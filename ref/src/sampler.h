@@ -0,0 +1,370 @@
+#ifndef _SAMPLER_H
+#define _SAMPLER_H
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "rng.h"
+
+// 32bitのハッシュ関数(lowbias32)
+inline uint32_t hash32(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+inline uint32_t hashCombine(uint32_t seed, uint32_t v) {
+  return hash32(seed ^ (hash32(v) + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+// 32bitの整数を[0, 1)のfloatに変換する
+inline float toUnitFloat(uint32_t x) { return (x >> 8) * 0x1p-24f; }
+
+constexpr uint32_t reverseBits(uint32_t x) {
+  x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+  x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+  x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+  x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+// Laine-Karras permutation
+// bitを反転した値に対するOwen scrambling(下位bitから順に, それより下位の
+// bitに依存して反転する)
+inline uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed) {
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return x;
+}
+
+// Owen scrambling(上位bitから順に, それより上位のbitに依存して反転する)
+// Burley, "Practical Hash-based Owen Scrambling" (2020)
+inline uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+  return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+}
+
+// Sobol列の最初の4次元の生成行列
+// k番目の列(bitを反転して下位bitに詰めたもの)の4次元分を
+// v[4 * k + 次元]に並べる
+// NOTE: 2次元目以降はJoe-Kuoの原始多項式と初期値から計算する
+struct SobolDirections {
+  uint32_t v[32 * 4];
+};
+
+constexpr SobolDirections makeSobolDirections() {
+  // 次数s, 係数a, 初期値m
+  constexpr int s[3] = {1, 2, 3};
+  constexpr uint32_t a[3] = {0, 1, 1};
+  constexpr uint32_t m[3][3] = {{1}, {1, 3}, {1, 3, 1}};
+
+  SobolDirections directions = {};
+  uint32_t v[32] = {};
+  for (int k = 0; k < 32; ++k) {
+    directions.v[4 * k] = 1u << k;
+  }
+  for (int d = 1; d < 4; ++d) {
+    const int sd = s[d - 1];
+    for (int k = 0; k < 32; ++k) {
+      if (k < sd) {
+        v[k] = m[d - 1][k] << (31 - k);
+      } else {
+        v[k] = v[k - sd] ^ (v[k - sd] >> sd);
+        for (int l = 1; l < sd; ++l) {
+          v[k] ^= ((a[d - 1] >> (sd - 1 - l)) & 1) * v[k - l];
+        }
+      }
+      directions.v[4 * k + d] = reverseBits(v[k]);
+    }
+  }
+  return directions;
+}
+
+inline constexpr SobolDirections sobolDirections = makeSobolDirections();
+
+// Owen scramblingしたSobol列のindex番目の点のgroup番目の4次元
+// 次元を4つずつの組に分け, 組ごとに異なる順番に並べ替えた4次元のSobol列を
+// 使う(padding). 2のべき乗個の点では各組の最初の2次元が(0, m, 2)-netになる
+// NOTE: bitを反転したまま計算してreverseBitsを減らし, 4次元をまとめて
+// 計算してループをSIMD化している
+inline void scrambledSobol4(uint32_t index, uint32_t group, uint32_t seed,
+                            float values[4]) {
+  // 並べ替えた番号(bitを反転したもの)
+  const uint32_t shuffled =
+      laineKarrasPermutation(reverseBits(index), hashCombine(seed, group));
+
+  uint32_t x[4] = {0, 0, 0, 0};
+  for (int k = 0; k < 32; ++k) {
+    const uint32_t mask = -((shuffled >> (31 - k)) & 1);
+    for (int d = 0; d < 4; ++d) {
+      x[d] ^= mask & sobolDirections.v[4 * k + d];
+    }
+  }
+  for (int d = 0; d < 4; ++d) {
+    const uint32_t scrambled =
+        laineKarrasPermutation(x[d], hashCombine(seed, 4 * group + d));
+    values[d] = toUnitFloat(reverseBits(scrambled));
+  }
+}
+
+// 64x64画素のブルーノイズのマスク([0, 1)の値)
+// void-and-cluster法で, 最も疎な画素から順に値を割り当てて作る
+inline const std::vector<float>& blueNoiseMask() {
+  static const std::vector<float> mask = []() {
+    constexpr int size = 64;
+    constexpr int n = size * size;
+    constexpr float sigma = 1.5f;
+
+    // トーラス上のガウシアンの重み
+    std::vector<float> kernel(n);
+    for (int y = 0; y < size; ++y) {
+      for (int x = 0; x < size; ++x) {
+        const int dx = std::min(x, size - x);
+        const int dy = std::min(y, size - y);
+        kernel[x + size * y] =
+            std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+      }
+    }
+
+    // NOTE: 同じエネルギーの画素が規則的に選ばれないように微小な値を加える
+    std::vector<float> energy(n);
+    for (int k = 0; k < n; ++k) {
+      energy[k] = 1e-6f * toUnitFloat(hash32(k));
+    }
+
+    std::vector<float> mask(n, -1.0f);
+    for (int rank = 0; rank < n; ++rank) {
+      int best = -1;
+      for (int k = 0; k < n; ++k) {
+        if (mask[k] < 0 && (best < 0 || energy[k] < energy[best])) best = k;
+      }
+      mask[best] = (rank + 0.5f) / n;
+
+      const int bx = best % size;
+      const int by = best / size;
+      for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+          const int dx = (x - bx + size) % size;
+          const int dy = (y - by + size) % size;
+          energy[x + size * y] += kernel[dx + size * dy];
+        }
+      }
+    }
+    return mask;
+  }();
+  return mask;
+}
+
+// 画素ごとのサンプルの生成器
+// 画素(i, j)のindex番目のサンプルについて, getNextを呼ぶたびに
+// 次の次元の値を返す. 同じ(i, j, index, 次元)には常に同じ値を返すので,
+// 途中の次元から再開することもできる
+// NOTE: スレッド間で共有せず, cloneしたものをスレッドごとに使う
+class Sampler {
+ public:
+  virtual ~Sampler() = default;
+
+  // 画素(i, j)のindex番目のサンプルをdimension次元目から始める
+  virtual void startPixelSample(int i, int j, uint32_t index,
+                                uint32_t dimension = 0) = 0;
+
+  // 現在の次元の[0, 1)の値を返し, 次の次元に進む
+  virtual float getNext() = 0;
+
+  // 次のgetNextで返す次元
+  virtual uint32_t getDimension() const = 0;
+
+  // 同じ設定のSamplerを作る
+  virtual std::unique_ptr<Sampler> clone() const = 0;
+};
+
+// 独立な一様乱数(PCG32)
+// 画素ごとに異なる系列を使い, サンプルごとに2^16次元ずつ進める
+class IndependentSampler final : public Sampler {
+ private:
+  uint32_t seed;
+  RNG rng;
+  uint32_t dimension = 0;
+
+ public:
+  IndependentSampler(uint32_t seed = 0) : seed(seed) {}
+
+  void startPixelSample(int i, int j, uint32_t index,
+                        uint32_t dimension = 0) override {
+    rng = RNG(seed, hashCombine(hashCombine(seed, i), j));
+    rng.advance((uint64_t(index) << 16) + dimension);
+    this->dimension = dimension;
+  }
+
+  float getNext() override {
+    ++dimension;
+    return rng.getNext();
+  }
+
+  uint32_t getDimension() const override { return dimension; }
+
+  std::unique_ptr<Sampler> clone() const override {
+    return std::make_unique<IndependentSampler>(*this);
+  }
+};
+
+// Owen scramblingしたSobol列
+// 画素ごとに異なるscramblingを行う
+class SobolSampler final : public Sampler {
+ private:
+  uint32_t seed;
+  uint32_t pixelSeed = 0;
+  uint32_t index = 0;
+  uint32_t dimension = 0;
+  uint32_t group = ~0u;  // valuesに計算済みの4次元の組
+  float values[4];
+
+ public:
+  SobolSampler(uint32_t seed = 0) : seed(seed) {}
+
+  void startPixelSample(int i, int j, uint32_t index,
+                        uint32_t dimension = 0) override {
+    pixelSeed = hashCombine(hashCombine(seed, i), j);
+    this->index = index;
+    this->dimension = dimension;
+    group = ~0u;
+  }
+
+  float getNext() override {
+    const uint32_t d = dimension++;
+    if (d / 4 != group) {
+      group = d / 4;
+      scrambledSobol4(index, group, pixelSeed, values);
+    }
+    return values[d % 4];
+  }
+
+  uint32_t getDimension() const override { return dimension; }
+
+  std::unique_ptr<Sampler> clone() const override {
+    return std::make_unique<SobolSampler>(*this);
+  }
+};
+
+// 各桁をランダムにずらしたHalton列
+// NOTE: 素数の大きい次元ほど質が落ちるので, maxDimensions次元目以降は
+// 独立な一様乱数を使う
+class HaltonSampler final : public Sampler {
+ private:
+  static constexpr int maxDimensions = 32;
+  static constexpr uint32_t primes[maxDimensions] = {
+      2,  3,  5,  7,  11, 13, 17, 19, 23, 29,  31,  37,  41,  43,  47,  53,
+      59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131};
+
+  uint32_t seed;
+  uint32_t pixelSeed = 0;
+  uint32_t index = 0;
+  uint32_t dimension = 0;
+
+  // 基数baseの根基逆関数. 各桁にseedから決まる値を足してずらす
+  // NOTE: 2^16個の点を区別できる桁までずらし, それより下の桁は
+  // まとめて一様乱数にする
+  static float scrambledRadicalInverse(uint32_t base, uint32_t index,
+                                       uint32_t seed) {
+    const float invBase = 1.0f / base;
+    float invBaseN = 1.0f;
+    float x = 0.0f;
+    uint32_t state = seed;
+    while (invBaseN > 0x1p-16f) {
+      state = state * 747796405u + 2891336453u;
+      const uint32_t d = (index % base + (state >> 16) % base) % base;
+      index /= base;
+      invBaseN *= invBase;
+      x += d * invBaseN;
+    }
+    x += invBaseN * toUnitFloat(hash32(state));
+    return std::min(x, 1.0f - 0x1p-24f);
+  }
+
+ public:
+  HaltonSampler(uint32_t seed = 0) : seed(seed) {}
+
+  void startPixelSample(int i, int j, uint32_t index,
+                        uint32_t dimension = 0) override {
+    pixelSeed = hashCombine(hashCombine(seed, i), j);
+    this->index = index;
+    this->dimension = dimension;
+  }
+
+  float getNext() override {
+    const uint32_t d = dimension++;
+    const uint32_t dimSeed = hashCombine(pixelSeed, d);
+    if (d < maxDimensions) {
+      return scrambledRadicalInverse(primes[d], index, dimSeed);
+    }
+    return toUnitFloat(hashCombine(dimSeed, index));
+  }
+
+  uint32_t getDimension() const override { return dimension; }
+
+  std::unique_ptr<Sampler> clone() const override {
+    return std::make_unique<HaltonSampler>(*this);
+  }
+};
+
+// ブルーノイズでディザリングしたSobol列
+// 全ての画素で同じSobol列を使い, 次元ごとにずらしたブルーノイズのマスクで
+// 画素ごとにトーラス上を平行移動する(Cranley-Patterson rotation)
+// 隣り合う画素の誤差が負の相関を持ち, 少ないサンプル数でも誤差が
+// 高周波のノイズとして見える
+class BlueNoiseSampler final : public Sampler {
+ private:
+  static constexpr int maskSize = 64;  // NOTE: 2のべき乗
+
+  uint32_t seed;
+  const std::vector<float>* mask;
+  int i = 0;
+  int j = 0;
+  uint32_t index = 0;
+  uint32_t dimension = 0;
+  uint32_t group = ~0u;  // valuesに計算済みの4次元の組
+  float values[4];
+
+ public:
+  BlueNoiseSampler(uint32_t seed = 0) : seed(seed), mask(&blueNoiseMask()) {}
+
+  void startPixelSample(int i, int j, uint32_t index,
+                        uint32_t dimension = 0) override {
+    this->i = i;
+    this->j = j;
+    this->index = index;
+    this->dimension = dimension;
+    group = ~0u;
+  }
+
+  float getNext() override {
+    const uint32_t d = dimension++;
+    // 次元ごとにマスクをずらす量
+    const uint32_t offset = hash32(seed + d * 0x9e3779b9u);
+    const int x = (i + offset) & (maskSize - 1);
+    const int y = (j + (offset >> 16)) & (maskSize - 1);
+    const float shift = (*mask)[x + maskSize * y];
+
+    if (d / 4 != group) {
+      group = d / 4;
+      scrambledSobol4(index, group, seed, values);
+    }
+    const float u = values[d % 4] + shift;
+    return u < 1.0f ? u : u - 1.0f;
+  }
+
+  uint32_t getDimension() const override { return dimension; }
+
+  std::unique_ptr<Sampler> clone() const override {
+    return std::make_unique<BlueNoiseSampler>(*this);
+  }
+};
+
+#endif
@@ -2,6 +2,8 @@
 #define _SAMPLING_H
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <vector>
 
 #include "constant.h"
 #include "vec3.h"
@@ -28,4 +30,123 @@ inline Vec3f sampleCosineHemisphere(float u, float v, float& pdf) {
                std::sin(phi) * std::sin(theta));
 }
 
+// 球面上の一様サンプリング
+inline Vec3f sampleSphere(float u, float v, float& pdf) {
+  const float cosTheta = 1.0f - 2.0f * u;
+  const float sinTheta = std::sqrt(std::max(1.0f - cosTheta * cosTheta, 0.0f));
+  const float phi = 2.0f * PI * v;
+  pdf = 0.5f * PI_MUL_2_INV;
+  return Vec3f(std::cos(phi) * sinTheta, cosTheta, std::sin(phi) * sinTheta);
+}
+
+// 接空間でのcosThetaMaxを頂角とする円錐内の一様サンプリング
+inline Vec3f sampleCone(float u, float v, float cosThetaMax, float& pdf) {
+  const float cosTheta = 1.0f - u * (1.0f - cosThetaMax);
+  const float sinTheta = std::sqrt(std::max(1.0f - cosTheta * cosTheta, 0.0f));
+  const float phi = 2.0f * PI * v;
+  pdf = 1.0f / (2.0f * PI * (1.0f - cosThetaMax));
+  return Vec3f(std::cos(phi) * sinTheta, cosTheta, std::sin(phi) * sinTheta);
+}
+
+// 三角形上の一様サンプリング
+// 重心座標(b1, b2)を返す
+inline void sampleTriangle(float u, float v, float& b1, float& b2) {
+  const float su = std::sqrt(u);
+  b1 = 1.0f - su;
+  b2 = v * su;
+}
+
+// 面積測度のpdfを点refから見た立体角測度のpdfに変換する
+// pは面上の点, nはpにおける法線
+inline float areaToSolidAngle(float pdfArea, const Vec3f& ref, const Vec3f& p,
+                              const Vec3f& n) {
+  const Vec3f d = p - ref;
+  const float dist2 = length2(d);
+  const float cos = std::abs(dot(n, d)) / std::sqrt(dist2);
+  if (cos == 0.0f) return 0.0f;
+  return pdfArea * dist2 / cos;
+}
+
+// 重みに比例して番号を選ぶ離散分布(Walkerのエイリアス法)
+// 構築はO(n), サンプリングはO(1)
+// NOTE: 重みが全て0の場合は一様分布にする
+class AliasTable {
+ public:
+  AliasTable() {}
+
+  AliasTable(const std::vector<float>& weights) : bins(weights.size()) {
+    const int n = weights.size();
+    if (n == 0) return;
+    double sum = 0;
+    for (const float w : weights) sum += w;
+
+    // 各番号の確率のn倍(平均1)を, 1未満と1以上に分ける
+    std::vector<double> q(n);
+    std::vector<int> small, large;
+    for (int i = 0; i < n; ++i) {
+      bins[i].pmf = sum > 0 ? weights[i] / sum : 1.0 / n;
+      q[i] = double(bins[i].pmf) * n;
+      (q[i] < 1 ? small : large).push_back(i);
+    }
+    // 1未満の番号の余りを1以上の番号で埋める(Voseの方法)
+    while (!small.empty() && !large.empty()) {
+      const int s = small.back();
+      const int l = large.back();
+      small.pop_back();
+      large.pop_back();
+      bins[s].threshold = q[s];
+      bins[s].alias = l;
+      q[l] += q[s] - 1;
+      (q[l] < 1 ? small : large).push_back(l);
+    }
+    // NOTE: 丸め誤差で残ったものは確率1で自身を選ぶ
+    for (const int i : small) bins[i] = {1, uint32_t(i), bins[i].pmf};
+    for (const int i : large) bins[i] = {1, uint32_t(i), bins[i].pmf};
+  }
+
+  int size() const { return bins.size(); }
+
+  // uに応じて番号を選び, pmfにその確率を返す
+  // uRemappedには選んだ後に残った乱数を[0, 1)の一様乱数として返す
+  // (続くサンプリングに使える)
+  int sample(float u, float& pmf, float& uRemapped) const {
+    const int n = bins.size();
+    const float x = u * n;
+    const int i = std::min(int(x), n - 1);
+    const float frac = std::min(x - i, oneMinusEpsilon);
+    const Bin& bin = bins[i];
+    int k;
+    if (frac < bin.threshold) {
+      k = i;
+      uRemapped = frac / bin.threshold;
+    } else {
+      k = bin.alias;
+      uRemapped = (frac - bin.threshold) / (1 - bin.threshold);
+    }
+    uRemapped = std::min(uRemapped, oneMinusEpsilon);
+    pmf = bins[k].pmf;
+    return k;
+  }
+
+  // 番号iが選ばれる確率
+  float pmf(int i) const { return bins[i].pmf; }
+
+ private:
+  static constexpr float oneMinusEpsilon = 0x1.fffffep-1f;
+
+  struct Bin {
+    float threshold = 1;  // 自身を選ぶ確率
+    uint32_t alias = 0;   // 自身を選ばない場合の番号
+    float pmf = 0;        // 自身の確率
+  };
+  std::vector<Bin> bins;
+};
+
+// Multiple Importance Samplingのpower heuristic(beta = 2)
+inline float powerHeuristic(float pdf1, float pdf2) {
+  const float p1 = pdf1 * pdf1;
+  const float p2 = pdf2 * pdf2;
+  return p1 / (p1 + p2);
+}
+
 #endif
\ No newline at end of file
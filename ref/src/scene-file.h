@@ -0,0 +1,541 @@
+#ifndef _SCENE_FILE_H
+#define _SCENE_FILE_H
+#include <sys/stat.h>
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "binary-io.h"
+#include "bsdf.h"
+#include "camera.h"
+#include "constant.h"
+#include "environment-map.h"
+#include "image.h"
+#include "light.h"
+#include "mesh-loader.h"
+#include "primitive.h"
+#include "scene.h"
+#include "shape.h"
+#include "texture.h"
+
+// テキストのシーン記述ファイル
+// 1行に1つの設定か要素を書く. #から行末まではコメント
+//
+//   resolution <width> <height>
+//   samples <spp>
+//   denoise <on|off>
+//   output <file>  (拡張子でppm, png, pfm, exrを選ぶ)
+//   camera <位置xyz> <注視点xyz> <画角[deg]>
+//   sky <r g b>
+//   environment <PFM/HDRファイル> [<r g b>]  (緯度経度形式, 色は倍率)
+//   material <名前> lambert <r g b> [texture <PPMファイル>]
+//   material <名前> mirror <r g b>
+//   material <名前> glass <r g b> <屈折率>
+//   sphere <material> <中心xyz> <半径> [emission <r g b>]
+//   plane <material> <角xyz> <右xyz> <上xyz> [emission <r g b>]
+//   mesh <material> <OBJ/PLYファイル> [emission <r g b>]
+//
+// メッシュ, テクスチャ, 環境マップのパスはシーン記述ファイルからの相対パス.
+// テクスチャの反射率は<r g b>とテクスチャの値の積
+// 読み込んだシーンはメッシュとBVH, 前計算した形状ごと<ファイル名>.cacheに
+// 書き出す. 次回からはシーン記述ファイルとメッシュファイルが変わって
+// いなければキャッシュを読み, パースやBVHの構築を行わない
+class SceneFile {
+ public:
+  // レンダリングの設定
+  int width = 512;                    // 画像の横幅[px]
+  int height = 512;                   // 画像の縦幅[px]
+  int samples = 64;                   // サンプル数
+  bool denoise = false;               // デノイズするか
+  std::string output = "output.ppm";  // 出力ファイル
+
+  // カメラ
+  Vec3f camPos = Vec3f(0, 0, -1);  // 位置
+  Vec3f lookAt = Vec3f(0);         // 注視点
+  float fov = 45;                  // 画角[deg]
+
+  Vec3f sky = Vec3f(0);  // 空の放射輝度
+  std::string environment;  // 環境マップ(空ならskyを使う)
+  Vec3f environmentScale = Vec3f(1);  // 環境マップの倍率
+
+  // テクスチャキャッシュの容量[byte](loadの前に設定する)
+  size_t textureCacheSize = size_t(256) << 20;
+
+  // シーン記述ファイルを読み込み, シーンを構築する
+  // useCacheがtrueなら有効なキャッシュがあれば使い, 無ければ書き出す
+  bool load(const std::string& filename, bool useCache = true) {
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+    const auto elapsed = [&]() {
+      return std::chrono::duration<double, std::milli>(Clock::now() - start)
+          .count();
+    };
+
+    MappedFile file(filename);
+    if (!file.isOpen()) {
+      std::cerr << "failed to open " << filename << std::endl;
+      return false;
+    }
+    const uint64_t textHash = hash(file.getData(), file.getSize());
+
+    const std::string cachePath = filename + ".cache";
+    if (useCache && readCache(cachePath, textHash)) {
+      std::cout << "[Scene] loaded " << cachePath << " (" << elapsed()
+                << " ms)" << std::endl;
+      return true;
+    }
+
+    clear();
+    if (!parse(filename, std::string(file.getData(), file.getSize()))) {
+      return false;
+    }
+    if (!buildScene()) return false;
+    scene->commit();
+    std::cout << "[Scene] loaded " << filename << " (" << elapsed() << " ms)"
+              << std::endl;
+
+    if (useCache && writeCache(cachePath, textHash)) {
+      std::cout << "[Scene] wrote " << cachePath << std::endl;
+    }
+    return true;
+  }
+
+  const Scene& getScene() const { return *scene; }
+
+  // テクスチャのタイルのキャッシュ(テクスチャが無い場合はnullptr)
+  const std::shared_ptr<TextureCache>& getTextureCache() const {
+    return textureCache;
+  }
+
+  std::shared_ptr<Camera> createCamera() const {
+    return std::make_shared<PinholeCamera>(
+        camPos, normalize(lookAt - camPos), fov * PI / 180.0f);
+  }
+
+ private:
+  // キャッシュの形式の版(形式を変えたら上げる)
+  static constexpr uint32_t cacheVersion = 4;
+
+  enum class MaterialType : uint32_t { Lambert, Mirror, Glass };
+
+  struct MaterialDesc {
+    MaterialType type;
+    Vec3f rho;         // 反射率
+    float ior;         // 屈折率(Glassのみ)
+    uint32_t texture;  // texturePathsでの番号(無い場合はnoTexture)
+  };
+  static constexpr uint32_t noTexture = ~uint32_t(0);
+
+  enum class ShapeType : uint32_t { Sphere, Plane, Mesh };
+
+  struct ShapeDesc {
+    ShapeType type;
+    uint32_t material;  // materialsでの番号
+    uint32_t mesh;      // meshesでの番号(Meshのみ)
+    uint32_t isLight;   // 光源か
+    Vec3f p[3];         // Sphere: 中心, Plane: 角, 右, 上
+    float radius;       // 半径(Sphereのみ)
+    Vec3f emission;     // 光源の放射輝度
+  };
+
+  // キャッシュの作成時のメッシュファイルの大きさと更新時刻
+  struct MeshFile {
+    std::string path;
+    int64_t size;
+    int64_t mtime;  // [ns]
+  };
+
+  struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t bvhWidth;
+    uint32_t vec3Size;  // sizeof(Vec3f)(VEC3_SIMDで変わる)
+    uint32_t reserved;
+    uint64_t textHash;  // シーン記述ファイルのハッシュ値
+  };
+
+  std::vector<MaterialDesc> materials;
+  std::vector<ShapeDesc> shapes;
+  std::vector<std::shared_ptr<TriangleMesh>> meshes;
+  std::vector<MeshFile> meshFiles;  // meshesと同じ順
+  // NOTE: テクスチャはタイル化したファイルを別に持つので,
+  // キャッシュにはパスだけを書く
+  std::vector<std::string> texturePaths;
+  std::shared_ptr<TextureCache> textureCache;
+  std::unique_ptr<Scene> scene;
+
+  void clear() {
+    materials.clear();
+    shapes.clear();
+    meshes.clear();
+    meshFiles.clear();
+    texturePaths.clear();
+    // NOTE: 環境マップは指定が無ければ使わないので, 設定も戻しておく
+    environment.clear();
+    environmentScale = Vec3f(1);
+    // NOTE: シーンがテクスチャを参照しているので先に破棄する
+    scene.reset();
+    textureCache.reset();
+  }
+
+  // FNV-1a
+  static uint64_t hash(const char* data, size_t size) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; ++i) {
+      h = (h ^ static_cast<uint8_t>(data[i])) * 0x100000001b3ull;
+    }
+    return h;
+  }
+
+  // ファイルの大きさと更新時刻を取得する
+  static bool getFileStamp(const std::string& path, MeshFile& stamp) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return false;
+    stamp.path = path;
+    stamp.size = st.st_size;
+    stamp.mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+  }
+
+  // シーン記述ファイルをパースし, メッシュを読み込む
+  bool parse(const std::string& filename, const std::string& text) {
+    const size_t slash = filename.find_last_of('/');
+    const std::string dir =
+        slash == std::string::npos ? "" : filename.substr(0, slash + 1);
+
+    std::map<std::string, uint32_t> materialIndices;
+    std::map<std::string, uint32_t> meshIndices;
+    std::map<std::string, uint32_t> textureIndices;
+
+    std::istringstream lines(text);
+    std::string line;
+    for (int lineNo = 1; std::getline(lines, line); ++lineNo) {
+      const auto fail = [&](const std::string& message) {
+        std::cerr << "failed to parse " << filename << ":" << lineNo << ": "
+                  << message << std::endl;
+        return false;
+      };
+
+      line = line.substr(0, line.find('#'));
+      std::istringstream in(line);
+      std::string command;
+      if (!(in >> command)) continue;
+
+      const auto readVec3 = [&](Vec3f& v) {
+        float x, y, z;
+        if (!(in >> x >> y >> z)) return false;
+        v = Vec3f(x, y, z);
+        return true;
+      };
+
+      // 形状の材質と, 末尾の光源の指定を読む
+      const auto readShape = [&](ShapeDesc& shape) {
+        std::string name;
+        in >> name;
+        const auto it = materialIndices.find(name);
+        if (it == materialIndices.end()) return false;
+        shape.material = it->second;
+        return true;
+      };
+      const auto readEmission = [&](ShapeDesc& shape) {
+        std::string keyword;
+        shape.isLight = 0;
+        shape.emission = Vec3f(0);
+        if (!(in >> keyword)) return true;
+        if (keyword != "emission" || !readVec3(shape.emission)) return false;
+        shape.isLight = 1;
+        return true;
+      };
+
+      if (command == "resolution") {
+        if (!(in >> width >> height) || width <= 0 || height <= 0) {
+          return fail("invalid resolution");
+        }
+      } else if (command == "samples") {
+        if (!(in >> samples) || samples <= 0) {
+          return fail("invalid samples");
+        }
+      } else if (command == "denoise") {
+        std::string value;
+        in >> value;
+        if (value != "on" && value != "off") return fail("expected on|off");
+        denoise = value == "on";
+      } else if (command == "output") {
+        if (!(in >> output)) return fail("expected a file name");
+      } else if (command == "camera") {
+        if (!readVec3(camPos) || !readVec3(lookAt) || !(in >> fov)) {
+          return fail("expected position, look-at point and fov");
+        }
+      } else if (command == "sky") {
+        if (!readVec3(sky)) return fail("expected radiance");
+      } else if (command == "environment") {
+        if (!(in >> environment)) return fail("expected a file name");
+        if (environment[0] != '/') environment = dir + environment;
+        environmentScale = Vec3f(1);
+        if (!(in >> std::ws).eof() && !readVec3(environmentScale)) {
+          return fail("expected scale");
+        }
+      } else if (command == "material") {
+        std::string name, type;
+        MaterialDesc material = {};
+        if (!(in >> name >> type) || !readVec3(material.rho)) {
+          return fail("expected name, type and reflectance");
+        }
+        material.texture = noTexture;
+        if (type == "lambert") {
+          material.type = MaterialType::Lambert;
+          std::string keyword, path;
+          if (in >> keyword) {
+            if (keyword != "texture" || !(in >> path)) {
+              return fail("expected texture");
+            }
+            if (path[0] != '/') path = dir + path;
+            if (textureIndices.count(path) == 0) {
+              textureIndices[path] = texturePaths.size();
+              texturePaths.push_back(path);
+            }
+            material.texture = textureIndices[path];
+          }
+        } else if (type == "mirror") {
+          material.type = MaterialType::Mirror;
+        } else if (type == "glass") {
+          material.type = MaterialType::Glass;
+          if (!(in >> material.ior)) return fail("expected ior");
+        } else {
+          return fail("unknown material type " + type);
+        }
+        materialIndices[name] = materials.size();
+        materials.push_back(material);
+      } else if (command == "sphere") {
+        ShapeDesc shape = {};
+        shape.type = ShapeType::Sphere;
+        if (!readShape(shape)) return fail("unknown material");
+        if (!readVec3(shape.p[0]) || !(in >> shape.radius)) {
+          return fail("expected center and radius");
+        }
+        if (!readEmission(shape)) return fail("expected emission");
+        shapes.push_back(shape);
+      } else if (command == "plane") {
+        ShapeDesc shape = {};
+        shape.type = ShapeType::Plane;
+        if (!readShape(shape)) return fail("unknown material");
+        if (!readVec3(shape.p[0]) || !readVec3(shape.p[1]) ||
+            !readVec3(shape.p[2])) {
+          return fail("expected corner, right and up vectors");
+        }
+        if (!readEmission(shape)) return fail("expected emission");
+        shapes.push_back(shape);
+      } else if (command == "mesh") {
+        ShapeDesc shape = {};
+        shape.type = ShapeType::Mesh;
+        if (!readShape(shape)) return fail("unknown material");
+        std::string path;
+        if (!(in >> path)) return fail("expected a mesh file");
+        if (path[0] != '/') path = dir + path;
+        if (!readEmission(shape)) return fail("expected emission");
+
+        // 同じファイルは1回だけ読み込む
+        if (meshIndices.count(path) == 0) {
+          MeshFile stamp;
+          const auto mesh = loadMesh(path);
+          if (!mesh || !getFileStamp(path, stamp)) {
+            return fail("failed to load " + path);
+          }
+          meshIndices[path] = meshes.size();
+          meshes.push_back(mesh);
+          meshFiles.push_back(stamp);
+        }
+        shape.mesh = meshIndices[path];
+        shapes.push_back(shape);
+      } else {
+        return fail("unknown command " + command);
+      }
+    }
+    return true;
+  }
+
+  // 読み込んだ要素からシーンを作る(commitは呼ばない)
+  // テクスチャはここで開く(初回はタイル化したファイルを作る)
+  bool buildScene() {
+    std::vector<std::shared_ptr<ImageTexture>> textures;
+    if (!texturePaths.empty()) {
+      textureCache = std::make_shared<TextureCache>(textureCacheSize);
+    }
+    for (const auto& path : texturePaths) {
+      textures.push_back(textureCache->open(path));
+      if (!textures.back()) {
+        std::cerr << "failed to load " << path << std::endl;
+        return false;
+      }
+    }
+
+    std::vector<std::shared_ptr<BSDF>> bsdfs;
+    for (const auto& m : materials) {
+      switch (m.type) {
+        case MaterialType::Lambert:
+          bsdfs.push_back(std::make_shared<Lambert>(
+              m.rho, m.texture == noTexture ? nullptr : textures[m.texture]));
+          break;
+        case MaterialType::Mirror:
+          bsdfs.push_back(std::make_shared<Mirror>(m.rho));
+          break;
+        case MaterialType::Glass:
+          bsdfs.push_back(std::make_shared<Glass>(m.rho, m.ior));
+          break;
+      }
+    }
+
+    if (environment.empty()) {
+      scene = std::make_unique<Scene>(Sky(sky));
+    } else {
+      const auto envMap = EnvironmentMap::load(environment);
+      if (!envMap) return false;
+      scene = std::make_unique<Scene>(Sky(envMap, environmentScale));
+    }
+    for (const auto& s : shapes) {
+      std::shared_ptr<Shape> shape;
+      switch (s.type) {
+        case ShapeType::Sphere:
+          shape = std::make_shared<Sphere>(s.p[0], s.radius);
+          break;
+        case ShapeType::Plane:
+          shape = std::make_shared<Plane>(s.p[0], s.p[1], s.p[2]);
+          break;
+        case ShapeType::Mesh:
+          shape = meshes[s.mesh];
+          break;
+      }
+      const auto light =
+          s.isLight ? std::make_shared<AreaLight>(s.emission) : nullptr;
+      scene->addPrimitive(Primitive(shape, bsdfs[s.material], light));
+    }
+    return true;
+  }
+
+  // 設定, 要素, メッシュとBVH, 前計算した形状を書き出す
+  bool writeCache(const std::string& path, uint64_t textHash) const {
+    binary_io::Writer writer;
+    writer.write(CacheHeader{{'P', 'B', 'R', 'S', 'C', 'E', 'N', 'E'},
+                             cacheVersion,
+                             BVH_WIDTH,
+                             sizeof(Vec3f),
+                             0,
+                             textHash});
+
+    writer.write(width);
+    writer.write(height);
+    writer.write(samples);
+    writer.write<uint8_t>(denoise);
+    writer.writeString(output);
+    writer.write(camPos);
+    writer.write(lookAt);
+    writer.write(fov);
+    writer.write(sky);
+    writer.writeString(environment);
+    writer.write(environmentScale);
+
+    writer.writeArray(materials);
+    writer.writeArray(shapes);
+    writer.write<uint64_t>(texturePaths.size());
+    for (const auto& texturePath : texturePaths) {
+      writer.writeString(texturePath);
+    }
+    writer.write<uint64_t>(meshes.size());
+    for (int i = 0; i < meshes.size(); ++i) {
+      writer.writeString(meshFiles[i].path);
+      writer.write(meshFiles[i].size);
+      writer.write(meshFiles[i].mtime);
+      meshes[i]->write(writer);
+    }
+    scene->writeCommitted(writer);
+
+    return image_io::writeFile(path, writer.getBuffer());
+  }
+
+  // キャッシュを読み込む
+  // 無い場合や, シーン記述ファイル, メッシュファイルが変わっている場合は
+  // falseを返す
+  bool readCache(const std::string& path, uint64_t textHash) {
+    MappedFile file(path);
+    if (!file.isOpen()) return false;
+    binary_io::Reader reader(file.getData(), file.getSize());
+
+    CacheHeader header;
+    if (!reader.read(header) ||
+        std::string(header.magic, 8) != "PBRSCENE" ||
+        header.version != cacheVersion || header.bvhWidth != BVH_WIDTH ||
+        header.vec3Size != sizeof(Vec3f) ||
+        header.textHash != textHash) {
+      return false;
+    }
+
+    clear();
+    const auto fail = [&]() {
+      std::cerr << "failed to read " << path << std::endl;
+      clear();
+      return false;
+    };
+
+    uint8_t denoiseFlag;
+    if (!reader.read(width) || !reader.read(height) || !reader.read(samples) ||
+        !reader.read(denoiseFlag) || !reader.readString(output) ||
+        !reader.read(camPos) || !reader.read(lookAt) || !reader.read(fov) ||
+        !reader.read(sky) || !reader.readString(environment) ||
+        !reader.read(environmentScale) || !reader.readArray(materials) ||
+        !reader.readArray(shapes)) {
+      return fail();
+    }
+    denoise = denoiseFlag;
+
+    uint64_t nTextures;
+    if (!reader.read(nTextures)) return fail();
+    texturePaths.resize(nTextures);
+    for (auto& texturePath : texturePaths) {
+      if (!reader.readString(texturePath)) return fail();
+    }
+
+    uint64_t nMeshes;
+    if (!reader.read(nMeshes)) return fail();
+    for (uint64_t i = 0; i < nMeshes; ++i) {
+      MeshFile stamp, current;
+      if (!reader.readString(stamp.path) || !reader.read(stamp.size) ||
+          !reader.read(stamp.mtime)) {
+        return fail();
+      }
+      // メッシュファイルが変わっていたらキャッシュを使わない
+      if (!getFileStamp(stamp.path, current) || current.size != stamp.size ||
+          current.mtime != stamp.mtime) {
+        clear();
+        return false;
+      }
+
+      const auto mesh = TriangleMesh::read(reader);
+      if (!mesh) return fail();
+      meshes.push_back(mesh);
+      meshFiles.push_back(stamp);
+    }
+
+    for (const auto& m : materials) {
+      if (m.texture != noTexture && m.texture >= texturePaths.size()) {
+        return fail();
+      }
+    }
+    for (const auto& s : shapes) {
+      if (s.material >= materials.size() ||
+          (s.type == ShapeType::Mesh && s.mesh >= meshes.size())) {
+        return fail();
+      }
+    }
+
+    if (!buildScene() || !scene->commitFrom(reader)) return fail();
+    return true;
+  }
+};
+
+#endif
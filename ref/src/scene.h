@@ -1,11 +1,25 @@
 #ifndef _SCENE_H
 #define _SCENE_H
+#include <algorithm>
+#include <iostream>
 #include <vector>
 
+#include "accumulation-buffer.h"
+#include "baked-shape.h"
+#include "binary-io.h"
 #include "intersect-info.h"
+#include "light-bvh.h"
 #include "light.h"
 #include "primitive.h"
 #include "ray.h"
+#include "stats.h"
+#include "wide-bvh.h"
+
+// 光源サンプリングで光源を選ぶ方法
+enum class LightSampling {
+  Uniform,  // 一様に選ぶ
+  BVH,      // Light BVHで位置と向きから寄与の大きそうな光源を選ぶ
+};
 
 class Scene {
  public:
@@ -15,16 +29,220 @@ class Scene {
   Scene(const Sky& sky) : sky(sky) {}
 
   void addPrimitive(const Primitive& primitive) {
+    if (primitive.areaLight) {
+      lightIndices.push_back(primitives.size());
+    }
     primitives.push_back(primitive);
   }
 
-  bool intersect(const Ray& ray, IntersectInfo& info) const {
-    bool hit = false;
+  // 光源(areaLightを持つPrimitive)の数
+  int nLights() const { return lightIndices.size(); }
+
+  // 光源サンプリングを行えるか(光源か環境マップの空があるか)
+  bool canSampleLights() const {
+    return nLights() > 0 || sky.hasEnvironmentMap();
+  }
+
+  // 光源の選び方を設定する(デフォルトはLightSampling::BVH)
+  void setLightSampling(LightSampling mode) { lightSampling = mode; }
+
+  // 光源サンプリングで空を選ぶ確率
+  // NOTE: 一様に選ぶ場合は環境マップの空を光源の1つとして扱い,
+  // Light BVHを使う場合は空とLight BVHを半分ずつの確率で選ぶ
+  float skySelectPdf() const {
+    if (!sky.hasEnvironmentMap()) return 0.0f;
+    if (lightSampling == LightSampling::BVH) {
+      return nLights() > 0 ? 0.5f : 1.0f;
+    }
+    return 1.0f / (nLights() + 1);
+  }
+
+  // 点pos(法線n)から光源を1つ選ぶ(選べない場合はnullptr)
+  // pdfに選ばれる確率(空を選ばない確率を含む)を返す
+  // NOTE: 空を選ばなかった場合に呼ぶ
+  const Primitive* sampleLight(const Vec3f& pos, const Vec3f& n, float u,
+                               float& pdf) const {
+    int light;
+    if (lightSampling == LightSampling::BVH) {
+      light = lightBVH.sample(pos, n, u, pdf);
+      if (light < 0) return nullptr;
+    } else {
+      const int count = lightIndices.size();
+      light = std::min(int(u * count), count - 1);
+      pdf = 1.0f / count;
+    }
+    pdf *= 1 - skySelectPdf();
+    return &primitives[lightIndices[light]];
+  }
+
+  // 点pos(法線n)から光源lightがsampleLightで選ばれる確率
+  float lightPdf(const Primitive& light, const Vec3f& pos,
+                 const Vec3f& n) const {
+    float pmf;
+    if (lightSampling == LightSampling::BVH) {
+      // lightIndicesは昇順なので二分探索で光源の番号を求める
+      const uint32_t primIdx = &light - primitives.data();
+      const int idx = std::lower_bound(lightIndices.begin(),
+                                       lightIndices.end(), primIdx) -
+                      lightIndices.begin();
+      pmf = lightBVH.pmf(idx, pos, n);
+    } else {
+      pmf = 1.0f / lightIndices.size();
+    }
+    return (1 - skySelectPdf()) * pmf;
+  }
+
+  // 点pos(法線n)から光源(空を含む)の方向をサンプリングし, その放射輝度を
+  // 返す. uSelectで光源か空を選び, (u, v)で光源上の点か空の方向を選ぶ
+  // wiに方向, distに可視判定する距離, pdfに選ぶ確率を含む立体角測度の
+  // pdfを返す
+  // NOTE: 光源自身と交差しないように距離を少し縮めている
+  Vec3f sampleLightDirection(const Vec3f& pos, const Vec3f& n, float uSelect,
+                             float u, float v, Vec3f& wi, float& dist,
+                             float& pdf) const {
+    const float skyPdf = skySelectPdf();
+    if (uSelect < skyPdf) {
+      const Vec3f le = sky.sample(u, v, wi, pdf);
+      pdf *= skyPdf;
+      dist = Ray::defaultTmax;
+      return le;
+    }
+
+    float lightSelectPdf;
+    const Primitive* light =
+        sampleLight(pos, n, (uSelect - skyPdf) / (1 - skyPdf), lightSelectPdf);
+    if (!light) {
+      pdf = 0;
+      return Vec3f(0);
+    }
+    Vec3f lightNormal;
+    const Vec3f lightPos =
+        light->getShape().sample(pos, u, v, lightNormal, pdf);
+    pdf *= lightSelectPdf;
+    if (pdf == 0) return Vec3f(0);
+
+    const Vec3f toLight = lightPos - pos;
+    dist = length(toLight);
+    wi = toLight / dist;
+    dist -= Ray::defaultTmin;
+    return light->areaLight->Le();
+  }
+
+  // 方向dirの空がsampleLightDirectionで選ばれるpdf
+  float skyPdf(const Vec3f& dir) const {
+    return sky.hasEnvironmentMap() ? skySelectPdf() * sky.pdf(dir) : 0.0f;
+  }
+
+  // シーンの構築を完了する
+  // BVHを構築し, 全ての形状を交差判定用のレコードに前計算して
+  // 1つの配列にまとめる. 以降の交差判定はレコードだけを読む
+  // NOTE: commit()の後にaddPrimitiveしてはいけない
+  void commit() {
+    bvh.build(computePrimBounds());
+    builtCost = bvh.sahCost();
+    bake();
+    buildLightBVH();
+  }
+
+  // commit後に形状(Instanceの変換など)を変更した時に呼び, BVHとレコードを
+  // 更新する. 通常はBVHの構造はそのままでAABBだけを更新(refit)し,
+  // SAHコストが構築直後のrebuildThreshold倍を超えた場合だけ構築し直す
+  // 構築し直した場合はtrueを返す(commit前の場合はcommitする)
+  // NOTE: 形状やBSDF, TriangleMeshなどの内部のBVHはそのまま使い回す
+  bool update(float rebuildThreshold = 1.5f) {
+    if (!bvh.isBuilt()) {
+      commit();
+      return true;
+    }
+
+    const std::vector<AABB> primBounds = computePrimBounds();
+    bake();
+    // NOTE: Light BVHは光源だけから作るので軽く, 毎回構築し直す
+    buildLightBVH();
+
+    bvh.refit(primBounds);
+    if (bvh.sahCost() <= rebuildThreshold * builtCost) return false;
+
+    bvh.build(primBounds);
+    builtCost = bvh.sahCost();
+    return true;
+  }
 
+  // BVHのSAHコスト(根の表面積あたり)
+  float sahCost() const { return bvh.sahCost(); }
+
+  // NOTE: 互換性のために残している. commit()と同じ
+  void build() { commit(); }
+
+  // commitで作ったBVHとレコードを書き出す(シーンのキャッシュ用)
+  void writeCommitted(binary_io::Writer& writer) const {
+    bvh.write(writer);
+    writer.writeArray(bakedShapes);
+  }
+
+  // writeCommittedで書き出したBVHとレコードを読み込んでcommitを完了する
+  // NOTE: primitivesは書き出した時と同じ順で追加しておく必要がある
+  bool commitFrom(binary_io::Reader& reader) {
+    if (!bvh.read(reader) || !reader.readArray(bakedShapes)) return false;
+    builtCost = bvh.sahCost();
+    buildLightBVH();
+    return bakedShapes.size() == primitives.size();
+  }
+
+  // 交差判定に使うメモリ量をPrimitiveあたりで表示する
+  // commit前はPrimitiveと形状オブジェクト, commit後は前計算したレコード
+  // (前計算しない形状はPrimitiveと形状オブジェクトも)の大きさ
+  // NOTE: TriangleMeshの頂点などの内部データはcommitの前後で共通なので
+  // 含めない
+  void printMemoryReport() const {
+    size_t before = 0, after = 0;
+    for (int i = 0; i < primitives.size(); ++i) {
+      const size_t shapeSize = primitives[i].getShape().visit(
+          [](const auto& shape) { return sizeof(shape); });
+      before += sizeof(Primitive) + shapeSize;
+      after += sizeof(BakedShape);
+      if (bakedShapes.size() == primitives.size() &&
+          bakedShapes[i].type == BakedShape::Type::Other) {
+        after += sizeof(Primitive) + shapeSize;
+      }
+    }
+
+    const size_t n = std::max<size_t>(primitives.size(), 1);
+    std::cout << "[Scene] primitives: " << primitives.size() << std::endl;
+    std::cout << "[Scene] before commit: " << before << " bytes ("
+              << before / n << " bytes/primitive)" << std::endl;
+    if (bakedShapes.size() == primitives.size()) {
+      std::cout << "[Scene] after commit: " << after << " bytes ("
+                << after / n << " bytes/primitive)" << std::endl;
+    }
+  }
+
+  bool intersect(const Ray& ray, IntersectInfo& info) const {
+    STATS_TIMER(Intersect);
     IntersectInfo info_each;
     // NOTE: 最小値を求めるために, 予め最大値をセットしておく
     info.t = ray.tmax;
+
+    // commit済みならBVHと前計算したレコードを使う
+    if (bvh.isBuilt()) {
+      return bvh.intersect(ray, info.t, [&](uint32_t idx, float& tmax) {
+        STATS_INC(IntersectionTests);
+        if (bakedShapes[idx].intersect(ray, info_each,
+                                       primitives[idx].getShape()) &&
+            info_each.t < tmax) {
+          info = info_each;
+          info.hitPrimitive = &primitives[idx];
+          tmax = info_each.t;
+          return true;
+        }
+        return false;
+      });
+    }
+
+    // 構築前は全てのPrimitiveと総当たりで交差判定する
+    bool hit = false;
     for (const auto& primitive : primitives) {
+      STATS_INC(IntersectionTests);
       // 交差距離が以前に交差したものより短かったら交差情報を更新
       if (primitive.intersect(ray, info_each) && info_each.t < info.t) {
         hit = true;
@@ -34,6 +252,63 @@ class Scene {
 
     return hit;
   }
+
+  // (ray.tmin, tmax)内に交差点があるかを判定する
+  // 光源サンプリングやAOなどの可視判定に使い, 交差情報は計算しない
+  bool occluded(const Ray& ray, float tmax) const {
+    STATS_TIMER(Occluded);
+    if (bvh.isBuilt()) {
+      return bvh.occluded(ray, tmax, [&](uint32_t idx) {
+        STATS_INC(IntersectionTests);
+        return bakedShapes[idx].occluded(ray, tmax,
+                                         primitives[idx].getShape());
+      });
+    }
+
+    for (const auto& primitive : primitives) {
+      STATS_INC(IntersectionTests);
+      if (primitive.occluded(ray, tmax)) return true;
+    }
+    return false;
+  }
+
+ private:
+  AccelBVH bvh;
+  float builtCost = 0;  // 構築直後のBVHのSAHコスト
+  std::vector<BakedShape> bakedShapes;  // primitivesと同じ順の前計算した形状
+  std::vector<uint32_t> lightIndices;  // 光源のprimitivesでの番号
+  LightSampling lightSampling = LightSampling::BVH;
+  LightBVH lightBVH;  // lightIndicesの順の光源のLight BVH
+
+  std::vector<AABB> computePrimBounds() const {
+    std::vector<AABB> primBounds(primitives.size());
+    for (int i = 0; i < primitives.size(); ++i) {
+      primBounds[i] = primitives[i].getShape().getBounds();
+    }
+    return primBounds;
+  }
+
+  // 各光源の位置, 放射束, 向きからLight BVHを構築する
+  // NOTE: 放射束は両面から放射する拡散光源として2 x pi x 輝度 x 面積とする
+  void buildLightBVH() {
+    std::vector<LightBounds> lights(lightIndices.size());
+    for (int i = 0; i < lightIndices.size(); ++i) {
+      const Primitive& primitive = primitives[lightIndices[i]];
+      const Shape& shape = *primitive.shape;
+      LightBounds& lb = lights[i];
+      lb.bounds = shape.getBounds();
+      lb.power = 2 * PI * luminance(primitive.areaLight->Le()) * shape.area();
+      shape.normalCone(lb.axis, lb.cosThetaO);
+    }
+    lightBVH.build(lights);
+  }
+
+  void bake() {
+    bakedShapes.resize(primitives.size());
+    for (int i = 0; i < primitives.size(); ++i) {
+      bakedShapes[i] = BakedShape::bake(primitives[i].getShape());
+    }
+  }
 };
 
 #endif
\ No newline at end of file
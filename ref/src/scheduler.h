@@ -0,0 +1,169 @@
+#ifndef _SCHEDULER_H
+#define _SCHEDULER_H
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 画像を分割した矩形領域 [x0, x1) x [y0, y1)
+struct Tile {
+  int x0, y0;
+  int x1, y1;
+};
+
+// スレッドごとのタイルのキュー
+// 持ち主は先頭から取り出し, 他のスレッドは末尾から盗む
+// NOTE: タイル単位の粒度なので競合は少なく, mutexで十分
+class WorkStealingQueue {
+ private:
+  std::deque<Tile> tiles;
+  std::mutex mtx;
+
+ public:
+  void push(const Tile& tile) {
+    std::lock_guard<std::mutex> lock(mtx);
+    tiles.push_back(tile);
+  }
+
+  bool pop(Tile& tile) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (tiles.empty()) return false;
+    tile = tiles.front();
+    tiles.pop_front();
+    return true;
+  }
+
+  bool steal(Tile& tile) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (tiles.empty()) return false;
+    tile = tiles.back();
+    tiles.pop_back();
+    return true;
+  }
+};
+
+// 2次元の番号からMorton符号(Z曲線上の順番)を計算する
+inline uint32_t mortonCode2D(uint32_t x, uint32_t y) {
+  const auto spread = [](uint32_t v) {
+    v &= 0x0000ffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+  };
+  return spread(x) | (spread(y) << 1);
+}
+
+// 呼び出したスレッドの実行を論理コアcpu % (コア数)に固定する
+// NOTE: Linux以外では何もしない
+inline void pinCurrentThread(int cpu) {
+#ifdef __linux__
+  const int nCores = std::max<int>(std::thread::hardware_concurrency(), 1);
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu % nCores, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+// 呼び出したスレッドの固定を戻すためのガード
+class ThreadAffinityGuard {
+ private:
+#ifdef __linux__
+  cpu_set_t saved;
+#endif
+
+ public:
+  ThreadAffinityGuard() {
+#ifdef __linux__
+    pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved);
+#endif
+  }
+  ~ThreadAffinityGuard() {
+#ifdef __linux__
+    pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+#endif
+  }
+};
+
+// 画像をタイルに分割し, ワークスティーリングで複数スレッドに割り振る
+class TileScheduler {
+ private:
+  std::vector<Tile> tiles;  // Morton順に並べたタイル
+  int nThreads;
+  bool pinThreads;  // スレッドi番目を論理コアi番目に固定するか
+
+ public:
+  TileScheduler(int width, int height, int tileSize, int nThreads,
+                bool pinThreads = false)
+      : nThreads(std::max(nThreads, 1)), pinThreads(pinThreads) {
+    const int nx = (width + tileSize - 1) / tileSize;
+    const int ny = (height + tileSize - 1) / tileSize;
+
+    std::vector<std::pair<uint32_t, Tile>> keyed;
+    for (int ty = 0; ty < ny; ++ty) {
+      for (int tx = 0; tx < nx; ++tx) {
+        const Tile tile = {tx * tileSize, ty * tileSize,
+                           std::min((tx + 1) * tileSize, width),
+                           std::min((ty + 1) * tileSize, height)};
+        keyed.emplace_back(mortonCode2D(tx, ty), tile);
+      }
+    }
+    // 近いタイルが続けて処理されるようにMorton順に並べる
+    std::sort(keyed.begin(), keyed.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+    for (const auto& [key, tile] : keyed) {
+      tiles.push_back(tile);
+    }
+  }
+
+  int nTiles() const { return tiles.size(); }
+
+  // 全てのタイルに対してrenderTile(tile, threadIdx)を呼ぶ
+  template <typename F>
+  void run(F&& renderTile) const {
+    // Morton順の連続した区間を各スレッドに割り当てる
+    std::vector<WorkStealingQueue> queues(nThreads);
+    for (int i = 0; i < tiles.size(); ++i) {
+      queues[int64_t(i) * nThreads / tiles.size()].push(tiles[i]);
+    }
+
+    const auto worker = [&](int threadIdx) {
+      if (pinThreads) pinCurrentThread(threadIdx);
+
+      Tile tile;
+      while (true) {
+        // 自分のキューが空になったら他のスレッドから盗む
+        bool found = queues[threadIdx].pop(tile);
+        for (int k = 1; k < nThreads && !found; ++k) {
+          found = queues[(threadIdx + k) % nThreads].steal(tile);
+        }
+        // NOTE: タイルは追加されないので全て空なら終了してよい
+        if (!found) break;
+
+        renderTile(tile, threadIdx);
+      }
+    };
+
+    // NOTE: 呼び出したスレッドも0番目として使うので, 終了後に固定を戻す
+    const ThreadAffinityGuard guard;
+    std::vector<std::thread> threads;
+    for (int i = 1; i < nThreads; ++i) {
+      threads.emplace_back(worker, i);
+    }
+    worker(0);
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+};
+
+#endif
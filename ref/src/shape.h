@@ -1,23 +1,143 @@
 #ifndef _SPHERE_H
 #define _SPHERE_H
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "aabb.h"
+#include "binary-io.h"
+#include "constant.h"
+#include "dispatch.h"
 #include "intersect-info.h"
 #include "ray.h"
+#include "sampling.h"
+#include "triangle4.h"
 #include "vec3.h"
+#include "wide-bvh.h"
 
 class Shape {
  public:
   virtual bool intersect(const Ray& ray, IntersectInfo& info) const = 0;
+
+  // (ray.tmin, tmax)内に交差点があるかだけを判定する
+  // NOTE: 交差情報を計算せず, 最初に見つかった交差で判定を終える
+  virtual bool occluded(const Ray& ray, float tmax) const = 0;
+
+  // 形状を囲むAABBを返す
+  virtual AABB getBounds() const = 0;
+
+  // 点refから見た形状上の点をサンプリングする(光源サンプリング用)
+  // サンプリングした点を返し, nにその点の法線, pdfに立体角測度のpdfを返す
+  virtual Vec3f sample(const Vec3f& ref, float u, float v, Vec3f& n,
+                       float& pdf) const = 0;
+
+  // 点refからsampleで形状上の点p(法線n)が選ばれる立体角測度のpdf
+  virtual float pdf(const Vec3f& ref, const Vec3f& p, const Vec3f& n) const = 0;
+
+  // 形状上の点を面積について一様にサンプリングする(光源からのフォトン用)
+  // サンプリングした点を返し, nにその点の法線を返す. pdfは1 / area()
+  virtual Vec3f samplePoint(float u, float v, Vec3f& n) const = 0;
+
+  // 表面積(光源の放射束の見積もりに使う)
+  // NOTE: 光源サンプリングに対応しない形状は0を返す
+  virtual float area() const = 0;
+
+  // 法線の向きを囲む円錐の軸axisと半頂角のcosを返す(光源の選択に使う)
+  // NOTE: 向きを限定できない形状は全方向(cosTheta = -1)とする
+  virtual void normalCone(Vec3f& axis, float& cosTheta) const {
+    axis = Vec3f(0, 0, 1);
+    cosTheta = -1;
+  }
 };
 
-class Sphere : public Shape {
+// 球面上の法線nの点の経緯度によるテクスチャ座標
+inline void sphereTexCoord(const Vec3f& n, float& u, float& v) {
+  u = 0.5f + std::atan2(n[2], n[0]) * (0.5f * PI_INV);
+  v = 1.0f - std::acos(std::clamp(n[1], -1.0f, 1.0f)) * PI_INV;
+}
+
+class Sphere final : public Shape {
  public:
   Vec3f center;  // 中心位置
   float radius;  // 半径
 
   Sphere(const Vec3f& center, float radius) : center(center), radius(radius) {}
 
-  bool intersect(const Ray& ray, IntersectInfo& info) const {
+  bool intersect(const Ray& ray, IntersectInfo& info) const override {
+    float t;
+    if (!hitDistance(ray, ray.tmax, t)) return false;
+
+    // 交差情報を計算
+    info.t = t;
+    info.hitPos = ray(t);
+    info.hitNormal = normalize(info.hitPos - center);
+    sphereTexCoord(info.hitNormal, info.u, info.v);
+    info.uvDensity = PI_INV / radius;
+
+    return true;
+  }
+
+  bool occluded(const Ray& ray, float tmax) const override {
+    float t;
+    return hitDistance(ray, tmax, t);
+  }
+
+  AABB getBounds() const override {
+    return AABB(center - Vec3f(radius), center + Vec3f(radius));
+  }
+
+  // refから見える円錐内の方向を一様にサンプリングする
+  // NOTE: refが球の内部にある場合は球面上を一様にサンプリングする
+  Vec3f sample(const Vec3f& ref, float u, float v, Vec3f& n,
+               float& pdf) const override {
+    const Vec3f dc = center - ref;
+    const float dist2 = length2(dc);
+    if (dist2 <= radius * radius) {
+      const Vec3f p = samplePoint(u, v, n);
+      pdf = areaToSolidAngle(1.0f / area(), ref, p, n);
+      return p;
+    }
+
+    const float cosThetaMax =
+        std::sqrt(std::max(1.0f - radius * radius / dist2, 0.0f));
+    const Vec3f w = normalize(dc);
+    Vec3f t, b;
+    tangentSpaceBasis(w, t, b);
+    const Vec3f wi = localToWorld(sampleCone(u, v, cosThetaMax, pdf), t, w, b);
+
+    // 方向wiと球の交点を求める
+    const float B = dot(wi, -dc);
+    const float D = std::max(B * B - (dist2 - radius * radius), 0.0f);
+    const Vec3f p = ref + (-B - std::sqrt(D)) * wi;
+    n = normalize(p - center);
+    return p;
+  }
+
+  float pdf(const Vec3f& ref, const Vec3f& p, const Vec3f& n) const override {
+    const float dist2 = length2(center - ref);
+    if (dist2 <= radius * radius) {
+      return areaToSolidAngle(1.0f / area(), ref, p, n);
+    }
+    const float cosThetaMax =
+        std::sqrt(std::max(1.0f - radius * radius / dist2, 0.0f));
+    return 1.0f / (2.0f * PI * (1.0f - cosThetaMax));
+  }
+
+  Vec3f samplePoint(float u, float v, Vec3f& n) const override {
+    float pdfDir;
+    n = sampleSphere(u, v, pdfDir);
+    return center + radius * n;
+  }
+
+  float area() const override { return 4.0f * PI * radius * radius; }
+
+ private:
+  // (ray.tmin, tmax)内で最も近い交差距離tを求める
+  bool hitDistance(const Ray& ray, float tmax, float& t) const {
     const float b = dot(ray.direction, ray.origin - center);
     const float c = length2(ray.origin - center) - radius * radius;
     const float D = b * b - c;
@@ -29,26 +149,20 @@ class Sphere : public Shape {
     const float t1 = -b + std::sqrt(D);
 
     // レイの始点から近い方の解を計算
-    float t = t0;
-    if (t < ray.tmin || t > ray.tmax) {
+    t = t0;
+    if (t < ray.tmin || t > tmax) {
       t = t1;
 
       // レイが許容交差距離内に無かった場合
-      if (t < ray.tmin || t > ray.tmax) {
+      if (t < ray.tmin || t > tmax) {
         return false;
       }
     }
-
-    // 交差情報を計算
-    info.t = t;
-    info.hitPos = ray(t);
-    info.hitNormal = normalize(info.hitPos - center);
-
     return true;
   }
 };
 
-class Plane : public Shape {
+class Plane final : public Shape {
  public:
   const Vec3f leftCornerPoint;
   const Vec3f right;
@@ -58,28 +172,433 @@ class Plane : public Shape {
       : leftCornerPoint(leftCornerPoint), right(right), up(up) {}
 
   bool intersect(const Ray& ray, IntersectInfo& info) const override {
-    const Vec3f normal = normalize(cross(right, up));
-    const Vec3f center = leftCornerPoint + 0.5f * right + 0.5f * up;
-    const Vec3f rightDir = normalize(right);
-    const float rightLength = length(right);
-    const Vec3f upDir = normalize(up);
-    const float upLength = length(up);
-
-    const float t =
-        -dot(ray.origin - center, normal) / dot(ray.direction, normal);
-    if (t < ray.tmin || t > ray.tmax) return false;
-
-    const Vec3 hitPos = ray(t);
-    const float dx = dot(hitPos - leftCornerPoint, rightDir);
-    const float dy = dot(hitPos - leftCornerPoint, upDir);
-    if (dx < 0.0f || dx > rightLength || dy < 0.0f || dy > upLength)
-      return false;
+    float t;
+    if (!hitDistance(ray, ray.tmax, t)) return false;
 
     info.t = t;
-    info.hitPos = hitPos;
-    info.hitNormal = normal;
+    info.hitPos = ray(t);
+    info.hitNormal = normalize(cross(right, up));
+    // 角を原点, 右と上の辺を[0, 1]とする座標
+    const Vec3f p = info.hitPos - leftCornerPoint;
+    info.u = dot(p, right) / length2(right);
+    info.v = dot(p, up) / length2(up);
+    info.uvDensity = 1.0f / std::sqrt(length(right) * length(up));
     return true;
   }
+
+  bool occluded(const Ray& ray, float tmax) const override {
+    float t;
+    return hitDistance(ray, tmax, t);
+  }
+
+  AABB getBounds() const override {
+    AABB bounds(leftCornerPoint, leftCornerPoint);
+    bounds = mergeAABB(bounds, leftCornerPoint + right);
+    bounds = mergeAABB(bounds, leftCornerPoint + up);
+    bounds = mergeAABB(bounds, leftCornerPoint + right + up);
+
+    // NOTE: 軸に平行な平面の場合AABBの厚みが0になるので少し広げておく
+    constexpr float eps = 1e-4f;
+    return AABB(bounds[0] - Vec3f(eps), bounds[1] + Vec3f(eps));
+  }
+
+  // 面上の点を一様にサンプリングする
+  Vec3f sample(const Vec3f& ref, float u, float v, Vec3f& n,
+               float& pdf) const override {
+    const Vec3f p = samplePoint(u, v, n);
+    pdf = areaToSolidAngle(1.0f / area(), ref, p, n);
+    return p;
+  }
+
+  float pdf(const Vec3f& ref, const Vec3f& p, const Vec3f& n) const override {
+    return areaToSolidAngle(1.0f / area(), ref, p, n);
+  }
+
+  Vec3f samplePoint(float u, float v, Vec3f& n) const override {
+    n = normalize(cross(right, up));
+    return leftCornerPoint + u * right + v * up;
+  }
+
+  float area() const override { return length(cross(right, up)); }
+
+  void normalCone(Vec3f& axis, float& cosTheta) const override {
+    axis = normalize(cross(right, up));
+    cosTheta = 1;
+  }
+
+ private:
+  // (ray.tmin, tmax)内での交差距離tを求める
+  // NOTE: 正規化していない法線, 辺ベクトルで判定しsqrtを避けている
+  bool hitDistance(const Ray& ray, float tmax, float& t) const {
+    const Vec3f normal = cross(right, up);
+    t = -dot(ray.origin - leftCornerPoint, normal) /
+        dot(ray.direction, normal);
+    if (t < ray.tmin || t > tmax) return false;
+
+    const Vec3f hitPos = ray(t);
+    const float dx = dot(hitPos - leftCornerPoint, right);
+    const float dy = dot(hitPos - leftCornerPoint, up);
+    if (dx < 0.0f || dx > length2(right) || dy < 0.0f || dy > length2(up))
+      return false;
+
+    return true;
+  }
+};
+
+// インデックス付き三角形メッシュ
+// 頂点位置, 法線, テクスチャ座標は全ての三角形で共有し,
+// 三角形は頂点番号の3つ組で表す
+// 三角形の探索には内部に持つBVHを使い, N分木の場合は葉の三角形を
+// 4つずつまとめてSIMDで交差判定する
+class TriangleMesh final : public Shape {
+ public:
+  const std::vector<Vec3f> positions;   // 頂点位置
+  const std::vector<Vec3f> normals;     // 頂点法線(空の場合は面法線を使う)
+  const std::vector<uint32_t> indices;  // 頂点位置の番号(3つで1つの三角形)
+  // 頂点法線の番号(空の場合はindicesを使う)
+  const std::vector<uint32_t> normalIndices;
+  // テクスチャ座標(u, vの順. 空の場合は重心座標を使う)
+  const std::vector<float> texcoords;
+  // テクスチャ座標の番号(空の場合はindicesを使う)
+  const std::vector<uint32_t> texcoordIndices;
+
+  TriangleMesh(std::vector<Vec3f> positions, std::vector<Vec3f> normals,
+               std::vector<uint32_t> indices,
+               std::vector<uint32_t> normalIndices = {},
+               std::vector<float> texcoords = {},
+               std::vector<uint32_t> texcoordIndices = {})
+      : positions(std::move(positions)),
+        normals(std::move(normals)),
+        indices(std::move(indices)),
+        normalIndices(std::move(normalIndices)),
+        texcoords(std::move(texcoords)),
+        texcoordIndices(std::move(texcoordIndices)) {
+    std::vector<AABB> triBounds(nTriangles());
+#pragma omp parallel for
+    for (int i = 0; i < nTriangles(); ++i) {
+      AABB bounds(vertex(i, 0), vertex(i, 0));
+      bounds = mergeAABB(bounds, vertex(i, 1));
+      bounds = mergeAABB(bounds, vertex(i, 2));
+      triBounds[i] = bounds;
+    }
+    bvh.build(triBounds);
+
+    precompute();
+  }
+
+  // 構築済みのBVHを使うコンストラクタ(シーンのキャッシュ用)
+  TriangleMesh(std::vector<Vec3f> positions, std::vector<Vec3f> normals,
+               std::vector<uint32_t> indices,
+               std::vector<uint32_t> normalIndices,
+               std::vector<float> texcoords,
+               std::vector<uint32_t> texcoordIndices, AccelBVH bvh)
+      : positions(std::move(positions)),
+        normals(std::move(normals)),
+        indices(std::move(indices)),
+        normalIndices(std::move(normalIndices)),
+        texcoords(std::move(texcoords)),
+        texcoordIndices(std::move(texcoordIndices)),
+        bvh(std::move(bvh)) {
+    precompute();
+  }
+
+  int nTriangles() const { return indices.size() / 3; }
+
+  // 頂点とBVHを書き出す
+  void write(binary_io::Writer& writer) const {
+    writer.writeArray(positions);
+    writer.writeArray(normals);
+    writer.writeArray(indices);
+    writer.writeArray(normalIndices);
+    writer.writeArray(texcoords);
+    writer.writeArray(texcoordIndices);
+    bvh.write(writer);
+  }
+
+  // writeで書き出したメッシュを読み込む(失敗した場合はnullptr)
+  static std::shared_ptr<TriangleMesh> read(binary_io::Reader& reader) {
+    std::vector<Vec3f> positions, normals;
+    std::vector<uint32_t> indices, normalIndices, texcoordIndices;
+    std::vector<float> texcoords;
+    AccelBVH bvh;
+    if (!reader.readArray(positions) || !reader.readArray(normals) ||
+        !reader.readArray(indices) || !reader.readArray(normalIndices) ||
+        !reader.readArray(texcoords) || !reader.readArray(texcoordIndices) ||
+        !bvh.read(reader)) {
+      return nullptr;
+    }
+    return std::make_shared<TriangleMesh>(
+        std::move(positions), std::move(normals), std::move(indices),
+        std::move(normalIndices), std::move(texcoords),
+        std::move(texcoordIndices), std::move(bvh));
+  }
+
+  bool intersect(const Ray& ray, IntersectInfo& info) const override {
+    uint32_t hitTri;
+    float hitT, hitU, hitV;
+#if BVH_WIDTH > 2
+    const auto& primIndices = bvh.getPrimIndices();
+    const bool hit = bvh.intersectLeaves(
+        ray, ray.tmax, [&](uint32_t start, uint32_t n, float& t) {
+          bool hitLeaf = false;
+          for (uint32_t k = start / 4; k < (start + n + 3) / 4; ++k) {
+            int lane;
+            float u, v;
+            if (packets[k].intersect(ray, t, lane, u, v)) {
+              hitTri = primIndices[4 * k + lane];
+              hitT = t;
+              hitU = u;
+              hitV = v;
+              hitLeaf = true;
+            }
+          }
+          return hitLeaf;
+        });
+#else
+    const bool hit = bvh.intersect(ray, ray.tmax, [&](uint32_t tri, float& t) {
+      float u, v;
+      if (intersectTriangle(ray, tri, t, u, v)) {
+        hitTri = tri;
+        hitT = t;
+        hitU = u;
+        hitV = v;
+        return true;
+      }
+      return false;
+    });
+#endif
+    if (!hit) return false;
+
+    // 交差情報を計算
+    info.t = hitT;
+    info.hitPos = ray(hitT);
+    info.hitNormal = shadingNormal(hitTri, hitU, hitV);
+    texCoord(hitTri, hitU, hitV, info);
+    return true;
+  }
+
+  bool occluded(const Ray& ray, float tmax) const override {
+#if BVH_WIDTH > 2
+    return bvh.occludedLeaves(ray, tmax, [&](uint32_t start, uint32_t n) {
+      for (uint32_t k = start / 4; k < (start + n + 3) / 4; ++k) {
+        if (packets[k].occluded(ray, tmax)) return true;
+      }
+      return false;
+    });
+#else
+    return bvh.occluded(ray, tmax, [&](uint32_t tri) {
+      float t = tmax, u, v;
+      return intersectTriangle(ray, tri, t, u, v);
+    });
+#endif
+  }
+
+  AABB getBounds() const override { return bvh.getBounds(); }
+
+  Vec3f sample(const Vec3f& ref, float u, float v, Vec3f& n,
+               float& pdf) const override {
+    const Vec3f p = samplePoint(u, v, n);
+    pdf = areaToSolidAngle(1.0f / totalArea, ref, p, n);
+    return p;
+  }
+
+  float pdf(const Vec3f& ref, const Vec3f& p, const Vec3f& n) const override {
+    return areaToSolidAngle(1.0f / totalArea, ref, p, n);
+  }
+
+  // 面積に比例して三角形を選び, その上の点を一様にサンプリングする
+  Vec3f samplePoint(float u, float v, Vec3f& n) const override {
+    const float target = u * totalArea;
+    const int tri = std::min<int>(
+        std::upper_bound(areaCDF.begin(), areaCDF.end(), target) -
+            areaCDF.begin(),
+        nTriangles() - 1);
+    // 選んだ三角形内での位置に乱数を再利用する
+    const float cdf0 = tri > 0 ? areaCDF[tri - 1] : 0.0f;
+    const float uRemapped =
+        std::clamp((target - cdf0) / (areaCDF[tri] - cdf0), 0.0f, 1.0f);
+
+    float b1, b2;
+    sampleTriangle(uRemapped, v, b1, b2);
+    const Vec3f p = (1.0f - b1 - b2) * vertex(tri, 0) + b1 * vertex(tri, 1) +
+                    b2 * vertex(tri, 2);
+    n = shadingNormal(tri, b1, b2);
+    return p;
+  }
+
+  float area() const override { return totalArea; }
+
+  // 全ての三角形の面法線が(符号を除いて)平行な場合はその向き,
+  // そうでなければ全方向とする
+  void normalCone(Vec3f& axis, float& cosTheta) const override {
+    Shape::normalCone(axis, cosTheta);
+    Vec3f n0(0);
+    for (int i = 0; i < nTriangles(); ++i) {
+      const Vec3f n = cross(vertex(i, 1) - vertex(i, 0),
+                            vertex(i, 2) - vertex(i, 0));
+      if (length2(n) == 0) continue;
+      if (n0[0] == 0 && n0[1] == 0 && n0[2] == 0) {
+        n0 = normalize(n);
+      } else if (std::abs(dot(n0, normalize(n))) < 1 - 1e-5f) {
+        return;
+      }
+    }
+    if (n0[0] != 0 || n0[1] != 0 || n0[2] != 0) {
+      axis = n0;
+      cosTheta = 1;
+    }
+  }
+
+ private:
+  AccelBVH bvh;                // 三角形のBVH
+  std::vector<float> areaCDF;  // 三角形の面積の累積和
+  float totalArea;             // 表面積
+#if BVH_WIDTH > 2
+  std::vector<Triangle4> packets;  // BVHの葉の順に並べた三角形
+#endif
+
+  // 光源サンプリング用の面積の累積分布と, SIMD用の三角形の組を作る
+  void precompute() {
+    // 光源サンプリング用に面積の累積分布を計算する
+    // NOTE: 三角形の数が多い場合の誤差を抑えるためdoubleで足し合わせる
+    areaCDF.resize(nTriangles());
+    double sum = 0;
+    for (int i = 0; i < nTriangles(); ++i) {
+      sum += 0.5f * length(cross(vertex(i, 1) - vertex(i, 0),
+                                 vertex(i, 2) - vertex(i, 0)));
+      areaCDF[i] = sum;
+    }
+    totalArea = sum;
+
+#if BVH_WIDTH > 2
+    // BVHの葉の並び順で三角形を4つずつまとめる
+    const auto& primIndices = bvh.getPrimIndices();
+    packets.resize(primIndices.size() / 4);
+    for (int i = 0; i < primIndices.size(); ++i) {
+      const uint32_t tri = primIndices[i];
+      packets[i / 4].set(i % 4, vertex(tri, 0), vertex(tri, 1), vertex(tri, 2));
+    }
+#endif
+  }
+
+  const Vec3f& vertex(uint32_t tri, int k) const {
+    return positions[indices[3 * tri + k]];
+  }
+  const Vec3f& normal(uint32_t tri, int k) const {
+    return normalIndices.empty() ? normals[indices[3 * tri + k]]
+                                 : normals[normalIndices[3 * tri + k]];
+  }
+
+  // 重心座標(u, v)における法線
+  // 頂点法線があれば補間し, 無ければ面法線を使う
+  Vec3f shadingNormal(uint32_t tri, float u, float v) const {
+    if (normals.empty()) {
+      return normalize(cross(vertex(tri, 1) - vertex(tri, 0),
+                             vertex(tri, 2) - vertex(tri, 0)));
+    }
+    return normalize((1.0f - u - v) * normal(tri, 0) + u * normal(tri, 1) +
+                     v * normal(tri, 2));
+  }
+
+  // 重心座標(u, v)におけるテクスチャ座標とその変化の大きさ
+  // テクスチャ座標が無ければ重心座標を使う
+  void texCoord(uint32_t tri, float u, float v, IntersectInfo& info) const {
+    if (texcoords.empty()) {
+      info.u = u;
+      info.v = v;
+      info.uvDensity = 0;
+      return;
+    }
+
+    const uint32_t* idx = texcoordIndices.empty() ? &indices[3 * tri]
+                                                  : &texcoordIndices[3 * tri];
+    const float* t0 = &texcoords[2 * idx[0]];
+    const float* t1 = &texcoords[2 * idx[1]];
+    const float* t2 = &texcoords[2 * idx[2]];
+    info.u = (1.0f - u - v) * t0[0] + u * t1[0] + v * t2[0];
+    info.v = (1.0f - u - v) * t0[1] + u * t1[1] + v * t2[1];
+
+    // テクスチャ座標での面積と三角形の面積の比の平方根
+    const float uvArea = std::abs((t1[0] - t0[0]) * (t2[1] - t0[1]) -
+                                  (t2[0] - t0[0]) * (t1[1] - t0[1]));
+    const float area = length(cross(vertex(tri, 1) - vertex(tri, 0),
+                                    vertex(tri, 2) - vertex(tri, 0)));
+    info.uvDensity = area > 0 ? std::sqrt(uvArea / area) : 0;
+  }
+
+  // Moller-Trumboreの方法による三角形との交差判定
+  // (ray.tmin, tmax)内で交差した場合はtmaxと重心座標(u, v)を更新する
+  bool intersectTriangle(const Ray& ray, uint32_t tri, float& tmax, float& u,
+                         float& v) const {
+    const Vec3f& p0 = vertex(tri, 0);
+    const Vec3f e1 = vertex(tri, 1) - p0;
+    const Vec3f e2 = vertex(tri, 2) - p0;
+
+    const Vec3f pvec = cross(ray.direction, e2);
+    const float det = dot(e1, pvec);
+    // レイと三角形が平行な場合
+    if (std::abs(det) < 1e-12f) return false;
+    const float invDet = 1.0f / det;
+
+    const Vec3f tvec = ray.origin - p0;
+    const float b1 = dot(tvec, pvec) * invDet;
+    if (b1 < 0.0f || b1 > 1.0f) return false;
+
+    const Vec3f qvec = cross(tvec, e1);
+    const float b2 = dot(ray.direction, qvec) * invDet;
+    if (b2 < 0.0f || b1 + b2 > 1.0f) return false;
+
+    const float t = dot(e2, qvec) * invDet;
+    if (t < ray.tmin || t >= tmax) return false;
+
+    tmax = t;
+    u = b1;
+    v = b2;
+    return true;
+  }
+};
+
+// 仮想関数を介さずに形状の関数を呼ぶための参照
+// Sphere, Plane, TriangleMeshはswitchで分岐し, それ以外は仮想関数で呼ぶ
+class ShapeRef {
+ private:
+  VariantRef<Shape, Sphere, Plane, TriangleMesh> ref;
+
+ public:
+  ShapeRef() {}
+  ShapeRef(const Shape* shape) : ref(shape) {}
+
+  // 具体的な型の参照でf(shape)を呼ぶ
+  template <typename F>
+  decltype(auto) visit(F&& f) const {
+    return ref.visit(f);
+  }
+
+  bool intersect(const Ray& ray, IntersectInfo& info) const {
+    return ref.visit(
+        [&](const auto& shape) { return shape.intersect(ray, info); });
+  }
+
+  bool occluded(const Ray& ray, float tmax) const {
+    return ref.visit(
+        [&](const auto& shape) { return shape.occluded(ray, tmax); });
+  }
+
+  AABB getBounds() const {
+    return ref.visit([&](const auto& shape) { return shape.getBounds(); });
+  }
+
+  Vec3f sample(const Vec3f& ref, float u, float v, Vec3f& n,
+               float& pdf) const {
+    return this->ref.visit([&](const auto& shape) {
+      return shape.sample(ref, u, v, n, pdf);
+    });
+  }
+
+  float pdf(const Vec3f& ref, const Vec3f& p, const Vec3f& n) const {
+    return this->ref.visit(
+        [&](const auto& shape) { return shape.pdf(ref, p, n); });
+  }
 };
 
-#endif
\ No newline at end of file
+#endif
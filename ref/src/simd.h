@@ -0,0 +1,160 @@
+#ifndef _SIMD_H
+#define _SIMD_H
+#include <immintrin.h>
+
+// SSE/AVXのレジスタを包む薄いラッパー
+// NOTE: 比較演算の結果はビットマスクを持つ同じ型で表す
+
+// 4要素のfloat(SSE)
+struct Float4 {
+  __m128 v;
+
+  Float4() {}
+  Float4(__m128 v) : v(v) {}
+  Float4(float x) : v(_mm_set1_ps(x)) {}
+
+  static Float4 load(const float* p) { return _mm_load_ps(p); }
+  void store(float* p) const { _mm_store_ps(p, v); }
+
+  float operator[](int i) const {
+    alignas(16) float tmp[4];
+    store(tmp);
+    return tmp[i];
+  }
+
+  // 各要素の比較結果のビットマスク
+  int mask() const { return _mm_movemask_ps(v); }
+};
+
+inline Float4 operator+(const Float4& a, const Float4& b) {
+  return _mm_add_ps(a.v, b.v);
+}
+inline Float4 operator-(const Float4& a, const Float4& b) {
+  return _mm_sub_ps(a.v, b.v);
+}
+inline Float4 operator*(const Float4& a, const Float4& b) {
+  return _mm_mul_ps(a.v, b.v);
+}
+inline Float4 operator/(const Float4& a, const Float4& b) {
+  return _mm_div_ps(a.v, b.v);
+}
+inline Float4 operator<(const Float4& a, const Float4& b) {
+  return _mm_cmplt_ps(a.v, b.v);
+}
+inline Float4 operator<=(const Float4& a, const Float4& b) {
+  return _mm_cmple_ps(a.v, b.v);
+}
+inline Float4 operator>(const Float4& a, const Float4& b) {
+  return _mm_cmpgt_ps(a.v, b.v);
+}
+inline Float4 operator>=(const Float4& a, const Float4& b) {
+  return _mm_cmpge_ps(a.v, b.v);
+}
+inline Float4 operator&(const Float4& a, const Float4& b) {
+  return _mm_and_ps(a.v, b.v);
+}
+inline Float4 operator|(const Float4& a, const Float4& b) {
+  return _mm_or_ps(a.v, b.v);
+}
+inline Float4 min(const Float4& a, const Float4& b) {
+  return _mm_min_ps(a.v, b.v);
+}
+inline Float4 max(const Float4& a, const Float4& b) {
+  return _mm_max_ps(a.v, b.v);
+}
+inline Float4 abs(const Float4& a) {
+  return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v);
+}
+inline Float4 sqrt(const Float4& a) { return _mm_sqrt_ps(a.v); }
+// 逆数平方根の近似値(相対誤差1.5 * 2^-12以下)
+inline Float4 rsqrtApprox(const Float4& a) { return _mm_rsqrt_ps(a.v); }
+// maskが立っている要素はa, それ以外はbを選ぶ
+inline Float4 select(const Float4& mask, const Float4& a, const Float4& b) {
+  return _mm_blendv_ps(b.v, a.v, mask.v);
+}
+
+#ifdef __AVX__
+// 8要素のfloat(AVX)
+struct Float8 {
+  __m256 v;
+
+  Float8() {}
+  Float8(__m256 v) : v(v) {}
+  Float8(float x) : v(_mm256_set1_ps(x)) {}
+
+  static Float8 load(const float* p) { return _mm256_load_ps(p); }
+  void store(float* p) const { _mm256_store_ps(p, v); }
+
+  float operator[](int i) const {
+    alignas(32) float tmp[8];
+    store(tmp);
+    return tmp[i];
+  }
+
+  // 各要素の比較結果のビットマスク
+  int mask() const { return _mm256_movemask_ps(v); }
+};
+
+inline Float8 operator+(const Float8& a, const Float8& b) {
+  return _mm256_add_ps(a.v, b.v);
+}
+inline Float8 operator-(const Float8& a, const Float8& b) {
+  return _mm256_sub_ps(a.v, b.v);
+}
+inline Float8 operator*(const Float8& a, const Float8& b) {
+  return _mm256_mul_ps(a.v, b.v);
+}
+inline Float8 operator/(const Float8& a, const Float8& b) {
+  return _mm256_div_ps(a.v, b.v);
+}
+inline Float8 operator<(const Float8& a, const Float8& b) {
+  return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ);
+}
+inline Float8 operator<=(const Float8& a, const Float8& b) {
+  return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ);
+}
+inline Float8 operator>(const Float8& a, const Float8& b) {
+  return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ);
+}
+inline Float8 operator>=(const Float8& a, const Float8& b) {
+  return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ);
+}
+inline Float8 operator&(const Float8& a, const Float8& b) {
+  return _mm256_and_ps(a.v, b.v);
+}
+inline Float8 operator|(const Float8& a, const Float8& b) {
+  return _mm256_or_ps(a.v, b.v);
+}
+inline Float8 min(const Float8& a, const Float8& b) {
+  return _mm256_min_ps(a.v, b.v);
+}
+inline Float8 max(const Float8& a, const Float8& b) {
+  return _mm256_max_ps(a.v, b.v);
+}
+inline Float8 abs(const Float8& a) {
+  return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v);
+}
+inline Float8 sqrt(const Float8& a) { return _mm256_sqrt_ps(a.v); }
+// 逆数平方根の近似値(相対誤差1.5 * 2^-12以下)
+inline Float8 rsqrtApprox(const Float8& a) { return _mm256_rsqrt_ps(a.v); }
+// maskが立っている要素はa, それ以外はbを選ぶ
+inline Float8 select(const Float8& mask, const Float8& a, const Float8& b) {
+  return _mm256_blendv_ps(b.v, a.v, mask.v);
+}
+#endif
+
+// 要素数からSIMD型を選ぶ
+template <int N>
+struct SIMDFloat;
+template <>
+struct SIMDFloat<4> {
+  using type = Float4;
+};
+#ifdef __AVX__
+template <>
+struct SIMDFloat<8> {
+  using type = Float8;
+};
+#endif
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef _STATS_H
+#define _STATS_H
+#include <chrono>
+#include <cstdint>
+
+// レンダリング中の処理の回数と時間の統計
+// NOTE: CMakeオプションENABLE_STATSを指定した場合だけ計測する.
+// 指定しない場合はSTATS_*マクロが空になり, 計測のコストはかからない
+namespace stats {
+
+enum class Counter {
+  PrimaryRays,                  // カメラからのレイ
+  SecondaryRays,                // 反射後のレイ
+  ShadowRays,                   // 光源サンプリングの可視判定のレイ
+  BVHNodeVisits,                // BVHで訪れたノード(メッシュ内部も含む)
+  IntersectionTests,            // Primitiveとの交差判定
+  Bounces,                      // 反射回数
+  RussianRouletteTerminations,  // ロシアンルーレットで終了したパス
+  TextureCacheHits,             // キャッシュにあったテクスチャのタイル
+  TextureCacheMisses,           // ファイルから読んだテクスチャのタイル
+  Count,
+};
+
+// 時間を計測する処理
+// NOTE: Integratorは交差判定と可視判定を含む
+enum class Stage {
+  CameraRay,   // カメラからのレイの生成
+  Intersect,   // Scene::intersect
+  Occluded,    // Scene::occluded
+  Integrator,  // Integrator::radiance
+  Count,
+};
+
+constexpr int nCounters = int(Counter::Count);
+constexpr int nStages = int(Stage::Count);
+
+inline const char* getName(Counter counter) {
+  constexpr const char* names[nCounters] = {
+      "primary_rays",      "secondary_rays",     "shadow_rays",
+      "bvh_node_visits",   "intersection_tests", "bounces",
+      "russian_roulette_terminations", "texture_cache_hits",
+      "texture_cache_misses"};
+  return names[int(counter)];
+}
+
+inline const char* getName(Stage stage) {
+  constexpr const char* names[nStages] = {"camera_ray", "intersect",
+                                          "occluded", "integrator"};
+  return names[int(stage)];
+}
+
+// 1スレッド分の統計
+// NOTE: スレッドごとの統計を配列で持つので, 偽共有しないように揃えている
+struct alignas(64) RenderStats {
+  uint64_t counters[nCounters] = {};
+  uint64_t nanoseconds[nStages] = {};  // 処理ごとの時間[ns]
+  uint32_t timerCalls[nStages] = {};   // ScopedTimerの呼び出し回数
+
+  void add(Counter counter, uint64_t n) { counters[int(counter)] += n; }
+  uint64_t get(Counter counter) const { return counters[int(counter)]; }
+  double getSeconds(Stage stage) const {
+    return 1e-9 * nanoseconds[int(stage)];
+  }
+
+  void merge(const RenderStats& other) {
+    for (int i = 0; i < nCounters; ++i) counters[i] += other.counters[i];
+    for (int i = 0; i < nStages; ++i) nanoseconds[i] += other.nanoseconds[i];
+  }
+};
+
+// 現在のスレッドが書き込む統計(nullptrなら記録しない)
+// NOTE: Rendererがタイルを処理する前にスレッドごとの統計を設定する
+inline thread_local RenderStats* current = nullptr;
+
+// スコープを抜けるまでの時間をstageに加える
+// NOTE: 時刻の取得は1回数十nsかかり, 交差判定ごとに計ると計測自体が
+// 処理時間の大半を占めてしまう. そこで処理ごとにtimerPeriod回に1回だけ
+// 計測し, timerPeriod倍して全体の時間を推定する
+class ScopedTimer {
+ private:
+  using Clock = std::chrono::steady_clock;
+  static constexpr uint32_t timerPeriod = 16;
+
+  Stage stage;
+  bool isSampled;
+  Clock::time_point start;
+
+ public:
+  ScopedTimer(Stage stage)
+      : stage(stage),
+        isSampled(current &&
+                  current->timerCalls[int(stage)]++ % timerPeriod == 0) {
+    if (isSampled) start = Clock::now();
+  }
+  ~ScopedTimer() {
+    if (!isSampled) return;
+    current->nanoseconds[int(stage)] +=
+        timerPeriod * std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          Clock::now() - start)
+                          .count();
+  }
+};
+
+}  // namespace stats
+
+#ifdef ENABLE_STATS
+#define STATS_ADD(counter, n)                                           \
+  do {                                                                  \
+    if (stats::current) stats::current->add(stats::Counter::counter, n); \
+  } while (0)
+#define STATS_TIMER(stage) \
+  const stats::ScopedTimer statsTimer(stats::Stage::stage)
+#else
+#define STATS_ADD(counter, n) \
+  do {                        \
+  } while (0)
+#define STATS_TIMER(stage) \
+  do {                     \
+  } while (0)
+#endif
+#define STATS_INC(counter) STATS_ADD(counter, 1)
+
+#endif
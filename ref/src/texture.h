@@ -0,0 +1,562 @@
+#ifndef _TEXTURE_H
+#define _TEXTURE_H
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "intersect-info.h"
+#include "mesh-loader.h"
+#include "ray.h"
+#include "stats.h"
+#include "vec3.h"
+
+// テクスチャを参照する位置と範囲
+struct TexCoord {
+  float u, v;   // テクスチャ座標
+  float width;  // 参照する範囲の幅(テクスチャ座標での長さ, mipmapの選択用)
+};
+
+// 拡散反射した後のレイのコーンの広がり[rad]
+// NOTE: 拡散反射の後は細かいテクスチャは見分けられないので,
+// 粗いmipmapを参照してキャッシュの読み込みを減らす
+constexpr float diffuseConeSpread = 0.1f;
+
+// rayの交差点infoでテクスチャを参照する位置と範囲
+inline TexCoord texCoordAt(const Ray& ray, const IntersectInfo& info) {
+  return {info.u, info.v, ray.coneWidthAt(info.t) * info.uvDensity};
+}
+
+namespace texture_io {
+
+// タイル化したテクスチャのファイルの形式の版(形式を変えたら上げる)
+constexpr uint32_t tiledVersion = 1;
+
+// タイルの一辺の長さ[texel]
+constexpr int tileSize = 64;
+// タイル1枚の大きさ(8bitのsRGBのRGB)[byte]
+constexpr size_t tileBytes = 3 * tileSize * tileSize;
+
+// ファイルの先頭に置くヘッダー
+// NOTE: タイルは詳細なmipmapのレベルから順に, 各レベル内は行優先で並べる
+struct TiledHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t tileSize;
+  uint32_t width, height;  // レベル0の大きさ[texel]
+  uint32_t nLevels;        // mipmapのレベル数
+  uint32_t reserved;
+  int64_t sourceSize;   // 変換元の画像ファイルの大きさ
+  int64_t sourceMtime;  // 変換元の画像ファイルの更新時刻[ns]
+};
+
+// mipmapの1つのレベル
+struct MipLevel {
+  int width, height;   // [texel]
+  int tilesX, tilesY;  // タイルの数
+  uint32_t firstTile;  // 最初のタイルの通し番号
+};
+
+// width x heightの画像のmipmapの各レベル(1x1まで半分ずつ縮小する)
+inline std::vector<MipLevel> mipLevels(int width, int height) {
+  std::vector<MipLevel> levels;
+  uint32_t firstTile = 0;
+  while (true) {
+    MipLevel level = {width, height, (width + tileSize - 1) / tileSize,
+                      (height + tileSize - 1) / tileSize, firstTile};
+    levels.push_back(level);
+    firstTile += level.tilesX * level.tilesY;
+    if (width == 1 && height == 1) break;
+    width = std::max(1, (width + 1) / 2);
+    height = std::max(1, (height + 1) / 2);
+  }
+  return levels;
+}
+
+// sRGBの8bitの値から線形の値への変換表
+inline const float* srgbToLinearTable() {
+  static const auto table = []() {
+    std::vector<float> t(256);
+    for (int i = 0; i < 256; ++i) {
+      const float c = i / 255.0f;
+      t[i] = c <= 0.04045f ? c / 12.92f
+                           : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+    return t;
+  }();
+  return table.data();
+}
+
+inline uint8_t linearToSRGB(float c) {
+  c = std::clamp(c, 0.0f, 1.0f);
+  c = c <= 0.0031308f ? 12.92f * c
+                      : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+  return uint8_t(255.0f * c + 0.5f);
+}
+
+// ファイルの大きさと更新時刻を取得する
+inline bool getFileStamp(const std::string& path, int64_t& size,
+                         int64_t& mtime) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) return false;
+  size = st.st_size;
+  mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  return true;
+}
+
+// バイナリのPPM(P6, 8bit)のヘッダーを読み, 画素の先頭を返す
+inline const uint8_t* parsePPM(const MappedFile& file, int& width,
+                               int& height) {
+  const char* p = file.getData();
+  const char* end = p + file.getSize();
+  int values[3];
+  if (file.getSize() < 2 || p[0] != 'P' || p[1] != '6') return nullptr;
+  p += 2;
+  for (int k = 0; k < 3; ++k) {
+    // 空白とコメントを飛ばす
+    while (p < end && (std::isspace(*p) || *p == '#')) {
+      if (*p == '#') {
+        while (p < end && *p != '\n') ++p;
+      } else {
+        ++p;
+      }
+    }
+    const auto res = std::from_chars(p, end, values[k]);
+    if (res.ec != std::errc()) return nullptr;
+    p = res.ptr;
+  }
+  width = values[0];
+  height = values[1];
+  // NOTE: 最大値の後の空白1文字の次から画素が始まる
+  if (values[2] != 255 || width <= 0 || height <= 0 || p >= end) {
+    return nullptr;
+  }
+  ++p;
+  if (end - p < int64_t(3) * width * height) return nullptr;
+  return reinterpret_cast<const uint8_t*>(p);
+}
+
+// 画像を2x2の平均で半分に縮小する(線形の値で平均する)
+inline std::vector<uint8_t> downsample(const uint8_t* src, int width,
+                                       int height, int newWidth,
+                                       int newHeight) {
+  const float* toLinear = srgbToLinearTable();
+  std::vector<uint8_t> dst(size_t(3) * newWidth * newHeight);
+#pragma omp parallel for
+  for (int y = 0; y < newHeight; ++y) {
+    const int y0 = std::min(2 * y, height - 1);
+    const int y1 = std::min(2 * y + 1, height - 1);
+    for (int x = 0; x < newWidth; ++x) {
+      const int x0 = std::min(2 * x, width - 1);
+      const int x1 = std::min(2 * x + 1, width - 1);
+      for (int c = 0; c < 3; ++c) {
+        const float sum =
+            toLinear[src[3 * (size_t(y0) * width + x0) + c]] +
+            toLinear[src[3 * (size_t(y0) * width + x1) + c]] +
+            toLinear[src[3 * (size_t(y1) * width + x0) + c]] +
+            toLinear[src[3 * (size_t(y1) * width + x1) + c]];
+        dst[3 * (size_t(y) * newWidth + x) + c] = linearToSRGB(0.25f * sum);
+      }
+    }
+  }
+  return dst;
+}
+
+// PPM画像をmipmapを持つタイル化したテクスチャのファイルに変換する
+// NOTE: 画素はメモリマップして読み, 縮小したレベルだけをメモリに持つ.
+// 一時ファイルに書いてからrenameする
+inline bool convertToTiled(const std::string& source,
+                           const std::string& filename) {
+  MappedFile file(source);
+  if (!file.isOpen()) {
+    std::cerr << "failed to open " << source << std::endl;
+    return false;
+  }
+  int width, height;
+  const uint8_t* pixels = parsePPM(file, width, height);
+  if (!pixels) {
+    std::cerr << "failed to read " << source << " (expected binary PPM)"
+              << std::endl;
+    return false;
+  }
+
+  TiledHeader header = {{'P', 'B', 'R', 'T', 'E', 'X', '\0', '\0'},
+                        tiledVersion,
+                        tileSize,
+                        uint32_t(width),
+                        uint32_t(height),
+                        0,
+                        0,
+                        0,
+                        0};
+  if (!getFileStamp(source, header.sourceSize, header.sourceMtime)) {
+    std::cerr << "failed to stat " << source << std::endl;
+    return false;
+  }
+  const auto levels = mipLevels(width, height);
+  header.nLevels = levels.size();
+
+  const std::string tmp = filename + ".tmp";
+  std::ofstream out(tmp, std::ios::binary);
+  if (!out) {
+    std::cerr << "failed to open " << tmp << std::endl;
+    return false;
+  }
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  std::vector<uint8_t> level, tile(tileBytes);
+  const uint8_t* src = pixels;
+  for (int l = 0; l < levels.size(); ++l) {
+    const MipLevel& lv = levels[l];
+    if (l > 0) {
+      level = downsample(src, levels[l - 1].width, levels[l - 1].height,
+                         lv.width, lv.height);
+      src = level.data();
+    }
+
+    for (int ty = 0; ty < lv.tilesY; ++ty) {
+      for (int tx = 0; tx < lv.tilesX; ++tx) {
+        // NOTE: 端のタイルのはみ出した部分は0で埋める
+        std::fill(tile.begin(), tile.end(), 0);
+        const int x0 = tx * tileSize;
+        const int w = std::min(tileSize, lv.width - x0);
+        for (int y = 0; y < tileSize && ty * tileSize + y < lv.height; ++y) {
+          const size_t row = size_t(ty * tileSize + y) * lv.width + x0;
+          std::memcpy(&tile[3 * y * tileSize], src + 3 * row, 3 * w);
+        }
+        out.write(reinterpret_cast<const char*>(tile.data()), tileBytes);
+      }
+    }
+  }
+
+  out.close();
+  if (!out) {
+    std::cerr << "failed to write " << tmp << std::endl;
+    return false;
+  }
+  if (std::rename(tmp.c_str(), filename.c_str()) != 0) {
+    std::cerr << "failed to rename " << tmp << " to " << filename
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace texture_io
+
+class TextureCache;
+
+// タイル化してmipmapを持つ画像テクスチャ
+// タイルは参照された時にTextureCacheに読み込まれ, キャッシュの容量を
+// 超えると使われていないものから追い出される
+class ImageTexture {
+ public:
+  ~ImageTexture();
+
+  ImageTexture(const ImageTexture&) = delete;
+  ImageTexture& operator=(const ImageTexture&) = delete;
+
+  int getWidth() const { return levels[0].width; }
+  int getHeight() const { return levels[0].height; }
+  int nLevels() const { return levels.size(); }
+
+  // tcの位置の値(線形の反射率)
+  // 参照する範囲の幅に応じた2つのmipmapのレベルを双線形補間で参照し,
+  // レベル間を線形補間する(トライリニア)
+  // NOTE: テクスチャ座標は繰り返す. vは画像の下から上に向かう
+  Vec3f lookup(const TexCoord& tc) const {
+    const float texels = tc.width * std::max(getWidth(), getHeight());
+    const float lod =
+        std::clamp(std::log2(std::max(texels, 1e-8f)), 0.0f,
+                   float(nLevels() - 1));
+    const int l = lod;
+    const float f = lod - l;
+    const Vec3f c = bilinear(l, tc.u, tc.v);
+    if (f == 0 || l + 1 >= nLevels()) return c;
+    return (1 - f) * c + f * bilinear(l + 1, tc.u, tc.v);
+  }
+
+ private:
+  friend class TextureCache;
+
+  std::shared_ptr<TextureCache> cache;
+  uint32_t id;  // キャッシュでの番号
+  int fd;       // タイル化したファイル
+  std::vector<texture_io::MipLevel> levels;
+  // タイルを読み込んだキャッシュのスロット(読み込んでいなければ-1)
+  std::unique_ptr<std::atomic<int32_t>[]> tileSlots;
+
+  ImageTexture(std::shared_ptr<TextureCache> cache, uint32_t id, int fd,
+               std::vector<texture_io::MipLevel> levels)
+      : cache(std::move(cache)),
+        id(id),
+        fd(fd),
+        levels(std::move(levels)) {
+    const auto& last = this->levels.back();
+    const uint32_t nTiles = last.firstTile + last.tilesX * last.tilesY;
+    tileSlots.reset(new std::atomic<int32_t>[nTiles]);
+    for (uint32_t i = 0; i < nTiles; ++i) tileSlots[i].store(-1);
+  }
+
+  // タイルtileをファイルからdataに読み込む
+  bool readTile(uint32_t tile, uint8_t* data) const {
+    const off_t offset =
+        sizeof(texture_io::TiledHeader) + off_t(tile) * texture_io::tileBytes;
+    size_t done = 0;
+    while (done < texture_io::tileBytes) {
+      const ssize_t n = pread(fd, data + done, texture_io::tileBytes - done,
+                              offset + done);
+      if (n <= 0) return false;
+      done += n;
+    }
+    return true;
+  }
+
+  Vec3f texel(int level, int x, int y) const;
+
+  // レベルlevelの(u, v)を双線形補間で参照する
+  Vec3f bilinear(int level, float u, float v) const {
+    const texture_io::MipLevel& lv = levels[level];
+    const float x = (u - std::floor(u)) * lv.width - 0.5f;
+    const float y = (1 - (v - std::floor(v))) * lv.height - 0.5f;
+    const int x0 = std::floor(x);
+    const int y0 = std::floor(y);
+    const float fx = x - x0;
+    const float fy = y - y0;
+    // 繰り返し
+    const auto wrap = [](int i, int n) { return (i % n + n) % n; };
+    const int xa = wrap(x0, lv.width), xb = wrap(x0 + 1, lv.width);
+    const int ya = wrap(y0, lv.height), yb = wrap(y0 + 1, lv.height);
+    return (1 - fy) * ((1 - fx) * texel(level, xa, ya) +
+                       fx * texel(level, xb, ya)) +
+           fy * ((1 - fx) * texel(level, xa, yb) + fx * texel(level, xb, yb));
+  }
+};
+
+// 画像テクスチャのタイルのキャッシュ
+// 容量(maxBytes)分のタイルのスロットを持ち, 全てのImageTextureで共有する
+// NOTE: キャッシュにあるタイルの参照はロックを取らない. スロットを参照中の
+// 数(pins)を増やしてからタグ(key)を確認し, 追い出す側はタグを消してから
+// pinsを確認する(どちらもseq_cst)ので, 参照中のスロットは追い出されない.
+// 読み込みと追い出しは1つのmutexで排他し, 追い出すスロットは
+// CLOCK法(参照ビットによるLRUの近似)で選ぶ
+class TextureCache : public std::enable_shared_from_this<TextureCache> {
+ public:
+  TextureCache(size_t maxBytes = size_t(256) << 20)
+      : nSlots(std::max<size_t>(maxBytes / texture_io::tileBytes, 64)),
+        slots(new Slot[nSlots]),
+        // NOTE: 初期化しないので, タイルを読み込むまで物理メモリは使わない
+        data(new uint8_t[nSlots * texture_io::tileBytes]) {}
+
+  TextureCache(const TextureCache&) = delete;
+  TextureCache& operator=(const TextureCache&) = delete;
+
+  // キャッシュの容量[byte]
+  size_t getMaxBytes() const { return nSlots * texture_io::tileBytes; }
+
+  // 画像ファイル(PPM)のテクスチャを開く
+  // 初回は<ファイル名>.texにタイル化したファイルを作り, 以降は画像が
+  // 変わっていなければそれを使う(失敗した場合はnullptr)
+  std::shared_ptr<ImageTexture> open(const std::string& filename) {
+    const std::string tiledPath = filename + ".tex";
+    int fd = openTiled(filename, tiledPath);
+    if (fd < 0) {
+      if (!texture_io::convertToTiled(filename, tiledPath)) return nullptr;
+      std::cout << "[Texture] wrote " << tiledPath << std::endl;
+      fd = openTiled(filename, tiledPath);
+      if (fd < 0) {
+        std::cerr << "failed to read " << tiledPath << std::endl;
+        return nullptr;
+      }
+    }
+
+    texture_io::TiledHeader header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+      close(fd);
+      return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    const uint32_t id = textures.size();
+    std::shared_ptr<ImageTexture> texture(
+        new ImageTexture(shared_from_this(), id, fd,
+                         texture_io::mipLevels(header.width, header.height)));
+    textures.push_back(texture.get());
+    return texture;
+  }
+
+  // 読み込み, 追い出したタイルの数を表示する
+  void printStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::cout << "[TextureCache] capacity: " << (getMaxBytes() >> 20)
+              << " MB, resident: " << ((nUsed * texture_io::tileBytes) >> 20)
+              << " MB, tile loads: " << nLoads
+              << ", evictions: " << nEvictions << std::endl;
+  }
+
+ private:
+  friend class ImageTexture;
+
+  static constexpr uint64_t emptyKey = ~uint64_t(0);
+
+  // キャッシュのスロット
+  // NOTE: 参照のたびに書き換えるので, 偽共有しないように揃えている
+  struct alignas(64) Slot {
+    std::atomic<uint64_t> key{emptyKey};  // 読み込んだタイル(テクスチャ, 番号)
+    std::atomic<uint32_t> pins{0};        // 参照中のスレッドの数
+    std::atomic<uint8_t> referenced{0};   // CLOCK法の参照ビット
+  };
+
+  const size_t nSlots;
+  std::unique_ptr<Slot[]> slots;
+  std::unique_ptr<uint8_t[]> data;  // スロットのタイルの画素
+
+  // 以下はmutexで保護する
+  mutable std::mutex mutex;
+  std::vector<ImageTexture*> textures;  // 番号ごとのテクスチャ(破棄後はnull)
+  size_t nUsed = 0;      // 使ったことのあるスロットの数
+  size_t clockHand = 0;  // CLOCK法で次に調べるスロット
+  uint64_t nLoads = 0;
+  uint64_t nEvictions = 0;
+
+  static uint64_t makeKey(uint32_t textureId, uint32_t tile) {
+    return (uint64_t(textureId) << 32) | tile;
+  }
+
+  // タイル化したファイルが有効なら開く(無効なら-1)
+  static int openTiled(const std::string& source,
+                       const std::string& tiledPath) {
+    const int fd = ::open(tiledPath.c_str(), O_RDONLY);
+    if (fd < 0) return -1;
+    texture_io::TiledHeader header;
+    int64_t size, mtime;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        std::string(header.magic, 6) != "PBRTEX" ||
+        header.version != texture_io::tiledVersion ||
+        header.tileSize != texture_io::tileSize ||
+        !texture_io::getFileStamp(source, size, mtime) ||
+        header.sourceSize != size || header.sourceMtime != mtime) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  // テクスチャが破棄された時に呼ぶ
+  // NOTE: 読み込んだタイルはスロットに残り, いずれ追い出される
+  void release(uint32_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    textures[id] = nullptr;
+  }
+
+  static Vec3f decode(const uint8_t* p) {
+    const float* toLinear = texture_io::srgbToLinearTable();
+    return Vec3f(toLinear[p[0]], toLinear[p[1]], toLinear[p[2]]);
+  }
+
+  // textureのタイルtileの先頭からoffset[byte]の画素
+  Vec3f fetch(const ImageTexture& texture, uint32_t tile, uint32_t offset) {
+    const uint64_t key = makeKey(texture.id, tile);
+    const int32_t s = texture.tileSlots[tile].load(std::memory_order_acquire);
+    if (s >= 0) {
+      Slot& slot = slots[s];
+      slot.pins.fetch_add(1);
+      if (slot.key.load() == key) {
+        STATS_INC(TextureCacheHits);
+        // NOTE: 既に立っていれば書き込まない(キャッシュラインを汚さない)
+        if (!slot.referenced.load(std::memory_order_relaxed)) {
+          slot.referenced.store(1, std::memory_order_relaxed);
+        }
+        const Vec3f c = decode(&data[s * texture_io::tileBytes + offset]);
+        slot.pins.fetch_sub(1, std::memory_order_release);
+        return c;
+      }
+      slot.pins.fetch_sub(1, std::memory_order_release);
+    }
+    return fetchMiss(texture, tile, offset);
+  }
+
+  // キャッシュに無い場合: ロックを取ってタイルを読み込む
+  Vec3f fetchMiss(const ImageTexture& texture, uint32_t tile,
+                  uint32_t offset) {
+    STATS_INC(TextureCacheMisses);
+    const uint64_t key = makeKey(texture.id, tile);
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // NOTE: 待っている間に他のスレッドが読み込んだ場合はそれを使う
+    int32_t s = texture.tileSlots[tile].load(std::memory_order_relaxed);
+    if (s < 0 || slots[s].key.load() != key) {
+      s = evict();
+      uint8_t* tileData = &data[s * texture_io::tileBytes];
+      if (!texture.readTile(tile, tileData)) {
+        std::fill(tileData, tileData + texture_io::tileBytes, 0);
+      }
+      slots[s].referenced.store(1, std::memory_order_relaxed);
+      slots[s].key.store(key);
+      texture.tileSlots[tile].store(s, std::memory_order_release);
+      ++nLoads;
+    }
+    // NOTE: ロック中は追い出されないのでpinsは増やさない
+    return decode(&data[s * texture_io::tileBytes + offset]);
+  }
+
+  // 空いているスロットを返す. 無ければCLOCK法で1つ追い出す
+  // NOTE: mutexを取った状態で呼ぶ
+  int32_t evict() {
+    if (nUsed < nSlots) return nUsed++;
+    while (true) {
+      const int32_t s = clockHand;
+      clockHand = (clockHand + 1) % nSlots;
+      Slot& slot = slots[s];
+      // 最近参照されたスロットは参照ビットを消して次の周回まで残す
+      if (slot.referenced.load(std::memory_order_relaxed)) {
+        slot.referenced.store(0, std::memory_order_relaxed);
+        continue;
+      }
+
+      const uint64_t old = slot.key.load();
+      slot.key.store(emptyKey);
+      if (slot.pins.load() != 0) {
+        // 参照中なので戻して次を探す
+        slot.key.store(old);
+        continue;
+      }
+
+      if (old != emptyKey) {
+        ImageTexture* owner = textures[old >> 32];
+        if (owner) owner->tileSlots[uint32_t(old)].store(-1);
+        ++nEvictions;
+      }
+      return s;
+    }
+  }
+};
+
+inline ImageTexture::~ImageTexture() {
+  cache->release(id);
+  close(fd);
+}
+
+inline Vec3f ImageTexture::texel(int level, int x, int y) const {
+  using texture_io::tileSize;
+  const texture_io::MipLevel& lv = levels[level];
+  const uint32_t tile =
+      lv.firstTile + (y / tileSize) * lv.tilesX + x / tileSize;
+  const uint32_t offset = 3 * ((y % tileSize) * tileSize + x % tileSize);
+  return cache->fetch(*this, tile, offset);
+}
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef _TRANSFORM_H
+#define _TRANSFORM_H
+#include <cmath>
+
+#include "aabb.h"
+#include "vec3.h"
+
+// アフィン変換 p' = A p + b
+// 3x4行列 [A | b] で持つ
+class Transform {
+ private:
+  float m[3][4];
+
+ public:
+  // 恒等変換
+  Transform() : m{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}} {}
+
+  float operator()(int i, int j) const { return m[i][j]; }
+
+  // 平行移動
+  static Transform translate(const Vec3f& t) {
+    Transform ret;
+    for (int i = 0; i < 3; ++i) ret.m[i][3] = t[i];
+    return ret;
+  }
+
+  // 拡大縮小
+  static Transform scale(const Vec3f& s) {
+    Transform ret;
+    for (int i = 0; i < 3; ++i) ret.m[i][i] = s[i];
+    return ret;
+  }
+
+  // 軸axis周りにangle[rad]回転(ロドリゲスの回転公式)
+  static Transform rotate(const Vec3f& axis, float angle) {
+    const Vec3f a = normalize(axis);
+    const float c = std::cos(angle);
+    const float s = std::sin(angle);
+    Transform ret;
+    for (int i = 0; i < 3; ++i) {
+      for (int j = 0; j < 3; ++j) {
+        ret.m[i][j] = (1 - c) * a[i] * a[j] + (i == j ? c : 0);
+      }
+    }
+    ret.m[0][1] -= s * a[2];
+    ret.m[0][2] += s * a[1];
+    ret.m[1][0] += s * a[2];
+    ret.m[1][2] -= s * a[0];
+    ret.m[2][0] -= s * a[1];
+    ret.m[2][1] += s * a[0];
+    return ret;
+  }
+
+  // 合成(tを適用してからこの変換を適用する)
+  Transform operator*(const Transform& t) const {
+    Transform ret;
+    for (int i = 0; i < 3; ++i) {
+      for (int j = 0; j < 4; ++j) {
+        ret.m[i][j] =
+            m[i][0] * t.m[0][j] + m[i][1] * t.m[1][j] + m[i][2] * t.m[2][j];
+      }
+      ret.m[i][3] += m[i][3];
+    }
+    return ret;
+  }
+
+  // 線形部分Aの行列式
+  float determinant() const {
+    return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+           m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+           m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+  }
+
+  // 逆変換
+  // NOTE: 線形部分が正則であることを仮定する
+  Transform inverse() const {
+    const float invDet = 1.0f / determinant();
+    Transform ret;
+    // 余因子行列の転置 / 行列式
+    for (int i = 0; i < 3; ++i) {
+      for (int j = 0; j < 3; ++j) {
+        const int i1 = (j + 1) % 3, i2 = (j + 2) % 3;
+        const int j1 = (i + 1) % 3, j2 = (i + 2) % 3;
+        ret.m[i][j] =
+            (m[i1][j1] * m[i2][j2] - m[i1][j2] * m[i2][j1]) * invDet;
+      }
+    }
+    // 平行移動は -A^-1 b
+    for (int i = 0; i < 3; ++i) {
+      ret.m[i][3] = -(ret.m[i][0] * m[0][3] + ret.m[i][1] * m[1][3] +
+                      ret.m[i][2] * m[2][3]);
+    }
+    return ret;
+  }
+
+  // 点の変換
+  Vec3f applyPoint(const Vec3f& p) const {
+    return Vec3f(m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3],
+                 m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3],
+                 m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3]);
+  }
+
+  // 方向ベクトルの変換(平行移動しない)
+  Vec3f applyVector(const Vec3f& v) const {
+    return Vec3f(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                 m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                 m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+  }
+
+  // 線形部分の転置による変換
+  // NOTE: 法線は逆変換の転置で変換するので, 逆変換のこの関数を使う
+  Vec3f applyTransposed(const Vec3f& v) const {
+    return Vec3f(m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2],
+                 m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2],
+                 m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2]);
+  }
+
+  // 変換後のAABBを囲むAABB
+  AABB apply(const AABB& b) const {
+    AABB ret;
+    for (int k = 0; k < 8; ++k) {
+      const Vec3f corner(b[k & 1][0], b[(k >> 1) & 1][1], b[(k >> 2) & 1][2]);
+      ret = mergeAABB(ret, applyPoint(corner));
+    }
+    return ret;
+  }
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef _TRIANGLE4_H
+#define _TRIANGLE4_H
+#include "ray.h"
+#include "simd.h"
+#include "vec3.h"
+
+// 4つの三角形をSoAで保持し, 1本のレイとの交差判定をSIMDで同時に行う
+struct alignas(16) Triangle4 {
+  float p0[3][4];  // 頂点0
+  float e1[3][4];  // 頂点0から頂点1へのベクトル
+  float e2[3][4];  // 頂点0から頂点2へのベクトル
+
+  // lane番目に三角形(v0, v1, v2)を設定する
+  void set(int lane, const Vec3f& v0, const Vec3f& v1, const Vec3f& v2) {
+    for (int k = 0; k < 3; ++k) {
+      p0[k][lane] = v0[k];
+      e1[k][lane] = v1[k] - v0[k];
+      e2[k][lane] = v2[k] - v0[k];
+    }
+  }
+
+  // 4つの三角形との交差判定
+  // (ray.tmin, tmax)内で交差した場合は最も近い三角形の番号laneと
+  // tmax, 重心座標(u, v)を更新する
+  bool intersect(const Ray& ray, float& tmax, int& lane, float& u,
+                 float& v) const {
+    Float4 t, b1, b2;
+    int mask = test(ray, tmax, t, b1, b2).mask();
+    if (mask == 0) return false;
+
+    // 交差した中で最も近いものを選ぶ
+    alignas(16) float tArray[4];
+    t.store(tArray);
+    lane = -1;
+    while (mask) {
+      const int i = __builtin_ctz(mask);
+      mask &= mask - 1;
+      if (lane == -1 || tArray[i] < tArray[lane]) lane = i;
+    }
+    tmax = tArray[lane];
+    u = b1[lane];
+    v = b2[lane];
+    return true;
+  }
+
+  // (ray.tmin, tmax)内でいずれかの三角形と交差するかを判定する
+  bool occluded(const Ray& ray, float tmax) const {
+    Float4 t, b1, b2;
+    return test(ray, tmax, t, b1, b2).mask() != 0;
+  }
+
+ private:
+  // Moller-Trumboreの方法による4つの三角形との交差判定
+  // 交差距離t, 重心座標(b1, b2)と交差したかどうかのマスクを返す
+  Float4 test(const Ray& ray, float tmax, Float4& t, Float4& b1,
+              Float4& b2) const {
+    const Float4 d[3] = {ray.direction[0], ray.direction[1],
+                         ray.direction[2]};
+    const Float4 E1[3] = {Float4::load(e1[0]), Float4::load(e1[1]),
+                          Float4::load(e1[2])};
+    const Float4 E2[3] = {Float4::load(e2[0]), Float4::load(e2[1]),
+                          Float4::load(e2[2])};
+    const Float4 tvec[3] = {Float4(ray.origin[0]) - Float4::load(p0[0]),
+                            Float4(ray.origin[1]) - Float4::load(p0[1]),
+                            Float4(ray.origin[2]) - Float4::load(p0[2])};
+
+    const Float4 pvec[3] = {d[1] * E2[2] - d[2] * E2[1],
+                            d[2] * E2[0] - d[0] * E2[2],
+                            d[0] * E2[1] - d[1] * E2[0]};
+    const Float4 det = E1[0] * pvec[0] + E1[1] * pvec[1] + E1[2] * pvec[2];
+    const Float4 invDet = Float4(1.0f) / det;
+
+    b1 = (tvec[0] * pvec[0] + tvec[1] * pvec[1] + tvec[2] * pvec[2]) * invDet;
+
+    const Float4 qvec[3] = {tvec[1] * E1[2] - tvec[2] * E1[1],
+                            tvec[2] * E1[0] - tvec[0] * E1[2],
+                            tvec[0] * E1[1] - tvec[1] * E1[0]};
+    b2 = (d[0] * qvec[0] + d[1] * qvec[1] + d[2] * qvec[2]) * invDet;
+    t = (E2[0] * qvec[0] + E2[1] * qvec[1] + E2[2] * qvec[2]) * invDet;
+
+    // NOTE: レイと三角形が平行な場合はdetが0に近くなるので除外する
+    return (abs(det) >= Float4(1e-12f)) & (b1 >= Float4(0.0f)) &
+           (b2 >= Float4(0.0f)) & (b1 + b2 <= Float4(1.0f)) &
+           (t >= Float4(ray.tmin)) & (t < Float4(tmax));
+  }
+};
+
+#endif
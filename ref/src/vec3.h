@@ -2,6 +2,12 @@
 #define _VEC3_H
 #include <cmath>
 #include <iostream>
+#ifdef VEC3_SIMD
+#ifndef __SSE4_1__
+#error "VEC3_SIMD requires SSE4.1"
+#endif
+#include <immintrin.h>
+#endif
 
 template <typename T>
 struct Vec3 {
@@ -45,6 +51,116 @@ struct Vec3 {
   }
 };
 
+#ifdef VEC3_SIMD
+// SSEのレジスタ1本で演算できるように4要素に広げて16byteに揃えたVec3f
+// NOTE: 4番目の要素は常に0にしておき, 内積などでは使わない
+template <>
+struct alignas(16) Vec3<float> {
+  float v[4];
+
+  constexpr Vec3() : v{0, 0, 0, 0} {}
+  constexpr Vec3(float x) : v{x, x, x, 0} {}
+  constexpr Vec3(float x, float y, float z) : v{x, y, z, 0} {}
+  Vec3(__m128 m) { _mm_store_ps(v, m); }
+
+  __m128 load() const { return _mm_load_ps(v); }
+
+  float operator[](unsigned int i) const { return v[i]; }
+  float& operator[](unsigned int i) { return v[i]; }
+
+  Vec3 operator-() const {
+    return _mm_xor_ps(load(), _mm_setr_ps(-0.0f, -0.0f, -0.0f, 0.0f));
+  }
+
+  Vec3& operator+=(const Vec3& v) {
+    return *this = _mm_add_ps(load(), v.load());
+  }
+
+  Vec3& operator-=(const Vec3& v) {
+    return *this = _mm_sub_ps(load(), v.load());
+  }
+
+  Vec3& operator*=(const Vec3& v) {
+    return *this = _mm_mul_ps(load(), v.load());
+  }
+
+  Vec3& operator/=(const Vec3& v) {
+    return *this = _mm_div_ps(load(), v.divisor());
+  }
+
+  // 除数として使う値(4番目の要素を1にして0除算を避ける)
+  __m128 divisor() const {
+    return _mm_blend_ps(load(), _mm_set1_ps(1.0f), 0x8);
+  }
+};
+
+// 4番目の要素を0にする
+inline __m128 clearW(__m128 m) {
+  return _mm_blend_ps(m, _mm_setzero_ps(), 0x8);
+}
+
+// 1番目から3番目の要素の和
+inline float horizontalSum3(__m128 m) {
+  const __m128 s = _mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1)));
+  return _mm_cvtss_f32(
+      _mm_add_ss(s, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 2, 2, 2))));
+}
+
+// NOTE: 以下の非テンプレートの関数は汎用のテンプレートより優先される
+inline Vec3<float> operator+(const Vec3<float>& v1, const Vec3<float>& v2) {
+  return _mm_add_ps(v1.load(), v2.load());
+}
+inline Vec3<float> operator-(const Vec3<float>& v1, const Vec3<float>& v2) {
+  return _mm_sub_ps(v1.load(), v2.load());
+}
+inline Vec3<float> operator*(const Vec3<float>& v1, float k) {
+  return _mm_mul_ps(v1.load(), _mm_set1_ps(k));
+}
+inline Vec3<float> operator*(float k, const Vec3<float>& v2) {
+  return _mm_mul_ps(_mm_set1_ps(k), v2.load());
+}
+inline Vec3<float> operator/(const Vec3<float>& v1, float k) {
+  return clearW(_mm_div_ps(v1.load(), _mm_set1_ps(k)));
+}
+inline Vec3<float> operator/(float k, const Vec3<float>& v2) {
+  return clearW(_mm_div_ps(_mm_set1_ps(k), v2.divisor()));
+}
+inline Vec3<float> operator*(const Vec3<float>& v1, const Vec3<float>& v2) {
+  return _mm_mul_ps(v1.load(), v2.load());
+}
+inline Vec3<float> operator/(const Vec3<float>& v1, const Vec3<float>& v2) {
+  return _mm_div_ps(v1.load(), v2.divisor());
+}
+
+inline float dot(const Vec3<float>& v1, const Vec3<float>& v2) {
+  return horizontalSum3(_mm_mul_ps(v1.load(), v2.load()));
+}
+inline float length2(const Vec3<float>& v) { return dot(v, v); }
+inline float length(const Vec3<float>& v) {
+  return _mm_cvtss_f32(_mm_sqrt_ss(_mm_set_ss(length2(v))));
+}
+
+// NOTE: rsqrtの近似値(12bit)をNewton法で1回改良して, 除算と平方根を避ける
+inline Vec3<float> normalize(const Vec3<float>& v) {
+  const __m128 l2 = _mm_set1_ps(length2(v));
+  const __m128 r = _mm_rsqrt_ps(l2);
+  const __m128 inv = _mm_mul_ps(
+      _mm_mul_ps(_mm_set1_ps(0.5f), r),
+      _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_mul_ps(l2, r), r)));
+  return _mm_mul_ps(v.load(), inv);
+}
+
+inline Vec3<float> cross(const Vec3<float>& v1, const Vec3<float>& v2) {
+  // (y, z, x)の順に並べ替えて a * b.yzx - a.yzx * b を求め, 最後に戻す
+  const __m128 a = v1.load();
+  const __m128 b = v2.load();
+  const __m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+  const __m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+  const __m128 c = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+  return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+#endif
+
 // ベクトル同士の加算
 template <typename T>
 inline Vec3<T> operator+(const Vec3<T>& v1, const Vec3<T>& v2) {
@@ -0,0 +1,137 @@
+#ifndef _VEC3X8_H
+#define _VEC3X8_H
+#include "simd.h"
+#include "vec3.h"
+
+#ifdef __AVX__
+// 8つのベクトルを成分ごとのFloat8で持つSoAのベクトル
+// 8本のレイやサンプルをまとめて処理するカーネルで使う. 演算はVec3fと同じ
+// NOTE: 比較や分岐の代わりにFloat8のマスクとselectを使う
+struct Vec3x8 {
+  Float8 v[3];
+
+  Vec3x8() {}
+  Vec3x8(const Float8& x, const Float8& y, const Float8& z) : v{x, y, z} {}
+  // 全ての要素をaにする
+  Vec3x8(const Vec3f& a) : v{a[0], a[1], a[2]} {}
+
+  // 成分ごとの配列(32byteに揃えたもの)から8要素を読み込む
+  static Vec3x8 load(const float* x, const float* y, const float* z) {
+    return Vec3x8(Float8::load(x), Float8::load(y), Float8::load(z));
+  }
+  void store(float* x, float* y, float* z) const {
+    v[0].store(x);
+    v[1].store(y);
+    v[2].store(z);
+  }
+
+  // 8つのVec3fから作る
+  static Vec3x8 gather(const Vec3f* p) {
+    alignas(32) float x[8], y[8], z[8];
+    for (int i = 0; i < 8; ++i) {
+      x[i] = p[i][0];
+      y[i] = p[i][1];
+      z[i] = p[i][2];
+    }
+    return load(x, y, z);
+  }
+
+  // i番目の要素
+  Vec3f get(int i) const { return Vec3f(v[0][i], v[1][i], v[2][i]); }
+
+  const Float8& operator[](unsigned int i) const { return v[i]; }
+  Float8& operator[](unsigned int i) { return v[i]; }
+
+  Vec3x8 operator-() const {
+    return Vec3x8(Float8(0.0f) - v[0], Float8(0.0f) - v[1],
+                  Float8(0.0f) - v[2]);
+  }
+
+  Vec3x8& operator+=(const Vec3x8& a) {
+    for (int i = 0; i < 3; ++i) v[i] = v[i] + a.v[i];
+    return *this;
+  }
+  Vec3x8& operator-=(const Vec3x8& a) {
+    for (int i = 0; i < 3; ++i) v[i] = v[i] - a.v[i];
+    return *this;
+  }
+  Vec3x8& operator*=(const Vec3x8& a) {
+    for (int i = 0; i < 3; ++i) v[i] = v[i] * a.v[i];
+    return *this;
+  }
+};
+
+inline Vec3x8 operator+(const Vec3x8& a, const Vec3x8& b) {
+  return Vec3x8(a[0] + b[0], a[1] + b[1], a[2] + b[2]);
+}
+inline Vec3x8 operator-(const Vec3x8& a, const Vec3x8& b) {
+  return Vec3x8(a[0] - b[0], a[1] - b[1], a[2] - b[2]);
+}
+// アダマール積
+inline Vec3x8 operator*(const Vec3x8& a, const Vec3x8& b) {
+  return Vec3x8(a[0] * b[0], a[1] * b[1], a[2] * b[2]);
+}
+inline Vec3x8 operator/(const Vec3x8& a, const Vec3x8& b) {
+  return Vec3x8(a[0] / b[0], a[1] / b[1], a[2] / b[2]);
+}
+// 要素ごとのスカラー倍
+inline Vec3x8 operator*(const Vec3x8& a, const Float8& k) {
+  return Vec3x8(a[0] * k, a[1] * k, a[2] * k);
+}
+inline Vec3x8 operator*(const Float8& k, const Vec3x8& a) { return a * k; }
+inline Vec3x8 operator/(const Vec3x8& a, const Float8& k) {
+  return a * (Float8(1.0f) / k);
+}
+
+inline Float8 dot(const Vec3x8& a, const Vec3x8& b) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+inline Vec3x8 cross(const Vec3x8& a, const Vec3x8& b) {
+  return Vec3x8(a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2],
+                a[0] * b[1] - a[1] * b[0]);
+}
+
+inline Float8 length2(const Vec3x8& a) { return dot(a, a); }
+inline Float8 length(const Vec3x8& a) { return sqrt(length2(a)); }
+
+// NOTE: rsqrtの近似値をNewton法で1回改良して, 除算と平方根を避ける
+inline Vec3x8 normalize(const Vec3x8& a) {
+  const Float8 l2 = length2(a);
+  const Float8 r = rsqrtApprox(l2);
+  return a * (Float8(0.5f) * r * (Float8(3.0f) - l2 * r * r));
+}
+
+// 反射ベクトルの計算
+inline Vec3x8 reflect(const Vec3x8& v, const Vec3x8& n) {
+  return Float8(2.0f) * dot(v, n) * n - v;
+}
+
+// 屈折ベクトルの計算
+// 全反射しない要素のマスクを返す(全反射する要素のrは不定)
+inline Float8 refract(const Vec3x8& v, const Vec3x8& n, const Float8& ior1,
+                      const Float8& ior2, Vec3x8& r) {
+  const Vec3x8 t_h = (Float8(0.0f) - ior1 / ior2) * (v - dot(v, n) * n);
+  const Float8 l2 = length2(t_h);
+  const Vec3x8 t_p =
+      (Float8(0.0f) - sqrt(max(Float8(1.0f) - l2, Float8(0.0f)))) * n;
+  r = t_h + t_p;
+  return l2 <= Float8(1.0f);
+}
+
+// ワールド座標系からローカル座標系への変換
+inline Vec3x8 worldToLocal(const Vec3x8& v, const Vec3x8& lx,
+                           const Vec3x8& ly, const Vec3x8& lz) {
+  return Vec3x8(dot(v, lx), dot(v, ly), dot(v, lz));
+}
+
+// ローカル座標系からワールド座標系への変換
+inline Vec3x8 localToWorld(const Vec3x8& v, const Vec3x8& lx,
+                           const Vec3x8& ly, const Vec3x8& lz) {
+  return Vec3x8(v[0] * lx[0] + v[1] * ly[0] + v[2] * lz[0],
+                v[0] * lx[1] + v[1] * ly[1] + v[2] * lz[1],
+                v[0] * lx[2] + v[1] * ly[2] + v[2] * lz[2]);
+}
+#endif
+
+#endif
@@ -0,0 +1,390 @@
+#ifndef _WAVEFRONT_H
+#define _WAVEFRONT_H
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <typeinfo>
+#include <vector>
+
+#include "camera.h"
+#include "image.h"
+#include "intersect-info.h"
+#include "ray.h"
+#include "sampler.h"
+#include "sampling.h"
+#include "scene.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "texture.h"
+
+// ウェーブフロント方式のパストレーシング
+// 1本ずつパスを最後まで追跡する代わりに多数のパスを同時に保持し,
+// 生成, 交差判定, 光源サンプリング, シャドウレイ, BSDFサンプリングの
+// 各段階を全てのパスに対してまとめて行う
+// 推定量はPathTracing(NEE + MIS, ロシアンルーレット)と同じ
+class WavefrontPathTracing {
+ public:
+  // 追跡中のパスの状態(SoA)とキュー
+  // NOTE: スレッドごとに1つ用意し, タイル間で使い回す
+  struct Workspace {
+    // パスの状態
+    std::vector<Vec3f> origin;       // レイの始点
+    std::vector<Vec3f> direction;    // レイの方向
+    std::vector<float> coneWidth;    // レイの始点でのコーンの幅
+    std::vector<float> coneSpread;   // レイのコーンの広がり
+    std::vector<Vec3f> throughput;   // f*cos / pdfの積
+    std::vector<Vec3f> radiance;     // 放射輝度
+    std::vector<Vec3f> prevPos;      // 直前に反射した位置
+    std::vector<Vec3f> prevNormal;   // 直前に反射した位置の法線
+    std::vector<float> prevPdf;      // 直前のBSDF Samplingのpdf
+    std::vector<uint8_t> prevDelta;  // 直前の反射がデルタ関数か
+    std::vector<int> depth;          // 反射回数
+    std::vector<uint32_t> pixel;     // タイル内の画素番号
+    // パスごとのSampler
+    std::vector<std::unique_ptr<Sampler>> sampler;
+    std::vector<IntersectInfo> hit;  // 交差情報
+    std::vector<TexCoord> texCoord;  // 交差点のテクスチャ座標
+
+    // キュー(パスの番号)
+    std::vector<uint32_t> active;     // 交差判定を行うパス
+    std::vector<uint32_t> shade;      // 物体表面で反射させるパス
+    std::vector<uint32_t> freeSlots;  // 空いている番号
+
+    // シャドウレイのキュー
+    std::vector<uint32_t> shadowPath;  // 寄与を加えるパス
+    std::vector<Vec3f> shadowOrigin;
+    std::vector<Vec3f> shadowDirection;
+    std::vector<float> shadowDistance;
+    std::vector<Vec3f> shadowContribution;
+
+    // BSDFの種類ごとに並べ替えるための作業領域
+    std::vector<const std::type_info*> materialTypes;  // 現れた種類
+    std::vector<int> materialCounts;  // 種類ごとの数, 書き込み位置
+    std::vector<int> materialIndex;   // shadeの各パスの種類
+    std::vector<uint32_t> sorted;
+
+    std::vector<Vec3f> pixelSum;  // タイル内の画素ごとの放射輝度の和
+
+    // NOTE: Samplerは最初の1回だけprototypeから作る
+    void resize(int poolSize, const Sampler& prototype) {
+      origin.resize(poolSize);
+      direction.resize(poolSize);
+      coneWidth.resize(poolSize);
+      coneSpread.resize(poolSize);
+      throughput.resize(poolSize);
+      radiance.resize(poolSize);
+      prevPos.resize(poolSize);
+      prevNormal.resize(poolSize);
+      prevPdf.resize(poolSize);
+      prevDelta.resize(poolSize);
+      depth.resize(poolSize);
+      pixel.resize(poolSize);
+      sampler.resize(poolSize);
+      for (auto& s : sampler) {
+        if (!s) s = prototype.clone();
+      }
+      hit.resize(poolSize);
+      texCoord.resize(poolSize);
+    }
+  };
+
+ private:
+  int maxDepth = 100;   // 最大反射回数
+  bool useNEE = true;   // 光源サンプリングを行うか
+  int poolSize = 4096;  // 同時に追跡するパスの数
+
+  // パスを終了し, 放射輝度を画素に加えて番号を空ける
+  static void finish(Workspace& ws, uint32_t p) {
+    ws.pixelSum[ws.pixel[p]] += ws.radiance[p];
+    ws.freeSlots.push_back(p);
+  }
+
+  // 生成: 空いている番号に新しいパスを割り当てる
+  // n番目のサンプルは画素n % nPixelsの(n / nPixels)番目のサンプル
+  void generate(const Camera& camera, int width, int height, const Tile& tile,
+                uint64_t& next, uint64_t total, Workspace& ws) const {
+    const int tileWidth = tile.x1 - tile.x0;
+    const uint64_t nPixels = (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+    while (!ws.freeSlots.empty() && next < total) {
+      const uint32_t p = ws.freeSlots.back();
+      ws.freeSlots.pop_back();
+
+      const uint32_t pixel = next % nPixels;
+      const int i = tile.x0 + pixel % tileWidth;
+      const int j = tile.y0 + pixel / tileWidth;
+      Sampler& sampler = *ws.sampler[p];
+      sampler.startPixelSample(i, j, next / nPixels);
+      ++next;
+
+      {
+        STATS_TIMER(CameraRay);
+        // (u, v)の計算
+        const float u = (2.0f * (i + sampler.getNext()) - width) / height;
+        const float v = (2.0f * (j + sampler.getNext()) - height) / height;
+        const Ray ray = camera.sampleRay(u, v);
+
+        ws.origin[p] = ray.origin;
+        ws.direction[p] = ray.direction;
+        ws.coneWidth[p] = 0;
+        ws.coneSpread[p] = camera.pixelSpread(2.0f / height);
+      }
+      ws.throughput[p] = Vec3f(1);
+      ws.radiance[p] = Vec3f(0);
+      ws.prevDelta[p] = true;
+      ws.prevPdf[p] = 0;
+      ws.depth[p] = 0;
+      ws.pixel[p] = pixel;
+      ws.active.push_back(p);
+    }
+  }
+
+  // 交差判定: ロシアンルーレットの後にレイを飛ばし,
+  // 空や光源に当たったパスを終了して残りをshadeに積む
+  void intersect(const Scene& scene, Workspace& ws) const {
+    const bool nee = useNEE && scene.canSampleLights();
+
+    ws.shade.clear();
+    for (const uint32_t p : ws.active) {
+      // ロシアンルーレット
+      const Vec3f& throughput = ws.throughput[p];
+      const float russianRouletteProb = std::min(
+          std::max(std::max(throughput[0], throughput[1]), throughput[2]),
+          1.0f);
+      if (ws.sampler[p]->getNext() > russianRouletteProb) {
+        STATS_INC(RussianRouletteTerminations);
+        finish(ws, p);
+        continue;
+      }
+      ws.throughput[p] /= russianRouletteProb;
+
+      if (ws.depth[p] == 0) {
+        STATS_INC(PrimaryRays);
+      } else {
+        STATS_INC(SecondaryRays);
+      }
+      IntersectInfo& info = ws.hit[p];
+      Ray ray(ws.origin[p], ws.direction[p]);
+      ray.coneWidth = ws.coneWidth[p];
+      ray.coneSpread = ws.coneSpread[p];
+      if (!scene.intersect(ray, info)) {
+        // 空に飛んでいった場合
+        float weight = 1.0f;
+        if (nee && !ws.prevDelta[p] && scene.sky.hasEnvironmentMap()) {
+          weight = powerHeuristic(ws.prevPdf[p], scene.skyPdf(ray.direction));
+        }
+        ws.radiance[p] +=
+            weight * ws.throughput[p] * scene.sky.Le(ray.direction);
+        finish(ws, p);
+        continue;
+      }
+
+      // 光源に当たった場合
+      if (info.hitPrimitive->areaLight) {
+        float weight = 1.0f;
+        if (nee && !ws.prevDelta[p]) {
+          const float lightPdf =
+              scene.lightPdf(*info.hitPrimitive, ws.prevPos[p],
+                             ws.prevNormal[p]) *
+              info.hitPrimitive->getShape().pdf(ws.prevPos[p],
+                                                info.hitPos, info.hitNormal);
+          weight = powerHeuristic(ws.prevPdf[p], lightPdf);
+        }
+        ws.radiance[p] +=
+            weight * ws.throughput[p] * info.hitPrimitive->areaLight->Le();
+        finish(ws, p);
+        continue;
+      }
+
+      ws.texCoord[p] = texCoordAt(ray, info);
+      ws.shade.push_back(p);
+    }
+  }
+
+  // shadeをBSDFの種類ごとにまとめて並べ替える(計数ソート)
+  // NOTE: 同じ種類のBSDFが続くので仮想関数の分岐予測と命令キャッシュが
+  // 効きやすくなる
+  void sortByMaterial(Workspace& ws) const {
+    ws.materialTypes.clear();
+    ws.materialCounts.clear();
+    ws.materialIndex.resize(ws.shade.size());
+    for (int k = 0; k < ws.shade.size(); ++k) {
+      const BSDF& bsdf = *ws.hit[ws.shade[k]].hitPrimitive->bsdf;
+      const std::type_info* type = &typeid(bsdf);
+
+      // NOTE: BSDFの種類は少ないので線形探索で十分
+      int idx = 0;
+      while (idx < ws.materialTypes.size() && *ws.materialTypes[idx] != *type) {
+        ++idx;
+      }
+      if (idx == ws.materialTypes.size()) {
+        ws.materialTypes.push_back(type);
+        ws.materialCounts.push_back(0);
+      }
+      ws.materialIndex[k] = idx;
+      ws.materialCounts[idx]++;
+    }
+    if (ws.materialTypes.size() <= 1) return;
+
+    // 各種類の開始位置
+    int offset = 0;
+    for (int& count : ws.materialCounts) {
+      const int n = count;
+      count = offset;
+      offset += n;
+    }
+    ws.sorted.resize(ws.shade.size());
+    for (int k = 0; k < ws.shade.size(); ++k) {
+      ws.sorted[ws.materialCounts[ws.materialIndex[k]]++] = ws.shade[k];
+    }
+    std::swap(ws.shade, ws.sorted);
+  }
+
+  // 光源サンプリング: 寄与とシャドウレイをキューに積む
+  void sampleLights(const Scene& scene, Workspace& ws) const {
+    ws.shadowPath.clear();
+    ws.shadowOrigin.clear();
+    ws.shadowDirection.clear();
+    ws.shadowDistance.clear();
+    ws.shadowContribution.clear();
+    if (!useNEE || !scene.canSampleLights()) return;
+
+    for (const uint32_t p : ws.shade) {
+      const IntersectInfo& info = ws.hit[p];
+      const BSDFRef& bsdf = info.hitPrimitive->getBSDF();
+      if (bsdf.isDelta()) continue;
+
+      Sampler& sampler = *ws.sampler[p];
+      const float uSelect = sampler.getNext();
+      const float u = sampler.getNext();
+      const float v = sampler.getNext();
+      Vec3f wi;
+      float dist, lightPdf;
+      const Vec3f le = scene.sampleLightDirection(
+          info.hitPos, info.hitNormal, uSelect, u, v, wi, dist, lightPdf);
+      if (lightPdf == 0) continue;
+
+      Vec3f t, b;
+      tangentSpaceBasis(info.hitNormal, t, b);
+      const Vec3f woTangent =
+          worldToLocal(-ws.direction[p], t, info.hitNormal, b);
+      const Vec3f wiTangent = worldToLocal(wi, t, info.hitNormal, b);
+      const Vec3f f = bsdf.eval(ws.texCoord[p], woTangent, wiTangent);
+      if (f[0] == 0 && f[1] == 0 && f[2] == 0) continue;
+
+      const float weight =
+          powerHeuristic(lightPdf, bsdf.pdf(woTangent, wiTangent));
+      const float cos = std::abs(dot(wi, info.hitNormal));
+
+      ws.shadowPath.push_back(p);
+      ws.shadowOrigin.push_back(info.hitPos);
+      ws.shadowDirection.push_back(wi);
+      ws.shadowDistance.push_back(dist);
+      ws.shadowContribution.push_back(ws.throughput[p] * weight * f * cos *
+                                      le / lightPdf);
+    }
+  }
+
+  // シャドウレイ: 遮蔽されていない光源サンプリングの寄与を加える
+  void traceShadowRays(const Scene& scene, Workspace& ws) const {
+    STATS_ADD(ShadowRays, ws.shadowPath.size());
+    for (int k = 0; k < ws.shadowPath.size(); ++k) {
+      if (!scene.occluded(Ray(ws.shadowOrigin[k], ws.shadowDirection[k]),
+                          ws.shadowDistance[k])) {
+        ws.radiance[ws.shadowPath[k]] += ws.shadowContribution[k];
+      }
+    }
+  }
+
+  // BSDFサンプリング: 次のレイを生成し, 続くパスをactiveに積む(圧縮)
+  void sampleBSDFs(Workspace& ws) const {
+    ws.active.clear();
+    for (const uint32_t p : ws.shade) {
+      const IntersectInfo& info = ws.hit[p];
+      const BSDFRef& bsdf = info.hitPrimitive->getBSDF();
+
+      Vec3f t, b;
+      tangentSpaceBasis(info.hitNormal, t, b);
+      const Vec3f woTangent =
+          worldToLocal(-ws.direction[p], t, info.hitNormal, b);
+
+      float pdf;
+      Vec3f wiTangent;
+      const Vec3f f = bsdf.sample(ws.texCoord[p], *ws.sampler[p], woTangent,
+                                  wiTangent, pdf);
+      // NOTE: 接平面上の方向がサンプリングされた場合は打ち切る
+      if (pdf == 0 || wiTangent[1] == 0) {
+        finish(ws, p);
+        continue;
+      }
+      STATS_INC(Bounces);
+      const Vec3f wi = localToWorld(wiTangent, t, info.hitNormal, b);
+      const float cos = std::abs(dot(wi, info.hitNormal));
+      ws.throughput[p] *= f * cos / pdf;
+
+      ws.origin[p] = info.hitPos;
+      ws.direction[p] = wi;
+      ws.coneWidth[p] += info.t * ws.coneSpread[p];
+      if (!bsdf.isDelta()) {
+        ws.coneSpread[p] = std::max(ws.coneSpread[p], diffuseConeSpread);
+      }
+      ws.prevDelta[p] = bsdf.isDelta();
+      ws.prevPdf[p] = pdf;
+      ws.prevPos[p] = info.hitPos;
+      ws.prevNormal[p] = info.hitNormal;
+
+      if (++ws.depth[p] >= maxDepth) {
+        finish(ws, p);
+        continue;
+      }
+      ws.active.push_back(p);
+    }
+  }
+
+ public:
+  WavefrontPathTracing(int maxDepth = 100, bool useNEE = true,
+                       int poolSize = 4096)
+      : maxDepth(maxDepth), useNEE(useNEE), poolSize(std::max(poolSize, 1)) {}
+
+  // タイル内の各画素についてsamples本のパスを追跡し,
+  // 平均をimageに書き込む. パスごとのSamplerはsamplerから作る
+  void renderTile(const Scene& scene, const Camera& camera, const Tile& tile,
+                  int samples, Image& image, const Sampler& sampler,
+                  Workspace& ws) const {
+    const int width = image.getWidth();
+    const int height = image.getHeight();
+    const int nPixels = (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+
+    ws.resize(poolSize, sampler);
+    ws.active.clear();
+    ws.freeSlots.clear();
+    for (int p = poolSize - 1; p >= 0; --p) {
+      ws.freeSlots.push_back(p);
+    }
+    ws.pixelSum.assign(nPixels, Vec3f(0));
+
+    uint64_t next = 0;
+    const uint64_t total = uint64_t(nPixels) * samples;
+    while (true) {
+      // 終了したパスの分だけ新しいパスを生成して補充する
+      generate(camera, width, height, tile, next, total, ws);
+      if (ws.active.empty()) break;
+
+      // NOTE: 統計ではパス生成以外の段階をまとめてIntegratorとして計測する
+      STATS_TIMER(Integrator);
+      intersect(scene, ws);
+      sortByMaterial(ws);
+      sampleLights(scene, ws);
+      traceShadowRays(scene, ws);
+      sampleBSDFs(ws);
+    }
+
+    // 平均を書き込む
+    const int tileWidth = tile.x1 - tile.x0;
+    for (int k = 0; k < nPixels; ++k) {
+      image.setPixel(tile.x0 + k % tileWidth, tile.y0 + k / tileWidth,
+                     ws.pixelSum[k] / Vec3f(samples));
+    }
+  }
+};
+
+#endif
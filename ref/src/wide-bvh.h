@@ -0,0 +1,404 @@
+#ifndef _WIDE_BVH_H
+#define _WIDE_BVH_H
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include "aabb.h"
+#include "binary-io.h"
+#include "bvh.h"
+#include "ray.h"
+#include "simd.h"
+#include "stats.h"
+
+// BVHの分岐数(2, 4, 8)
+// 2の場合は二分木のBVHをそのまま使い, 4, 8の場合はSIMDで走査する
+#ifndef BVH_WIDTH
+#ifdef __AVX__
+#define BVH_WIDTH 8
+#else
+#define BVH_WIDTH 4
+#endif
+#endif
+
+#if BVH_WIDTH != 2 && BVH_WIDTH != 4 && BVH_WIDTH != 8
+#error "BVH_WIDTH must be 2, 4 or 8"
+#endif
+#if BVH_WIDTH == 8 && !defined(__AVX__)
+#error "BVH_WIDTH=8 requires AVX"
+#endif
+
+// N分木のBVH
+// 二分木のBVHを構築した後, 子を展開してN個の子を持つノードに変換する
+// 各ノードは子のAABBをSoAで持ち, 1本のレイとN個の子の交差判定をSIMDで行う
+template <int N>
+class WideBVH {
+ public:
+  // 葉の開始位置はこの数の倍数に揃える(葉単位のSIMD交差判定用)
+  static constexpr int leafAlignment = 4;
+
+ private:
+  using FloatN = typename SIMDFloat<N>::type;
+
+  struct alignas(sizeof(float) * N) Node {
+    // 子のAABB(minX, minY, minZ, maxX, maxY, maxZ)
+    // NOTE: 空の子は最小点を+inf, 最大点を-infにして必ず外れるようにする
+    float bounds[6][N];
+    uint32_t child[N];        // 内部: ノード番号, 葉: primIndicesの開始位置
+    uint32_t nPrimitives[N];  // 葉に含まれる要素の数(内部ノードでは0)
+  };
+
+  // 走査用スタックの要素
+  struct StackEntry {
+    uint32_t child;
+    uint32_t nPrimitives;
+    float t;  // 子のAABBとの交差距離
+  };
+
+  // 走査中に使い回すレイの情報
+  struct RayData {
+    FloatN org[3];  // 始点
+    FloatN inv[3];  // 方向の逆数
+    // レイの方向に応じて選んだ手前側, 奥側の面の番号
+    int nearIdx[3];
+    int farIdx[3];
+
+    RayData(const Ray& ray) {
+      const Vec3f invDir = 1.0f / ray.direction;
+      for (int k = 0; k < 3; ++k) {
+        org[k] = FloatN(ray.origin[k]);
+        inv[k] = FloatN(invDir[k]);
+        nearIdx[k] = invDir[k] < 0 ? 3 + k : k;
+        farIdx[k] = invDir[k] < 0 ? k : 3 + k;
+      }
+    }
+  };
+
+  std::vector<Node> nodes;
+  std::vector<uint32_t> primIndices;  // 葉から参照される要素の番号
+  AABB bounds;
+  bool built = false;
+
+  // N個の子のAABBとの交差判定(スラブ法)
+  // 交差した子のビットマスクを返し, tNearに各子との交差距離を書き込む
+  int intersectChildren(const Node& node, const Ray& ray,
+                        const RayData& rayData, float tmax,
+                        FloatN& tNear) const {
+    tNear = FloatN(ray.tmin);
+    FloatN tFar(tmax);
+    for (int k = 0; k < 3; ++k) {
+      tNear = max(tNear,
+                  (FloatN::load(node.bounds[rayData.nearIdx[k]]) -
+                   rayData.org[k]) *
+                      rayData.inv[k]);
+      tFar = min(tFar, (FloatN::load(node.bounds[rayData.farIdx[k]]) -
+                        rayData.org[k]) *
+                           rayData.inv[k]);
+    }
+    return (tNear <= tFar).mask();
+  }
+
+  // 子iが空か
+  // NOTE: 根は子にならないので, 番号0の内部ノードを指す子は空
+  bool isEmpty(const Node& node, int i) const {
+    return node.nPrimitives[i] == 0 && node.child[i] == 0;
+  }
+
+  AABB getChildBounds(const Node& node, int i) const {
+    return AABB(Vec3f(node.bounds[0][i], node.bounds[1][i], node.bounds[2][i]),
+                Vec3f(node.bounds[3][i], node.bounds[4][i], node.bounds[5][i]));
+  }
+
+  // 二分木のノードnodeIdxを根とする部分木をN分木のノードに変換する
+  uint32_t collapse(const BVH& bvh, uint32_t nodeIdx) {
+    // 表面積の大きい内部ノードから順に子に置き換えてN個まで展開する
+    std::vector<uint32_t> children = {nodeIdx + 1,
+                                      bvh.nodes[nodeIdx].offset};
+    while (children.size() < N) {
+      int best = -1;
+      float bestArea = -1;
+      for (int i = 0; i < children.size(); ++i) {
+        const auto& c = bvh.nodes[children[i]];
+        if (c.nPrimitives == 0 && c.bbox.surfaceArea() > bestArea) {
+          best = i;
+          bestArea = c.bbox.surfaceArea();
+        }
+      }
+      if (best == -1) break;
+
+      const uint32_t c = children[best];
+      children[best] = c + 1;
+      children.push_back(bvh.nodes[c].offset);
+    }
+
+    const uint32_t wideIdx = nodes.size();
+    nodes.emplace_back();
+    for (int i = 0; i < N; ++i) {
+      setEmpty(wideIdx, i);
+    }
+
+    for (int i = 0; i < children.size(); ++i) {
+      const auto& c = bvh.nodes[children[i]];
+      if (c.nPrimitives > 0) {
+        setLeaf(wideIdx, i, c.bbox, bvh, c.offset, c.nPrimitives);
+      } else {
+        const uint32_t childIdx = collapse(bvh, children[i]);
+        // NOTE: 再帰でnodesが再確保されるので番号で書き込む
+        setBounds(wideIdx, i, c.bbox);
+        nodes[wideIdx].child[i] = childIdx;
+        nodes[wideIdx].nPrimitives[i] = 0;
+      }
+    }
+    return wideIdx;
+  }
+
+  void setBounds(uint32_t nodeIdx, int i, const AABB& bbox) {
+    for (int k = 0; k < 3; ++k) {
+      nodes[nodeIdx].bounds[k][i] = bbox[0][k];
+      nodes[nodeIdx].bounds[3 + k][i] = bbox[1][k];
+    }
+  }
+
+  void setEmpty(uint32_t nodeIdx, int i) {
+    for (int k = 0; k < 3; ++k) {
+      nodes[nodeIdx].bounds[k][i] = std::numeric_limits<float>::infinity();
+      nodes[nodeIdx].bounds[3 + k][i] = -std::numeric_limits<float>::infinity();
+    }
+    nodes[nodeIdx].child[i] = 0;
+    nodes[nodeIdx].nPrimitives[i] = 0;
+  }
+
+  // 二分木の葉を子iに設定する
+  // 葉の要素は開始位置をleafAlignmentの倍数に揃えてprimIndicesにコピーし,
+  // 余った部分は最後の要素で埋める
+  void setLeaf(uint32_t nodeIdx, int i, const AABB& bbox, const BVH& bvh,
+               uint32_t offset, uint32_t nPrims) {
+    setBounds(nodeIdx, i, bbox);
+    nodes[nodeIdx].child[i] = primIndices.size();
+    nodes[nodeIdx].nPrimitives[i] = nPrims;
+    for (uint32_t k = 0; k < nPrims; ++k) {
+      primIndices.push_back(bvh.primIndices[offset + k]);
+    }
+    while (primIndices.size() % leafAlignment != 0) {
+      primIndices.push_back(primIndices.back());
+    }
+  }
+
+ public:
+  WideBVH() {}
+
+  // 各要素のAABBからBVHを構築する
+  void build(const std::vector<AABB>& primBounds) {
+    built = true;
+    nodes.clear();
+    primIndices.clear();
+
+    BVH bvh;
+    bvh.build(primBounds);
+    bounds = bvh.getBounds();
+    if (bvh.nodes.empty()) return;
+
+    if (bvh.nodes[0].nPrimitives > 0) {
+      // 根が葉の場合は子を1つだけ持つノードを作る
+      nodes.emplace_back();
+      for (int i = 0; i < N; ++i) {
+        setEmpty(0, i);
+      }
+      setLeaf(0, 0, bvh.nodes[0].bbox, bvh, bvh.nodes[0].offset,
+              bvh.nodes[0].nPrimitives);
+    } else {
+      collapse(bvh, 0);
+    }
+  }
+
+  bool isBuilt() const { return built; }
+
+  int nNodes() const { return nodes.size(); }
+
+  // 構築済みのBVHを書き出す(シーンのキャッシュ用)
+  void write(binary_io::Writer& writer) const {
+    writer.write<uint8_t>(built);
+    writer.write(bounds);
+    writer.writeArray(nodes);
+    writer.writeArray(primIndices);
+  }
+
+  // writeで書き出したBVHを読み込む
+  bool read(binary_io::Reader& reader) {
+    uint8_t b;
+    if (!reader.read(b) || !reader.read(bounds) || !reader.readArray(nodes) ||
+        !reader.readArray(primIndices)) {
+      return false;
+    }
+    built = b;
+    return true;
+  }
+
+  // 全体のAABB
+  AABB getBounds() const { return bounds; }
+
+  // 木の構造はそのままで, 要素のAABBが変わった後のノードのAABBを更新する
+  // NOTE: 子は常に親より後ろに配置されているので, 後ろから順に更新する
+  void refit(const std::vector<AABB>& primBounds) {
+    std::vector<AABB> nodeBounds(nodes.size());
+    for (int idx = int(nodes.size()) - 1; idx >= 0; --idx) {
+      for (int i = 0; i < N; ++i) {
+        const Node& node = nodes[idx];
+        if (isEmpty(node, i)) continue;
+
+        AABB bbox;
+        if (node.nPrimitives[i] > 0) {
+          for (uint32_t k = 0; k < node.nPrimitives[i]; ++k) {
+            bbox = mergeAABB(bbox, primBounds[primIndices[node.child[i] + k]]);
+          }
+        } else {
+          bbox = nodeBounds[node.child[i]];
+        }
+        setBounds(idx, i, bbox);
+        nodeBounds[idx] = mergeAABB(nodeBounds[idx], bbox);
+      }
+    }
+    bounds = nodes.empty() ? AABB() : nodeBounds[0];
+  }
+
+  // 木全体のSAHコスト(根の表面積あたり)
+  // refitで木の品質がどれだけ悪くなったかの指標に使う
+  float sahCost() const {
+    if (nodes.empty()) return 0;
+    float cost = bounds.surfaceArea();
+    for (const auto& node : nodes) {
+      for (int i = 0; i < N; ++i) {
+        if (isEmpty(node, i)) continue;
+        cost += getChildBounds(node, i).surfaceArea() *
+                (node.nPrimitives[i] > 0 ? node.nPrimitives[i] : 1);
+      }
+    }
+    return cost / std::max(bounds.surfaceArea(), 1e-20f);
+  }
+
+  // 葉から参照される要素の番号
+  // NOTE: 葉[start, start + n)の開始位置はleafAlignmentの倍数になっている
+  const std::vector<uint32_t>& getPrimIndices() const { return primIndices; }
+
+  // 最も近い交差点を求める
+  // intersectLeaf(start, n, tmax)は葉に含まれる要素
+  // getPrimIndices()[start, start + n)との交差判定を行い,
+  // tmaxより近くで交差した場合にtmaxを更新してtrueを返す
+  template <typename F>
+  bool intersectLeaves(const Ray& ray, float tmax, F&& intersectLeaf) const {
+    if (nodes.empty()) return false;
+
+    const RayData rayData(ray);
+
+    bool hit = false;
+    StackEntry stack[64 * N];
+    int stackSize = 0;
+    stack[stackSize++] = {0, 0, -std::numeric_limits<float>::infinity()};
+    while (stackSize > 0) {
+      const StackEntry entry = stack[--stackSize];
+      // 積んだ後に見つかった交差点より遠い場合は飛ばす
+      if (entry.t > tmax) continue;
+
+      if (entry.nPrimitives > 0) {
+        if (intersectLeaf(entry.child, entry.nPrimitives, tmax)) hit = true;
+        continue;
+      }
+
+      STATS_INC(BVHNodeVisits);
+      const Node& node = nodes[entry.child];
+      FloatN tNear;
+      int mask = intersectChildren(node, ray, rayData, tmax, tNear);
+      if (mask == 0) continue;
+
+      alignas(sizeof(float) * N) float tNearArray[N];
+      tNear.store(tNearArray);
+
+      // 交差した子を遠い順に並べてスタックに積む(近い子から取り出される)
+      const int first = stackSize;
+      while (mask) {
+        const int i = __builtin_ctz(mask);
+        mask &= mask - 1;
+
+        const StackEntry e = {node.child[i], node.nPrimitives[i],
+                              tNearArray[i]};
+        int j = stackSize++;
+        while (j > first && stack[j - 1].t < e.t) {
+          stack[j] = stack[j - 1];
+          --j;
+        }
+        stack[j] = e;
+      }
+    }
+
+    return hit;
+  }
+
+  // 最も近い交差点を求める
+  // intersectPrim(index, tmax)はBVH::intersectと同じ
+  template <typename F>
+  bool intersect(const Ray& ray, float tmax, F&& intersectPrim) const {
+    return intersectLeaves(
+        ray, tmax, [&](uint32_t start, uint32_t n, float& t) {
+          bool hit = false;
+          for (uint32_t i = start; i < start + n; ++i) {
+            if (intersectPrim(primIndices[i], t)) hit = true;
+          }
+          return hit;
+        });
+  }
+
+
+  // (ray.tmin, tmax)内に交差点があるかを判定する
+  // occludedLeaf(start, n)は葉に含まれる要素
+  // getPrimIndices()[start, start + n)と(ray.tmin, tmax)内で交差するかを返す
+  // NOTE: 最初に交差が見つかった時点で走査を終える
+  template <typename F>
+  bool occludedLeaves(const Ray& ray, float tmax, F&& occludedLeaf) const {
+    if (nodes.empty()) return false;
+
+    const RayData rayData(ray);
+
+    // NOTE: 交差の有無だけが必要なので子を距離順に並べない
+    StackEntry stack[64 * N];
+    int stackSize = 0;
+    stack[stackSize++] = {0, 0, 0};
+    while (stackSize > 0) {
+      const StackEntry entry = stack[--stackSize];
+      if (entry.nPrimitives > 0) {
+        if (occludedLeaf(entry.child, entry.nPrimitives)) return true;
+        continue;
+      }
+
+      STATS_INC(BVHNodeVisits);
+      const Node& node = nodes[entry.child];
+      FloatN tNear;
+      int mask = intersectChildren(node, ray, rayData, tmax, tNear);
+      while (mask) {
+        const int i = __builtin_ctz(mask);
+        mask &= mask - 1;
+        stack[stackSize++] = {node.child[i], node.nPrimitives[i], 0};
+      }
+    }
+
+    return false;
+  }
+
+  // (ray.tmin, tmax)内に交差点があるかを判定する
+  // occludedPrim(index)はBVH::occludedと同じ
+  template <typename F>
+  bool occluded(const Ray& ray, float tmax, F&& occludedPrim) const {
+    return occludedLeaves(ray, tmax, [&](uint32_t start, uint32_t n) {
+      for (uint32_t i = start; i < start + n; ++i) {
+        if (occludedPrim(primIndices[i])) return true;
+      }
+      return false;
+    });
+  }
+};
+
+// シーン, メッシュで使うBVH
+using AccelBVH =
+    std::conditional_t<BVH_WIDTH == 2, BVH, WideBVH<BVH_WIDTH>>;
+
+#endif
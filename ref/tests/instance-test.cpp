@@ -0,0 +1,93 @@
+// Instanceの交差判定のテスト
+// 拡大縮小したインスタンスでも, 許容最小交差距離(Ray::tmin)がワールド座標系
+// の距離として扱われることを確かめる
+// usage: ./instance-test (失敗した場合は0以外を返す)
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "instance.h"
+#include "rng.h"
+#include "sampling.h"
+#include "shape.h"
+
+namespace {
+
+int nFailures = 0;
+
+void check(bool ok, const std::string& name) {
+  if (!ok) {
+    std::cerr << "failed: " << name << std::endl;
+    ++nFailures;
+  }
+}
+
+// 半径1の球と同じ形になるように, 半径radiusの球をscale倍したインスタンス
+std::shared_ptr<Shape> scaledSphere(float radius, float scale) {
+  return std::make_shared<Instance>(std::make_shared<Sphere>(Vec3f(0), radius),
+                                    Transform::scale(Vec3f(scale)));
+}
+
+// 球面から距離dだけ外の点から球に向かうレイが, 距離dで交差するか
+void checkHitDistance(const Shape& shape, const std::string& name) {
+  for (const float d : {0.5f * Ray::defaultTmin, 2.0f * Ray::defaultTmin,
+                        0.05f}) {
+    const Ray ray(Vec3f(0, 0, -1 - d), Vec3f(0, 0, 1));
+    IntersectInfo info;
+    const bool hit = shape.intersect(ray, info);
+    const std::string label = name + " at " + std::to_string(d);
+    if (d < Ray::defaultTmin) {
+      // tminより近い交差は無視され, 反対側の面と交差する
+      check(hit && std::abs(info.t - (d + 2)) < 1e-3f, label + " (near)");
+      check(!shape.occluded(ray, 1.0f), label + " (occluded, near)");
+    } else {
+      check(hit && std::abs(info.t - d) < 1e-4f, label);
+      check(shape.occluded(ray, 1.0f), label + " (occluded)");
+    }
+  }
+}
+
+// 球面上の点から外向きに反射したレイが, 同じ球と交差しないか
+void checkSelfIntersection(const Shape& shape, const std::string& name) {
+  RNG rng(1);
+  int nSelfHits = 0;
+  constexpr int n = 10000;
+  for (int i = 0; i < n; ++i) {
+    float pdf;
+    const Vec3f dir = sampleSphere(rng.getNext(), rng.getNext(), pdf);
+    IntersectInfo info;
+    if (!shape.intersect(Ray(Vec3f(0), dir), info)) continue;
+
+    Vec3f t, b;
+    tangentSpaceBasis(info.hitNormal, t, b);
+    const Vec3f wi = localToWorld(
+        sampleCosineHemisphere(rng.getNext(), rng.getNext(), pdf), t,
+        info.hitNormal, b);
+    IntersectInfo bounce;
+    nSelfHits += shape.intersect(Ray(info.hitPos, wi), bounce);
+  }
+  check(nSelfHits == 0, name + " self-intersections: " +
+                            std::to_string(nSelfHits) + "/" +
+                            std::to_string(n));
+}
+
+}  // namespace
+
+int main() {
+  const Sphere sphere(Vec3f(0), 1);
+  const auto shrunk = scaledSphere(1000, 0.001f);
+  const auto enlarged = scaledSphere(0.01f, 100);
+
+  checkHitDistance(sphere, "sphere");
+  checkHitDistance(*shrunk, "shrunk instance");
+  checkHitDistance(*enlarged, "enlarged instance");
+
+  checkSelfIntersection(sphere, "sphere");
+  checkSelfIntersection(*shrunk, "shrunk instance");
+  checkSelfIntersection(*enlarged, "enlarged instance");
+
+  if (nFailures > 0) return 1;
+  std::cout << "[Test] instance: passed" << std::endl;
+  return 0;
+}
@@ -0,0 +1,137 @@
+// 画像テクスチャ
+// 多数の大きなテクスチャを貼った球を並べ, 容量を制限したキャッシュで
+// レンダリングする. 画像を指定しない場合は市松模様のPPMを生成する
+// usage: ./textures [--cache <容量[MB]>] [image.ppm ...]
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "instance.h"
+#include "renderer.h"
+#include "scene.h"
+#include "texture.h"
+
+// k番目の市松模様の画像をsize x sizeのPPMとして書き出す
+// NOTE: 細かい格子と粗い格子を重ねて, mipmapのレベルの違いが見えるようにする
+bool writeChecker(const std::string& filename, int size, int k) {
+  const uint8_t colors[][3] = {{230, 90, 60},   {60, 150, 230},
+                               {240, 200, 60},  {80, 190, 110},
+                               {170, 100, 210}, {230, 230, 230}};
+  const uint8_t* c0 = colors[k % 6];
+  const uint8_t* c1 = colors[(k + 1) % 6];
+
+  std::ofstream out(filename, std::ios::binary);
+  out << "P6\n" << size << " " << size << "\n255\n";
+  std::vector<uint8_t> row(3 * size);
+  for (int y = 0; y < size; ++y) {
+    for (int x = 0; x < size; ++x) {
+      const bool coarse = ((x * 8 / size) + (y * 8 / size)) % 2;
+      const bool fine = ((x / 8) + (y / 8)) % 2;
+      const uint8_t* c = coarse ? c0 : c1;
+      const float shade = fine ? 1.0f : 0.6f;
+      for (int i = 0; i < 3; ++i) row[3 * x + i] = c[i] * shade;
+    }
+    out.write(reinterpret_cast<const char*>(row.data()), row.size());
+  }
+  return bool(out);
+}
+
+int main(int argc, char** argv) {
+  constexpr int width = 512;   // 画像の横幅[px]
+  constexpr int height = 512;  // 画像の縦幅[px]
+  constexpr int samples = 16;  // サンプル数
+  constexpr int gridSize = 8;  // 一辺に並べる球の数
+  constexpr int nGenerated = 16;      // 生成するテクスチャの数
+  constexpr int generatedSize = 2048;  // 生成するテクスチャの大きさ[px]
+
+  int cacheMB = 32;  // キャッシュの容量[MB]
+  std::vector<std::string> images;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (i + 1 < argc && arg == "--cache") {
+      cacheMB = std::max(std::atoi(argv[++i]), 1);
+    } else {
+      images.push_back(arg);
+    }
+  }
+  if (images.empty()) {
+    for (int k = 0; k < nGenerated; ++k) {
+      char filename[32];
+      std::snprintf(filename, sizeof(filename), "checker%02d.ppm", k);
+      images.push_back(filename);
+      std::ifstream exists(filename);
+      if (exists) continue;
+      if (!writeChecker(filename, generatedSize, k)) {
+        std::cerr << "failed to write " << filename << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  // テクスチャを開く
+  // NOTE: 初回はタイル化したファイル(<画像>.tex)を作る
+  const auto cache = std::make_shared<TextureCache>(size_t(cacheMB) << 20);
+  std::vector<std::shared_ptr<ImageTexture>> textures;
+  size_t totalTexels = 0;
+  for (const auto& image : images) {
+    const auto texture = cache->open(image);
+    if (!texture) return 1;
+    totalTexels += size_t(texture->getWidth()) * texture->getHeight();
+    textures.push_back(texture);
+  }
+  std::cout << "[Texture] textures: " << textures.size()
+            << ", level 0: " << ((3 * totalTexels) >> 20)
+            << " MB, cache: " << (cache->getMaxBytes() >> 20) << " MB"
+            << std::endl;
+
+  // カメラの設定
+  constexpr Vec3f camPos(-3, 6, -3);
+  constexpr Vec3f lookAt(8, 0, 8);
+  const auto camera = std::make_shared<PinholeCamera>(
+      camPos, normalize(lookAt - camPos), 0.25f * PI);
+
+  // レンダラーの作成
+  Renderer renderer(width, height, camera);
+
+  // シーンの作成
+  Sky sky(Vec3f(1.0f));
+  Scene scene(sky);
+
+  // 床には1枚目のテクスチャを貼る
+  const auto floor = std::make_shared<Plane>(
+      Vec3f(-2, 0, -2), Vec3f(0, 0, 2.5f * gridSize + 4),
+      Vec3f(2.5f * gridSize + 4, 0, 0));
+  scene.addPrimitive(Primitive(
+      floor, std::make_shared<Lambert>(Vec3f(0.8), textures[0])));
+
+  // 球はジオメトリを共有し, テクスチャを順に割り当てる
+  std::vector<std::shared_ptr<BSDF>> materials;
+  for (const auto& texture : textures) {
+    materials.push_back(std::make_shared<Lambert>(Vec3f(0.9), texture));
+  }
+  const auto sphere = std::make_shared<Sphere>(Vec3f(0), 1);
+  for (int j = 0; j < gridSize; ++j) {
+    for (int i = 0; i < gridSize; ++i) {
+      const Transform t =
+          Transform::translate(Vec3f(2.5f * i, 1, 2.5f * j)) *
+          Transform::rotate(Vec3f(0, 1, 0), 0.4f * (i + j));
+      scene.addPrimitive(
+          Primitive(std::make_shared<Instance>(sphere, t),
+                    materials[(j * gridSize + i) % materials.size()]));
+    }
+  }
+  scene.commit();
+
+  // レンダリング
+  renderer.render(scene, samples);
+  cache->printStats();
+
+  // 画像の出力
+  renderer.writePPM("output.ppm");
+
+  return 0;
+}